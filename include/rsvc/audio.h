@@ -26,12 +26,44 @@
 
 /// Audio
 /// =====
+
+/// ..  type:: enum rsvc_sample_format
+///
+///     How samples are laid out when passed between a decoder and an
+///     encoder.  Samples are always interleaved, in native byte order.
+///
+///     ..  var:: RSVC_SAMPLE_S16
+///
+///         int16_t samples, with `bits_per_sample` 16.  The default,
+///         and accepted by every encoder.
+///
+///     ..  var:: RSVC_SAMPLE_S32
+///
+///         int32_t samples, holding `bits_per_sample` significant
+///         bits in the low bits (e.g. -8388608 to 8388607 for 24-bit
+///         audio).
+///
+///     ..  var:: RSVC_SAMPLE_F32
+///
+///         float samples, nominally from -1.0 to 1.0.
+enum rsvc_sample_format {
+    RSVC_SAMPLE_S16 = 0,
+    RSVC_SAMPLE_S32,
+    RSVC_SAMPLE_F32,
+};
+
+/// ..  macro:: RSVC_SAMPLE_FORMAT_BIT(format)
+///
+///     The bit representing `format` in a mask of sample formats.
+#define RSVC_SAMPLE_FORMAT_BIT(FORMAT) (1u << (FORMAT))
+
 struct rsvc_audio_info {
-    size_t  sample_rate;
-    size_t  channels;
-    size_t  samples_per_channel;
-    size_t  bits_per_sample;
-    size_t  block_align;
+    size_t                   sample_rate;
+    size_t                   channels;
+    size_t                   samples_per_channel;
+    size_t                   bits_per_sample;
+    size_t                   block_align;
+    enum rsvc_sample_format  sample_format;
 };
 
 typedef bool (*rsvc_audio_info_f)(FILE* file, rsvc_audio_info_t info, rsvc_done_t fail);
@@ -43,9 +75,68 @@ bool rsvc_audio_info_validate(rsvc_audio_info_t info, rsvc_done_t fail);
 /// ..  type:: void (^rsvc_encode_progress_f)(double progress)
 typedef void (^rsvc_encode_progress_f)(double progress);
 
+/// ..  type:: enum rsvc_verify
+///
+///     ..  var:: RSVC_VERIFY_INLINE
+///
+///         The encoder decodes its output as it goes, and fails on any
+///         difference from the input.  This is the default, and
+///         roughly doubles the time spent encoding.
+///
+///     ..  var:: RSVC_VERIFY_NONE
+///
+///         The output is not verified.
+///
+///     ..  var:: RSVC_VERIFY_DEFERRED
+///
+///         The encoder does not verify its output; instead, the caller
+///         checks the finished file with the format's `verify`
+///         function, typically on an otherwise idle queue.
+enum rsvc_verify {
+    RSVC_VERIFY_INLINE = 0,
+    RSVC_VERIFY_NONE,
+    RSVC_VERIFY_DEFERRED,
+};
+
+/// ..  type:: struct rsvc_encode_options
+///
+///     ..  member:: bool vbr
+///     ..  member:: int quality
+///
+///         If `vbr` is set, the MP3 encoder targets `quality`, from 0
+///         (best) to 9 (smallest), instead of `bitrate`.  Other formats
+///         ignore them.
+///
+///     ..  member:: int level
+///
+///         The FLAC compression level, from 0 (fastest) to 8
+///         (smallest).  Other formats ignore it.
+///
+///     ..  member:: enum rsvc_verify verify
+///
+///         How to verify the output.  Only FLAC verifies.
+///
+///     ..  member:: size_t threads
+///
+///         The number of chunks of a single stream that the encoder
+///         may encode concurrently.  0 or 1 encodes serially.  Only
+///         the FLAC and MP3 encoders split streams, and only long ones.
+///
+///     ..  member:: size_t segment_samples
+///
+///         When encoding concurrently, the length of each chunk, in
+///         samples per channel.  0 picks the encoder's default.  Shorter
+///         chunks spread a short stream over more threads, but each
+///         chunk has a fixed overhead.
 struct rsvc_encode_options {
     struct rsvc_audio_info  info;
     int32_t                 bitrate;
+    bool                    vbr;
+    int                     quality;
+    int                     level;
+    enum rsvc_verify        verify;
+    size_t                  threads;
+    size_t                  segment_samples;
     rsvc_encode_progress_f  progress;
 };
 
@@ -55,13 +146,40 @@ typedef bool (*rsvc_encode_f)(
         rsvc_encode_options_t options,
         rsvc_done_t fail);
 
+/// ..  type:: bool (*rsvc_verify_f)(const char* path, rsvc_done_t fail)
+///
+///     Decodes the file at `path` and checks it against the signature
+///     that its encoder stored.  Returns true if it matches; otherwise
+///     calls `fail` and returns false.
+typedef bool (*rsvc_verify_f)(const char* path, rsvc_done_t fail);
+
 /// Decoding
 /// --------
 typedef void (^rsvc_decode_info_f)(rsvc_audio_info_t meta);
 
+/// ..  type:: struct rsvc_decode_options
+///
+///     ..  member:: unsigned sample_formats
+///
+///         A mask of the sample formats that the consumer of the
+///         decoded audio accepts.  RSVC_SAMPLE_S16 is always accepted,
+///         so 0 means 16-bit only.  Decoders pick the one closest to
+///         their native output, and report it through `info`.
+///
+///     ..  member:: bool noise_shaping
+///
+///         When a decoder must reduce the bit depth of its output, it
+///         always applies TPDF dither.  If set, it also shapes the
+///         requantization noise towards high frequencies.
+struct rsvc_decode_options {
+    unsigned                sample_formats;
+    bool                    noise_shaping;
+};
+
 typedef bool (*rsvc_decode_f)(
         FILE* src_file,
         FILE* dst_file,
+        rsvc_decode_options_t options,
         rsvc_decode_info_f info,
         rsvc_done_t fail);
 
@@ -77,4 +195,20 @@ extern const struct rsvc_format rsvc_opus;
 extern const struct rsvc_format rsvc_vorbis;
 extern const struct rsvc_format rsvc_wav;
 
+/// ..  function:: bool rsvc_flac_md5(const char* path, uint8_t* md5, rsvc_done_t fail)
+///
+///     Reads the 16-byte MD5 signature of the decoded audio from the
+///     STREAMINFO block of the FLAC file at `path`.  It is all zeros if
+///     the file's encoder didn't compute one.
+bool rsvc_flac_md5(const char* path, uint8_t* md5, rsvc_done_t fail);
+
+/// ..  function:: bool rsvc_flac_copy_metadata(const char* src_path, const char* dst_path, rsvc_done_t fail)
+///
+///     Replaces the metadata blocks of the FLAC file at `dst_path`,
+///     other than STREAMINFO, with copies of those of `src_path`:
+///     comments, pictures, cue sheets, application data, and padding
+///     are copied exactly.  A seek table keeps its points, moved to
+///     the frames of `dst_path`.
+bool rsvc_flac_copy_metadata(const char* src_path, const char* dst_path, rsvc_done_t fail);
+
 #endif  // RSVC_AUDIO_H_
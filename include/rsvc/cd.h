@@ -47,7 +47,13 @@
 ///
 /// ..  function:: bool rsvc_cd_create(char* path, rsvc_cd_t* cd, rsvc_done_t fail)
 ///
-///     :param path:    A short-form device name, such as "disk1".
+///     :param path:    A short-form device name, such as "disk1".  On
+///                     Linux, this may instead be the path of a disc
+///                     image: a ``.cue`` sheet, or a ``.wav`` file
+///                     holding a single track.  Images are read as if
+///                     from a drive, optionally with simulated latency,
+///                     speed limits, read errors, C2 errors, and jitter
+///                     (see ``src/rsvc/cd_image.h``).
 ///
 /// ..  function:: void rsvc_cd_destroy(rsvc_cd_t cd)
 ///
@@ -62,6 +68,18 @@ void                    rsvc_cd_destroy(rsvc_cd_t cd);
 ///                 empty string.
 const char*             rsvc_cd_mcn(rsvc_cd_t cd);
 
+/// ..  function:: bool rsvc_cd_read_offset(rsvc_cd_t cd, int* offset)
+///
+///     Looks up the read offset of the CD's drive, in samples, from a
+///     table of known drive models.  A drive with an offset of +N
+///     returns audio N samples earlier than it should; pass the offset
+///     as the `offset` member of :type:`rsvc_cd_rip_options` to
+///     correct for it.
+///
+///     :param offset:  Set to the drive's read offset, if known.
+///     :returns:       true if the drive's offset is known.
+bool                    rsvc_cd_read_offset(rsvc_cd_t cd, int* offset);
+
 /// ..  function:: size_t rsvc_cd_nsessions(rsvc_cd_t cd)
 ///
 ///     :returns:   The number of sessions on the CD.
@@ -188,7 +206,162 @@ size_t                  rsvc_cd_track_nsamples(rsvc_cd_track_t track);
 void                    rsvc_cd_track_isrc(rsvc_cd_track_t track,
                                            void (^done)(const char* isrc));
 
-/// ..  function:: void rsvc_cd_track_rip(rsvc_cd_track_t track, FILE* file, rsvc_done_t done)
+/// ..  type:: struct rsvc_cd_rip_summary
+///
+///     Statistics describing a completed rip.
+///
+///     ..  member:: rsvc_cd_track_t track
+///
+///         The track that was ripped.
+///
+///     ..  member:: size_t nsectors
+///
+///         The number of sectors delivered.
+///
+///     ..  member:: size_t nreads
+///
+///         The number of read requests issued to the drive.
+///
+///     ..  member:: size_t nretries
+///
+///         The number of read requests that failed and were retried
+///         with a smaller batch.
+///
+///     ..  member:: size_t nc2
+///
+///         The number of sectors that the drive flagged with C2 errors.
+///
+///     ..  member:: size_t nrereads
+///
+///         The number of single-sector re-reads of flagged sectors.
+///
+///     ..  member:: size_t nsuspect
+///
+///         The number of flagged sectors that never read back clean.
+///
+///     ..  member:: size_t nverified
+///
+///         In secure mode, the number of sectors for which enough reads
+///         agreed.
+///
+///     ..  member:: size_t nunverified
+///
+///         In secure mode, the number of sectors for which no read was
+///         repeated often enough; the most common read was kept.
+///
+///     ..  member:: size_t nmismatches
+///
+///         In secure mode, the number of batches whose reads disagreed,
+///         and which were read again one sector at a time.
+///
+///     ..  member:: size_t njitter
+///
+///         In secure mode, the number of reads that the drive started at
+///         the wrong position, and that were realigned.
+///
+///     ..  member:: double confidence
+///
+///         In secure mode, the fraction of sectors that were verified,
+///         from 0.0 to 1.0.
+///
+///     ..  member:: double speed
+///
+///         The achieved read speed, as a multiple of realtime (75
+///         sectors per second).
+struct rsvc_cd_rip_summary {
+    rsvc_cd_track_t track;
+    size_t          nsectors;
+    size_t          nreads;
+    size_t          nretries;
+    size_t          nc2;
+    size_t          nrereads;
+    size_t          nsuspect;
+    size_t          nverified;
+    size_t          nunverified;
+    size_t          nmismatches;
+    size_t          njitter;
+    double          confidence;
+    double          speed;
+};
+
+/// ..  type:: void (^rsvc_cd_rip_summary_f)(rsvc_cd_rip_summary_t summary)
+typedef void (^rsvc_cd_rip_summary_f)(rsvc_cd_rip_summary_t summary);
+
+/// ..  type:: enum rsvc_cd_rip_mode
+enum rsvc_cd_rip_mode {
+    /// ..  var:: RSVC_CD_RIP_FAST
+    ///
+    ///     Reads each sector once, trusting the drive.
+    RSVC_CD_RIP_FAST,
+    /// ..  var:: RSVC_CD_RIP_SECURE
+    ///
+    ///     Reads each sector until several reads agree.  Reads overlap
+    ///     the audio already ripped, so that reads which the drive
+    ///     started at the wrong position can be realigned.
+    RSVC_CD_RIP_SECURE,
+};
+
+/// ..  type:: struct rsvc_cd_rip_options
+///
+///     Options for :func:`rsvc_cd_track_rip()`.  Passing `NULL` in
+///     place of a pointer to this struct selects the defaults for each
+///     member.
+///
+///     ..  member:: size_t batch
+///
+///         The maximum number of sectors to request from the drive in a
+///         single read.  If 0, the largest batch that the platform
+///         supports is used.  When a read fails, the batch is halved
+///         and the read retried, down to a single sector; after a run
+///         of successful reads, it grows back again.
+///
+///     ..  member:: bool c2
+///
+///         If true, asks the drive for C2 error pointers along with
+///         the audio data, and re-reads only the sectors that the drive
+///         flags.  Ignored if the drive or platform cannot report them.
+///
+///     ..  member:: enum rsvc_cd_rip_mode mode
+///
+///         :data:`RSVC_CD_RIP_FAST` (the default) or
+///         :data:`RSVC_CD_RIP_SECURE`.
+///
+///     ..  member:: size_t matches
+///
+///         In secure mode, the number of reads that must agree before a
+///         sector is accepted.  If 0, defaults to 2.
+///
+///     ..  member:: size_t max_reads
+///
+///         In secure mode, the number of times a sector is read before
+///         giving up on finding enough matching reads.  If 0, defaults
+///         to 16.
+///
+///     ..  member:: int offset
+///
+///         The drive's read offset, in samples; see
+///         :func:`rsvc_cd_read_offset()`.  The range of sectors read is
+///         shifted to cover the corrected audio, reading into the
+///         neighboring tracks as part of the same batched reads, and
+///         the audio is trimmed to the length of the track.  Samples
+///         that would lie outside the readable part of the disc are
+///         written as silence.
+///
+///     ..  member:: rsvc_cd_rip_summary_f summary
+///
+///         If not `NULL`, invoked on success with statistics about the
+///         rip, just before `done`.
+struct rsvc_cd_rip_options {
+    size_t                  batch;
+    bool                    c2;
+    enum rsvc_cd_rip_mode   mode;
+    size_t                  matches;
+    size_t                  max_reads;
+    int                     offset;
+    rsvc_cd_rip_summary_f   summary;
+};
+
+/// ..  function:: void rsvc_cd_track_rip(rsvc_cd_track_t track, FILE* file, rsvc_cd_rip_options_t options, rsvc_cancel_t cancel, rsvc_done_t done)
 ///
 ///     Begins ripping data from the track and writing it to `file`.  The
 ///     data written will be a sequence of native-endian int16_t
@@ -196,16 +369,59 @@ void                    rsvc_cd_track_isrc(rsvc_cd_track_t track,
 ///
 ///     The IO involved in ripping the CD takes place on the CD's
 ///     dedicated IO queue; only one rip may be active for a given CD at
-///     a time.
+///     a time.  Sectors are read in batches, and `cancel` is checked
+///     between batches.
 ///
 ///     :param file:    An open, writable file.
+///     :param options: Options for the rip, or `NULL` for defaults.
+///     :param cancel:  If not `NULL`, cancels the rip when triggered.
 ///     :param done:    Invoked when the rip is complete; either with
 ///                     `NULL` to indicate success, or with an error to
 ///                     indicate failure.
-///     :returns:       A block that can be invoked to cancel the rip. 
-///                     Must not be called after the :type:`rsvc_cd_t`
-///                     containing `track` is destroyed.
-void                    rsvc_cd_track_rip(rsvc_cd_track_t track, FILE* file, rsvc_cancel_t cancel,
+void                    rsvc_cd_track_rip(rsvc_cd_track_t track, FILE* file,
+                                          rsvc_cd_rip_options_t options, rsvc_cancel_t cancel,
                                           rsvc_done_t done);
 
+/// ..  type:: bool (^rsvc_cd_track_begin_f)(rsvc_cd_track_t track, FILE** file, rsvc_done_t fail)
+///
+///     Called by :func:`rsvc_cd_session_rip()` when the first audio of
+///     `track` is ready.  Sets `file` to the open, writable file that
+///     should receive the track's audio, or returns false after passing
+///     an error to `fail`.
+typedef bool (^rsvc_cd_track_begin_f)(rsvc_cd_track_t track, FILE** file, rsvc_done_t fail);
+
+/// ..  type:: void (^rsvc_cd_track_end_f)(rsvc_cd_track_t track)
+///
+///     Called by :func:`rsvc_cd_session_rip()` once nothing more will
+///     be written to the file of `track`.
+typedef void (^rsvc_cd_track_end_f)(rsvc_cd_track_t track);
+
+/// ..  function:: void rsvc_cd_session_rip(rsvc_cd_session_t session, rsvc_cd_rip_options_t options, rsvc_cd_track_begin_f track_begin, rsvc_cd_track_end_f track_end, rsvc_cancel_t cancel, rsvc_done_t done)
+///
+///     Rips all audio tracks of the session, skipping data tracks.
+///     Where the platform allows, each run of consecutive audio tracks
+///     is read as one continuous stream, so the drive doesn't stop
+///     between tracks, and the stream is split at the track boundaries.
+///
+///     Each track's file is requested from `track_begin` only when its
+///     audio is ready, and released with `track_end` after its last
+///     audio.  The next track may begin before the previous one ends.
+///     Every track that begins also ends, even if the rip fails.  If
+///     :type:`rsvc_cd_rip_options` has a `summary`, it is invoked once
+///     per track.
+///
+///     :param options:     Options for the rip, or `NULL` for defaults.
+///     :param track_begin: Provides the file for each track.
+///     :param track_end:   Releases the file of each track.
+///     :param cancel:      If not `NULL`, cancels the rip when
+///                         triggered.
+///     :param done:        Invoked when the rip is complete; either
+///                         with `NULL` to indicate success, or with an
+///                         error to indicate failure.
+void                    rsvc_cd_session_rip(rsvc_cd_session_t session,
+                                            rsvc_cd_rip_options_t options,
+                                            rsvc_cd_track_begin_f track_begin,
+                                            rsvc_cd_track_end_f track_end,
+                                            rsvc_cancel_t cancel, rsvc_done_t done);
+
 #endif  // RSVC_CD_H_
@@ -51,7 +51,9 @@ struct rsvc_format {
 
     rsvc_open_tags_f    open_tags;
     rsvc_encode_f       encode;
+    unsigned            sample_formats;  // accepted by `encode`, besides RSVC_SAMPLE_S16.
     rsvc_decode_f       decode;
+    rsvc_verify_f       verify;
     rsvc_audio_info_f   audio_info;
 
     rsvc_image_info_f   image_info;
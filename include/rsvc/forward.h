@@ -25,8 +25,11 @@ typedef const  struct rsvc_format*           rsvc_format_t;
 
 typedef        struct rsvc_audio_info*       rsvc_audio_info_t;
 typedef        struct rsvc_cd*               rsvc_cd_t;
+typedef        struct rsvc_cd_rip_options*   rsvc_cd_rip_options_t;
+typedef        struct rsvc_cd_rip_summary*   rsvc_cd_rip_summary_t;
 typedef        struct rsvc_cd_session*       rsvc_cd_session_t;
 typedef        struct rsvc_cd_track*         rsvc_cd_track_t;
+typedef        struct rsvc_decode_options*   rsvc_decode_options_t;
 typedef        struct rsvc_encode_options*   rsvc_encode_options_t;
 typedef        struct rsvc_error*            rsvc_error_t;
 typedef        struct rsvc_image_info*       rsvc_image_info_t;
@@ -25,5 +25,6 @@
 #include <rsvc/tag.h>
 
 bool rsvc_apply_musicbrainz_tags(rsvc_tags_t tags, rsvc_done_t fail);
+void rsvc_prefetch_musicbrainz(const char* discid);
 
 #endif  // RSVC_MUSICBRAINZ_H_
@@ -221,6 +221,15 @@ rsvc_tags_t rsvc_tags_new();
 /// ..  var:: RSVC_MEDIAKIND
 #define RSVC_MEDIAKIND              "MEDIAKIND"
 
+/// ..  var:: RSVC_ACCURATERIPV1
+///           RSVC_ACCURATERIPV2
+///           RSVC_ACCURATERIPCONFIDENCE
+///           RSVC_CRC32
+#define RSVC_ACCURATERIPV1          "ACCURATERIPV1"
+#define RSVC_ACCURATERIPV2          "ACCURATERIPV2"
+#define RSVC_ACCURATERIPCONFIDENCE  "ACCURATERIPCONFIDENCE"
+#define RSVC_CRC32                  "CRC32"
+
 enum rsvc_tag_code {
     RSVC_CODE_ARTIST            = 'a',
     RSVC_CODE_ALBUM             = 'A',
@@ -26,6 +26,7 @@
 #include <string.h>
 #include <sys/param.h>
 #include <sysexits.h>
+#include <unistd.h>
 
 #include <rsvc/audio.h>
 #include <rsvc/disc.h>
@@ -47,6 +48,7 @@ static rsvc_command_t  commands[]  = {
     &rsvc_info,
     &rsvc_rip,
     &rsvc_convert,
+    &rsvc_recompress,
     NULL,
 };
 
@@ -166,6 +168,7 @@ void rsvc_usage(rsvc_done_t done) {
                 "  info FILE...          print audio file info\n"
                 "  rip [DEVICE]          rip tracks to files\n"
                 "  convert IN [-o OUT]   convert files\n"
+                "  recompress PATH...    recompress FLAC files when idle\n"
                 "\n"
                 "Options:\n"
                 "  -h, --help            show this help page\n"
@@ -178,6 +181,12 @@ void rsvc_usage(rsvc_done_t done) {
 };
 
 static int rsvc_jobs_default() {
+#ifdef _SC_NPROCESSORS_ONLN
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus > 0) {
+        return ncpus;
+    }
+#endif
     return 4;
 }
 
@@ -243,6 +252,37 @@ bool format_option(struct encode_options* encode, rsvc_option_value_f get_value,
     return true;
 }
 
+bool level_option(struct encode_options* encode, rsvc_option_value_f get_value,
+                  rsvc_done_t fail) {
+    encode->has_level = true;
+    return rsvc_integer_option(&encode->level, get_value, fail);
+}
+
+bool quality_option(struct encode_options* encode, rsvc_option_value_f get_value,
+                    rsvc_done_t fail) {
+    encode->has_quality = true;
+    return rsvc_integer_option(&encode->quality, get_value, fail);
+}
+
+bool verify_option(struct encode_options* encode, rsvc_option_value_f get_value,
+                   rsvc_done_t fail) {
+    char* value;
+    if (!get_value(&value, fail)) {
+        return false;
+    }
+    if (strcmp(value, "inline") == 0) {
+        encode->verify = RSVC_VERIFY_INLINE;
+    } else if (strcmp(value, "none") == 0) {
+        encode->verify = RSVC_VERIFY_NONE;
+    } else if (strcmp(value, "deferred") == 0) {
+        encode->verify = RSVC_VERIFY_DEFERRED;
+    } else {
+        rsvc_errorf(fail, __FILE__, __LINE__, "invalid verify mode: %s", value);
+        return false;
+    }
+    return true;
+}
+
 bool path_option(char** string, rsvc_option_value_f get_value, rsvc_done_t fail) {
     return rsvc_string_option(string, get_value, fail)
         && rsvc_tags_validate_strf(*string, fail);
@@ -250,7 +290,9 @@ bool path_option(char** string, rsvc_option_value_f get_value, rsvc_done_t fail)
 
 bool validate_encode_options(struct encode_options* encode, rsvc_done_t fail) {
     if (!encode->format) {
-        if (encode->bitrate) {
+        if (encode->has_quality) {
+            encode->format = &rsvc_mp3;
+        } else if (encode->bitrate) {
             encode->format = &rsvc_vorbis;
         } else {
             encode->format = &rsvc_flac;
@@ -262,6 +304,22 @@ bool validate_encode_options(struct encode_options* encode, rsvc_done_t fail) {
             rsvc_errorf(fail, __FILE__, __LINE__,
                         "bitrate provided for lossless format %s", encode->format->name);
             return false;
+        } else if (encode->has_quality) {
+            rsvc_errorf(fail, __FILE__, __LINE__,
+                        "vbr quality provided for lossless format %s", encode->format->name);
+            return false;
+        }
+    } else if (encode->has_quality) {
+        if (encode->format != &rsvc_mp3) {
+            rsvc_errorf(fail, __FILE__, __LINE__,
+                        "vbr quality provided for format %s", encode->format->name);
+            return false;
+        } else if (encode->bitrate) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "both bitrate and vbr quality provided");
+            return false;
+        } else if ((encode->quality < 0) || (encode->quality > 9)) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "invalid vbr quality: %d", encode->quality);
+            return false;
         }
     } else {  // lossy
         if (!encode->bitrate) {
@@ -269,9 +327,42 @@ bool validate_encode_options(struct encode_options* encode, rsvc_done_t fail) {
         }
     }
 
+    if (encode->format != &rsvc_flac) {
+        if (encode->has_level) {
+            rsvc_errorf(fail, __FILE__, __LINE__,
+                        "compression level provided for format %s", encode->format->name);
+            return false;
+        }
+    } else if (!encode->has_level) {
+        encode->level = 8;
+    } else if ((encode->level < 0) || (encode->level > 8)) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "invalid compression level: %d", encode->level);
+        return false;
+    }
+
+    if ((encode->verify == RSVC_VERIFY_DEFERRED) && !encode->format->verify) {
+        rsvc_errorf(fail, __FILE__, __LINE__,
+                    "can't verify %s files", encode->format->name);
+        return false;
+    }
+
     return true;
 }
 
+void verify_later(rsvc_format_t format, const char* path, rsvc_done_t done) {
+    char* path_copy = strdup(path);
+    done = ^(rsvc_error_t error){
+        rsvc_prefix_error(path_copy, error, done);
+        free(path_copy);
+    };
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+        if (!format->verify(path_copy, done)) {
+            return;
+        }
+        done(NULL);
+    });
+}
+
 static bool multiply_safe(int64_t* value, int64_t by) {
     if ((INT64_MAX / by) < *value) {
         return false;
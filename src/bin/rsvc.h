@@ -22,6 +22,7 @@
 #define SRC_BIN_RSVC_H_
 
 #include <stdint.h>
+#include <rsvc/audio.h>
 #include <rsvc/forward.h>
 #include "../rsvc/options.h"
 
@@ -48,21 +49,42 @@ extern struct rsvc_command rsvc_eject;
 extern struct rsvc_command rsvc_info;
 extern struct rsvc_command rsvc_ls;
 extern struct rsvc_command rsvc_print;
+extern struct rsvc_command rsvc_recompress;
 extern struct rsvc_command rsvc_rip;
 extern struct rsvc_command rsvc_watch;
 
 struct encode_options {
     rsvc_format_t format;
     int64_t bitrate;
+    bool has_quality;
+    int quality;
+    bool has_level;
+    int level;
+    enum rsvc_verify verify;
 };
 bool  validate_encode_options(struct encode_options* encode, rsvc_done_t fail);
 
+// With --verify=deferred, checks the finished file at `path` on a
+// background queue, so that it doesn't hold up encoding.
+void  verify_later(rsvc_format_t format, const char* path, rsvc_done_t done);
+
+// Shared by `rsvc rip` and `rsvc watch --rip`, which both take the
+// options of `rsvc rip`.
+bool  validate_rip_options(rsvc_done_t fail);
+void  rip_disc(const char* disk, bool eject, rsvc_done_t done);
+
 void  rsvc_usage(rsvc_done_t done);
 void  rsvc_default_disk(void (^done)(rsvc_error_t error, char* disk));
 bool  bitrate_option(struct encode_options* encode, rsvc_option_value_f get_value,
                      rsvc_done_t fail);
 bool  format_option(struct encode_options* encode, rsvc_option_value_f get_value,
                     rsvc_done_t fail);
+bool  level_option(struct encode_options* encode, rsvc_option_value_f get_value,
+                   rsvc_done_t fail);
+bool  quality_option(struct encode_options* encode, rsvc_option_value_f get_value,
+                     rsvc_done_t fail);
+bool  verify_option(struct encode_options* encode, rsvc_option_value_f get_value,
+                    rsvc_done_t fail);
 bool  path_option(char** string, rsvc_option_value_f get_value, rsvc_done_t fail);
 
 #endif  // SRC_BIN_RSVC_H_
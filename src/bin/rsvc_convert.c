@@ -25,6 +25,7 @@
 #include "rsvc.h"
 
 #include <fts.h>
+#include <math.h>
 #include <string.h>
 #include <sys/param.h>
 #include <sys/stat.h>
@@ -35,9 +36,11 @@
 #include <rsvc/audio.h>
 #include <rsvc/format.h>
 #include <rsvc/tag.h>
+#include "../rsvc/downmix.h"
 #include "../rsvc/group.h"
 #include "../rsvc/list.h"
 #include "../rsvc/progress.h"
+#include "../rsvc/ring.h"
 #include "../rsvc/unix.h"
 #include "strlist.h"
 
@@ -48,50 +51,95 @@ struct file_pair {
     FILE*  output_file;
 };
 
+// An output format, with its own output paths.  Each -f option after
+// the first starts a new target; -b and -o apply to the latest one.
+typedef struct convert_target* convert_target_t;
+struct convert_target {
+    struct encode_options  encode;
+    struct string_list     output;
+    convert_target_t       prev, next;
+};
+
 static struct convert_options {
     struct string_list     input;
-    struct string_list     output;
+    struct {
+        convert_target_t   head, tail;
+    }                      targets;
+    size_t                 ntargets;
     bool                   recursive;
     bool                   update;
     bool                   delete_;
-    struct encode_options  encode;
-} options;
+    bool                   noise_shaping;
+    int                    segment;
+    struct rsvc_downmix_levels
+                           downmix;
+} options = {
+    .downmix = RSVC_DOWNMIX_ITU,
+};
 
 static struct convert_stats {
     int  nskipped;
     int  nnewer;
-    int  nsurround;
     int  nnonimage;
 } stats;
 
-static void convert(struct file_pair f, rsvc_done_t done);
-static void convert_recursive(struct file_pair f, dispatch_semaphore_t sema, rsvc_group_t group);
+// Deferred verifications join the run's group directly, rather than
+// the conversion's, so they don't hold a --jobs slot.
+static rsvc_group_t verifications;
+
+// The threads each encoder may use.  --jobs is split between the files
+// converted at once and the encoders of each, so that at most that many
+// chunks are encoded at a time.
+static size_t encode_threads = 1;
+
+static void convert(const char* input, char* const* outputs, rsvc_done_t done);
+static void convert_recursive(const char* input, char* const* outputs,
+                              dispatch_semaphore_t sema, rsvc_group_t group);
 static bool validate_convert_options(rsvc_done_t fail);
-static void convert_read(struct file_pair f, FILE* write_file, rsvc_done_t done,
-                         void (^start)(bool ok, rsvc_audio_info_t info));
-static void convert_write(struct file_pair f, rsvc_audio_info_t info,
-                          FILE* read_file, const char* tmp_path, rsvc_done_t done);
+static convert_target_t push_target();
+static convert_target_t current_target();
+static convert_target_t format_target();
+static void convert_read(struct file_pair f, unsigned sample_formats, FILE* write_file,
+                         rsvc_done_t done, void (^start)(bool ok, rsvc_audio_info_t info));
+static bool convert_downmix(FILE** read_pipes, size_t nreaders, rsvc_audio_info_t info,
+                            rsvc_done_t done);
+static void convert_write(struct file_pair f, struct encode_options* encode,
+                          rsvc_audio_info_t info, FILE* read_file, const char* tmp_path,
+                          rsvc_done_t done);
 static bool change_extension(const char* path, const char* extension, char* new_path,
                              rsvc_done_t fail);
 static void copy_tags(struct file_pair f, const char* tmp_path, rsvc_done_t done);
 static void push_string(struct string_list* list, const char* value);
 static bool push_string_option(struct string_list* list, rsvc_option_value_f get_value,
                                rsvc_done_t fail);
+static bool mix_level_option(float* level, rsvc_option_value_f get_value, rsvc_done_t fail);
 
 struct rsvc_command rsvc_convert = {
     .name = "convert",
 
     .usage = ^{
         errf(
-                "usage: %s convert [OPTIONS] IN... [-o OUT]...\n"
+                "usage: %s convert [OPTIONS] IN... [-f FMT [-b RATE|-q N|-l N] [-o OUT]...]...\n"
                 "\n"
                 "Options:\n"
                 "  -o, --output PATH       output path name (default: change ext of source)\n"
                 "  -b, --bitrate RATE      bitrate in SI format (default: 192k)\n"
                 "  -f, --format FMT        output format (default: flac or vorbis)\n"
+                "  -l, --level N           flac compression level, 0-8 (default: 8)\n"
+                "  -q, --quality N         mp3 vbr quality, 0-9 (default: cbr)\n"
+                "      --verify MODE       inline, deferred, or none (default: inline)\n"
                 "  -r, --recursive         convert folder recursively\n"
                 "  -u, --update            skip files that are newer than the source\n"
                 "      --delete            delete extraneous files from destination\n"
+                "      --noise-shaping     shape dither noise when reducing bit depth\n"
+                "      --segment SECS      encode long files in chunks of SECS seconds\n"
+                "      --center-mix DB     center level when downmixing to stereo (default: -3)\n"
+                "      --surround-mix DB   surround level when downmixing (default: -3)\n"
+                "      --lfe-mix DB        lfe level when downmixing (default: -inf)\n"
+                "\n"
+                "Each -f after the first adds another output format, with its own -b, -q, -l,\n"
+                "--verify, and -o options.  Each source is decoded once for all formats.\n"
+                "Surround sources are mixed down to stereo.\n"
                 "\n"
                 "Formats:\n",
                 rsvc_progname);
@@ -113,27 +161,50 @@ struct rsvc_command rsvc_convert = {
 
         rsvc_group_t group = rsvc_group_create(^(rsvc_error_t error){
             if (stats.nskipped) {
-                outf("%d files skipped (%d newer/%d surround/%d non-image)\n",
-                     stats.nskipped, stats.nnewer, stats.nsurround, stats.nnonimage);
+                outf("%d files skipped (%d newer/%d non-image)\n",
+                     stats.nskipped, stats.nnewer, stats.nnonimage);
             }
             done(error);
         });
 
-        dispatch_semaphore_t sema = dispatch_semaphore_create(rsvc_jobs);
-        for (string_list_node_t input = options.input.head, output = options.output.head;
-             input && output; input = input->next, output = output->next) {
-            struct file_pair files = {
-                .input = input->value,
-                .output = output->value,
-            };
+        verifications = group;
+
+        // Walk the input list and each target's output list together.
+        string_list_node_t output_nodes[options.ntargets];
+        char* outputs[options.ntargets];
+        size_t i = 0;
+        for (convert_target_t t = options.targets.head; t; t = t->next) {
+            output_nodes[i++] = t->output.head;
+        }
+
+        // Convert up to one file per --jobs slot for each target.  If
+        // that leaves slots idle, because there are fewer files than
+        // that, give them to the encoders.
+        const size_t jobs = MAX(1, rsvc_jobs);
+        size_t nfiles = MAX(1, jobs / options.ntargets);
+        if (!options.recursive) {
+            size_t ninputs = 0;
+            for (string_list_node_t input = options.input.head; input; input = input->next) {
+                ++ninputs;
+            }
+            nfiles = MIN(nfiles, ninputs);
+        }
+        encode_threads = MAX(1, jobs / (nfiles * options.ntargets));
+
+        dispatch_semaphore_t sema = dispatch_semaphore_create(nfiles);
+        for (string_list_node_t input = options.input.head; input; input = input->next) {
+            for (i = 0; i < options.ntargets; ++i) {
+                outputs[i] = output_nodes[i]->value;
+                output_nodes[i] = output_nodes[i]->next;
+            }
 
             if (options.recursive) {
-                convert_recursive(files, sema, group);
+                convert_recursive(input->value, outputs, sema, group);
             } else {
                 rsvc_done_t done = rsvc_group_add(group);
                 dispatch_retain(sema);
                 dispatch_semaphore_wait(sema, DISPATCH_TIME_FOREVER);
-                convert(files, ^(rsvc_error_t error){
+                convert(input->value, outputs, ^(rsvc_error_t error){
                     done(error);
                     dispatch_semaphore_signal(sema);
                     dispatch_release(sema);
@@ -146,12 +217,20 @@ struct rsvc_command rsvc_convert = {
 
     .short_option = ^bool (int32_t opt, rsvc_option_value_f get_value, rsvc_done_t fail){
         switch (opt) {
-          case 'b': return bitrate_option(&options.encode, get_value, fail);
-          case 'f': return format_option(&options.encode, get_value, fail);
-          case 'o': return push_string_option(&options.output, get_value, fail);
+          case 'b': return bitrate_option(&current_target()->encode, get_value, fail);
+          case 'f': return format_option(&format_target()->encode, get_value, fail);
+          case 'l': return level_option(&current_target()->encode, get_value, fail);
+          case 'o': return push_string_option(&current_target()->output, get_value, fail);
+          case 'q': return quality_option(&current_target()->encode, get_value, fail);
           case 'r': return rsvc_boolean_option(&options.recursive);
           case 'u': return rsvc_boolean_option(&options.update);
           case -1: return rsvc_boolean_option(&options.delete_);
+          case -2: return rsvc_boolean_option(&options.noise_shaping);
+          case -3: return verify_option(&current_target()->encode, get_value, fail);
+          case -4: return rsvc_integer_option(&options.segment, get_value, fail);
+          case -5: return mix_level_option(&options.downmix.center, get_value, fail);
+          case -6: return mix_level_option(&options.downmix.surround, get_value, fail);
+          case -7: return mix_level_option(&options.downmix.lfe, get_value, fail);
           default:  return rsvc_illegal_short_option(opt, fail);
         }
     },
@@ -160,9 +239,17 @@ struct rsvc_command rsvc_convert = {
         return rsvc_long_option((struct rsvc_long_option_name[]){
             {"bitrate",     'b'},
             {"format",      'f'},
+            {"level",       'l'},
+            {"quality",     'q'},
             {"recursive",   'r'},
             {"update",      'u'},
             {"delete",      -1},
+            {"noise-shaping", -2},
+            {"verify",      -3},
+            {"segment",     -4},
+            {"center-mix",  -5},
+            {"surround-mix", -6},
+            {"lfe-mix",     -7},
             {NULL}
         }, callbacks.short_option, opt, get_value, fail);
     },
@@ -174,85 +261,131 @@ struct rsvc_command rsvc_convert = {
     },
 };
 
-static void convert(struct file_pair f, rsvc_done_t done) {
-    f.input = strdup(f.input);
-    f.output = strdup(f.output);
+// Converts `input` to each target's format, writing to the
+// corresponding entry of `outputs`.  The input is decoded once; each
+// encoder reads the decoded audio from a shared ring.  Surround input
+// passes through a downmix stage on the way.
+static void convert(const char* input, char* const* outputs, rsvc_done_t done) {
+    const size_t ntargets = options.ntargets;
+    struct file_pair* files = calloc(ntargets, sizeof(struct file_pair));
+    char** tmp_paths = calloc(ntargets, sizeof(char*));
+    char* input_copy = strdup(input);
     done = ^(rsvc_error_t error){
-        free(f.input);
-        free(f.output);
+        for (size_t i = 0; i < ntargets; ++i) {
+            if (files[i].output_file) {
+                fclose(files[i].output_file);
+                unlink(tmp_paths[i]);
+            }
+            free(tmp_paths[i]);
+            free(files[i].output);
+        }
+        free(tmp_paths);
+        free(files);
+        free(input_copy);
         done(error);
     };
 
-    if (!rsvc_open(f.input, O_RDONLY, 0644, &f.input_file, done)) {
+    FILE* input_file;
+    if (!rsvc_open(input_copy, O_RDONLY, 0644, &input_file, done)) {
         return;
     }
     done = ^(rsvc_error_t error){
-        fclose(f.input_file);
+        fclose(input_file);
         done(error);
     };
 
-    // If the output file exists, stat it and check that it is different
-    // from the input file.  It could be the same if the user passed the
-    // same argument twice at the command-line (`rsvc convert a.flac
-    // a.flac`) or when using an implicit filename with formats that use
-    // the same extension (`rsvc convert a.m4a -falac`).
-    //
-    // Then, if --update was passed, skip if the output is newer.
-    struct stat st_input, st_output;
-    if ((fstat(fileno(f.input_file), &st_input) == 0)
-        && (stat(f.output, &st_output) == 0)) {
-        if ((st_input.st_dev == st_output.st_dev)
-            && (st_input.st_ino == st_output.st_ino)) {
-            rsvc_errorf(done, __FILE__, __LINE__, "%s and %s are the same file",
-                        f.input, f.output);
-            return;
+    // Decode to a sample format that all of the encoders accept.
+    size_t nactive = 0;
+    unsigned sample_formats = ~0u;
+    size_t i = 0;
+    for (convert_target_t t = options.targets.head; t; t = t->next, ++i) {
+        files[i].input = input_copy;
+        files[i].input_file = input_file;
+
+        // If the output file exists, stat it and check that it is
+        // different from the input file.  It could be the same if the
+        // user passed the same argument twice at the command-line
+        // (`rsvc convert a.flac a.flac`) or when using an implicit
+        // filename with formats that use the same extension (`rsvc
+        // convert a.m4a -falac`).
+        //
+        // Then, if --update was passed, skip if the output is newer.
+        struct stat st_input, st_output;
+        if ((fstat(fileno(input_file), &st_input) == 0)
+            && (stat(outputs[i], &st_output) == 0)) {
+            if ((st_input.st_dev == st_output.st_dev)
+                && (st_input.st_ino == st_output.st_ino)) {
+                rsvc_errorf(done, __FILE__, __LINE__, "%s and %s are the same file",
+                            input_copy, outputs[i]);
+                return;
+            }
+            if (options.update && (st_input.st_mtime < st_output.st_mtime)) {
+                ++stats.nskipped;
+                ++stats.nnewer;
+                continue;
+            }
         }
-        if (options.update && (st_input.st_mtime < st_output.st_mtime)) {
-            ++stats.nskipped;
-            ++stats.nnewer;
-            done(NULL);
-            return;
+
+        if (options.recursive) {
+            char parent[MAXPATHLEN];
+            rsvc_dirname(outputs[i], parent);
+            if (!rsvc_makedirs(parent, 0755, done)) {
+                return;
+            }
         }
-    }
 
-    if (options.recursive) {
-        char parent[MAXPATHLEN];
-        rsvc_dirname(f.output, parent);
-        if (!rsvc_makedirs(parent, 0755, done)) {
+        // Open a temporary file next to the output path.
+        char path_storage[MAXPATHLEN];
+        if (!rsvc_temp(outputs[i], path_storage, &files[i].output_file, done)) {
             return;
         }
+        files[i].output = strdup(outputs[i]);
+        tmp_paths[i] = strdup(path_storage);
+        sample_formats &= t->encode.format->sample_formats;
+        ++nactive;
     }
-
-    // Open a temporary file next to the output path.
-    char path_storage[MAXPATHLEN];
-    if (!rsvc_temp(f.output, path_storage, &f.output_file, done)) {
+    if (!nactive) {
+        done(NULL);
         return;
     }
-    char* tmp_path = strdup(path_storage);
-    done = ^(rsvc_error_t error){
-        fclose(f.output_file);
-        unlink(tmp_path);
-        free(tmp_path);
-        done(error);
-    };
 
-    FILE* read_pipe;
+    FILE** read_pipes = calloc(nactive, sizeof(FILE*));
     FILE* write_pipe;
-    if (!rsvc_pipe(&read_pipe, &write_pipe, done)) {
+    if (!rsvc_ring_fanout(nactive, read_pipes, &write_pipe, done)) {
+        free(read_pipes);
         return;
     }
 
+    struct file_pair source = {
+        .input       = input_copy,
+        .input_file  = input_file,
+    };
     rsvc_group_t group = rsvc_group_create(done);
-    convert_read(f, write_pipe, rsvc_group_add(group), ^(bool ok, rsvc_audio_info_t info){
-        if (!ok) {
-            fclose(read_pipe);
-        } else if (info->channels > 2) {
-            ++stats.nskipped;
-            ++stats.nsurround;
-            fclose(read_pipe);
-        } else {
-            convert_write(f, info, read_pipe, tmp_path, rsvc_group_add(group));
+    convert_read(source, sample_formats, write_pipe, rsvc_group_add(group),
+                 ^(bool ok, rsvc_audio_info_t info){
+        struct rsvc_audio_info stereo;
+        if (ok && (info->channels > 2)) {
+            ok = convert_downmix(read_pipes, nactive, info, rsvc_group_add(group));
+            stereo = *info;
+            stereo.channels = 2;
+            stereo.block_align = info->block_align / info->channels * 2;
+            info = &stereo;
         }
+        size_t reader = 0;
+        size_t i = 0;
+        for (convert_target_t t = options.targets.head; t; t = t->next, ++i) {
+            if (!files[i].output) {
+                continue;
+            }
+            FILE* read_pipe = read_pipes[reader++];
+            if (!ok) {
+                fclose(read_pipe);
+            } else {
+                convert_write(files[i], &t->encode, info, read_pipe, tmp_paths[i],
+                              rsvc_group_add(group));
+            }
+        }
+        free(read_pipes);
     });
     rsvc_group_ready(group);
 }
@@ -277,35 +410,56 @@ struct path_list {
     } *head, *tail;
 };
 
-static void convert_recursive(struct file_pair f, dispatch_semaphore_t sema, rsvc_group_t group) {
+static void convert_recursive(const char* input, char* const* outputs,
+                              dispatch_semaphore_t sema, rsvc_group_t group) {
+    const size_t ntargets = options.ntargets;
     rsvc_done_t walk_done = rsvc_group_add(group);
 
-    __block struct path_list outputs = {};
+    // Each target's root, and the files found under it, for --delete.
+    char** roots = calloc(ntargets, sizeof(char*));
+    struct path_list* existing = calloc(ntargets, sizeof(struct path_list));
+    for (size_t i = 0; i < ntargets; ++i) {
+        roots[i] = strdup(outputs[i]);
+    }
+    walk_done = ^(rsvc_error_t error){
+        for (size_t i = 0; i < ntargets; ++i) {
+            RSVC_LIST_CLEAR(&existing[i], ^(struct path_node* node){ (void)node; });
+            free(roots[i]);
+        }
+        free(existing);
+        free(roots);
+        walk_done(error);
+    };
+
     if (options.delete_) {
-        if (!rsvc_walk(f.output, FTS_NOCHDIR, walk_done,
-                       ^bool(unsigned short info, const char* dirname, const char* basename,
-                             struct stat* st, rsvc_done_t fail){
-            (void)st;
-            (void)fail;
-            if (info != FTS_F) {
-                return true;
-            }
-            struct path_node node = {};
-            strcat(node.path, f.output);
-            if (dirname) {
+        for (size_t i = 0; i < ntargets; ++i) {
+            const char* root = roots[i];
+            struct path_list* list = &existing[i];
+            if (!rsvc_walk(roots[i], FTS_NOCHDIR, walk_done,
+                           ^bool(unsigned short info, const char* dirname, const char* basename,
+                                 struct stat* st, rsvc_done_t fail){
+                (void)st;
+                (void)fail;
+                if (info != FTS_F) {
+                    return true;
+                }
+                struct path_node node = {};
+                strcat(node.path, root);
+                if (dirname) {
+                    strcat(node.path, "/");
+                    strcat(node.path, dirname);
+                }
                 strcat(node.path, "/");
-                strcat(node.path, dirname);
+                strcat(node.path, basename);
+                RSVC_LIST_PUSH(list, memdup(&node, sizeof(node)));
+                return true;
+            })) {
+                return;
             }
-            strcat(node.path, "/");
-            strcat(node.path, basename);
-            RSVC_LIST_PUSH(&outputs, memdup(&node, sizeof(node)));
-            return true;
-        })) {
-            return;
         }
     }
 
-    if (rsvc_walk(f.input, FTS_NOCHDIR, walk_done,
+    if (rsvc_walk((char*)input, FTS_NOCHDIR, walk_done,
                   ^bool(unsigned short info, const char* dirname, const char* basename,
                         struct stat* st, rsvc_done_t fail){
         (void)st;
@@ -313,23 +467,17 @@ static void convert_recursive(struct file_pair f, dispatch_semaphore_t sema, rsv
             if (!options.delete_) {
                 return true;
             }
-            char dir[MAXPATHLEN];
-            strcpy(dir, f.output);
-            if (dirname) {
-                strcat(dir, "/");
-                strcat(dir, dirname);
-            }
-            if (basename) {
-                strcat(dir, "/");
-                strcat(dir, basename);
-            }
-            rsvc_logf(1, "cleaning %s", dir);
-            for (struct path_node* node = outputs.head; node; node = node->next) {
-                if (strstr(node->path, dir) == node->path) {
-                    char* slash = strrchr(node->path, '/');
-                    if (slash && (slash == node->path + strlen(dir))) {
-                        if (!rsvc_rm(node->path, fail)) {
-                            return false;
+            for (size_t i = 0; i < ntargets; ++i) {
+                char dir[MAXPATHLEN];
+                build_path(dir, roots[i], dirname, basename);
+                rsvc_logf(1, "cleaning %s", dir);
+                for (struct path_node* node = existing[i].head; node; node = node->next) {
+                    if (strstr(node->path, dir) == node->path) {
+                        char* slash = strrchr(node->path, '/');
+                        if (slash && (slash == node->path + strlen(dir))) {
+                            if (!rsvc_rm(node->path, fail)) {
+                                return false;
+                            }
                         }
                     }
                 }
@@ -339,33 +487,35 @@ static void convert_recursive(struct file_pair f, dispatch_semaphore_t sema, rsv
             return true;
         }
 
-        char input[MAXPATHLEN], output[MAXPATHLEN];
-        build_path(input, f.input, dirname, basename);
-        build_path(output, f.output, dirname, basename);
-        if (!change_extension(output, options.encode.format->extension, output, fail)) {
-            return false;
-        }
+        char input_path[MAXPATHLEN];
+        char output_storage[ntargets][MAXPATHLEN];
+        char* output_paths[ntargets];
+        build_path(input_path, input, dirname, basename);
+        size_t i = 0;
+        for (convert_target_t t = options.targets.head; t; t = t->next, ++i) {
+            output_paths[i] = output_storage[i];
+            build_path(output_paths[i], roots[i], dirname, basename);
+            if (!change_extension(output_paths[i], t->encode.format->extension,
+                                  output_paths[i], fail)) {
+                return false;
+            }
 
-        if (options.delete_) {
-            for (struct path_node* node = outputs.head; node; node = node->next) {
-                if (strcmp(node->path, output) == 0) {
-                    RSVC_LIST_ERASE(&outputs, node);
-                    break;
+            if (options.delete_) {
+                for (struct path_node* node = existing[i].head; node; node = node->next) {
+                    if (strcmp(node->path, output_paths[i]) == 0) {
+                        RSVC_LIST_ERASE(&existing[i], node);
+                        break;
+                    }
                 }
             }
+            rsvc_logf(2, "+ %s", output_paths[i]);
         }
-
-        struct file_pair inner_files = {
-            .input = input,
-            .output = output,
-        };
-        rsvc_logf(2, "- %s", f.input);
-        rsvc_logf(2, "+ %s", f.output);
+        rsvc_logf(2, "- %s", input_path);
 
         dispatch_retain(sema);
         dispatch_semaphore_wait(sema, DISPATCH_TIME_FOREVER);
         rsvc_done_t convert_done = rsvc_group_add(group);
-        convert(inner_files, ^(rsvc_error_t error){
+        convert(input_path, output_paths, ^(rsvc_error_t error){
             convert_done(error);
             dispatch_semaphore_signal(sema);
             dispatch_release(sema);
@@ -377,42 +527,78 @@ static void convert_recursive(struct file_pair f, dispatch_semaphore_t sema, rsv
 }
 
 static bool validate_convert_options(rsvc_done_t fail) {
-    if (!validate_encode_options(&options.encode, fail)) {
-        return false;
-    } else if (!options.input.head) {
+    if (!options.targets.head) {
+        push_target();
+    }
+
+    if (!options.input.head) {
         rsvc_errorf(fail, __FILE__, __LINE__, "no input files");
         return false;
-    } else if (options.recursive && !options.output.head) {
-        rsvc_errorf(fail, __FILE__, __LINE__, "-r requires output path");
+    } else if (options.segment < 0) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "segment length must not be negative");
         return false;
     }
 
-    if (options.output.head) {
-        // If output paths were specified, ensure that the same number
-        // of input and output paths were given.
-        for (string_list_node_t input = options.input.head, output = options.output.head;
-             input || output; input = input->next, output = output->next) {
-            if (!input) {
-                rsvc_errorf(fail, __FILE__, __LINE__, "too many output paths");
-            } else if (!output) {
-                rsvc_errorf(fail, __FILE__, __LINE__, "not enough output paths");
-            }
+    for (convert_target_t t = options.targets.head; t; t = t->next) {
+        if (!validate_encode_options(&t->encode, fail)) {
+            return false;
+        } else if (options.recursive && !t->output.head) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "-r requires output path");
+            return false;
         }
-    } else {
-        // If they weren't, change the extensions of the input files.
-        char path_storage[MAXPATHLEN];
-        for (string_list_node_t curr = options.input.head; curr; curr = curr->next) {
-            if (!change_extension(curr->value, options.encode.format->extension, path_storage, fail)) {
-                return false;
+
+        if (t->output.head) {
+            // If output paths were specified, ensure that the same
+            // number of input and output paths were given.
+            for (string_list_node_t input = options.input.head, output = t->output.head;
+                 input || output; input = input->next, output = output->next) {
+                if (!input) {
+                    rsvc_errorf(fail, __FILE__, __LINE__, "too many output paths");
+                    return false;
+                } else if (!output) {
+                    rsvc_errorf(fail, __FILE__, __LINE__, "not enough output paths");
+                    return false;
+                }
+            }
+        } else {
+            // If they weren't, change the extensions of the input files.
+            char path_storage[MAXPATHLEN];
+            for (string_list_node_t curr = options.input.head; curr; curr = curr->next) {
+                if (!change_extension(curr->value, t->encode.format->extension, path_storage,
+                                      fail)) {
+                    return false;
+                }
+                push_string(&t->output, path_storage);
             }
-            push_string(&options.output, path_storage);
         }
     }
     return true;
 }
 
-static void convert_read(struct file_pair f, FILE* write_file, rsvc_done_t done,
-                         void (^start)(bool ok, rsvc_audio_info_t info)) {
+static convert_target_t push_target() {
+    struct convert_target target = {};
+    RSVC_LIST_PUSH(&options.targets, memdup(&target, sizeof(target)));
+    ++options.ntargets;
+    return options.targets.tail;
+}
+
+static convert_target_t current_target() {
+    if (!options.targets.tail) {
+        return push_target();
+    }
+    return options.targets.tail;
+}
+
+static convert_target_t format_target() {
+    convert_target_t target = current_target();
+    if (target->encode.format) {
+        return push_target();
+    }
+    return target;
+}
+
+static void convert_read(struct file_pair f, unsigned sample_formats, FILE* write_file,
+                         rsvc_done_t done, void (^start)(bool ok, rsvc_audio_info_t info)) {
     __block bool got_info = false;
     done = ^(rsvc_error_t error){
         fclose(write_file);
@@ -444,7 +630,11 @@ static void convert_read(struct file_pair f, FILE* write_file, rsvc_done_t done,
         return;
     }
     dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-        if (!format->decode(f.input_file, write_file, ^(rsvc_audio_info_t info){
+        struct rsvc_decode_options decode_options = {
+            .sample_formats = sample_formats,
+            .noise_shaping  = options.noise_shaping,
+        };
+        if (!format->decode(f.input_file, write_file, &decode_options, ^(rsvc_audio_info_t info){
             got_info = true;
             start(true, info);
         }, done)) {
@@ -454,8 +644,44 @@ static void convert_read(struct file_pair f, FILE* write_file, rsvc_done_t done,
     });
 }
 
-static void convert_write(struct file_pair f, rsvc_audio_info_t info,
-                          FILE* read_file, const char* tmp_path, rsvc_done_t done) {
+// Starts mixing the decoded audio down to stereo.  The stage reads from
+// the first of `read_pipes`; the rest are closed, and replaced with read
+// ends of the stage's output.  If it can't start, `read_pipes` are left
+// as they were.
+static bool convert_downmix(FILE** read_pipes, size_t nreaders, rsvc_audio_info_t info,
+                            rsvc_done_t done) {
+    FILE* stereo_pipes[nreaders];
+    FILE* write_file;
+    if (!rsvc_ring_fanout(nreaders, stereo_pipes, &write_file, done)) {
+        return false;
+    }
+    FILE* read_file = read_pipes[0];
+    for (size_t i = 0; i < nreaders; ++i) {
+        if (i > 0) {
+            fclose(read_pipes[i]);
+        }
+        read_pipes[i] = stereo_pipes[i];
+    }
+    done = ^(rsvc_error_t error){
+        fclose(read_file);
+        fclose(write_file);
+        done(error);
+    };
+
+    struct rsvc_audio_info info_copy = *info;
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        if (!rsvc_downmix(read_file, write_file, &info_copy, &options.downmix,
+                          options.noise_shaping, done)) {
+            return;
+        }
+        done(NULL);
+    });
+    return true;
+}
+
+static void convert_write(struct file_pair f, struct encode_options* encode,
+                          rsvc_audio_info_t info, FILE* read_file, const char* tmp_path,
+                          rsvc_done_t done) {
     done = ^(rsvc_error_t error){
         fclose(read_file);
         done(error);
@@ -466,14 +692,20 @@ static void convert_write(struct file_pair f, rsvc_audio_info_t info,
     struct rsvc_audio_info info_copy = *info;
     dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
         struct rsvc_encode_options encode_options = {
-            .bitrate   = options.encode.bitrate,
+            .bitrate   = encode->bitrate,
+            .vbr       = encode->has_quality,
+            .quality   = encode->quality,
+            .level     = encode->level,
+            .verify    = encode->verify,
             .info      = info_copy,
+            .threads   = encode_threads,
+            .segment_samples = options.segment * info_copy.sample_rate,
             .progress  = ^(double fraction){
                 rsvc_progress_update(node, fraction);
             },
         };
 
-        if (!options.encode.format->encode(read_file, f.output_file, &encode_options, done)) {
+        if (!encode->format->encode(read_file, f.output_file, &encode_options, done)) {
             rsvc_progress_done(node, "fail");
             return;
         }
@@ -487,6 +719,9 @@ static void convert_write(struct file_pair f, rsvc_audio_info_t info,
                 return;
             }
 
+            if (encode->verify == RSVC_VERIFY_DEFERRED) {
+                verify_later(encode->format, f.output, rsvc_group_add(verifications));
+            }
             done(NULL);
         });
     });
@@ -520,9 +755,18 @@ static bool change_extension(const char* path, const char* extension, char* new_
 static void copy_tags(struct file_pair f, const char* tmp_path, rsvc_done_t done) {
     // If we don't have tag support for both the input and output
     // formats (e.g. conversion to/from WAV), then silently do nothing.
+    //
+    // Other targets may be copying tags from the same input at the
+    // same time, so detect its format through a separate handle.
     rsvc_format_t read_fmt, write_fmt;
     rsvc_done_t ignore = ^(rsvc_error_t error){ (void)error; /* do nothing */ };
-    if (!(rsvc_format_detect(f.input, f.input_file, &read_fmt, ignore)
+    FILE* input_file;
+    if (!rsvc_open(f.input, O_RDONLY, 0644, &input_file, done)) {
+        return;
+    }
+    bool detected = rsvc_format_detect(f.input, input_file, &read_fmt, ignore);
+    fclose(input_file);
+    if (!(detected
           && read_fmt->open_tags
           && rsvc_format_detect(tmp_path, f.output_file, &write_fmt, ignore)
           && write_fmt->open_tags)) {
@@ -580,3 +824,19 @@ static bool push_string_option(struct string_list* list, rsvc_option_value_f get
     push_string(list, value);
     return true;
 }
+
+// Reads a level in decibels, which may be "-inf", and stores its gain.
+static bool mix_level_option(float* level, rsvc_option_value_f get_value, rsvc_done_t fail) {
+    char* value;
+    if (!get_value(&value, fail)) {
+        return false;
+    }
+    char* end;
+    double db = strtod(value, &end);
+    if ((end == value) || *end || isnan(db) || (db > 0)) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "invalid mix level: %s", value);
+        return false;
+    }
+    *level = pow(10, db / 20);
+    return true;
+}
@@ -0,0 +1,540 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2014 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#define _BSD_SOURCE
+#define _DEFAULT_SOURCE
+#define _POSIX_C_SOURCE 200809L
+
+#include "rsvc.h"
+
+#include <dispatch/dispatch.h>
+#include <fcntl.h>
+#include <fts.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <utime.h>
+
+#include <rsvc/audio.h>
+#include <rsvc/format.h>
+#include "../rsvc/group.h"
+#include "../rsvc/list.h"
+#include "../rsvc/progress.h"
+#include "../rsvc/ring.h"
+#include "../rsvc/unix.h"
+#include "strlist.h"
+
+static struct recompress_options {
+    struct string_list  input;
+    bool                has_level;
+    int                 level;
+    bool                has_max_load;
+    int                 max_load;
+} options;
+
+static struct recompress_stats {
+    int      nrecompressed;
+    int      nskipped;
+    int      nlarger;
+    int      nunsigned;
+    int64_t  saved;
+} stats;
+
+// All FLAC files found under the input paths, in walk order.
+static struct string_list files;
+
+// Set once the load average rises above --max-load.  From then on, the
+// file being decoded reads as if it had ended, which winds down the
+// decoder and encoder, and no more files are started.
+static volatile bool stopping;
+
+// The number of threads recompressing files right now.  While a file
+// is converted, its decoder and encoder each have one, and so does
+// its verification afterwards.
+static atomic_int running;
+
+// What's known about a file before recompressing it.
+struct original {
+    struct stat  st;
+    uint8_t      md5[16];
+};
+
+static bool validate_recompress_options(rsvc_done_t fail);
+static int default_max_load();
+static bool overloaded();
+static void run_background(dispatch_block_t block);
+static bool collect(char* path, rsvc_done_t fail);
+static void recompress_next(string_list_node_t node, rsvc_group_t group);
+static void recompress(const char* input, rsvc_done_t done);
+static void recompress_encode(rsvc_audio_info_t info, FILE* read_pipe, FILE* tmp_file,
+                              rsvc_progress_t node, rsvc_done_t done);
+static void recompress_finish(const char* input, const struct original* original,
+                              const char* tmp_path, rsvc_progress_t node, rsvc_done_t done);
+static void format_bytes(int64_t bytes, char* out, size_t size);
+static void push_string(struct string_list* list, const char* value);
+
+struct rsvc_command rsvc_recompress = {
+    .name = "recompress",
+
+    .usage = ^{
+        errf(
+                "usage: %s recompress [OPTIONS] PATH...\n"
+                "\n"
+                "Options:\n"
+                "  -l, --level N           flac compression level, 0-8 (default: 8)\n"
+                "      --max-load N        stop when the load average exceeds N (default: %d)\n"
+                "\n"
+                "Re-encodes FLAC files, and folders of them, in the background.  A file is\n"
+                "replaced only if the new one has the same audio MD5 and is smaller.\n",
+                rsvc_progname, default_max_load());
+    },
+
+    .run = ^(rsvc_done_t done){
+        if (!validate_recompress_options(done)) {
+            return;
+        }
+        for (string_list_node_t input = options.input.head; input; input = input->next) {
+            if (!collect(input->value, done)) {
+                return;
+            }
+        }
+
+        rsvc_group_t group = rsvc_group_create(^(rsvc_error_t error){
+            char saved[32];
+            format_bytes(stats.saved, saved, sizeof(saved));
+            if (stopping) {
+                outf("stopped: load average above %d\n", options.max_load);
+            }
+            outf("%d files recompressed, saving %s\n", stats.nrecompressed, saved);
+            if (stats.nskipped) {
+                outf("%d files skipped (%d no smaller/%d unsigned)\n",
+                     stats.nskipped, stats.nlarger, stats.nunsigned);
+            }
+            done(error);
+        });
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+            recompress_next(files.head, group);
+        });
+    },
+
+    .short_option = ^bool (int32_t opt, rsvc_option_value_f get_value, rsvc_done_t fail){
+        switch (opt) {
+          case 'l':
+            options.has_level = true;
+            return rsvc_integer_option(&options.level, get_value, fail);
+          case -1:
+            options.has_max_load = true;
+            return rsvc_integer_option(&options.max_load, get_value, fail);
+          default:
+            return rsvc_illegal_short_option(opt, fail);
+        }
+    },
+
+    .long_option = ^bool (char* opt, rsvc_option_value_f get_value, rsvc_done_t fail){
+        return rsvc_long_option((struct rsvc_long_option_name[]){
+            {"level",       'l'},
+            {"max-load",    -1},
+            {NULL}
+        }, callbacks.short_option, opt, get_value, fail);
+    },
+
+    .argument = ^bool (char* arg, rsvc_done_t fail) {
+        (void)fail;
+        push_string(&options.input, arg);
+        return true;
+    },
+};
+
+static bool validate_recompress_options(rsvc_done_t fail) {
+    if (!options.input.head) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "no input files");
+        return false;
+    }
+
+    if (!options.has_level) {
+        options.level = 8;
+    } else if ((options.level < 0) || (options.level > 8)) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "level must be between 0 and 8");
+        return false;
+    }
+
+    if (!options.has_max_load) {
+        options.max_load = default_max_load();
+    } else if (options.max_load < 0) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "max load must be non-negative");
+        return false;
+    }
+    return true;
+}
+
+// Leave half of the machine to whatever else is running.
+static int default_max_load() {
+    return (rsvc_jobs > 2) ? (rsvc_jobs / 2) : 1;
+}
+
+// Each thread that is recompressing accounts for about one of the
+// load average itself, so those aren't counted.  If the load average
+// can't be read, the machine is assumed to be idle.
+static bool overloaded() {
+    double load;
+    if (!rsvc_loadavg(&load, ^(rsvc_error_t error){ (void)error; })) {
+        return false;
+    }
+    return (load - atomic_load(&running)) > options.max_load;
+}
+
+// Runs `block` on a background thread, counted in `running`.
+static void run_background(dispatch_block_t block) {
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+        atomic_fetch_add(&running, 1);
+        block();
+        atomic_fetch_sub(&running, 1);
+    });
+}
+
+static void build_path(char* out, const char* a, const char* b, const char* c) {
+    out[0] = '\0';
+    strcat(out, a);
+    if (b) {
+        strcat(out, "/");
+        strcat(out, b);
+    }
+    if (c) {
+        strcat(out, "/");
+        strcat(out, c);
+    }
+}
+
+// Files given explicitly are always recompressed (or rejected, if
+// they aren't FLAC); folders are searched for *.flac files.
+static bool collect(char* path, rsvc_done_t fail) {
+    struct stat st;
+    if (stat(path, &st) < 0) {
+        rsvc_strerrorf(fail, __FILE__, __LINE__, "%s", path);
+        return false;
+    } else if (!S_ISDIR(st.st_mode)) {
+        push_string(&files, path);
+        return true;
+    }
+
+    return rsvc_walk(path, FTS_NOCHDIR, fail,
+                     ^bool(unsigned short info, const char* dirname, const char* basename,
+                           struct stat* st, rsvc_done_t fail){
+        (void)st;
+        (void)fail;
+        // Hidden files include temporary files left by earlier runs.
+        char ext[MAXPATHLEN];
+        if ((info != FTS_F)
+            || (basename[0] == '.')
+            || !rsvc_ext(basename, ext)
+            || (strcmp(ext, "flac") != 0)) {
+            return true;
+        }
+        char file[MAXPATHLEN];
+        build_path(file, path, dirname, basename);
+        push_string(&files, file);
+        return true;
+    });
+}
+
+// Recompresses files one at a time, so as to stay in the background.
+static void recompress_next(string_list_node_t node, rsvc_group_t group) {
+    if (!stopping && node && overloaded()) {
+        stopping = true;
+    }
+    if (stopping || !node) {
+        rsvc_group_ready(group);
+        return;
+    }
+
+    rsvc_done_t done = rsvc_group_add(group);
+    recompress(node->value, ^(rsvc_error_t error){
+        done(error);
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+            recompress_next(node->next, group);
+        });
+    });
+}
+
+// Reads from a source file until stopped, then reports end of file.
+static ssize_t source_read(void* cookie, char* data, size_t size) {
+    FILE* file = cookie;
+    if (stopping) {
+        return 0;
+    }
+    size_t nread = fread(data, 1, size, file);
+    if (!nread && ferror(file)) {
+        return -1;
+    }
+    return nread;
+}
+
+static bool has_md5(const uint8_t* md5) {
+    for (int i = 0; i < 16; ++i) {
+        if (md5[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Decodes `input` and encodes it again at the requested level, into a
+// temporary file next to it.  The MD5 signature from the original
+// encoder vouches for the decoded audio; the original is then replaced
+// only if the new file carries the same signature and, once the
+// original's metadata is copied over, verifies against it.
+static void recompress(const char* input, rsvc_done_t done) {
+    char* input_copy = strdup(input);
+    done = ^(rsvc_error_t error){
+        rsvc_prefix_error(input_copy, error, done);
+        free(input_copy);
+    };
+
+    FILE* input_file;
+    if (!rsvc_open(input_copy, O_RDONLY, 0644, &input_file, done)) {
+        return;
+    }
+    done = ^(rsvc_error_t error){
+        fclose(input_file);
+        done(error);
+    };
+
+    struct original original;
+    rsvc_format_t format;
+    if (fstat(fileno(input_file), &original.st) < 0) {
+        rsvc_strerrorf(done, __FILE__, __LINE__, NULL);
+        return;
+    } else if (!rsvc_format_detect(input_copy, input_file, &format, done)) {
+        return;
+    } else if (format != &rsvc_flac) {
+        rsvc_errorf(done, __FILE__, __LINE__, "not a FLAC file");
+        return;
+    } else if (!rsvc_flac_md5(input_copy, original.md5, done)) {
+        return;
+    } else if (!has_md5(original.md5)) {
+        rsvc_logf(1, "%s: no MD5 signature; skipping", input_copy);
+        ++stats.nskipped;
+        ++stats.nunsigned;
+        done(NULL);
+        return;
+    }
+
+    char path_storage[MAXPATHLEN];
+    __block FILE* tmp_file;
+    if (!rsvc_temp(input_copy, path_storage, &tmp_file, done)) {
+        return;
+    }
+    char* tmp_path = strdup(path_storage);
+    done = ^(rsvc_error_t error){
+        if (tmp_file) {
+            fclose(tmp_file);
+        }
+        unlink(tmp_path);
+        free(tmp_path);
+        done(error);
+    };
+
+    FILE* source_file;
+    if (!rsvc_cookieopen(input_file, "r", source_read, NULL, NULL, &source_file, done)) {
+        return;
+    }
+    done = ^(rsvc_error_t error){
+        fclose(source_file);
+        done(error);
+    };
+
+    // Check the load while the file is being recompressed, too.
+    dispatch_source_t timer = dispatch_source_create(
+            DISPATCH_SOURCE_TYPE_TIMER, 0, 0,
+            dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0));
+    dispatch_source_set_timer(timer, dispatch_time(DISPATCH_TIME_NOW, NSEC_PER_SEC),
+                              NSEC_PER_SEC, NSEC_PER_SEC / 10);
+    dispatch_source_set_event_handler(timer, ^{
+        if (overloaded()) {
+            stopping = true;
+        }
+    });
+    dispatch_resume(timer);
+    done = ^(rsvc_error_t error){
+        dispatch_source_cancel(timer);
+        dispatch_release(timer);
+        done(error);
+    };
+
+    FILE* read_pipe;
+    FILE* write_pipe;
+    if (!rsvc_ring_pipe(&read_pipe, &write_pipe, done)) {
+        return;
+    }
+
+    rsvc_progress_t node = rsvc_progress_start(input_copy);
+    rsvc_group_t group = rsvc_group_create(^(rsvc_error_t error){
+        fclose(tmp_file);
+        tmp_file = NULL;
+        if (stopping) {
+            rsvc_progress_done(node, "stopped");
+            done(NULL);
+        } else if (error) {
+            rsvc_progress_done(node, "fail");
+            done(error);
+        } else {
+            recompress_finish(input_copy, &original, tmp_path, node, done);
+        }
+    });
+    rsvc_done_t encode_done = rsvc_group_add(group);
+    rsvc_done_t decode_group_done = rsvc_group_add(group);
+    __block bool started = false;
+    rsvc_done_t decode_done = ^(rsvc_error_t error){
+        fclose(write_pipe);
+        if (!started) {
+            fclose(read_pipe);
+            encode_done(NULL);
+        }
+        decode_group_done(error);
+    };
+    rsvc_group_ready(group);
+
+    run_background(^{
+        struct rsvc_decode_options decode_options = {
+            .sample_formats = rsvc_flac.sample_formats,
+        };
+        if (!rsvc_flac.decode(source_file, write_pipe, &decode_options,
+                              ^(rsvc_audio_info_t info){
+            started = true;
+            recompress_encode(info, read_pipe, tmp_file, node, encode_done);
+        }, decode_done)) {
+            return;
+        }
+        decode_done(NULL);
+    });
+}
+
+static void recompress_encode(rsvc_audio_info_t info, FILE* read_pipe, FILE* tmp_file,
+                              rsvc_progress_t node, rsvc_done_t done) {
+    done = ^(rsvc_error_t error){
+        fclose(read_pipe);
+        done(error);
+    };
+
+    struct rsvc_audio_info info_copy = *info;
+    run_background(^{
+        // Verification is done separately, against the original's MD5.
+        struct rsvc_encode_options encode_options = {
+            .level     = options.level,
+            .verify    = RSVC_VERIFY_NONE,
+            .info      = info_copy,
+            .threads   = 1,
+            .progress  = ^(double fraction){
+                rsvc_progress_update(node, fraction);
+            },
+        };
+        if (!rsvc_flac.encode(read_pipe, tmp_file, &encode_options, done)) {
+            return;
+        }
+        done(NULL);
+    });
+}
+
+static void recompress_finish(const char* input, const struct original* original,
+                              const char* tmp_path, rsvc_progress_t node, rsvc_done_t done) {
+    struct original o = *original;
+    run_background(^{
+        rsvc_done_t fail = ^(rsvc_error_t error){
+            rsvc_progress_done(node, "fail");
+            done(error);
+        };
+
+        uint8_t md5[16];
+        struct stat st;
+        if (!rsvc_flac_md5(tmp_path, md5, fail)) {
+            return;
+        } else if (memcmp(md5, o.md5, sizeof(md5)) != 0) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "MD5 signature changed; keeping original");
+            return;
+        } else if (!(rsvc_flac_copy_metadata(input, tmp_path, fail)
+                     && rsvc_flac.verify(tmp_path, fail))) {
+            return;
+        } else if (stopping) {
+            rsvc_progress_done(node, "stopped");
+            done(NULL);
+            return;
+        } else if (stat(tmp_path, &st) < 0) {
+            rsvc_strerrorf(fail, __FILE__, __LINE__, "%s", tmp_path);
+            return;
+        } else if (st.st_size >= o.st.st_size) {
+            ++stats.nskipped;
+            ++stats.nlarger;
+            rsvc_progress_done(node, "no smaller");
+            done(NULL);
+            return;
+        }
+
+        // Keep the original's permissions and times, so that `rsvc
+        // convert --update` doesn't see the audio as new.
+        struct utimbuf times = {
+            .actime   = o.st.st_atime,
+            .modtime  = o.st.st_mtime,
+        };
+        if (chmod(tmp_path, o.st.st_mode & 07777) < 0) {
+            rsvc_strerrorf(fail, __FILE__, __LINE__, "%s", tmp_path);
+            return;
+        } else if (utime(tmp_path, &times) < 0) {
+            rsvc_strerrorf(fail, __FILE__, __LINE__, "%s", tmp_path);
+            return;
+        } else if (!rsvc_mv(tmp_path, input, fail)) {
+            return;
+        }
+
+        int64_t saved = o.st.st_size - st.st_size;
+        char note[64];
+        strcpy(note, "saved ");
+        format_bytes(saved, note + strlen(note), sizeof(note) - strlen(note));
+        ++stats.nrecompressed;
+        stats.saved += saved;
+        rsvc_progress_done(node, note);
+        done(NULL);
+    });
+}
+
+static void format_bytes(int64_t bytes, char* out, size_t size) {
+    static const char units[] = "kMGT";
+    if (bytes < 1000) {
+        snprintf(out, size, "%" PRId64 " bytes", bytes);
+        return;
+    }
+    double value = bytes / 1000.0;
+    const char* unit = units;
+    while ((value >= 1000) && unit[1]) {
+        value /= 1000;
+        ++unit;
+    }
+    snprintf(out, size, "%.1f %cB", value, *unit);
+}
+
+static void push_string(struct string_list* list, const char* value) {
+    struct string_list_node tmp = {
+        .value = strdup(value),
+    };
+    RSVC_LIST_PUSH(list, memdup(&tmp, sizeof(tmp)));
+}
@@ -22,6 +22,7 @@
 
 #include "rsvc.h"
 
+#include <Block.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -33,22 +34,73 @@
 #include <rsvc/disc.h>
 #include <rsvc/format.h>
 #include <rsvc/musicbrainz.h>
+#include "../rsvc/accuraterip.h"
 #include "../rsvc/group.h"
+#include "../rsvc/list.h"
 #include "../rsvc/progress.h"
+#include "../rsvc/ring.h"
 #include "../rsvc/unix.h"
+#include "strlist.h"
 
 static struct rip_options {
-    char* disk;
+    struct string_list disks;
+    bool all;
     struct encode_options encode;
     bool eject;
     char* path_format;
+    int batch;
+    bool c2;
+    bool secure;
+    int matches;
+    char* accuraterip;
+    bool has_offset;
+    int offset;
+    bool continuous;
 } opts;
 
+// Limits the number of encoders running at once, across all drives.
+// A track that finds no free slot waits in line, without holding a
+// thread; meanwhile its audio backs up in its pipe, and its drive
+// waits.  Only touched on `encoder_queue`.
+struct pending_encode {
+    dispatch_block_t        start;
+    struct pending_encode*  prev;
+    struct pending_encode*  next;
+};
+static dispatch_queue_t encoder_queue;
+static struct {
+    size_t                  free;
+    struct pending_encode*  head;
+    struct pending_encode*  tail;
+} encoders;
+
+// About six seconds of audio between the drive and the checksum stage.
+static const size_t kChecksumRingSize = 1 << 20;
+
+static void push_string(struct string_list* list, const char* value);
+static void find_discs(rsvc_done_t done);
 static void rip_all(rsvc_cd_t cd, rsvc_done_t done);
 static void rip_track(size_t n, size_t ntracks, rsvc_group_t group,
-                      rsvc_cd_t cd, rsvc_cd_session_t session);
+                      rsvc_cd_t cd, rsvc_cd_session_t session, int offset);
+struct track_output;
+static void rip_continuous(rsvc_group_t group, rsvc_cd_t cd, rsvc_cd_session_t session,
+                           int offset);
+static void prepare_tracks(size_t n, rsvc_cd_t cd, rsvc_cd_session_t session,
+                           struct track_output* outputs, rsvc_done_t done);
+static size_t track_index(rsvc_cd_session_t session, rsvc_cd_track_t track);
+static void print_summary(rsvc_cd_rip_summary_t summary);
+static bool open_track(rsvc_tags_t tags, char** path, FILE** file, rsvc_done_t fail);
+static bool start_encode(rsvc_cd_session_t session, size_t n, rsvc_tags_t tags, char* path,
+                         FILE* file, FILE** write_pipe, rsvc_done_t done, rsvc_done_t fail);
+static void acquire_encoder(dispatch_block_t start);
+static void release_encoder();
 static void get_tags(rsvc_cd_t cd, rsvc_cd_session_t session, rsvc_cd_track_t track,
                      void (^done)(rsvc_error_t error, rsvc_tags_t tags));
+static bool has_audio_track(rsvc_cd_session_t session, size_t begin, size_t end);
+static void checksum_track(rsvc_ring_t in, FILE* out, struct rsvc_accuraterip* ar,
+                           rsvc_done_t done);
+static bool add_checksum_tags(rsvc_tags_t tags, const struct rsvc_accuraterip* ar,
+                              int confidence, rsvc_done_t fail);
 static void set_tags(FILE* file, char* path, rsvc_tags_t source, rsvc_done_t done);
 
 struct rsvc_command rsvc_rip = {
@@ -56,14 +108,25 @@ struct rsvc_command rsvc_rip = {
 
     .usage = ^{
         errf(
-                "usage: %s rip [OPTIONS] [DEVICE]\n"
+                "usage: %s rip [OPTIONS] [DEVICE|IMAGE]...\n"
                 "\n"
                 "Options:\n"
+                "      --accuraterip DB    check AccurateRip CRCs against DB\n"
+                "  -a, --all               rip every CD that is inserted\n"
                 "  -b, --bitrate RATE      bitrate in SI format (default: 192k)\n"
+                "      --batch N           sectors per read (default: drive maximum)\n"
+                "      --c2                re-read sectors with C2 errors\n"
+                "      --continuous        read the whole disc without stopping\n"
                 "  -e, --eject             eject CD after ripping\n"
                 "  -f, --format FMT        output format (default: flac or vorbis)\n"
                 "  -h, --help              show this help page\n"
+                "  -l, --level N           flac compression level, 0-8 (default: 8)\n"
+                "      --offset N          drive read offset (default: detect)\n"
                 "  -p, --path PATH         format string for output (default %%k)\n"
+                "  -q, --quality N         mp3 vbr quality, 0-9 (default: cbr)\n"
+                "  -s, --secure            re-read until reads match\n"
+                "      --matches N         matching reads required (default: 2)\n"
+                "      --verify MODE       inline, deferred, or none (default: inline)\n"
                 "\n"
                 "Formats:\n",
                 rsvc_progname);
@@ -75,77 +138,181 @@ struct rsvc_command rsvc_rip = {
     },
 
     .run = ^(rsvc_done_t done){
-        if (opts.disk == NULL) {
-            rsvc_default_disk(^(rsvc_error_t error, char* disk){
+        if (opts.all && !opts.disks.head) {
+            find_discs(^(rsvc_error_t error){
                 if (error) {
                     done(error);
+                } else if (!opts.disks.head) {
+                    rsvc_errorf(done, __FILE__, __LINE__, "no discs available");
                 } else {
-                    opts.disk = strdup(disk);
                     rsvc_rip.run(done);
                 }
             });
             return;
-        }
-        if (!opts.path_format) {
-            opts.path_format = "%k";
-        }
-
-        if (!validate_encode_options(&opts.encode, done)) {
-            return;
-        }
-
-        rsvc_cd_t cd;
-        if (rsvc_cd_create(opts.disk, &cd, done)) {
-            rip_all(cd, ^(rsvc_error_t error){
-                rsvc_cd_destroy(cd);
+        } else if (!opts.disks.head) {
+            rsvc_default_disk(^(rsvc_error_t error, char* disk){
                 if (error) {
                     done(error);
-                } else if (opts.eject) {
-                    if (rsvc_disc_eject(opts.disk, done)) {
-                        done(NULL);
-                    }
                 } else {
-                    done(NULL);
+                    push_string(&opts.disks, disk);
+                    rsvc_rip.run(done);
                 }
             });
+            return;
         }
+        if (!validate_rip_options(done)) {
+            return;
+        }
+
+        // Each drive reads on its own queue; encoders for all of them
+        // share one pool, sized by --jobs.
+        rsvc_group_t group = rsvc_group_create(done);
+        for (string_list_node_t curr = opts.disks.head; curr; curr = curr->next) {
+            rip_disc(curr->value, opts.eject, rsvc_group_add(group));
+        }
+        rsvc_group_ready(group);
     },
 
     .short_option = ^bool (int32_t opt, rsvc_option_value_f get_value, rsvc_done_t fail){
         switch (opt) {
+          case 'a': return rsvc_boolean_option(&opts.all);
           case 'b': return bitrate_option(&opts.encode, get_value, fail);
           case 'f': return format_option(&opts.encode, get_value, fail);
+          case 'l': return level_option(&opts.encode, get_value, fail);
           case 'p': return path_option(&opts.path_format, get_value, fail);
+          case 'q': return quality_option(&opts.encode, get_value, fail);
           case 'e': return rsvc_boolean_option(&opts.eject);
+          case 's': return rsvc_boolean_option(&opts.secure);
+          case -1:  return rsvc_integer_option(&opts.batch, get_value, fail);
+          case -2:  return rsvc_boolean_option(&opts.c2);
+          case -3:  return rsvc_integer_option(&opts.matches, get_value, fail);
+          case -4:  return rsvc_string_option(&opts.accuraterip, get_value, fail);
+          case -5:
+            opts.has_offset = true;
+            return rsvc_integer_option(&opts.offset, get_value, fail);
+          case -6:  return rsvc_boolean_option(&opts.continuous);
+          case -7:  return verify_option(&opts.encode, get_value, fail);
           default:  return rsvc_illegal_short_option(opt, fail);
         }
     },
 
     .long_option = ^bool (char* opt, rsvc_option_value_f get_value, rsvc_done_t fail){
         return rsvc_long_option((struct rsvc_long_option_name[]){
+            {"accuraterip", -4},
+            {"all",      'a'},
             {"bitrate",  'b'},
+            {"batch",    -1},
+            {"c2",       -2},
+            {"continuous", -6},
             {"eject",    'e'},
             {"format",   'f'},
+            {"level",    'l'},
+            {"matches",  -3},
+            {"offset",   -5},
             {"path",     'p'},
+            {"quality",  'q'},
+            {"secure",   's'},
+            {"verify",   -7},
             {NULL}
         }, callbacks.short_option, opt, get_value, fail);
     },
 
     .argument = ^bool (char* arg, rsvc_done_t fail) {
-        if (!opts.disk) {
-            opts.disk = arg;
-            return true;
-        } else {
-            rsvc_errorf(fail, __FILE__, __LINE__, "too many arguments");
-            return false;
-        }
+        (void)fail;
+        push_string(&opts.disks, arg);
+        return true;
     },
 };
 
+static void push_string(struct string_list* list, const char* value) {
+    struct string_list_node tmp = {
+        .value = strdup(value),
+    };
+    RSVC_LIST_PUSH(list, memdup(&tmp, sizeof(tmp)));
+}
+
+// Adds every CD that is currently inserted to `opts.disks`.
+static void find_discs(rsvc_done_t done) {
+    struct rsvc_disc_watch_callbacks callbacks;
+    callbacks.appeared = ^(enum rsvc_disc_type type, const char* path){
+        if (type == RSVC_DISC_TYPE_CD) {
+            push_string(&opts.disks, path);
+        }
+    };
+    callbacks.disappeared = ^(enum rsvc_disc_type type, const char* path){
+        (void)type;
+        (void)path;
+    };
+    callbacks.initialized = ^(rsvc_stop_t stop){
+        stop();
+        done(NULL);
+    };
+    rsvc_disc_watch(callbacks);
+}
+
+bool validate_rip_options(rsvc_done_t fail) {
+    if (!opts.path_format) {
+        opts.path_format = "%k";
+    }
+
+    if (!validate_encode_options(&opts.encode, fail)) {
+        return false;
+    } else if (opts.batch < 0) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "invalid batch: %d", opts.batch);
+        return false;
+    } else if (opts.matches < 0) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "invalid matches: %d", opts.matches);
+        return false;
+    }
+
+    encoder_queue = dispatch_queue_create("net.sfiera.ripservice.encoders", NULL);
+    encoders.free = MAX(1, rsvc_jobs);
+    return true;
+}
+
+void rip_disc(const char* disk, bool eject, rsvc_done_t done) {
+    char* path = strdup(disk);
+    done = ^(rsvc_error_t error){
+        rsvc_prefix_error(path, error, ^(rsvc_error_t error){
+            free(path);
+            done(error);
+        });
+    };
+    rsvc_cd_t cd;
+    if (!rsvc_cd_create(path, &cd, done)) {
+        return;
+    }
+    rip_all(cd, ^(rsvc_error_t error){
+        rsvc_cd_destroy(cd);
+        if (error) {
+            done(error);
+        } else if (eject) {
+            if (rsvc_disc_eject(path, done)) {
+                done(NULL);
+            }
+        } else {
+            done(NULL);
+        }
+    });
+}
+
 static void rip_all(rsvc_cd_t cd, rsvc_done_t done) {
-    outf("Ripping…\n");
+    // Start fetching metadata now; it is first needed to name the
+    // first track's file, after the drive offset has been detected.
     rsvc_cd_session_t session = rsvc_cd_session(cd, 0);
     const size_t ntracks = rsvc_cd_session_ntracks(session);
+    rsvc_prefetch_musicbrainz(rsvc_cd_session_discid(session));
+
+    int offset = opts.offset;
+    if (!opts.has_offset) {
+        if (rsvc_cd_read_offset(cd, &offset)) {
+            outf("using drive read offset %+d\n", offset);
+        } else {
+            outf("unknown drive read offset; ripping without correction\n");
+        }
+    }
+
+    outf("Ripping…\n");
 
     rsvc_group_t group = rsvc_group_create(^(rsvc_error_t error){
         if (!error) {
@@ -154,11 +321,15 @@ static void rip_all(rsvc_cd_t cd, rsvc_done_t done) {
         done(error);
     });
 
-    rip_track(0, ntracks, group, cd, session);
+    if (opts.continuous) {
+        rip_continuous(group, cd, session, offset);
+    } else {
+        rip_track(0, ntracks, group, cd, session, offset);
+    }
 }
 
 static void rip_track(size_t n, size_t ntracks, rsvc_group_t group,
-                      rsvc_cd_t cd, rsvc_cd_session_t session) {
+                      rsvc_cd_t cd, rsvc_cd_session_t session, int offset) {
     if (n == ntracks) {
         rsvc_group_ready(group);
         return;
@@ -169,7 +340,7 @@ static void rip_track(size_t n, size_t ntracks, rsvc_group_t group,
     size_t track_number = rsvc_cd_track_number(track);
     if (rsvc_cd_track_type(track) == RSVC_CD_TRACK_DATA) {
         outf("skipping track %zu/%zu\n", track_number, ntracks);
-        rip_track(n + 1, ntracks, group, cd, session);
+        rip_track(n + 1, ntracks, group, cd, session, offset);
         return;
     }
 
@@ -180,7 +351,7 @@ static void rip_track(size_t n, size_t ntracks, rsvc_group_t group,
             rip_done(error);
         } else {
             rip_done(error);
-            rip_track(n + 1, ntracks, group, cd, session);
+            rip_track(n + 1, ntracks, group, cd, session, offset);
         }
     };
 
@@ -191,17 +362,8 @@ static void rip_track(size_t n, size_t ntracks, rsvc_group_t group,
         }
 
         char* path;
-        if (!rsvc_tags_strf(tags, opts.path_format, opts.encode.format->extension,
-                            &path, rip_done)) {
-            rsvc_tags_destroy(tags);
-            return;
-        }
-
-        char parent[MAXPATHLEN];
-        rsvc_dirname(path, parent);
         FILE* file;
-        if (!(rsvc_makedirs(parent, 0755, rip_done)
-              && rsvc_open(path, O_RDWR | O_CREAT | O_EXCL, 0644, &file, rip_done))) {
+        if (!open_track(tags, &path, &file, rip_done)) {
             rsvc_tags_destroy(tags);
             return;
         }
@@ -211,58 +373,341 @@ static void rip_track(size_t n, size_t ntracks, rsvc_group_t group,
         rsvc_done_t encode_done = rsvc_group_add(rip_group);
         rsvc_group_ready(rip_group);
 
-        FILE* read_pipe;
         FILE* write_pipe;
-        if (!rsvc_pipe(&read_pipe, &write_pipe, rip_done)) {
-            fclose(file);
-            free(path);
+        if (!start_encode(session, n, tags, path, file, &write_pipe, encode_done, decode_done)) {
+            encode_done(NULL);
             return;
         }
 
         // Rip the current track.  If that fails, bail.  If it succeeds,
         // start ripping the next track.
-        rsvc_cd_track_rip(track, write_pipe, &rsvc_sigint, ^(rsvc_error_t error){
+        struct rsvc_cd_rip_options rip_options = {
+            .batch = opts.batch,
+            .c2 = opts.c2,
+            .mode = opts.secure ? RSVC_CD_RIP_SECURE : RSVC_CD_RIP_FAST,
+            .matches = opts.matches,
+            .offset = offset,
+            .summary = ^(rsvc_cd_rip_summary_t summary){
+                print_summary(summary);
+            },
+        };
+        rsvc_cd_track_rip(track, write_pipe, &rip_options, &rsvc_sigint, ^(rsvc_error_t error){
             fclose(write_pipe);
             decode_done(error);
         });
+    });
+}
+
+// A track prepared for a continuous rip, before its audio arrives.
+struct track_output {
+    rsvc_tags_t  tags;
+    char*        path;
+    FILE*        file;
+    FILE*        write_pipe;
+    bool         started;
+};
+
+static void rip_continuous(rsvc_group_t group, rsvc_cd_t cd, rsvc_cd_session_t session,
+                           int offset) {
+    const size_t ntracks = rsvc_cd_session_ntracks(session);
+    struct track_output* outputs = calloc(ntracks, sizeof(struct track_output));
+    rsvc_done_t done = rsvc_group_add(group);
+    rsvc_group_ready(group);
+    done = ^(rsvc_error_t error){
+        for (size_t i = 0; i < ntracks; ++i) {
+            if (outputs[i].tags && !outputs[i].started) {
+                fclose(outputs[i].file);
+                free(outputs[i].path);
+                rsvc_tags_destroy(outputs[i].tags);
+            }
+        }
+        free(outputs);
+        done(error);
+    };
+
+    // Look up tags and open files for all tracks before the first read,
+    // so that the drive doesn't need to wait for them between tracks.
+    prepare_tracks(0, cd, session, outputs, ^(rsvc_error_t error){
+        if (error) {
+            done(error);
+            return;
+        }
+
+        rsvc_group_t rip_group = rsvc_group_create(done);
+        rsvc_done_t decode_done = rsvc_group_add(rip_group);
+        struct rsvc_cd_rip_options rip_options = {
+            .batch = opts.batch,
+            .c2 = opts.c2,
+            .mode = opts.secure ? RSVC_CD_RIP_SECURE : RSVC_CD_RIP_FAST,
+            .matches = opts.matches,
+            .offset = offset,
+            .summary = ^(rsvc_cd_rip_summary_t summary){
+                print_summary(summary);
+            },
+        };
+
+        // Encoders start as the audio for each track arrives, and run
+        // in parallel while the drive continues with the next tracks.
+        rsvc_cd_track_begin_f track_begin = ^bool (rsvc_cd_track_t track, FILE** file,
+                                                   rsvc_done_t fail){
+            size_t n = track_index(session, track);
+            struct track_output* out = &outputs[n];
+            rsvc_done_t encode_done = rsvc_group_add(rip_group);
+            out->started = true;
+            if (!start_encode(session, n, out->tags, out->path, out->file, &out->write_pipe,
+                              encode_done, fail)) {
+                encode_done(NULL);
+                return false;
+            }
+            *file = out->write_pipe;
+            return true;
+        };
+        rsvc_cd_track_end_f track_end = ^(rsvc_cd_track_t track){
+            fclose(outputs[track_index(session, track)].write_pipe);
+        };
+        rsvc_cd_session_rip(session, &rip_options, track_begin, track_end, &rsvc_sigint,
+                            decode_done);
+        rsvc_group_ready(rip_group);
+    });
+}
 
-        // Encode the current track.
-        rsvc_progress_t progress = rsvc_progress_start(path);
-        size_t nsamples = rsvc_cd_track_nsamples(track);
+static void prepare_tracks(size_t n, rsvc_cd_t cd, rsvc_cd_session_t session,
+                           struct track_output* outputs, rsvc_done_t done) {
+    const size_t ntracks = rsvc_cd_session_ntracks(session);
+    if (n == ntracks) {
+        done(NULL);
+        return;
+    }
+
+    rsvc_cd_track_t track = rsvc_cd_session_track(session, n);
+    if (rsvc_cd_track_type(track) == RSVC_CD_TRACK_DATA) {
+        outf("skipping track %zu/%zu\n", rsvc_cd_track_number(track), ntracks);
+        prepare_tracks(n + 1, cd, session, outputs, done);
+        return;
+    }
 
-        encode_done = ^(rsvc_error_t error){
-            fclose(file);
-            fclose(read_pipe);
+    get_tags(cd, session, track, ^(rsvc_error_t error, rsvc_tags_t tags){
+        if (error) {
+            done(error);
+            return;
+        }
+        struct track_output* out = &outputs[n];
+        if (!open_track(tags, &out->path, &out->file, done)) {
             rsvc_tags_destroy(tags);
-            if (error) {
-                rsvc_progress_done(progress, "fail");
+            return;
+        }
+        out->tags = tags;
+        prepare_tracks(n + 1, cd, session, outputs, done);
+    });
+}
+
+static size_t track_index(rsvc_cd_session_t session, rsvc_cd_track_t track) {
+    const size_t ntracks = rsvc_cd_session_ntracks(session);
+    for (size_t i = 0; i < ntracks; ++i) {
+        if (rsvc_cd_session_track(session, i) == track) {
+            return i;
+        }
+    }
+    return ntracks;
+}
+
+static void print_summary(rsvc_cd_rip_summary_t summary) {
+    size_t track_number = rsvc_cd_track_number(summary->track);
+    outf("track %zu: read %zu sectors at %.1fx\n",
+         track_number, summary->nsectors, summary->speed);
+    if (opts.secure) {
+        outf("track %zu: %.1f%% verified (%zu unverified sectors, %zu jitter fixes)\n",
+             track_number, summary->confidence * 100, summary->nunverified,
+             summary->njitter);
+    }
+    if (summary->nc2) {
+        outf("track %zu: %zu sectors with C2 errors, %zu still suspect\n",
+             track_number, summary->nc2, summary->nsuspect);
+    }
+}
+
+static bool open_track(rsvc_tags_t tags, char** path, FILE** file, rsvc_done_t fail) {
+    if (!rsvc_tags_strf(tags, opts.path_format, opts.encode.format->extension, path, fail)) {
+        return false;
+    }
+
+    char parent[MAXPATHLEN];
+    rsvc_dirname(*path, parent);
+    if (!(rsvc_makedirs(parent, 0755, fail)
+          && rsvc_open(*path, O_RDWR | O_CREAT | O_EXCL, 0644, file, fail))) {
+        free(*path);
+        return false;
+    }
+    return true;
+}
+
+// Starts checksumming and encoding track `n`, which will be read from
+// `*write_pipe`.  Takes ownership of `tags`, `path`, and `file`; calls
+// `done` once the track is encoded and tagged.  The caller must close
+// `*write_pipe` after writing the track's audio to it.
+static bool start_encode(rsvc_cd_session_t session, size_t n, rsvc_tags_t tags, char* path,
+                         FILE* file, FILE** write_pipe, rsvc_done_t done, rsvc_done_t fail) {
+    const size_t ntracks = rsvc_cd_session_ntracks(session);
+    rsvc_cd_track_t track = rsvc_cd_session_track(session, n);
+    size_t track_number = rsvc_cd_track_number(track);
+
+    // The CD writes to `write_pipe`; the checksum stage relays from
+    // `checksum_ring` to `encode_write_pipe`; the encoder reads from
+    // `read_pipe`.
+    rsvc_ring_t checksum_ring = rsvc_ring_create(kChecksumRingSize, 1);
+    FILE* read_pipe;
+    FILE* encode_write_pipe;
+    if (!rsvc_ring_open_write(checksum_ring, write_pipe, fail)) {
+        rsvc_ring_close_read(checksum_ring, 0);
+        rsvc_ring_close_write(checksum_ring);
+        rsvc_tags_destroy(tags);
+        fclose(file);
+        free(path);
+        return false;
+    } else if (!rsvc_ring_pipe(&read_pipe, &encode_write_pipe, fail)) {
+        rsvc_ring_close_read(checksum_ring, 0);
+        fclose(*write_pipe);
+        rsvc_tags_destroy(tags);
+        fclose(file);
+        free(path);
+        return false;
+    }
+
+    rsvc_group_t group = rsvc_group_create(done);
+    rsvc_done_t checksum_done = rsvc_group_add(group);
+    rsvc_done_t encode_done = rsvc_group_add(group);
+    rsvc_group_ready(group);
+
+    // Checksum the audio on its way to the encoder.  AccurateRip
+    // skips the edges of the disc, at the start of the first track
+    // and the end of the last.  The encoder's pipe is closed only
+    // after the lookup, so the results are ready when it finishes.
+    size_t nsamples = rsvc_cd_track_nsamples(track);
+    struct rsvc_accuraterip* ar = malloc(sizeof(struct rsvc_accuraterip));
+    rsvc_accuraterip_init(ar, nsamples,
+                          !has_audio_track(session, 0, n),
+                          !has_audio_track(session, n + 1, ntracks));
+    __block int confidence = -1;
+    checksum_done = ^(rsvc_error_t error){
+        rsvc_ring_close_read(checksum_ring, 0);
+        fclose(encode_write_pipe);
+        checksum_done(error);
+    };
+    rsvc_done_t checksum_finish = ^(rsvc_error_t error){
+        if (error) {
+            checksum_done(error);
+            return;
+        }
+        outf("track %zu: AccurateRip %08x/%08x, CRC32 %08x\n",
+             track_number, ar->v1, ar->v2, ar->crc32);
+        if (opts.accuraterip) {
+            const char* discid = rsvc_cd_session_discid(session);
+            if (!rsvc_accuraterip_lookup(opts.accuraterip, discid, track_number, ar,
+                                         &confidence, checksum_done)) {
+                return;
+            } else if (confidence > 0) {
+                outf("track %zu: accurately ripped (confidence %d)\n",
+                     track_number, confidence);
+            } else if (confidence == 0) {
+                outf("track %zu: does not match AccurateRip database\n", track_number);
             } else {
-                rsvc_progress_done(progress, "done");
+                outf("track %zu: not in AccurateRip database\n", track_number);
             }
-            free(path);
-            encode_done(error);
+        }
+        checksum_done(NULL);
+    };
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+        checksum_track(checksum_ring, encode_write_pipe, ar, checksum_finish);
+    });
+
+    // Encode the track.
+    rsvc_progress_t progress = rsvc_progress_start(path);
+
+    __block bool holding_encoder = true;
+    encode_done = ^(rsvc_error_t error){
+        if (holding_encoder) {
+            release_encoder();
+        }
+        fclose(file);
+        fclose(read_pipe);
+        rsvc_tags_destroy(tags);
+        free(ar);
+        if (error) {
+            rsvc_progress_done(progress, "fail");
+        } else {
+            rsvc_progress_done(progress, "done");
+        }
+        free(path);
+        encode_done(error);
+    };
+    acquire_encoder(^{
+        struct rsvc_encode_options encode_options = {
+            .bitrate = opts.encode.bitrate,
+            .vbr     = opts.encode.has_quality,
+            .quality = opts.encode.quality,
+            .level   = opts.encode.level,
+            .verify  = opts.encode.verify,
+            .info = {
+                .sample_rate          = 44100,
+                .channels             = 2,
+                .samples_per_channel  = nsamples,
+                .bits_per_sample      = 16,
+                .block_align          = 4,
+            },
+            .progress = ^(double fraction){
+                rsvc_progress_update(progress, fraction);
+            },
         };
-        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
-            struct rsvc_encode_options encode_options = {
-                .bitrate = opts.encode.bitrate,
-                .info = {
-                    .sample_rate          = 44100,
-                    .channels             = 2,
-                    .samples_per_channel  = nsamples,
-                    .bits_per_sample      = 16,
-                    .block_align          = 4,
-                },
-                .progress = ^(double fraction){
-                    rsvc_progress_update(progress, fraction);
-                },
-            };
-
-            if (!opts.encode.format->encode(read_pipe, file, &encode_options, encode_done)) {
+
+        // The encoder only sees EOF once the checksum stage is
+        // finished with the track, so the checksums are final here.
+        if (!(opts.encode.format->encode(read_pipe, file, &encode_options, encode_done)
+              && add_checksum_tags(tags, ar, confidence, encode_done))) {
+            return;
+        }
+        set_tags(file, path, tags, ^(rsvc_error_t error){
+            if (error || (opts.encode.verify != RSVC_VERIFY_DEFERRED)) {
+                encode_done(error);
                 return;
             }
-            set_tags(file, path, tags, encode_done);
+            // Let the next track start encoding while this one is
+            // checked.
+            holding_encoder = false;
+            release_encoder();
+            verify_later(opts.encode.format, path, encode_done);
         });
     });
+    return true;
+}
+
+// Runs `start` on a global queue once an encoder slot is free, or
+// queues it behind the tracks already waiting.  `start` must
+// eventually release the slot.
+static void acquire_encoder(dispatch_block_t start) {
+    dispatch_async(encoder_queue, ^{
+        if (encoders.free) {
+            --encoders.free;
+            dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), start);
+        } else {
+            struct pending_encode* pending = malloc(sizeof(struct pending_encode));
+            pending->start = Block_copy(start);
+            RSVC_LIST_PUSH(&encoders, pending);
+        }
+    });
+}
+
+// Hands the slot to the longest-waiting track, if any.
+static void release_encoder() {
+    dispatch_async(encoder_queue, ^{
+        if (encoders.head) {
+            dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
+                           encoders.head->start);
+            Block_release(encoders.head->start);
+            RSVC_LIST_ERASE(&encoders, encoders.head);
+        } else {
+            ++encoders.free;
+        }
+    });
 }
 
 static void get_tags(rsvc_cd_t cd, rsvc_cd_session_t session, rsvc_cd_track_t track,
@@ -299,6 +744,40 @@ static void get_tags(rsvc_cd_t cd, rsvc_cd_session_t session, rsvc_cd_track_t tr
     wrapped_done(NULL);
 }
 
+static bool has_audio_track(rsvc_cd_session_t session, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; ++i) {
+        if (rsvc_cd_track_type(rsvc_cd_session_track(session, i)) == RSVC_CD_TRACK_AUDIO) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Checksums the CD's output in place, as it sits in the ring, and
+// passes it on to the encoder.
+static void checksum_track(rsvc_ring_t in, FILE* out, struct rsvc_accuraterip* ar,
+                           rsvc_done_t done) {
+    const uint8_t* data;
+    size_t size;
+    while ((size = rsvc_ring_read_span(in, 0, &data))) {
+        rsvc_accuraterip_update(ar, data, size);
+        if (!rsvc_write("pipe", out, data, size, done)) {
+            return;
+        }
+        rsvc_ring_read_commit(in, 0, size);
+    }
+    done(NULL);
+}
+
+static bool add_checksum_tags(rsvc_tags_t tags, const struct rsvc_accuraterip* ar,
+                              int confidence, rsvc_done_t fail) {
+    return rsvc_tags_addf(tags, fail, RSVC_ACCURATERIPV1, "%08X", ar->v1)
+        && rsvc_tags_addf(tags, fail, RSVC_ACCURATERIPV2, "%08X", ar->v2)
+        && rsvc_tags_addf(tags, fail, RSVC_CRC32, "%08X", ar->crc32)
+        && ((confidence < 0)
+            || rsvc_tags_addf(tags, fail, RSVC_ACCURATERIPCONFIDENCE, "%d", confidence));
+}
+
 static void set_tags(FILE* file, char* path, rsvc_tags_t source, rsvc_done_t done) {
     rsvc_format_t format;
     rsvc_tags_t tags;
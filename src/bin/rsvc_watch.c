@@ -24,19 +24,36 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <rsvc/disc.h>
 #include "../rsvc/common.h"
 
+static struct watch_options {
+    bool rip;
+} opts;
+
+static void rip_appeared(const char* path);
+
 struct rsvc_command rsvc_watch = {
     .name = "watch",
 
     .usage = ^{
-        errf("usage: %s watch\n", rsvc_progname);
+        errf(
+                "usage: %s watch [OPTIONS]\n"
+                "\n"
+                "Options:\n"
+                "  -r, --rip               rip and eject each CD as it appears\n"
+                "\n"
+                "With --rip, also accepts the options of \"%s rip\".\n",
+                rsvc_progname, rsvc_progname);
     },
 
     .run = ^(rsvc_done_t done){
-        (void)done;  // run forever.
+        if (opts.rip && !validate_rip_options(done)) {
+            return;
+        }
         __block bool show = false;
 
         struct rsvc_disc_watch_callbacks callbacks;
@@ -44,6 +61,9 @@ struct rsvc_command rsvc_watch = {
             if (show) {
                 outf("+\t%s\t%s\n", path, rsvc_disc_type_name[type]);
             }
+            if (opts.rip && (type == RSVC_DISC_TYPE_CD)) {
+                rip_appeared(path);
+            }
         };
         callbacks.disappeared = ^(enum rsvc_disc_type type, const char* path){
             outf("-\t%s\t%s\n", path, rsvc_disc_type_name[type]);
@@ -55,4 +75,36 @@ struct rsvc_command rsvc_watch = {
 
         rsvc_disc_watch(callbacks);
     },
+
+    .short_option = ^bool (int32_t opt, rsvc_option_value_f get_value, rsvc_done_t fail){
+        switch (opt) {
+          case 'r': return rsvc_boolean_option(&opts.rip);
+          default:  return rsvc_rip.short_option(opt, get_value, fail);
+        }
+    },
+
+    .long_option = ^bool (char* opt, rsvc_option_value_f get_value, rsvc_done_t fail){
+        if (strcmp(opt, "rip") == 0) {
+            return rsvc_watch.short_option('r', get_value, fail);
+        }
+        return rsvc_rip.long_option(opt, get_value, fail);
+    },
 };
+
+// Rips a disc in the background and ejects it when done, so that the
+// next one can be inserted.  Errors are reported, but don't stop the
+// watch.  Encoders are shared between all drives and discs, so a drive
+// that is ripping faster than its audio can be encoded slows down
+// instead of piling up work.
+static void rip_appeared(const char* path) {
+    char* disk = strdup(path);
+    rip_disc(disk, true, ^(rsvc_error_t error){
+        if (error) {
+            errf("%s %s: %s (%s:%d)\n",
+                 rsvc_progname, rsvc_watch.name, error->message, error->file, error->lineno);
+        } else {
+            outf("ripped %s\n", disk);
+        }
+        free(disk);
+    });
+}
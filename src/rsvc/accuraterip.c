@@ -0,0 +1,212 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "accuraterip.h"
+
+#include <dispatch/dispatch.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "unix.h"
+
+enum {
+    // Five sectors of 588 stereo samples each.
+    kAccurateRipSkip = 5 * 588,
+};
+
+void rsvc_accuraterip_init(struct rsvc_accuraterip* ar, size_t nsamples,
+                           bool first_track, bool last_track) {
+    struct rsvc_accuraterip build_ar = {
+        .position    = 1,
+        .check_from  = first_track ? kAccurateRipSkip : 0,
+        .check_to    = nsamples,
+    };
+    if (last_track) {
+        build_ar.check_to = (nsamples > kAccurateRipSkip) ? (nsamples - kAccurateRipSkip) : 0;
+    }
+    *ar = build_ar;
+}
+
+// Adds `n` samples to the AccurateRip sums, multiplying each by its
+// position in the track, starting from `position`.  v1 keeps the low
+// word of each product; v2 adds the high word in too.
+static void accumulate(struct rsvc_accuraterip* ar, const uint8_t* data, size_t n,
+                       uint32_t position) {
+    size_t i = 0;
+#ifdef __SSE2__
+    // _mm_mul_epu32 multiplies the even lanes into 64-bit products; the
+    // odd lanes are shifted down and multiplied separately.  Summing the
+    // products as 32-bit lanes keeps low and high words apart.
+    __m128i sums = _mm_setzero_si128();
+    __m128i multipliers = _mm_set_epi32(position + 3, position + 2, position + 1, position);
+    const __m128i four = _mm_set1_epi32(4);
+    for ( ; (i + 4) <= n; i += 4) {
+        __m128i samples = _mm_loadu_si128((const __m128i*)(data + (4 * i)));
+        __m128i even = _mm_mul_epu32(samples, multipliers);
+        __m128i odd = _mm_mul_epu32(_mm_srli_epi64(samples, 32), _mm_srli_epi64(multipliers, 32));
+        sums = _mm_add_epi32(sums, _mm_add_epi32(even, odd));
+        multipliers = _mm_add_epi32(multipliers, four);
+    }
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, sums);
+    ar->v1 += lanes[0] + lanes[2];
+    ar->v2 += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    position += i;
+#endif
+    for ( ; i < n; ++i, ++position) {
+        uint32_t sample;
+        memcpy(&sample, data + (4 * i), 4);
+        uint64_t product = (uint64_t)sample * position;
+        ar->v1 += (uint32_t)product;
+        ar->v2 += (uint32_t)product + (uint32_t)(product >> 32);
+    }
+}
+
+static void add_samples(struct rsvc_accuraterip* ar, const uint8_t* data, size_t n) {
+    uint32_t position = ar->position;
+    size_t skip = 0;
+    if (position < ar->check_from) {
+        skip = ar->check_from - position;
+        if (skip > n) {
+            skip = n;
+        }
+    }
+    position += skip;
+    if (position <= ar->check_to) {
+        size_t count = n - skip;
+        if (count > (ar->check_to - position + 1)) {
+            count = ar->check_to - position + 1;
+        }
+        accumulate(ar, data + (4 * skip), count, position);
+    }
+    ar->position += n;
+}
+
+void rsvc_accuraterip_update(struct rsvc_accuraterip* ar, const void* data, size_t size) {
+    const uint8_t* bytes = data;
+    ar->crc32 = rsvc_crc32(ar->crc32, bytes, size);
+
+    if (ar->npartial) {
+        while ((ar->npartial < 4) && size) {
+            ar->partial[ar->npartial++] = *(bytes++);
+            --size;
+        }
+        if (ar->npartial < 4) {
+            return;
+        }
+        add_samples(ar, ar->partial, 1);
+        ar->npartial = 0;
+    }
+
+    add_samples(ar, bytes, size / 4);
+    bytes += size & ~(size_t)3;
+    size &= 3;
+    memcpy(ar->partial, bytes, size);
+    ar->npartial = size;
+}
+
+bool rsvc_accuraterip_lookup(const char* path, const char* discid, size_t track,
+                             const struct rsvc_accuraterip* ar, int* confidence,
+                             rsvc_done_t fail) {
+    FILE* file;
+    if (!rsvc_open(path, O_RDONLY, 0644, &file, fail)) {
+        return false;
+    }
+
+    *confidence = -1;
+    char* line = NULL;
+    size_t line_size = 0;
+    while (getline(&line, &line_size, file) > 0) {
+        char line_discid[64];
+        size_t line_track;
+        unsigned int crc;
+        int count;
+        if ((line[0] == '#')
+            || (sscanf(line, "%63s %zu %x %d", line_discid, &line_track, &crc, &count) != 4)
+            || (strcmp(line_discid, discid) != 0)
+            || (line_track != track)) {
+            continue;
+        }
+        if ((crc == ar->v1) || (crc == ar->v2)) {
+            *confidence = count;
+            break;
+        }
+        *confidence = 0;
+    }
+    free(line);
+
+    if (ferror(file)) {
+        rsvc_strerrorf(fail, __FILE__, __LINE__, "%s", path);
+        fclose(file);
+        return false;
+    }
+    fclose(file);
+    return true;
+}
+
+static uint32_t crc32_table[8][256];
+
+static void crc32_init() {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int j = 0; j < 8; ++j) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+        }
+        crc32_table[0][i] = crc;
+    }
+    for (int k = 1; k < 8; ++k) {
+        for (int i = 0; i < 256; ++i) {
+            uint32_t prev = crc32_table[k - 1][i];
+            crc32_table[k][i] = (prev >> 8) ^ crc32_table[0][prev & 0xff];
+        }
+    }
+}
+
+// Slicing-by-8: folds in eight bytes per step, with one table lookup
+// per byte, instead of stepping through the polynomial bit by bit.
+uint32_t rsvc_crc32(uint32_t crc, const void* data, size_t size) {
+    static dispatch_once_t init;
+    dispatch_once(&init, ^{
+        crc32_init();
+    });
+
+    const uint8_t* bytes = data;
+    crc = ~crc;
+    for ( ; size >= 8; bytes += 8, size -= 8) {
+        uint32_t lo, hi;
+        memcpy(&lo, bytes, 4);
+        memcpy(&hi, bytes + 4, 4);
+        lo ^= crc;
+        crc = crc32_table[7][lo & 0xff] ^ crc32_table[6][(lo >> 8) & 0xff]
+            ^ crc32_table[5][(lo >> 16) & 0xff] ^ crc32_table[4][lo >> 24]
+            ^ crc32_table[3][hi & 0xff] ^ crc32_table[2][(hi >> 8) & 0xff]
+            ^ crc32_table[1][(hi >> 16) & 0xff] ^ crc32_table[0][hi >> 24];
+    }
+    for ( ; size; ++bytes, --size) {
+        crc = crc32_table[0][(crc ^ *bytes) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
@@ -0,0 +1,60 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#ifndef SRC_RSVC_ACCURATERIP_H_
+#define SRC_RSVC_ACCURATERIP_H_
+
+#include <rsvc/common.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Running checksums of a track's 16-bit stereo PCM: the AccurateRip v1
+// and v2 CRCs, and the CRC32 of the whole track.  The AccurateRip CRCs
+// skip the first five sectors of the first track on a disc and the last
+// five sectors of the last, which drives typically can't read.
+struct rsvc_accuraterip {
+    uint32_t  v1;
+    uint32_t  v2;
+    uint32_t  crc32;
+
+    uint32_t  position;
+    uint32_t  check_from;
+    uint32_t  check_to;
+    uint8_t   partial[4];
+    size_t    npartial;
+};
+
+void      rsvc_accuraterip_init(struct rsvc_accuraterip* ar, size_t nsamples,
+                                bool first_track, bool last_track);
+void      rsvc_accuraterip_update(struct rsvc_accuraterip* ar, const void* data, size_t size);
+
+// Looks up the track in a local database file.  Each line of the file
+// has a MusicBrainz disc ID, a track number, a hexadecimal AccurateRip
+// CRC (v1 or v2), and the number of rips that agreed on that CRC.  Sets
+// `*confidence` to the count for the line matching `ar`; to 0 if the
+// track is listed but no CRC matches; or to -1 if it is not listed.
+bool      rsvc_accuraterip_lookup(const char* path, const char* discid, size_t track,
+                                  const struct rsvc_accuraterip* ar, int* confidence,
+                                  rsvc_done_t fail);
+
+uint32_t  rsvc_crc32(uint32_t crc, const void* data, size_t size);
+
+#endif  // SRC_RSVC_ACCURATERIP_H_
@@ -0,0 +1,151 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "accuraterip.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "test.h"
+
+static void expect_crc(const char* file, int line, const char* expr, uint32_t expected,
+                       uint32_t actual) {
+    if (expected != actual) {
+        test_failf(file, line, "%s: expected %08x, got %08x", expr, expected, actual);
+    }
+}
+
+#define EXPECT_CRC(EXPECTED, ACTUAL) \
+    expect_crc(__FILE__, __LINE__, #ACTUAL, (EXPECTED), (ACTUAL))
+
+// The checksums as AccurateRip defines them, one sample at a time.
+static void reference(const uint8_t* data, size_t nsamples, bool first_track, bool last_track,
+                      uint32_t* v1, uint32_t* v2) {
+    const size_t skip = 5 * 588;
+    *v1 = *v2 = 0;
+    for (size_t i = 0; i < nsamples; ++i) {
+        if ((first_track && (i < skip - 1)) || (last_track && (i >= nsamples - skip))) {
+            continue;
+        }
+        uint32_t sample = data[4 * i] | (data[4 * i + 1] << 8) | (data[4 * i + 2] << 16)
+                          | ((uint32_t)data[4 * i + 3] << 24);
+        uint64_t product = (uint64_t)sample * (i + 1);
+        *v1 += (uint32_t)product;
+        *v2 += (uint32_t)product + (uint32_t)(product >> 32);
+    }
+}
+
+static void test_crc32() {
+    EXPECT_CRC(0x00000000, rsvc_crc32(0, "", 0));
+    EXPECT_CRC(0xcbf43926, rsvc_crc32(0, "123456789", 9));
+    EXPECT_CRC(0x414fa339, rsvc_crc32(0, "The quick brown fox jumps over the lazy dog", 43));
+    EXPECT_CRC(0xcbf43926, rsvc_crc32(rsvc_crc32(0, "1234", 4), "56789", 5));
+}
+
+static void test_known() {
+    // Three full-scale samples: each product is (p << 32) - p.
+    const uint8_t data[12] = {
+        0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    };
+    struct rsvc_accuraterip ar;
+    rsvc_accuraterip_init(&ar, 3, false, false);
+    rsvc_accuraterip_update(&ar, data, sizeof(data));
+    EXPECT_CRC(0xfffffffa, ar.v1);
+    EXPECT_CRC(0xfffffffd, ar.v2);
+    EXPECT_CRC(rsvc_crc32(0, data, sizeof(data)), ar.crc32);
+}
+
+static void test_random(size_t nsamples, bool first_track, bool last_track) {
+    uint8_t* data = malloc(4 * nsamples);
+    uint32_t seed = 0x12345678;
+    for (size_t i = 0; i < 4 * nsamples; ++i) {
+        seed = (seed * 1103515245) + 12345;
+        data[i] = seed >> 24;
+    }
+    uint32_t v1, v2;
+    reference(data, nsamples, first_track, last_track, &v1, &v2);
+    const uint32_t crc32 = rsvc_crc32(0, data, 4 * nsamples);
+
+    // All at once, then in pieces that split samples, as reads of a
+    // pipe do.
+    const size_t pieces[] = {4 * nsamples, 1, 3, 4, 5, 2352, 4095};
+    for (size_t i = 0; i < sizeof(pieces) / sizeof(pieces[0]); ++i) {
+        struct rsvc_accuraterip ar;
+        rsvc_accuraterip_init(&ar, nsamples, first_track, last_track);
+        for (size_t at = 0; at < 4 * nsamples; at += pieces[i]) {
+            size_t size = 4 * nsamples - at;
+            rsvc_accuraterip_update(&ar, data + at, (size < pieces[i]) ? size : pieces[i]);
+        }
+        EXPECT_CRC(v1, ar.v1);
+        EXPECT_CRC(v2, ar.v2);
+        EXPECT_CRC(crc32, ar.crc32);
+    }
+    free(data);
+}
+
+static void test_lookup() {
+    char path[] = "/tmp/accuraterip.test.XXXXXX";
+    int fd = mkstemp(path);
+    FILE* file = fdopen(fd, "w");
+    fprintf(file, "# discid track crc count\n");
+    fprintf(file, "disc-a 1 0000000a 3\n");
+    fprintf(file, "disc-a 2 0000000b 5\n");
+    fprintf(file, "disc-a 2 000000bb 7\n");
+    fprintf(file, "disc-b 1 0000000c 9\n");
+    fclose(file);
+
+    rsvc_done_t fail = ^(rsvc_error_t error){
+        TEST_FAILF("%s", error->message);
+    };
+    struct rsvc_accuraterip ar = {.v1 = 0xbb, .v2 = 0xaa};
+    int confidence;
+    if (rsvc_accuraterip_lookup(path, "disc-a", 2, &ar, &confidence, fail)) {
+        EXPECT_EQ(7, confidence);  // the v1 CRC, on the second line
+    }
+    ar.v1 = 0x99;
+    ar.v2 = 0x0a;
+    if (rsvc_accuraterip_lookup(path, "disc-a", 1, &ar, &confidence, fail)) {
+        EXPECT_EQ(3, confidence);  // the v2 CRC
+    }
+    if (rsvc_accuraterip_lookup(path, "disc-b", 1, &ar, &confidence, fail)) {
+        EXPECT_EQ(0, confidence);  // listed, but no match
+    }
+    if (rsvc_accuraterip_lookup(path, "disc-b", 2, &ar, &confidence, fail)) {
+        EXPECT_EQ(-1, confidence);  // not listed
+    }
+    unlink(path);
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    test_crc32();
+    test_known();
+    test_random(1, false, false);
+    test_random(10000, false, false);
+    test_random(10000, true, false);
+    test_random(10000, false, true);
+    test_random(10000, true, true);
+    test_random(5000, true, true);  // the skipped ends overlap
+    test_lookup();
+    return test_result();
+}
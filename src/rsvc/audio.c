@@ -40,17 +40,25 @@ static bool valid_bit_depth(size_t depth) {
         || (depth == 1);
 }
 
-static bool valid_block_align(size_t block_align, size_t channels, size_t bit_depth) {
-    // TODO(sfiera): allow packing for bit_depth < 8
-    if (bit_depth <= 8) {
-        return block_align == (channels * sizeof(int8_t));
-    } else if (bit_depth == 16) {
-        return block_align == (channels * sizeof(int16_t));
-    } else if (bit_depth <= 32) {
-        return block_align == (channels * sizeof(int32_t));
-    } else {
-        return false;
+// Decoded samples are int16_t only at 16 bits; a decoder with fewer
+// bits widens them, and one with more uses RSVC_SAMPLE_S32.
+static bool valid_sample_format(enum rsvc_sample_format format, size_t depth) {
+    switch (format) {
+      case RSVC_SAMPLE_S16: return depth == 16;
+      case RSVC_SAMPLE_S32: return (16 < depth) && (depth <= 32);
+      case RSVC_SAMPLE_F32: return depth == 32;
     }
+    return false;
+}
+
+static bool valid_block_align(size_t block_align, size_t channels,
+                              enum rsvc_sample_format format) {
+    switch (format) {
+      case RSVC_SAMPLE_S16: return block_align == (channels * sizeof(int16_t));
+      case RSVC_SAMPLE_S32: return block_align == (channels * sizeof(int32_t));
+      case RSVC_SAMPLE_F32: return block_align == (channels * sizeof(float));
+    }
+    return false;
 }
 
 bool rsvc_audio_info_validate(rsvc_audio_info_t info, rsvc_done_t fail) {
@@ -63,7 +71,11 @@ bool rsvc_audio_info_validate(rsvc_audio_info_t info, rsvc_done_t fail) {
     } else if (!valid_bit_depth(info->bits_per_sample)) {
         rsvc_errorf(fail, __FILE__, __LINE__, "invalid bit depth: %zu", info->bits_per_sample);
         return false;
-    } else if (!valid_block_align(info->block_align, info->channels, info->bits_per_sample)) {
+    } else if (!valid_sample_format(info->sample_format, info->bits_per_sample)) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "invalid sample format for %zu-bit audio",
+                    info->bits_per_sample);
+        return false;
+    } else if (!valid_block_align(info->block_align, info->channels, info->sample_format)) {
         rsvc_errorf(  fail, __FILE__, __LINE__,
                       "invalid %zu-bit block align: %zu",
                       info->bits_per_sample, info->block_align);
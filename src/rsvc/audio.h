@@ -43,6 +43,7 @@ bool                    rsvc_id3_skip_tags(FILE* file, rsvc_done_t fail);
 bool                    rsvc_lame_encode(  FILE* src_file, FILE* dst_file,
                                            rsvc_encode_options_t options, rsvc_done_t fail);
 bool                    rsvc_mad_decode(FILE* src_file, FILE* dst_file,
+                                        rsvc_decode_options_t options,
                                         rsvc_decode_info_f info, rsvc_done_t fail);
 bool                    rsvc_mad_audio_info(FILE* file, rsvc_audio_info_t info, rsvc_done_t fail);
 
@@ -29,8 +29,10 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "cd_offset.h"
 #include "common.h"
 #include "unix.h"
 
@@ -222,6 +224,14 @@ const char* rsvc_cd_mcn(rsvc_cd_t cd) {
     return cd->mcn;
 }
 
+bool rsvc_cd_read_offset(rsvc_cd_t cd, int* offset) {
+    // The BSD client doesn't expose INQUIRY data, so drives can't be
+    // identified here.
+    (void)cd;
+    (void)offset;
+    return false;
+}
+
 size_t rsvc_cd_nsessions(rsvc_cd_t cd) {
     return cd->nsessions;
 }
@@ -287,61 +297,156 @@ void rsvc_cd_track_isrc(rsvc_cd_track_t track, void (^done)(const char* isrc)) {
     });
 }
 
-static void read_range(
-        rsvc_cd_track_t track, FILE* file, bool* stopped,
-        size_t begin, size_t end, rsvc_done_t done) {
-    if (*stopped) {
-        rsvc_errorf(done, __FILE__, __LINE__, "cancelled");
-        return;
-    }
+enum {
+    // Largest number of sectors requested from the drive in a single read.
+    kMaxReadBatch = 75,
 
-    uint8_t buffer[kCDSectorSizeCDDA];
-    dk_cd_read_t cd_read;
+    // After this many successful reads in a row, a batch that was shrunk
+    // after an error is allowed to grow again.
+    kGrowReadBatch = 8,
+};
 
-    memset(&cd_read, 0, sizeof(dk_cd_read_t));
-    memset(buffer, 0, kCDSectorSizeCDDA);
+struct rip {
+    rsvc_cd_track_t             track;
+    FILE*                       file;
+    bool                        stopped;
+
+    size_t                      sector;
+    size_t                      sector_end;
+    size_t                      batch;
+    size_t                      max_batch;
+    size_t                      nsuccesses;
+    uint8_t*                    buffer;
+    struct rsvc_cd_shift        shift;
+
+    struct timespec             start;
+    struct rsvc_cd_rip_summary  summary;
+};
 
-    cd_read.offset          = begin;
-    cd_read.sectorArea      = kCDSectorAreaUser;
-    cd_read.sectorType      = kCDSectorTypeCDDA;
-    cd_read.buffer          = buffer;
-    cd_read.bufferLength    = sizeof(buffer);
-    if ((end - begin) < cd_read.bufferLength) {
-        cd_read.bufferLength = (end - begin);
-    }
+static double elapsed_seconds(const struct timespec* since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) + ((now.tv_nsec - since->tv_nsec) / 1e9);
+}
 
-    if (ioctl(fileno(track->cd->file), DKIOCCDREAD, &cd_read) < 0) {
-        rsvc_strerrorf(done, __FILE__, __LINE__, "%s", track->cd->path);
+static void read_batch(struct rip* rip, rsvc_done_t done) {
+    rsvc_cd_t cd = rip->track->cd;
+    rsvc_cd_write_f write = ^bool (const unsigned char* data, size_t size, rsvc_done_t fail){
+        return rsvc_write("pipe", rip->file, data, size, fail);
+    };
+    if (rip->sector == rip->sector_end) {
+        double seconds = elapsed_seconds(&rip->start);
+        if (seconds > 0) {
+            rip->summary.speed = rip->summary.nsectors / (75 * seconds);
+        }
+        if (!rsvc_cd_shift_end(&rip->shift, write, done)) {
+            return;
+        }
+        done(NULL);
         return;
-    }
-
-    // TODO(sfiera): swap on big-endian, I guess.
-    if (!rsvc_write("pipe", file, buffer, cd_read.bufferLength, done)) {
+    } else if (rip->stopped) {
+        rsvc_errorf(done, __FILE__, __LINE__, "cancelled");
         return;
     }
 
-    begin += cd_read.bufferLength;
-    if (begin < end) {
-        dispatch_async(track->cd->queue, ^{
-            read_range(track, file, stopped, begin, end, done);
-        });
+    size_t nsectors = rip->sector_end - rip->sector;
+    if (nsectors > rip->batch) {
+        nsectors = rip->batch;
+    }
+    dk_cd_read_t cd_read;
+    memset(&cd_read, 0, sizeof(dk_cd_read_t));
+    cd_read.offset          = rip->sector * kCDSectorSizeCDDA;
+    cd_read.sectorArea      = kCDSectorAreaUser;
+    cd_read.sectorType      = kCDSectorTypeCDDA;
+    cd_read.buffer          = rip->buffer;
+    cd_read.bufferLength    = nsectors * kCDSectorSizeCDDA;
+
+    ++rip->summary.nreads;
+    if (ioctl(fileno(cd->file), DKIOCCDREAD, &cd_read) < 0) {
+        if (rip->batch == 1) {
+            rsvc_strerrorf(done, __FILE__, __LINE__, "%s", cd->path);
+            return;
+        }
+        rip->batch /= 2;
+        rip->nsuccesses = 0;
+        ++rip->summary.nretries;
     } else {
-        done(NULL);
+        // TODO(sfiera): swap on big-endian, I guess.
+        if (!rsvc_cd_shift_write(&rip->shift, rip->buffer, cd_read.bufferLength, write, done)) {
+            return;
+        }
+        rip->sector += nsectors;
+        rip->summary.nsectors += nsectors;
+        if ((rip->batch < rip->max_batch) && (++rip->nsuccesses == kGrowReadBatch)) {
+            rip->batch *= 2;
+            if (rip->batch > rip->max_batch) {
+                rip->batch = rip->max_batch;
+            }
+            rip->nsuccesses = 0;
+        }
     }
+
+    dispatch_async(cd->queue, ^{
+        read_batch(rip, done);
+    });
 }
 
-void rsvc_cd_track_rip(rsvc_cd_track_t track, FILE* file, rsvc_cancel_t cancel, rsvc_done_t done) {
+void rsvc_cd_track_rip(rsvc_cd_track_t track, FILE* file, rsvc_cd_rip_options_t options,
+                       rsvc_cancel_t cancel, rsvc_done_t done) {
     // Ensure that the done callback does not run in cd->queue.
     done = ^(rsvc_error_t error){
         rsvc_error_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0),
                          error, done);
     };
 
-    __block bool stopped = false;
+    if (options && (options->mode != RSVC_CD_RIP_FAST)) {
+        rsvc_errorf(done, __FILE__, __LINE__, "secure ripping not supported");
+        return;
+    }
+
+    size_t batch = kMaxReadBatch;
+    if (options && options->batch && (options->batch < batch)) {
+        batch = options->batch;
+    }
+    rsvc_cd_rip_summary_f summary = options ? options->summary : NULL;
+
+    struct rip build_rip = {
+        .track       = track,
+        .file        = file,
+        .stopped     = false,
+        .batch       = batch,
+        .max_batch   = batch,
+        .buffer      = malloc(batch * kCDSectorSizeCDDA),
+        .summary     = {
+            .track  = track,
+        },
+    };
+    rsvc_cd_shift_init(&build_rip.shift, track->sector_begin, track->sector_end,
+                       track->session->lead_out, options ? options->offset : 0);
+    build_rip.sector = build_rip.shift.sector_begin;
+    build_rip.sector_end = build_rip.shift.sector_end;
+    struct rip* rip = memdup(&build_rip, sizeof build_rip);
+
+    // A cancel can land after the rip has finished and freed `rip`.
+    // Both run on the CD's queue, so the cancel handler checks this
+    // first; it lives as long as the blocks that refer to it.
+    __block struct rip* active = rip;
+    done = ^(rsvc_error_t error){
+        active = NULL;
+        if (!error && summary) {
+            summary(&rip->summary);
+        }
+        free(rip->buffer);
+        free(rip);
+        done(error);
+    };
+
     if (cancel) {
         rsvc_cancel_handle_t handle = rsvc_cancel_add(cancel, ^{
             dispatch_async(track->cd->queue, ^{
-                stopped = true;
+                if (active) {
+                    active->stopped = true;
+                }
             });
         });
         done = ^(rsvc_error_t error){
@@ -354,8 +459,48 @@ void rsvc_cd_track_rip(rsvc_cd_track_t track, FILE* file, rsvc_cancel_t cancel,
         uint16_t speed = kCDSpeedMax;
         ioctl(fileno(track->cd->file), DKIOCCDSETSPEED, &speed);
 
-        size_t begin = track->sector_begin * kCDSectorSizeCDDA;
-        size_t end = track->sector_end * kCDSectorSizeCDDA;
-        read_range(track, file, &stopped, begin, end, done);
+        if (!rsvc_cd_shift_begin(&rip->shift, ^bool (const unsigned char* data, size_t size,
+                                                     rsvc_done_t fail){
+            return rsvc_write("pipe", rip->file, data, size, fail);
+        }, done)) {
+            return;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &rip->start);
+        read_batch(rip, done);
     });
 }
+
+// Rips the session's audio tracks from `track` onwards.  Reads here are
+// issued per track, so each track is ripped with its own series of
+// reads, one after another.
+static void rip_session_from(rsvc_cd_session_t session, rsvc_cd_track_t track,
+                             rsvc_cd_rip_options_t options, rsvc_cd_track_begin_f track_begin,
+                             rsvc_cd_track_end_f track_end, rsvc_cancel_t cancel,
+                             rsvc_done_t done) {
+    while ((track != session->track_end) && (track->type != RSVC_CD_TRACK_AUDIO)) {
+        ++track;
+    }
+    if (track == session->track_end) {
+        done(NULL);
+        return;
+    }
+    FILE* file;
+    if (!track_begin(track, &file, done)) {
+        return;
+    }
+    rsvc_cd_track_rip(track, file, options, cancel, ^(rsvc_error_t error){
+        track_end(track);
+        if (error) {
+            done(error);
+            return;
+        }
+        rip_session_from(session, track + 1, options, track_begin, track_end, cancel, done);
+    });
+}
+
+void rsvc_cd_session_rip(rsvc_cd_session_t session, rsvc_cd_rip_options_t options,
+                         rsvc_cd_track_begin_f track_begin, rsvc_cd_track_end_f track_end,
+                         rsvc_cancel_t cancel, rsvc_done_t done) {
+    rip_session_from(session, session->track_begin, options, track_begin, track_end,
+                     cancel, done);
+}
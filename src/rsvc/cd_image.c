@@ -0,0 +1,536 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "cd_image.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/param.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "unix.h"
+
+enum {
+    kSectorSize = 2352,
+    kC2Size = kSectorSize / 8,
+    kSectorsPerSecond = 75,
+
+    // Bytes at the start of a sector garbled by a simulated C2 error.
+    kDamageSize = 64,
+
+    kSenseMediumError = 0x03,
+    kSenseIllegalRequest = 0x05,
+};
+
+// A file holding the audio of consecutive sectors, from `sector_begin`.
+struct image_file {
+    int     fd;
+    off_t   data_offset;
+    size_t  size;
+    size_t  sector_begin;
+};
+
+// A sector that fails to read, or reads back damaged, the next
+// `remaining` times it is read.
+struct fault {
+    size_t  sector;
+    size_t  remaining;
+    bool    c2;
+};
+
+struct rsvc_cd_image {
+    char                         mcn[14];
+    size_t                       nsectors;
+
+    size_t                       nfiles;
+    struct image_file*           files;
+    size_t                       ntracks;
+    struct rsvc_cd_image_track*  tracks;
+    size_t                       nfaults;
+    struct fault*                faults;
+
+    long                         latency_usec;
+    double                       speed;
+    int                          jitter;
+    bool                         no_c2;
+    uint32_t                     random;
+};
+
+static bool has_extension(const char* path, const char* extension) {
+    size_t path_size = strlen(path);
+    size_t extension_size = strlen(extension);
+    return (path_size > extension_size)
+        && (strcasecmp(path + path_size - extension_size, extension) == 0);
+}
+
+bool rsvc_cd_image_path(const char* path) {
+    return has_extension(path, ".cue") || has_extension(path, ".wav");
+}
+
+static uint32_t read_le32(const unsigned char* data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static uint16_t read_le16(const unsigned char* data) {
+    return data[0] | (data[1] << 8);
+}
+
+// Finds the PCM data in a WAV file, which must hold 16-bit stereo audio
+// at 44.1 kHz, like a CD.
+static bool find_wav_data(const char* path, int fd, off_t* offset, size_t* size,
+                          rsvc_done_t fail) {
+    unsigned char header[12];
+    if ((pread(fd, header, sizeof(header), 0) != sizeof(header))
+        || (memcmp(header, "RIFF", 4) != 0)
+        || (memcmp(header + 8, "WAVE", 4) != 0)) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "%s: not a WAV file", path);
+        return false;
+    }
+
+    bool have_format = false;
+    off_t position = sizeof(header);
+    unsigned char chunk[24];
+    while (pread(fd, chunk, 8, position) == 8) {
+        uint32_t chunk_size = read_le32(chunk + 4);
+        if (memcmp(chunk, "fmt ", 4) == 0) {
+            if ((chunk_size < 16) || (pread(fd, chunk + 8, 16, position + 8) != 16)) {
+                break;
+            }
+            uint16_t format = read_le16(chunk + 8);
+            if (((format != 1) && (format != 0xfffe))
+                || (read_le16(chunk + 10) != 2)
+                || (read_le32(chunk + 12) != 44100)
+                || (read_le16(chunk + 22) != 16)) {
+                rsvc_errorf(fail, __FILE__, __LINE__,
+                            "%s: not 16-bit stereo audio at 44.1 kHz", path);
+                return false;
+            }
+            have_format = true;
+        } else if (memcmp(chunk, "data", 4) == 0) {
+            if (!have_format) {
+                break;
+            }
+            *offset = position + 8;
+            *size = chunk_size;
+            return true;
+        }
+        position += 8 + chunk_size + (chunk_size & 1);
+    }
+    rsvc_errorf(fail, __FILE__, __LINE__, "%s: malformed WAV file", path);
+    return false;
+}
+
+// Adds a data file to the image, following the files already added.
+static bool add_file(rsvc_cd_image_t image, const char* path, bool wave, rsvc_done_t fail) {
+    FILE* file;
+    if (!rsvc_open(path, O_RDONLY, 0644, &file, fail)) {
+        return false;
+    }
+    int fd = dup(fileno(file));
+    fclose(file);
+    if (fd < 0) {
+        rsvc_strerrorf(fail, __FILE__, __LINE__, "%s", path);
+        return false;
+    }
+
+    struct image_file build_file = {
+        .fd            = fd,
+        .sector_begin  = image->nsectors,
+    };
+    if (wave) {
+        if (!find_wav_data(path, fd, &build_file.data_offset, &build_file.size, fail)) {
+            close(fd);
+            return false;
+        }
+    } else {
+        off_t end = lseek(fd, 0, SEEK_END);
+        if (end < 0) {
+            rsvc_strerrorf(fail, __FILE__, __LINE__, "%s", path);
+            close(fd);
+            return false;
+        }
+        build_file.size = end;
+    }
+
+    image->files = realloc(image->files, (image->nfiles + 1) * sizeof(struct image_file));
+    image->files[image->nfiles++] = build_file;
+    image->nsectors += (build_file.size + kSectorSize - 1) / kSectorSize;
+    return true;
+}
+
+static struct rsvc_cd_image_track* add_track(rsvc_cd_image_t image, size_t number, bool audio) {
+    image->tracks = realloc(image->tracks,
+                            (image->ntracks + 1) * sizeof(struct rsvc_cd_image_track));
+    struct rsvc_cd_image_track build_track = {
+        .number        = number,
+        .audio         = audio,
+        .sector_begin  = SIZE_MAX,
+    };
+    image->tracks[image->ntracks] = build_track;
+    return &image->tracks[image->ntracks++];
+}
+
+static void add_fault(rsvc_cd_image_t image, size_t sector, size_t count, bool c2) {
+    image->faults = realloc(image->faults, (image->nfaults + 1) * sizeof(struct fault));
+    struct fault build_fault = {
+        .sector     = sector,
+        .remaining  = count ? count : SIZE_MAX,
+        .c2         = c2,
+    };
+    image->faults[image->nfaults++] = build_fault;
+}
+
+// Reads the next word of `*line`, which may be quoted, into `word`.
+static bool next_word(char** line, char* word, size_t size) {
+    char* p = *line + strspn(*line, " \t");
+    char* end;
+    if (*p == '"') {
+        ++p;
+        end = strchr(p, '"');
+        if (!end) {
+            return false;
+        }
+    } else {
+        end = p + strcspn(p, " \t");
+    }
+    if ((end == p) || ((size_t)(end - p) >= size)) {
+        return false;
+    }
+    memcpy(word, p, end - p);
+    word[end - p] = '\0';
+    *line = (*end == '"') ? (end + 1) : end;
+    return true;
+}
+
+static bool parse_simulation(rsvc_cd_image_t image, char* line) {
+    char setting[16];
+    char value[32];
+    char count[32] = "0";
+    if (!next_word(&line, setting, sizeof(setting))) {
+        return false;
+    } else if (strcasecmp(setting, "NOC2") == 0) {
+        image->no_c2 = true;
+        return true;
+    } else if (!next_word(&line, value, sizeof(value))) {
+        return false;
+    }
+    (void)next_word(&line, count, sizeof(count));
+
+    if (strcasecmp(setting, "LATENCY") == 0) {
+        image->latency_usec = strtol(value, NULL, 10);
+    } else if (strcasecmp(setting, "SPEED") == 0) {
+        image->speed = strtod(value, NULL);
+    } else if (strcasecmp(setting, "JITTER") == 0) {
+        image->jitter = strtol(value, NULL, 10);
+    } else if (strcasecmp(setting, "ERROR") == 0) {
+        add_fault(image, strtoul(value, NULL, 10), strtoul(count, NULL, 10), false);
+    } else if (strcasecmp(setting, "C2") == 0) {
+        add_fault(image, strtoul(value, NULL, 10), strtoul(count, NULL, 10), true);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool parse_cue_line(rsvc_cd_image_t image, const char* dir, char* line,
+                           size_t* file_begin, rsvc_done_t fail) {
+    char keyword[16];
+    char word[MAXPATHLEN];
+    if (!next_word(&line, keyword, sizeof(keyword))) {
+        return true;  // Blank line.
+    }
+    struct rsvc_cd_image_track* track = image->ntracks ? &image->tracks[image->ntracks - 1]
+                                                       : NULL;
+
+    if (strcasecmp(keyword, "FILE") == 0) {
+        char type[16];
+        char path[MAXPATHLEN];
+        if (!(next_word(&line, word, sizeof(word)) && next_word(&line, type, sizeof(type)))) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "bad FILE line");
+            return false;
+        }
+        bool wave = (strcasecmp(type, "WAVE") == 0);
+        if (!wave && (strcasecmp(type, "BINARY") != 0)) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "unsupported file type: %s", type);
+            return false;
+        }
+        if (word[0] == '/') {
+            strcpy(path, word);
+        } else {
+            snprintf(path, sizeof(path), "%s/%s", dir, word);
+        }
+        *file_begin = image->nsectors;
+        return add_file(image, path, wave, fail);
+    } else if (strcasecmp(keyword, "TRACK") == 0) {
+        char mode[16];
+        if (!image->nfiles) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "TRACK before FILE");
+            return false;
+        } else if (!(next_word(&line, word, sizeof(word))
+                     && next_word(&line, mode, sizeof(mode)))) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "bad TRACK line");
+            return false;
+        }
+        bool audio = (strcasecmp(mode, "AUDIO") == 0);
+        if (!audio && (strcasecmp(mode, "MODE1/2352") != 0)
+            && (strcasecmp(mode, "MODE2/2352") != 0)) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "unsupported track mode: %s", mode);
+            return false;
+        }
+        add_track(image, strtoul(word, NULL, 10), audio);
+    } else if (strcasecmp(keyword, "INDEX") == 0) {
+        char msf[16];
+        unsigned int m, s, f;
+        if (!track
+            || !(next_word(&line, word, sizeof(word)) && next_word(&line, msf, sizeof(msf)))
+            || (sscanf(msf, "%u:%u:%u", &m, &s, &f) != 3)) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "bad INDEX line");
+            return false;
+        }
+        if (strtoul(word, NULL, 10) == 1) {
+            track->sector_begin = *file_begin + (((m * 60) + s) * kSectorsPerSecond) + f;
+        }
+    } else if (strcasecmp(keyword, "ISRC") == 0) {
+        if (track && next_word(&line, word, sizeof(word))) {
+            snprintf(track->isrc, sizeof(track->isrc), "%s", word);
+        }
+    } else if (strcasecmp(keyword, "CATALOG") == 0) {
+        if (next_word(&line, word, sizeof(word))) {
+            snprintf(image->mcn, sizeof(image->mcn), "%s", word);
+        }
+    } else if (strcasecmp(keyword, "REM") == 0) {
+        if (next_word(&line, word, sizeof(word)) && (strcmp(word, "RSVC") == 0)
+            && !parse_simulation(image, line)) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "bad REM RSVC line");
+            return false;
+        }
+    } else if ((strcasecmp(keyword, "PREGAP") == 0) || (strcasecmp(keyword, "POSTGAP") == 0)) {
+        rsvc_logf(1, "ignoring %s; gaps must be stored in the image", keyword);
+    }
+    return true;
+}
+
+static bool parse_cue(rsvc_cd_image_t image, const char* path, rsvc_done_t fail) {
+    FILE* file;
+    if (!rsvc_open(path, O_RDONLY, 0644, &file, fail)) {
+        return false;
+    }
+    char dir[MAXPATHLEN];
+    rsvc_dirname(path, dir);
+
+    bool ok = true;
+    size_t file_begin = 0;
+    char* line = NULL;
+    size_t line_size = 0;
+    ssize_t line_length;
+    size_t line_number = 0;
+    while (ok && ((line_length = getline(&line, &line_size, file)) > 0)) {
+        ++line_number;
+        line[strcspn(line, "\r\n")] = '\0';
+        ok = parse_cue_line(image, dir, line, &file_begin, ^(rsvc_error_t error){
+            rsvc_errorf(fail, error->file, error->lineno, "%s:%zu: %s",
+                        path, line_number, error->message);
+        });
+    }
+    free(line);
+    if (ok && ferror(file)) {
+        rsvc_strerrorf(fail, __FILE__, __LINE__, "%s", path);
+        ok = false;
+    }
+    fclose(file);
+    return ok;
+}
+
+// Fills in where each track ends, once all tracks have been read.
+static bool finish_tracks(rsvc_cd_image_t image, const char* path, rsvc_done_t fail) {
+    if (!image->ntracks) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "%s: no tracks", path);
+        return false;
+    }
+    for (size_t i = 0; i < image->ntracks; ++i) {
+        struct rsvc_cd_image_track* track = &image->tracks[i];
+        size_t end = (i + 1 < image->ntracks) ? track[1].sector_begin : image->nsectors;
+        if ((track->sector_begin == SIZE_MAX) || (track->sector_begin >= end)) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "%s: bad INDEX for track %zu",
+                        path, track->number);
+            return false;
+        }
+        track->sector_end = end;
+    }
+    return true;
+}
+
+bool rsvc_cd_image_open(const char* path, rsvc_cd_image_t* image, rsvc_done_t fail) {
+    struct rsvc_cd_image build_image = {
+        .random = 2463534242,
+    };
+    *image = memdup(&build_image, sizeof(build_image));
+
+    bool ok;
+    if (has_extension(path, ".wav")) {
+        ok = add_file(*image, path, true, fail);
+        if (ok) {
+            add_track(*image, 1, true)->sector_begin = 0;
+        }
+    } else {
+        ok = parse_cue(*image, path, fail);
+    }
+    if (!(ok && finish_tracks(*image, path, fail))) {
+        rsvc_cd_image_close(*image);
+        *image = NULL;
+        return false;
+    }
+    return true;
+}
+
+void rsvc_cd_image_close(rsvc_cd_image_t image) {
+    for (size_t i = 0; i < image->nfiles; ++i) {
+        close(image->files[i].fd);
+    }
+    free(image->files);
+    free(image->tracks);
+    free(image->faults);
+    free(image);
+}
+
+const char* rsvc_cd_image_mcn(rsvc_cd_image_t image) {
+    return image->mcn;
+}
+
+size_t rsvc_cd_image_ntracks(rsvc_cd_image_t image) {
+    return image->ntracks;
+}
+
+const struct rsvc_cd_image_track* rsvc_cd_image_track(rsvc_cd_image_t image, size_t n) {
+    return &image->tracks[n];
+}
+
+// Reads bytes of the disc, starting at byte `offset` of sector 0.  Parts
+// before the start or past the end of the image read as silence.
+static void read_bytes(rsvc_cd_image_t image, long long offset, unsigned char* data,
+                       size_t size) {
+    memset(data, 0, size);
+    for (size_t i = 0; i < image->nfiles; ++i) {
+        const struct image_file* file = &image->files[i];
+        long long begin = (long long)file->sector_begin * kSectorSize;
+        long long end = begin + file->size;
+        long long from = (offset > begin) ? offset : begin;
+        long long to = ((offset + (long long)size) < end) ? (offset + (long long)size) : end;
+        if (from < to) {
+            ssize_t n = pread(file->fd, data + (from - offset), to - from,
+                              file->data_offset + (from - begin));
+            (void)n;  // A short read leaves silence.
+        }
+    }
+}
+
+static uint32_t next_random(rsvc_cd_image_t image) {
+    uint32_t x = image->random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return image->random = x;
+}
+
+// Waits until a read begun at `start` has taken as long as the
+// simulated drive would need.
+static void simulate_delay(rsvc_cd_image_t image, const struct timespec* start,
+                           size_t nsectors) {
+    double seconds = image->latency_usec / 1e6;
+    if (image->speed > 0) {
+        seconds += nsectors / (kSectorsPerSecond * image->speed);
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    seconds -= (now.tv_sec - start->tv_sec) + ((now.tv_nsec - start->tv_nsec) / 1e9);
+    if (seconds > 0) {
+        struct timespec delay = {
+            .tv_sec = seconds,
+            .tv_nsec = (seconds - (time_t)seconds) * 1e9,
+        };
+        nanosleep(&delay, NULL);
+    }
+}
+
+int rsvc_cd_image_read(rsvc_cd_image_t image, size_t sector, size_t nsectors, bool c2,
+                       unsigned char* data) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (c2 && image->no_c2) {
+        return kSenseIllegalRequest;
+    }
+
+    bool failed = false;
+    for (size_t i = 0; i < image->nfaults; ++i) {
+        struct fault* fault = &image->faults[i];
+        if (!fault->c2 && fault->remaining
+            && (fault->sector >= sector) && (fault->sector < (sector + nsectors))) {
+            if (fault->remaining != SIZE_MAX) {
+                --fault->remaining;
+            }
+            failed = true;
+        }
+    }
+    if (failed) {
+        simulate_delay(image, &start, nsectors);
+        return kSenseMediumError;
+    }
+
+    int jitter = 0;
+    if (image->jitter > 0) {
+        jitter = (int)(next_random(image) % ((2 * image->jitter) + 1)) - image->jitter;
+    }
+    size_t stride = c2 ? (kSectorSize + kC2Size) : kSectorSize;
+    for (size_t i = 0; i < nsectors; ++i) {
+        long long offset = ((long long)(sector + i) * kSectorSize) + (jitter * 4);
+        read_bytes(image, offset, data + (i * stride), kSectorSize);
+        if (c2) {
+            memset(data + (i * stride) + kSectorSize, 0, kC2Size);
+        }
+    }
+
+    for (size_t i = 0; i < image->nfaults; ++i) {
+        struct fault* fault = &image->faults[i];
+        if (fault->c2 && fault->remaining
+            && (fault->sector >= sector) && (fault->sector < (sector + nsectors))) {
+            if (fault->remaining != SIZE_MAX) {
+                --fault->remaining;
+            }
+            unsigned char* damaged = data + ((fault->sector - sector) * stride);
+            for (size_t j = 0; j < kDamageSize; ++j) {
+                damaged[j] ^= next_random(image) | 1;
+            }
+            if (c2) {
+                memset(damaged + kSectorSize, 0xff, kDamageSize / 8);
+            }
+        }
+    }
+
+    simulate_delay(image, &start, nsectors);
+    return 0;
+}
@@ -0,0 +1,71 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#ifndef SRC_RSVC_CD_IMAGE_H_
+#define SRC_RSVC_CD_IMAGE_H_
+
+#include <rsvc/common.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// A disc image, read in place of a drive so that rips can be tested and
+// measured without hardware.  The image is either a CUE sheet, whose
+// tracks are stored in raw BINARY (2352 bytes per sector) or 16-bit
+// stereo WAVE files, or a single WAV file, which is a disc of one
+// track.  CATALOG and ISRC lines give the MCN and ISRCs.
+//
+// Drive behavior is simulated with REM lines in the CUE sheet:
+//
+//   REM RSVC LATENCY usec        each read takes at least this long
+//   REM RSVC SPEED x             reads no faster than x times realtime
+//   REM RSVC ERROR sector [n]    reads of `sector` fail (n times, or always)
+//   REM RSVC C2 sector [n]       `sector` is damaged and flagged by C2
+//                                (n times, or always)
+//   REM RSVC JITTER samples      reads start up to this far off
+//   REM RSVC NOC2                the drive doesn't report C2 errors
+typedef struct rsvc_cd_image* rsvc_cd_image_t;
+
+struct rsvc_cd_image_track {
+    size_t  number;
+    bool    audio;
+    size_t  sector_begin;
+    size_t  sector_end;
+    char    isrc[13];
+};
+
+// True if `path` names an image rather than a device.
+bool rsvc_cd_image_path(const char* path);
+
+bool rsvc_cd_image_open(const char* path, rsvc_cd_image_t* image, rsvc_done_t fail);
+void rsvc_cd_image_close(rsvc_cd_image_t image);
+
+// The MCN from the CATALOG line, or an empty string.
+const char* rsvc_cd_image_mcn(rsvc_cd_image_t image);
+size_t rsvc_cd_image_ntracks(rsvc_cd_image_t image);
+const struct rsvc_cd_image_track* rsvc_cd_image_track(rsvc_cd_image_t image, size_t n);
+
+// Reads `nsectors` sectors of 2352 bytes starting at `sector`, each
+// followed by 294 bytes of C2 error pointers if `c2` is set.  Returns
+// 0 on success, or the SCSI sense key a drive would have returned.
+int rsvc_cd_image_read(rsvc_cd_image_t image, size_t sector, size_t nsectors, bool c2,
+                       unsigned char* data);
+
+#endif  // SRC_RSVC_CD_IMAGE_H_
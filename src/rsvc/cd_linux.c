@@ -22,26 +22,46 @@
 
 #include <rsvc/cd.h>
 
+#include <Block.h>
 #include <discid/discid.h>
 #include <fcntl.h>
 #include <linux/cdrom.h>
+#include <linux/fs.h>
+#include <scsi/sg.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/errno.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "cd_image.h"
+#include "cd_offset.h"
 #include "common.h"
 #include "unix.h"
 
+enum cd_reader {
+    CD_READER_UNKNOWN,
+    CD_READER_READ_CD,
+    CD_READER_READ_AUDIO,
+};
+
 struct rsvc_cd {
     dispatch_queue_t   queue;
 
     FILE*              file;
+    rsvc_cd_image_t    image;
     char*              path;
     struct cdrom_mcn   mcn;
+    enum cd_reader     reader;
+    char               vendor[9];
+    char               product[17];
 
     size_t             nsessions;
     rsvc_cd_session_t  sessions;
@@ -141,10 +161,98 @@ bool calculate_musicbrainz_discid(rsvc_cd_t cd, rsvc_done_t fail) {
     return true;
 }
 
+// Copies a space-padded field of an INQUIRY response to `out`, which
+// has room for `size` bytes and a terminating null.
+static void copy_inquiry_field(char* out, const unsigned char* in, size_t size) {
+    while (size && ((in[size - 1] == ' ') || (in[size - 1] == '\0'))) {
+        --size;
+    }
+    memcpy(out, in, size);
+    out[size] = '\0';
+}
+
+// Identifies the drive with a SCSI INQUIRY, so that its read offset can
+// be looked up.  Drives that don't answer are left unidentified.
+static void read_inquiry(rsvc_cd_t cd) {
+    unsigned char response[36] = {};
+    unsigned char command[6] = {
+        [0] = 0x12,
+        [4] = sizeof(response),
+    };
+    struct request_sense s = {};
+    struct sg_io_hdr sg_io = {
+        .interface_id = 'S',
+        .sbp = (unsigned char*)&s,
+        .mx_sb_len = sizeof(s),
+        .cmdp = command,
+        .cmd_len = sizeof(command),
+        .dxferp = response,
+        .dxfer_len = sizeof(response),
+        .dxfer_direction = SG_DXFER_FROM_DEV,
+    };
+    if ((ioctl(fileno(cd->file), SG_IO, &sg_io) != 0)
+        || ((sg_io.info & SG_INFO_OK_MASK) != SG_INFO_OK)) {
+        return;
+    }
+    copy_inquiry_field(cd->vendor, response + 8, 8);
+    copy_inquiry_field(cd->product, response + 16, 16);
+}
+
+// Creates a CD backed by a disc image instead of a drive.  Reads from
+// it go through the same paths as READ CD.
+static bool create_from_image(char* path, rsvc_cd_t* cd, rsvc_done_t fail) {
+    rsvc_cd_image_t image;
+    if (!rsvc_cd_image_open(path, &image, fail)) {
+        return false;
+    }
+
+    size_t ntracks = rsvc_cd_image_ntracks(image);
+    struct rsvc_cd build_cd = {
+        .image      = image,
+        .queue      = dispatch_queue_create("net.sfiera.ripservice.cd", NULL),
+        .path       = strdup(path),
+        .reader     = CD_READER_READ_CD,
+        .vendor     = "RSVC",
+        .product    = "IMAGE",
+        .nsessions  = 1,
+        .sessions   = calloc(1, sizeof(struct rsvc_cd_session)),
+        .ntracks    = ntracks,
+        .tracks     = calloc(ntracks, sizeof(struct rsvc_cd_track)),
+    };
+    *cd = memdup(&build_cd, sizeof(build_cd));
+    snprintf((char*)(*cd)->mcn.medium_catalog_number,
+             sizeof((*cd)->mcn.medium_catalog_number), "%s", rsvc_cd_image_mcn(image));
+
+    for (size_t i = 0; i < ntracks; ++i) {
+        const struct rsvc_cd_image_track* image_track = rsvc_cd_image_track(image, i);
+        struct rsvc_cd_track build_track = {
+            .number        = image_track->number,
+            .cd            = *cd,
+            .session       = &(*cd)->sessions[0],
+            .type          = image_track->audio ? RSVC_CD_TRACK_AUDIO : RSVC_CD_TRACK_DATA,
+            .sector_begin  = image_track->sector_begin,
+            .sector_end    = image_track->sector_end,
+            .nchannels     = 2,
+        };
+        (*cd)->tracks[i] = build_track;
+    }
+
+    if (!(build_sessions(*cd, 0, ntracks, fail)
+          && calculate_musicbrainz_discid(*cd, fail))) {
+        rsvc_cd_destroy(*cd);
+        *cd = NULL;
+        return false;
+    }
+    return true;
+}
+
 bool rsvc_cd_create(char* path, rsvc_cd_t* cd, rsvc_done_t fail) {
     fail = ^(rsvc_error_t error){
         rsvc_prefix_error(path, error, fail);
     };
+    if (rsvc_cd_image_path(path)) {
+        return create_from_image(path, cd, fail);
+    }
 
     bool ok = false;
     FILE* file;
@@ -173,6 +281,7 @@ bool rsvc_cd_create(char* path, rsvc_cd_t* cd, rsvc_done_t fail) {
             if (ioctl(fileno(file), CDROM_GET_MCN, &mcn) == 0) {
                 (*cd)->mcn = mcn;
             }
+            read_inquiry(*cd);
 
             rsvc_cd_track_t track = &(*cd)->tracks[0];
             if (build_tracks(*cd, &track, begin, end, fail) &&
@@ -216,7 +325,11 @@ void rsvc_cd_destroy(rsvc_cd_t cd) {
         free(cd->tracks);
     }
     free(cd->path);
-    fclose(cd->file);
+    if (cd->image) {
+        rsvc_cd_image_close(cd->image);
+    } else {
+        fclose(cd->file);
+    }
     dispatch_release(cd->queue);
     free(cd);
 }
@@ -225,6 +338,10 @@ const char* rsvc_cd_mcn(rsvc_cd_t cd) {
     return (const char*)cd->mcn.medium_catalog_number;
 }
 
+bool rsvc_cd_read_offset(rsvc_cd_t cd, int* offset) {
+    return rsvc_cd_drive_offset(cd->vendor, cd->product, offset);
+}
+
 size_t rsvc_cd_nsessions(rsvc_cd_t cd) {
     return cd->nsessions;
 }
@@ -278,58 +395,641 @@ size_t rsvc_cd_track_nsamples(rsvc_cd_track_t track) {
 }
 
 void rsvc_cd_track_isrc(rsvc_cd_track_t track, void (^done)(const char* isrc)) {
-    (void)track;  // TODO(sfiera): ISRC on Linux.
+    rsvc_cd_t cd = track->cd;
+    if (cd->image) {
+        const char* isrc = rsvc_cd_image_track(cd->image, track - cd->tracks)->isrc;
+        done(*isrc ? isrc : NULL);
+        return;
+    }
+    // TODO(sfiera): ISRC on Linux.
     done(NULL);
 }
 
-static bool read_frame(rsvc_cd_t cd, FILE* out, size_t frame, rsvc_done_t fail) {
-    unsigned char buffer[CD_FRAMESIZE_RAW] = {};
+enum {
+    // CDROMREADAUDIO refuses to read more than CD_FRAMES sectors at once.
+    kMaxReadAudioBatch = CD_FRAMES,
+
+    // READ CD can transfer as much as the host adapter allows, but there
+    // is little to gain beyond about a megabyte per request.
+    kMaxReadCdBatch = 396,
+
+    // After this many successful reads in a row, a batch that was shrunk
+    // after an error is allowed to grow again.
+    kGrowReadBatch = 8,
+
+    // A sector read with C2 error pointers is followed by one bit for
+    // each of its 2352 bytes.
+    kC2Size = CD_FRAMESIZE_RAW / 8,
+    kC2SectorSize = CD_FRAMESIZE_RAW + kC2Size,
+
+    // Number of times a sector flagged by C2 is re-read before giving up
+    // and keeping the last copy.
+    kMaxC2Rereads = 8,
+
+    kSenseIllegalRequest = 0x05,
+
+    // In secure mode, each read starts and ends one sector beyond the
+    // batch.  The last kAlignSize bytes already written are looked for
+    // in the leading overlap, up to kMaxJitter samples away from where
+    // they should be, and the read is realigned to match.
+    kOverlap = 1,
+    kAlignSize = 1024,
+    kMaxJitter = 256,
+
+    // Drives cache what they read, so before reading the same sectors
+    // again, read a sector this far away to push them out.
+    kCacheFlushDistance = 10000,
+
+    kDefaultMatches = 2,
+    kDefaultMaxReads = 16,
+};
+
+struct rip {
+    // Reads for `track` end at `track_sector`; `track_end` follows the
+    // last track to read.  Audio goes to `file`, which belongs to
+    // `out_track`, and is NULL until `begin` has provided it.
+    rsvc_cd_track_t             track;
+    rsvc_cd_track_t             track_end;
+    size_t                      track_sector;
+    rsvc_cd_track_t             out_track;
+    FILE*                       file;
+    size_t                      out_remaining;
+    rsvc_cd_track_begin_f       begin;
+    rsvc_cd_track_end_f         end;
+    rsvc_cd_rip_summary_f       report;
+
+    bool                        stopped;
+    bool                        c2;
+    enum rsvc_cd_rip_mode       mode;
+    size_t                      matches;
+    size_t                      max_reads;
+
+    size_t                      sector;
+    size_t                      sector_end;
+    size_t                      sector_limit;
+    size_t                      batch;
+    size_t                      max_batch;
+    size_t                      max_transfer;
+    size_t                      nsuccesses;
+    unsigned char*              buffer;
+    struct rsvc_cd_shift        shift;
+
+    // Secure mode only.
+    size_t                      vote_end;
+    unsigned char*              reference;
+    unsigned char*              votes;
+    size_t*                     counts;
+    bool                        verified;
+    bool                        has_tail;
+    unsigned char               tail[kAlignSize];
+
+    struct timespec             start;
+    struct rsvc_cd_rip_summary  summary;
+};
+
+static double elapsed_seconds(const struct timespec* since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) + ((now.tv_nsec - since->tv_nsec) / 1e9);
+}
+
+// Issues an MMC READ CD command for `nsectors` sectors of CD-DA
+// starting at `sector`, with C2 error pointers following each sector if
+// `c2` is set.  Returns 0 on success; the sense key if the drive
+// rejected the command; or -1 if the ioctl itself failed.
+static int read_cd(rsvc_cd_t cd, size_t sector, size_t nsectors, bool c2,
+                   unsigned char* data) {
+    if (cd->image) {
+        int status = rsvc_cd_image_read(cd->image, sector, nsectors, c2, data);
+        if (status) {
+            errno = EIO;
+        }
+        return status;
+    }
+
+    unsigned char command[12] = {
+        [0] = 0xbe,
+        [1] = 0x04,  // Expected sector type: CD-DA.
+        [2] = sector >> 24,
+        [3] = sector >> 16,
+        [4] = sector >> 8,
+        [5] = sector,
+        [6] = nsectors >> 16,
+        [7] = nsectors >> 8,
+        [8] = nsectors,
+        [9] = c2 ? 0x12 : 0x10,  // User data, and maybe C2 error bits.
+    };
+    struct request_sense s = {};
+    size_t sector_size = c2 ? kC2SectorSize : CD_FRAMESIZE_RAW;
+
+    struct sg_io_hdr sg_io = {
+        .interface_id = 'S',
+        .sbp = (unsigned char*)&s,
+        .mx_sb_len = sizeof(s),
+        .cmdp = command,
+        .cmd_len = sizeof(command),
+        .flags = SG_FLAG_LUN_INHIBIT | SG_FLAG_DIRECT_IO,
+        .dxferp = data,
+        .dxfer_len = nsectors * sector_size,
+        .dxfer_direction = SG_DXFER_FROM_DEV,
+    };
+
+    if (ioctl(fileno(cd->file), SG_IO, &sg_io) != 0) {
+        return -1;
+    } else if ((sg_io.info & SG_INFO_OK_MASK) != SG_INFO_OK) {
+        errno = EIO;
+        return s.sense_key ? s.sense_key : -1;
+    }
+    return 0;
+}
+
+static bool read_audio(rsvc_cd_t cd, size_t sector, size_t nsectors, unsigned char* data) {
     struct cdrom_read_audio read_audio = {
         .addr_format = CDROM_LBA,
         .addr = {
-            .lba = frame,
+            .lba = sector,
         },
-        .nframes = 1,
-        .buf = buffer,
+        .nframes = nsectors,
+        .buf = data,
     };
+    return ioctl(fileno(cd->file), CDROMREADAUDIO, &read_audio) == 0;
+}
 
-    bool eof = false;
-    if (ioctl(fileno(cd->file), CDROMREADAUDIO, &read_audio) != 0) {
-        rsvc_strerrorf(fail, __FILE__, __LINE__, "%s", cd->path);
-        return false;
-    } else if (!rsvc_write("pipe", out, buffer, CD_FRAMESIZE_RAW, fail)) {
-        return false;
-    } else if (eof) {
-        // TODO(sfiera): 0 is not an error, but we must break early.
-        rsvc_errorf(fail, __FILE__, __LINE__, "pipe closed");
-        return false;
+// Largest batch, in sectors, that the drive's host adapter accepts in a
+// single READ CD transfer.
+static size_t max_read_cd_batch(rsvc_cd_t cd) {
+    unsigned short max_sectors;
+    if (cd->image) {
+        return kMaxReadCdBatch;
+    } else if (ioctl(fileno(cd->file), BLKSECTGET, &max_sectors) != 0) {
+        return kMaxReadAudioBatch;
+    }
+    size_t batch = (max_sectors * 512) / kC2SectorSize;
+    if (batch > kMaxReadCdBatch) {
+        return kMaxReadCdBatch;
+    } else if (batch == 0) {
+        return 1;
+    }
+    return batch;
+}
+
+static bool has_c2_errors(const unsigned char* c2) {
+    for (size_t i = 0; i < kC2Size; ++i) {
+        if (c2[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Compares two blocks of audio, 64 bytes at a time where SSE2 is
+// available.  Mismatches are rare, so this does not bother finding
+// where the blocks differ.
+static bool blocks_equal(const unsigned char* a, const unsigned char* b, size_t size) {
+#ifdef __SSE2__
+    for ( ; size >= 64; a += 64, b += 64, size -= 64) {
+        __m128i diff = _mm_or_si128(
+                _mm_or_si128(
+                    _mm_xor_si128(_mm_loadu_si128((const __m128i*)a),
+                                  _mm_loadu_si128((const __m128i*)b)),
+                    _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + 16)),
+                                  _mm_loadu_si128((const __m128i*)(b + 16)))),
+                _mm_or_si128(
+                    _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + 32)),
+                                  _mm_loadu_si128((const __m128i*)(b + 32))),
+                    _mm_xor_si128(_mm_loadu_si128((const __m128i*)(a + 48)),
+                                  _mm_loadu_si128((const __m128i*)(b + 48)))));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xffff) {
+            return false;
+        }
+    }
+#endif
+    return memcmp(a, b, size) == 0;
+}
+
+// Re-reads each sector in `data` that the drive flagged with C2 errors,
+// until the drive returns a clean copy, then packs the audio data of
+// the sectors together.
+static void fix_c2_errors(struct rip* rip, size_t sector, size_t nsectors,
+                          unsigned char* data) {
+    rsvc_cd_t cd = rip->track->cd;
+    unsigned char reread[kC2SectorSize];
+    for (size_t i = 0; i < nsectors; ++i) {
+        unsigned char* raw = data + (i * kC2SectorSize);
+        if (has_c2_errors(raw + CD_FRAMESIZE_RAW)) {
+            ++rip->summary.nc2;
+            bool clean = false;
+            for (int j = 0; !clean && (j < kMaxC2Rereads); ++j) {
+                ++rip->summary.nrereads;
+                if (read_cd(cd, sector + i, 1, true, reread) == 0) {
+                    memcpy(raw, reread, CD_FRAMESIZE_RAW);
+                    clean = !has_c2_errors(reread + CD_FRAMESIZE_RAW);
+                }
+            }
+            if (!clean) {
+                rsvc_logf(1, "sector %zu still has C2 errors", sector + i);
+                ++rip->summary.nsuspect;
+            }
+        }
+        memmove(data + (i * CD_FRAMESIZE_RAW), raw, CD_FRAMESIZE_RAW);
+    }
+}
+
+static bool read_sectors(struct rip* rip, size_t sector, size_t nsectors, unsigned char* data);
+
+// Reads at most `rip->max_transfer` sectors with a single command, using
+// READ CD when the drive supports it, and CDROMREADAUDIO otherwise.  The
+// first READ CD on a CD decides which is used; if the drive rejects C2
+// error pointers, the rip continues without them.
+static bool read_transfer(struct rip* rip, size_t sector, size_t nsectors, unsigned char* data) {
+    rsvc_cd_t cd = rip->track->cd;
+    while (cd->reader != CD_READER_READ_AUDIO) {
+        ++rip->summary.nreads;
+        int status = read_cd(cd, sector, nsectors, rip->c2, data);
+        if (status == 0) {
+            cd->reader = CD_READER_READ_CD;
+            if (rip->c2) {
+                fix_c2_errors(rip, sector, nsectors, data);
+            }
+            return true;
+        } else if (rip->c2 && (status == kSenseIllegalRequest)) {
+            rsvc_logf(1, "%s: no C2 error pointers; reading without them", cd->path);
+            rip->c2 = false;
+        } else if ((cd->reader == CD_READER_READ_CD)
+                   || ((status > 0) && (status != kSenseIllegalRequest))) {
+            return false;
+        } else {
+            rsvc_logf(1, "%s: READ CD not supported; using CDROMREADAUDIO", cd->path);
+            cd->reader = CD_READER_READ_AUDIO;
+            rip->max_transfer = kMaxReadAudioBatch;
+            if (rip->max_batch > kMaxReadAudioBatch) {
+                rip->max_batch = kMaxReadAudioBatch;
+            }
+            if (rip->batch > rip->max_batch) {
+                rip->batch = rip->max_batch;
+            }
+            return read_sectors(rip, sector, nsectors, data);
+        }
+    }
+    ++rip->summary.nreads;
+    return read_audio(cd, sector, nsectors, data);
+}
+
+// Reads `nsectors` sectors into `data`, in as few commands as the drive
+// allows.
+static bool read_sectors(struct rip* rip, size_t sector, size_t nsectors, unsigned char* data) {
+    while (nsectors > 0) {
+        size_t n = nsectors;
+        if (n > rip->max_transfer) {
+            n = rip->max_transfer;
+        }
+        if (!read_transfer(rip, sector, n, data)) {
+            return false;
+        }
+        sector += n;
+        nsectors -= n;
+        data += n * CD_FRAMESIZE_RAW;
+    }
+    return true;
+}
+
+// Finds the audio already written within the leading overlap of a
+// secure read, allowing the drive to have started up to kMaxJitter
+// samples early or late, and returns the audio that follows it.  If it
+// can't be found, returns the audio where it should have been.
+static unsigned char* align_read(struct rip* rip, size_t before, size_t after) {
+    unsigned char* expected = rip->buffer + (before * CD_FRAMESIZE_RAW);
+    if (!rip->has_tail || !before) {
+        return expected;
+    }
+    for (int i = 0; i <= (2 * kMaxJitter); ++i) {
+        int jitter = (i % 2) ? -((i + 1) / 2) : (i / 2);
+        if ((jitter > 0) && ((size_t)(jitter * 4) > (after * CD_FRAMESIZE_RAW))) {
+            continue;
+        }
+        unsigned char* candidate = expected + (jitter * 4);
+        if (blocks_equal(candidate - kAlignSize, rip->tail, kAlignSize)) {
+            if (jitter) {
+                rsvc_logf(2, "sector %zu: corrected %d samples of jitter", rip->sector, jitter);
+                ++rip->summary.njitter;
+            }
+            return candidate;
+        }
+    }
+    rsvc_logf(1, "sector %zu: could not align read", rip->sector);
+    return expected;
+}
+
+static void flush_cache(struct rip* rip) {
+    rsvc_cd_t cd = rip->track->cd;
+    size_t lead_out = cd->tracks[cd->ntracks - 1].sector_end;
+    size_t sector;
+    if ((rip->sector + kCacheFlushDistance) < lead_out) {
+        sector = rip->sector + kCacheFlushDistance;
+    } else if (rip->sector >= kCacheFlushDistance) {
+        sector = rip->sector - kCacheFlushDistance;
     } else {
+        return;
+    }
+    unsigned char ignored[CD_FRAMESIZE_RAW];
+    if (cd->reader == CD_READER_READ_AUDIO) {
+        (void)read_audio(cd, sector, 1, ignored);
+    } else {
+        (void)read_cd(cd, sector, 1, false, ignored);
+    }
+}
+
+// Reads the batch at `rip->sector` until `rip->matches` aligned reads
+// agree, and sets `*data` to the agreed audio.  If reads of a batch of
+// several sectors disagree, sets `*data` to NULL, so that the batch is
+// retried one sector at a time.  A single sector is read up to
+// `rip->max_reads` times, and the most common read is kept.
+static bool read_secure(struct rip* rip, size_t nsectors, unsigned char** data) {
+    size_t before = rip->has_tail ? kOverlap : 0;
+    size_t after = rip->sector_limit - (rip->sector + nsectors);
+    if (after > kOverlap) {
+        after = kOverlap;
+    }
+    size_t size = nsectors * CD_FRAMESIZE_RAW;
+    size_t ncandidates = 0;
+
+    for (size_t nreads = 0; nreads < rip->max_reads; ++nreads) {
+        if (nreads) {
+            flush_cache(rip);
+        }
+        if (!read_sectors(rip, rip->sector - before, before + nsectors + after, rip->buffer)) {
+            return false;
+        }
+        unsigned char* aligned = align_read(rip, before, after);
+
+        if (nsectors > 1) {
+            if (ncandidates == 0) {
+                memcpy(rip->reference, aligned, size);
+                rip->counts[0] = ncandidates = 1;
+            } else if (!blocks_equal(aligned, rip->reference, size)) {
+                *data = NULL;
+                return true;
+            } else {
+                ++rip->counts[0];
+            }
+            if (rip->counts[0] >= rip->matches) {
+                rip->summary.nverified += nsectors;
+                rip->verified = true;
+                *data = rip->reference;
+                return true;
+            }
+            continue;
+        }
+
+        size_t i = 0;
+        for ( ; i < ncandidates; ++i) {
+            if (blocks_equal(aligned, rip->votes + (i * CD_FRAMESIZE_RAW), CD_FRAMESIZE_RAW)) {
+                break;
+            }
+        }
+        if (i == ncandidates) {
+            memcpy(rip->votes + (i * CD_FRAMESIZE_RAW), aligned, CD_FRAMESIZE_RAW);
+            rip->counts[i] = 0;
+            ++ncandidates;
+        }
+        if (++rip->counts[i] >= rip->matches) {
+            ++rip->summary.nverified;
+            rip->verified = true;
+            *data = rip->votes + (i * CD_FRAMESIZE_RAW);
+            return true;
+        }
+    }
+
+    if (nsectors > 1) {
+        *data = NULL;
         return true;
     }
+    size_t best = 0;
+    for (size_t i = 1; i < ncandidates; ++i) {
+        if (rip->counts[i] > rip->counts[best]) {
+            best = i;
+        }
+    }
+    rsvc_logf(1, "sector %zu: no %zu reads agreed", rip->sector, rip->matches);
+    ++rip->summary.nunverified;
+    rip->verified = false;
+    *data = rip->votes + (best * CD_FRAMESIZE_RAW);
+    return true;
+}
+
+// Writes audio to the tracks being ripped, beginning each track when
+// its first audio arrives and ending it after its last.
+static bool write_output(struct rip* rip, const unsigned char* data, size_t size,
+                         rsvc_done_t fail) {
+    while (size > 0) {
+        if (!rip->file) {
+            if (!rip->begin(rip->out_track, &rip->file, fail)) {
+                return false;
+            }
+            rip->out_remaining = (rip->out_track->sector_end - rip->out_track->sector_begin)
+                                 * CD_FRAMESIZE_RAW;
+        }
+        size_t n = (size < rip->out_remaining) ? size : rip->out_remaining;
+        if (!rsvc_write("pipe", rip->file, data, n, fail)) {
+            return false;
+        }
+        data += n;
+        size -= n;
+        if ((rip->out_remaining -= n) == 0) {
+            rip->file = NULL;
+            rip->end(rip->out_track++);
+        }
+    }
+    return true;
 }
 
-static void read_range(rsvc_cd_t cd, FILE* out, size_t begin, size_t end, bool* cancelled,
-                       rsvc_done_t done) {
-    if (begin == end) {
+// Reports on the track whose reads just finished, and starts counting
+// for the next one.
+static void finish_track(struct rip* rip) {
+    double seconds = elapsed_seconds(&rip->start);
+    if (seconds > 0) {
+        rip->summary.speed = rip->summary.nsectors / (CD_FRAMES * seconds);
+    }
+    if (rip->mode == RSVC_CD_RIP_SECURE) {
+        rip->summary.confidence = 1.0;
+        if (rip->summary.nsectors) {
+            rip->summary.confidence =
+                (double)rip->summary.nverified / rip->summary.nsectors;
+        }
+    }
+    if (rip->report) {
+        rip->report(&rip->summary);
+    }
+
+    ++rip->track;
+    memset(&rip->summary, 0, sizeof(rip->summary));
+    rip->summary.track = rip->track;
+    if (rip->track != rip->track_end) {
+        rip->track_sector = rsvc_cd_shift_boundary(&rip->shift, rip->track->sector_end);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &rip->start);
+}
+
+// Reads up to `rip->batch` sectors and writes them out.  If the read
+// fails, retries with a smaller batch, failing only once a single
+// sector cannot be read.  Cancellation is checked once per batch.
+// Batches stop at track boundaries, so that each track's summary counts
+// only its own reads.
+static void read_batch(struct rip* rip, rsvc_done_t done) {
+    rsvc_cd_t cd = rip->track->cd;
+    rsvc_cd_write_f write = ^bool (const unsigned char* data, size_t size, rsvc_done_t fail){
+        return write_output(rip, data, size, fail);
+    };
+    if (rip->sector == rip->sector_end) {
+        if (!rsvc_cd_shift_end(&rip->shift, write, done)) {
+            return;
+        }
+        while (rip->track != rip->track_end) {
+            finish_track(rip);
+        }
         done(NULL);
         return;
-    } else if (*cancelled) {
+    } else if (rip->stopped) {
         rsvc_errorf(done, __FILE__, __LINE__, "cancelled");
         return;
-    } else if (read_frame(cd, out, begin, done)) {
-        dispatch_async(cd->queue, ^{
-            read_range(cd, out, begin + 1, end, cancelled, done);
-        });
     }
+
+    // The last track finishes above, once its trailing silence is
+    // written.
+    while ((rip->sector == rip->track_sector) && ((rip->track + 1) != rip->track_end)) {
+        finish_track(rip);
+    }
+    size_t nsectors = rip->track_sector - rip->sector;
+    if (nsectors > rip->batch) {
+        nsectors = rip->batch;
+    }
+    if (rip->sector < rip->vote_end) {
+        nsectors = 1;
+    }
+
+    unsigned char* data = rip->buffer;
+    bool ok;
+    if (rip->mode == RSVC_CD_RIP_SECURE) {
+        ok = read_secure(rip, nsectors, &data);
+    } else {
+        ok = read_sectors(rip, rip->sector, nsectors, rip->buffer);
+    }
+
+    if (!ok) {
+        if (rip->batch == 1) {
+            rsvc_strerrorf(done, __FILE__, __LINE__, "%s", cd->path);
+            return;
+        }
+        rip->batch /= 2;
+        rip->nsuccesses = 0;
+        ++rip->summary.nretries;
+        rsvc_logf(1, "read of %zu sectors at %zu failed; retrying with %zu",
+                  nsectors, rip->sector, rip->batch);
+    } else if (!data) {
+        rsvc_logf(1, "reads of %zu sectors at %zu disagree; retrying sector by sector",
+                  nsectors, rip->sector);
+        ++rip->summary.nmismatches;
+        rip->vote_end = rip->sector + nsectors;
+    } else {
+        size_t size = nsectors * CD_FRAMESIZE_RAW;
+        if (!rsvc_cd_shift_write(&rip->shift, data, size, write, done)) {
+            return;
+        }
+        if (rip->mode == RSVC_CD_RIP_SECURE) {
+            // Only align later reads against audio that was verified.
+            memcpy(rip->tail, data + size - kAlignSize, kAlignSize);
+            rip->has_tail = rip->verified;
+        }
+        rip->sector += nsectors;
+        rip->summary.nsectors += nsectors;
+        if ((rip->batch < rip->max_batch) && (++rip->nsuccesses == kGrowReadBatch)) {
+            rip->batch *= 2;
+            if (rip->batch > rip->max_batch) {
+                rip->batch = rip->max_batch;
+            }
+            rip->nsuccesses = 0;
+        }
+    }
+
+    dispatch_async(cd->queue, ^{
+        read_batch(rip, done);
+    });
 }
 
-void rsvc_cd_track_rip(rsvc_cd_track_t track, FILE* file, rsvc_cancel_t cancel, rsvc_done_t done) {
-    rsvc_cd_t cd = track->cd;
-    __block bool stopped = false;
+// Rips the consecutive audio tracks [`begin`, `end`) with one
+// continuous series of reads.
+static void rip_tracks(rsvc_cd_track_t begin, rsvc_cd_track_t end,
+                       rsvc_cd_rip_options_t options, rsvc_cd_track_begin_f track_begin,
+                       rsvc_cd_track_end_f track_end, rsvc_cancel_t cancel, rsvc_done_t done) {
+    rsvc_cd_t cd = begin->cd;
+    size_t batch = options ? options->batch : 0;
+
+    // Secure reads overlap into the neighboring sectors, as long as
+    // those are audio too.
+    rsvc_cd_track_t last = end - 1;
+    while (((last + 1) != (cd->tracks + cd->ntracks))
+           && (last[1].type == RSVC_CD_TRACK_AUDIO)) {
+        ++last;
+    }
+
+    struct rip build_rip = {
+        .track         = begin,
+        .track_end     = end,
+        .out_track     = begin,
+        .begin         = Block_copy(track_begin),
+        .end           = Block_copy(track_end),
+        .report        = (options && options->summary) ? Block_copy(options->summary) : NULL,
+        .stopped       = false,
+        .c2            = options && options->c2,
+        .mode          = options ? options->mode : RSVC_CD_RIP_FAST,
+        .matches       = (options && options->matches) ? options->matches : kDefaultMatches,
+        .max_reads     = (options && options->max_reads) ? options->max_reads : kDefaultMaxReads,
+        .sector_limit  = last->sector_end,
+        .summary       = {
+            .track  = begin,
+        },
+    };
+    // Correct for the drive's read offset by reading the shifted range
+    // of sectors, reaching into the neighboring tracks as needed.
+    rsvc_cd_shift_init(&build_rip.shift, begin->sector_begin, end[-1].sector_end,
+                       build_rip.sector_limit, options ? options->offset : 0);
+    build_rip.sector = build_rip.shift.sector_begin;
+    build_rip.sector_end = build_rip.shift.sector_end;
+    build_rip.track_sector = rsvc_cd_shift_boundary(&build_rip.shift, begin->sector_end);
+    if (build_rip.max_reads < build_rip.matches) {
+        build_rip.max_reads = build_rip.matches;
+    }
+    struct rip* rip = memdup(&build_rip, sizeof build_rip);
+
+    // A cancel can land after the rip has finished and freed `rip`.
+    // Both run on the CD's queue, so the cancel handler checks this
+    // first; it lives as long as the blocks that refer to it.
+    __block struct rip* active = rip;
+    done = ^(rsvc_error_t error){
+        active = NULL;
+        // Whatever happened, end the track in progress.
+        if (rip->file) {
+            rip->end(rip->out_track);
+        }
+        Block_release(rip->begin);
+        Block_release(rip->end);
+        if (rip->report) {
+            Block_release(rip->report);
+        }
+        free(rip->buffer);
+        free(rip->reference);
+        free(rip->votes);
+        free(rip->counts);
+        free(rip);
+        done(error);
+    };
+
     if (cancel) {
         rsvc_cancel_handle_t cancel_handle = rsvc_cancel_add(cancel, ^{
             dispatch_async(cd->queue, ^{
-                stopped = true;
+                if (active) {
+                    active->stopped = true;
+                }
             });
         });
         done = ^(rsvc_error_t error){
@@ -339,6 +1039,79 @@ void rsvc_cd_track_rip(rsvc_cd_track_t track, FILE* file, rsvc_cancel_t cancel,
     }
 
     dispatch_async(cd->queue, ^{
-        read_range(cd, file, track->sector_begin, track->sector_end, &stopped, done);
+        // The reader is chosen on the CD's queue, so the batch limit can
+        // only be known here.
+        rip->max_transfer = kMaxReadAudioBatch;
+        if (cd->reader != CD_READER_READ_AUDIO) {
+            rip->max_transfer = max_read_cd_batch(cd);
+        }
+        size_t max_batch = rip->max_transfer;
+        if (batch && (batch < max_batch)) {
+            max_batch = batch;
+        }
+        rip->batch = rip->max_batch = max_batch;
+        rip->buffer = malloc((max_batch + (2 * kOverlap)) * kC2SectorSize);
+        if (rip->mode == RSVC_CD_RIP_SECURE) {
+            rip->reference = malloc(max_batch * CD_FRAMESIZE_RAW);
+            rip->votes = malloc(rip->max_reads * CD_FRAMESIZE_RAW);
+            rip->counts = calloc(rip->max_reads, sizeof(size_t));
+        }
+
+        if (!rsvc_cd_shift_begin(&rip->shift, ^bool (const unsigned char* data, size_t size,
+                                                     rsvc_done_t fail){
+            return write_output(rip, data, size, fail);
+        }, done)) {
+            return;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &rip->start);
+        read_batch(rip, done);
+    });
+}
+
+void rsvc_cd_track_rip(rsvc_cd_track_t track, FILE* file, rsvc_cd_rip_options_t options,
+                       rsvc_cancel_t cancel, rsvc_done_t done) {
+    rip_tracks(track, track + 1, options,
+               ^bool (rsvc_cd_track_t begun, FILE** out, rsvc_done_t fail){
+                   (void)begun;
+                   (void)fail;
+                   *out = file;
+                   return true;
+               },
+               ^(rsvc_cd_track_t ended){
+                   (void)ended;
+               },
+               cancel, done);
+}
+
+// Rips the session's audio tracks from `track` onwards, one run of
+// consecutive audio tracks at a time.
+static void rip_session_from(rsvc_cd_session_t session, rsvc_cd_track_t track,
+                             rsvc_cd_rip_options_t options, rsvc_cd_track_begin_f track_begin,
+                             rsvc_cd_track_end_f track_end, rsvc_cancel_t cancel,
+                             rsvc_done_t done) {
+    while ((track != session->track_end) && (track->type != RSVC_CD_TRACK_AUDIO)) {
+        ++track;
+    }
+    if (track == session->track_end) {
+        done(NULL);
+        return;
+    }
+    rsvc_cd_track_t end = track + 1;
+    while ((end != session->track_end) && (end->type == RSVC_CD_TRACK_AUDIO)) {
+        ++end;
+    }
+    rip_tracks(track, end, options, track_begin, track_end, cancel, ^(rsvc_error_t error){
+        if (error) {
+            done(error);
+            return;
+        }
+        rip_session_from(session, end, options, track_begin, track_end, cancel, done);
     });
 }
+
+void rsvc_cd_session_rip(rsvc_cd_session_t session, rsvc_cd_rip_options_t options,
+                         rsvc_cd_track_begin_f track_begin, rsvc_cd_track_end_f track_end,
+                         rsvc_cancel_t cancel, rsvc_done_t done) {
+    rip_session_from(session, session->track_begin, options, track_begin, track_end,
+                     cancel, done);
+}
@@ -0,0 +1,145 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "cd_offset.h"
+
+#include <string.h>
+
+enum {
+    kSectorSize = 2352,
+    kSampleSize = 4,
+};
+
+// Read offsets of common drives, in samples, as measured against
+// AccurateRip's reference drive.  Drives pad their product strings in
+// different ways, and report firmware variants as suffixes, so the
+// model number is matched anywhere in the product string.
+static const struct {
+    const char* vendor;
+    const char* model;
+    int         offset;
+} kDriveOffsets[] = {
+    {"ASUS",      "DRW-24B1ST",  6},
+    {"ASUS",      "DRW-24D5MT",  6},
+    {"ATAPI",     "iHAS124",     6},
+    {"HL-DT-ST",  "GH24NSB0",    6},
+    {"HL-DT-ST",  "GH24NSD1",    6},
+    {"HL-DT-ST",  "GP57EB40",    6},
+    {"LITE-ON",   "SHW-160P6S",  6},
+    {"PIONEER",   "BDR-209D",    667},
+    {"PIONEER",   "DVR-111D",    48},
+    {"PLEXTOR",   "PX-716A",     30},
+    {"PLEXTOR",   "PX-760A",     30},
+    {"TSSTcorp",  "SE-208GB",    6},
+    {"TSSTcorp",  "SH-224DB",    6},
+};
+
+#define DRIVE_OFFSETS_SIZE (sizeof(kDriveOffsets) / sizeof(kDriveOffsets[0]))
+
+void rsvc_cd_shift_init(struct rsvc_cd_shift* shift, size_t sector_begin, size_t sector_end,
+                        size_t sector_limit, int offset) {
+    // Work in bytes, relative to the start of the disc.  The first and
+    // last bytes may fall outside it.
+    long long shift_bytes = (long long)offset * kSampleSize;
+    long long first = ((long long)sector_begin * kSectorSize) + shift_bytes;
+    long long last = ((long long)sector_end * kSectorSize) + shift_bytes;
+    long long limit = (long long)sector_limit * kSectorSize;
+
+    memset(shift, 0, sizeof(*shift));
+    shift->bytes = shift_bytes;
+    if (first < 0) {
+        shift->zero_before = (last < 0) ? (last - first) : -first;
+        first = 0;
+    }
+    if (last > limit) {
+        shift->zero_after = (first > limit) ? (last - first) : (last - limit);
+        last = limit;
+    }
+    if (first >= last) {
+        shift->sector_begin = shift->sector_end = sector_begin;
+        return;
+    }
+
+    shift->sector_begin = first / kSectorSize;
+    shift->sector_end = (last + kSectorSize - 1) / kSectorSize;
+    shift->skip = first - ((long long)shift->sector_begin * kSectorSize);
+    shift->remaining = last - first;
+}
+
+size_t rsvc_cd_shift_boundary(const struct rsvc_cd_shift* shift, size_t sector) {
+    long long last = ((long long)sector * kSectorSize) + shift->bytes;
+    long long boundary = (last + kSectorSize - 1) / kSectorSize;
+    if ((last <= 0) || (boundary < (long long)shift->sector_begin)) {
+        return shift->sector_begin;
+    } else if (boundary > (long long)shift->sector_end) {
+        return shift->sector_end;
+    }
+    return boundary;
+}
+
+static bool write_silence(size_t size, rsvc_cd_write_f write, rsvc_done_t fail) {
+    static const unsigned char zeros[kSectorSize] = {};
+    while (size > 0) {
+        size_t n = (size < kSectorSize) ? size : kSectorSize;
+        if (!write(zeros, n, fail)) {
+            return false;
+        }
+        size -= n;
+    }
+    return true;
+}
+
+bool rsvc_cd_shift_begin(struct rsvc_cd_shift* shift, rsvc_cd_write_f write, rsvc_done_t fail) {
+    return write_silence(shift->zero_before, write, fail);
+}
+
+bool rsvc_cd_shift_write(struct rsvc_cd_shift* shift, const unsigned char* data, size_t size,
+                         rsvc_cd_write_f write, rsvc_done_t fail) {
+    if (shift->skip >= size) {
+        shift->skip -= size;
+        return true;
+    }
+    data += shift->skip;
+    size -= shift->skip;
+    shift->skip = 0;
+    if (size > shift->remaining) {
+        size = shift->remaining;
+    }
+    shift->remaining -= size;
+    return write(data, size, fail);
+}
+
+bool rsvc_cd_shift_end(struct rsvc_cd_shift* shift, rsvc_cd_write_f write, rsvc_done_t fail) {
+    return write_silence(shift->zero_after, write, fail);
+}
+
+bool rsvc_cd_drive_offset(const char* vendor, const char* product, int* offset) {
+    for (size_t i = 0; i < DRIVE_OFFSETS_SIZE; ++i) {
+        if ((strcmp(vendor, kDriveOffsets[i].vendor) == 0)
+            && strstr(product, kDriveOffsets[i].model)) {
+            *offset = kDriveOffsets[i].offset;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,75 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#ifndef SRC_RSVC_CD_OFFSET_H_
+#define SRC_RSVC_CD_OFFSET_H_
+
+#include <rsvc/common.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+// Shifts the audio of a track by a drive's read offset.  A drive with
+// an offset of +N returns audio N samples early, so the track's audio
+// is found N samples after where its sectors begin.
+// The sectors to read are computed once, and then the audio read from
+// them is trimmed to the track's length.  Audio that would lie outside
+// the readable area (before the start of the disc, or past the last
+// audio sector) is replaced with silence.
+struct rsvc_cd_shift {
+    long long  bytes;           // The read offset, in bytes.
+    size_t     sector_begin;    // First sector to read.
+    size_t     sector_end;      // One past the last sector to read.
+
+    size_t     zero_before;     // Bytes of silence before the first sector.
+    size_t     skip;            // Bytes left to discard from the first sector.
+    size_t     remaining;       // Bytes left to pass through.
+    size_t     zero_after;      // Bytes of silence after the last sector.
+};
+
+// Receives the shifted audio.
+typedef bool (^rsvc_cd_write_f)(const unsigned char* data, size_t size, rsvc_done_t fail);
+
+// Computes the sectors to read for audio spanning
+// [`sector_begin`, `sector_end`), on a drive with the given read offset
+// in samples.  No sector at or past `sector_limit` is read.
+void rsvc_cd_shift_init(struct rsvc_cd_shift* shift, size_t sector_begin, size_t sector_end,
+                        size_t sector_limit, int offset);
+
+// Returns the sector to read up to, in order to have all of the audio
+// before `sector`.  For a range spanning several tracks, this is where
+// the reads for each track end.
+size_t rsvc_cd_shift_boundary(const struct rsvc_cd_shift* shift, size_t sector);
+
+// Writes the silence before the audio, if any.
+bool rsvc_cd_shift_begin(struct rsvc_cd_shift* shift, rsvc_cd_write_f write, rsvc_done_t fail);
+
+// Writes the part of `size` bytes just read that belongs to the audio.
+bool rsvc_cd_shift_write(struct rsvc_cd_shift* shift, const unsigned char* data, size_t size,
+                         rsvc_cd_write_f write, rsvc_done_t fail);
+
+// Writes the silence after the audio, if any.
+bool rsvc_cd_shift_end(struct rsvc_cd_shift* shift, rsvc_cd_write_f write, rsvc_done_t fail);
+
+// Looks up the read offset of a drive model by its SCSI INQUIRY vendor
+// and product strings.  Returns false if the model is unknown.
+bool rsvc_cd_drive_offset(const char* vendor, const char* product, int* offset);
+
+#endif  // SRC_RSVC_CD_OFFSET_H_
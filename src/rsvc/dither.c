@@ -0,0 +1,211 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "dither.h"
+
+#include <string.h>
+
+#include "sample.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RSVC_DITHER_X86 1
+#include <immintrin.h>
+#endif
+
+// Error feedback coefficients for noise shaping (Wannamaker's 3-tap
+// filter, which puts most of the noise above 10kHz).
+static const float kShapingFilter[3] = {1.623f, -0.982f, 0.109f};
+
+void rsvc_dither_init(struct rsvc_dither* dither, size_t channels, size_t from_bits,
+                      bool noise_shaping) {
+    memset(dither, 0, sizeof(*dither));
+    dither->channels = channels;
+    dither->shift = (from_bits > 16) ? (from_bits - 16) : 0;
+    dither->noise_shaping = noise_shaping;
+    for (int i = 0; i < RSVC_DITHER_LANES; ++i) {
+        dither->rng[i] = 0x9e3779b9u * (i + 1);
+    }
+}
+
+static inline uint32_t xorshift32(uint32_t x) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return x;
+}
+
+static inline int16_t clip16(int32_t sample) {
+    if (sample > INT16_MAX) {
+        return INT16_MAX;
+    } else if (sample < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return sample;
+}
+
+// Each random number gives two uniform values of `shift` bits, from its
+// low and high halves; their difference is triangular.  Arithmetic is
+// unsigned, so that it wraps the same way as the vector versions.
+static void dither_scalar(struct rsvc_dither* d, const int32_t* in, int16_t* out,
+                          size_t begin, size_t end) {
+    const uint32_t mask = (1u << d->shift) - 1;
+    const uint32_t bias = 1u << (d->shift - 1);
+    for (size_t i = begin; i < end; ++i) {
+        uint32_t* rng = &d->rng[i % RSVC_DITHER_LANES];
+        uint32_t r = *rng = xorshift32(*rng);
+        uint32_t noise = (r & mask) - ((r >> 16) & mask);
+        uint32_t sample = (uint32_t)in[i] + noise + bias;
+        out[i] = clip16((int32_t)sample >> d->shift);
+    }
+}
+
+static void dither_shaped(struct rsvc_dither* d, const int32_t* in, int16_t* out,
+                          size_t count) {
+    const uint32_t mask = (1u << d->shift) - 1;
+    const float scale = 1.0f / (1u << d->shift);
+    for (size_t i = 0; i < count; ++i) {
+        float* e = d->error[i % d->channels];
+        uint32_t* rng = &d->rng[i % RSVC_DITHER_LANES];
+        uint32_t r = *rng = xorshift32(*rng);
+        float noise = ((int32_t)(r & mask) - (int32_t)((r >> 16) & mask)) * scale;
+
+        float wanted = (in[i] * scale)
+                     - (kShapingFilter[0] * e[0])
+                     - (kShapingFilter[1] * e[1])
+                     - (kShapingFilter[2] * e[2]);
+        int32_t quantized = (int32_t)(wanted + noise + 32768.5f) - 32768;
+        out[i] = clip16(quantized);
+
+        // Feed back the error before clipping, so that clipping
+        // cannot make the filter run away.
+        e[2] = e[1];
+        e[1] = e[0];
+        e[0] = quantized - wanted;
+    }
+}
+
+#ifdef RSVC_DITHER_X86
+
+static inline __m128i xorshift32_sse2(__m128i x) {
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+    return x;
+}
+
+__attribute__((target("sse2")))
+static size_t dither_sse2(struct rsvc_dither* d, const int32_t* in, int16_t* out,
+                          size_t count) {
+    const __m128i mask = _mm_set1_epi32((1u << d->shift) - 1);
+    const __m128i bias = _mm_set1_epi32(1u << (d->shift - 1));
+    const __m128i shift = _mm_cvtsi32_si128(d->shift);
+    __m128i rng0 = _mm_loadu_si128((const __m128i*)&d->rng[0]);
+    __m128i rng1 = _mm_loadu_si128((const __m128i*)&d->rng[4]);
+
+    size_t i = 0;
+    for ( ; i + 8 <= count; i += 8) {
+        rng0 = xorshift32_sse2(rng0);
+        rng1 = xorshift32_sse2(rng1);
+        __m128i noise0 = _mm_sub_epi32(_mm_and_si128(rng0, mask),
+                                       _mm_and_si128(_mm_srli_epi32(rng0, 16), mask));
+        __m128i noise1 = _mm_sub_epi32(_mm_and_si128(rng1, mask),
+                                       _mm_and_si128(_mm_srli_epi32(rng1, 16), mask));
+        __m128i s0 = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i s1 = _mm_loadu_si128((const __m128i*)(in + i + 4));
+        s0 = _mm_sra_epi32(_mm_add_epi32(_mm_add_epi32(s0, noise0), bias), shift);
+        s1 = _mm_sra_epi32(_mm_add_epi32(_mm_add_epi32(s1, noise1), bias), shift);
+        // Packing saturates, which clips.
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packs_epi32(s0, s1));
+    }
+
+    _mm_storeu_si128((__m128i*)&d->rng[0], rng0);
+    _mm_storeu_si128((__m128i*)&d->rng[4], rng1);
+    return i;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i xorshift32_avx2(__m256i x) {
+    x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+    x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+    return x;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i dither_avx2_step(__m256i s, __m256i* rng, __m256i mask, __m256i bias,
+                                       __m128i shift) {
+    *rng = xorshift32_avx2(*rng);
+    __m256i noise = _mm256_sub_epi32(_mm256_and_si256(*rng, mask),
+                                     _mm256_and_si256(_mm256_srli_epi32(*rng, 16), mask));
+    return _mm256_sra_epi32(_mm256_add_epi32(_mm256_add_epi32(s, noise), bias), shift);
+}
+
+__attribute__((target("avx2")))
+static size_t dither_avx2(struct rsvc_dither* d, const int32_t* in, int16_t* out,
+                          size_t count) {
+    const __m256i mask = _mm256_set1_epi32((1u << d->shift) - 1);
+    const __m256i bias = _mm256_set1_epi32(1u << (d->shift - 1));
+    const __m128i shift = _mm_cvtsi32_si128(d->shift);
+    __m256i rng = _mm256_loadu_si256((const __m256i*)d->rng);
+
+    size_t i = 0;
+    for ( ; i + 16 <= count; i += 16) {
+        __m256i s0 = _mm256_loadu_si256((const __m256i*)(in + i));
+        __m256i s1 = _mm256_loadu_si256((const __m256i*)(in + i + 8));
+        s0 = dither_avx2_step(s0, &rng, mask, bias, shift);
+        s1 = dither_avx2_step(s1, &rng, mask, bias, shift);
+        // Packing works within 128-bit halves; put the quarters back
+        // in order afterwards.
+        __m256i packed = _mm256_packs_epi32(s0, s1);
+        packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i*)(out + i), packed);
+    }
+
+    _mm256_storeu_si256((__m256i*)d->rng, rng);
+    return i;
+}
+
+#endif  // RSVC_DITHER_X86
+
+void rsvc_dither_s32_to_s16(struct rsvc_dither* dither, const int32_t* in, int16_t* out,
+                            size_t count) {
+    if (dither->shift == 0) {
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = clip16(in[i]);
+        }
+        return;
+    } else if (dither->noise_shaping) {
+        dither_shaped(dither, in, out, count);
+        return;
+    }
+
+    size_t done = 0;
+#ifdef RSVC_DITHER_X86
+    switch (rsvc_sample_isa()) {
+      case RSVC_ISA_AVX2: done = dither_avx2(dither, in, out, count); break;
+      case RSVC_ISA_SSE2: done = dither_sse2(dither, in, out, count); break;
+      case RSVC_ISA_SCALAR: break;
+    }
+#endif
+    dither_scalar(dither, in, out, done, count);
+}
@@ -0,0 +1,58 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#ifndef SRC_RSVC_DITHER_H_
+#define SRC_RSVC_DITHER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define RSVC_DITHER_MAX_CHANNELS 8
+#define RSVC_DITHER_LANES 8
+
+// Requantizes interleaved int32 samples with `from_bits` significant
+// bits (at most 30) down to int16, with TPDF dither.  Each sample
+// is rounded after adding triangular noise of +/-1 LSB of the
+// output, which decorrelates the quantization error from the signal.
+//
+// With noise shaping, the quantization error is also fed back through
+// a 3-tap filter, which moves the noise towards high frequencies where
+// it is less audible.  That path is inherently sequential and is not
+// vectorized.
+struct rsvc_dither {
+    size_t    channels;
+    int       shift;
+    bool      noise_shaping;
+
+    // One random number generator per lane; sample `i` of a call uses
+    // lane `i % RSVC_DITHER_LANES`, so all implementations produce the
+    // same output.
+    uint32_t  rng[RSVC_DITHER_LANES];
+    float     error[RSVC_DITHER_MAX_CHANNELS][3];
+};
+
+void rsvc_dither_init(struct rsvc_dither* dither, size_t channels, size_t from_bits,
+                      bool noise_shaping);
+void rsvc_dither_s32_to_s16(struct rsvc_dither* dither, const int32_t* in, int16_t* out,
+                            size_t count);
+
+#endif  // SRC_RSVC_DITHER_H_
@@ -0,0 +1,168 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "downmix.h"
+
+#include <math.h>
+
+#include "common.h"
+#include "dither.h"
+#include "sample.h"
+#include "unix.h"
+
+#define kDownmixMaxChannels  8
+#define kDownmixFrames       1024
+
+enum downmix_speaker {
+    FL, FR, FC, LFE, BL, BR, BC, SL, SR,
+};
+
+static const enum downmix_speaker kDownmixLayouts[kDownmixMaxChannels + 1][8] = {
+    [3] = {FL, FR, FC},
+    [4] = {FL, FR, BL, BR},
+    [5] = {FL, FR, FC, BL, BR},
+    [6] = {FL, FR, FC, LFE, BL, BR},
+    [7] = {FL, FR, FC, LFE, BC, SL, SR},
+    [8] = {FL, FR, FC, LFE, BL, BR, SL, SR},
+};
+
+// Fills `matrix` with the left output's coefficient for each input
+// channel, then the right's, as rsvc_sample_mix_f32() expects.
+static bool downmix_matrix(size_t channels, const struct rsvc_downmix_levels* levels,
+                           float* matrix, rsvc_done_t fail) {
+    if ((channels < 3) || (channels > kDownmixMaxChannels)) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "can't downmix %zu-channel audio", channels);
+        return false;
+    }
+    float* left = matrix;
+    float* right = matrix + channels;
+    float sum = 0;
+    for (size_t c = 0; c < channels; ++c) {
+        float l = 0, r = 0;
+        switch (kDownmixLayouts[channels][c]) {
+          case FL:  l = 1;                                        break;
+          case FR:  r = 1;                                        break;
+          case FC:  l = r = levels->center;                       break;
+          case LFE: l = r = levels->lfe;                          break;
+          case BC:  l = r = levels->surround * 0.70710678f;       break;
+          case BL:
+          case SL:  l = levels->surround;                         break;
+          case BR:
+          case SR:  r = levels->surround;                         break;
+        }
+        left[c] = l;
+        right[c] = r;
+        sum += fabsf(l);
+    }
+
+    // Both sides are symmetric, so they have the same sum.
+    if (sum > 1) {
+        for (size_t c = 0; c < 2 * channels; ++c) {
+            matrix[c] /= sum;
+        }
+    }
+    return true;
+}
+
+bool rsvc_downmix(FILE* src_file, FILE* dst_file, rsvc_audio_info_t info,
+                  const struct rsvc_downmix_levels* levels, bool noise_shaping,
+                  rsvc_done_t fail) {
+    const size_t channels = info->channels;
+    float matrix[2 * kDownmixMaxChannels];
+    if (!(rsvc_audio_info_validate(info, fail)
+          && downmix_matrix(channels, levels, matrix, fail))) {
+        return false;
+    } else if ((info->sample_format == RSVC_SAMPLE_S32) && (info->bits_per_sample > 24)) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "can't downmix %zu-bit audio",
+                    info->bits_per_sample);
+        return false;
+    }
+
+    struct rsvc_dither dither;
+    if (info->sample_format == RSVC_SAMPLE_S16) {
+        rsvc_dither_init(&dither, 2, 24, noise_shaping);
+    }
+    const float scale = 1.0f / (1u << (info->bits_per_sample - 1));
+    const size_t block_align = info->block_align / channels * 2;
+
+    union {
+        int16_t  s16[kDownmixMaxChannels * kDownmixFrames];
+        int32_t  s32[kDownmixMaxChannels * kDownmixFrames];
+        float    f32[kDownmixMaxChannels * kDownmixFrames];
+    } in;
+    union {
+        int32_t  s32[2 * kDownmixFrames];
+        float    f32[2 * kDownmixFrames];
+    } out;
+    int16_t s16[2 * kDownmixFrames];
+    float planar[kDownmixMaxChannels][kDownmixFrames];
+    float mixed[2][kDownmixFrames];
+    float* in_planes[kDownmixMaxChannels];
+    for (size_t c = 0; c < channels; ++c) {
+        in_planes[c] = planar[c];
+    }
+    float* out_planes[2] = {mixed[0], mixed[1]};
+
+    bool eof = false;
+    while (!eof) {
+        size_t n;
+        if (!rsvc_read("pipe", src_file, &in, kDownmixFrames, info->block_align,
+                       &n, &eof, fail)) {
+            return false;
+        } else if (n == 0) {
+            continue;
+        }
+
+        switch (info->sample_format) {
+          case RSVC_SAMPLE_S16:
+            rsvc_sample_deinterleave_s16_to_f32(in.s16, in_planes, channels, n, scale);
+            break;
+          case RSVC_SAMPLE_S32:
+            rsvc_sample_deinterleave_s32_to_f32(in.s32, in_planes, channels, n, scale);
+            break;
+          case RSVC_SAMPLE_F32:
+            rsvc_sample_deinterleave_f32(in.f32, in_planes, channels, n);
+            break;
+        }
+        rsvc_sample_mix_f32((const float* const*)in_planes, out_planes, channels, 2, n, matrix);
+
+        const float* const* mix = (const float* const*)out_planes;
+        const void* data = out.s32;
+        switch (info->sample_format) {
+          case RSVC_SAMPLE_S16:
+            rsvc_sample_interleave_f32_to_s32(mix, out.s32, 2, n, 24);
+            rsvc_dither_s32_to_s16(&dither, out.s32, s16, 2 * n);
+            data = s16;
+            break;
+          case RSVC_SAMPLE_S32:
+            rsvc_sample_interleave_f32_to_s32(mix, out.s32, 2, n, info->bits_per_sample);
+            break;
+          case RSVC_SAMPLE_F32:
+            rsvc_sample_interleave_f32(mix, out.f32, 2, n);
+            break;
+        }
+        if (!rsvc_write("pipe", dst_file, data, n * block_align, fail)) {
+            return false;
+        }
+    }
+    return true;
+}
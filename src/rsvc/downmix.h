@@ -0,0 +1,59 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#ifndef SRC_RSVC_DOWNMIX_H_
+#define SRC_RSVC_DOWNMIX_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <rsvc/audio.h>
+
+// Mixes surround audio down to stereo, as a stage between a decoder and
+// its encoders.  Input channels are in WAV order:
+//
+//   3: L R C
+//   4: L R Ls Rs
+//   5: L R C Ls Rs
+//   6: L R C LFE Ls Rs
+//   7: L R C LFE Cs Ls Rs
+//   8: L R C LFE Lb Rb Ls Rs
+//
+// Each side gets its front channel, plus the center, LFE, and its
+// surround channels at the given levels; a back center goes to both
+// sides, 3 dB below `surround`.  The mix is then scaled so that
+// full-scale input can't clip.
+struct rsvc_downmix_levels {
+    float  center;
+    float  surround;
+    float  lfe;
+};
+
+// ITU-R BS.775: center and surrounds at -3 dB, LFE dropped.
+#define RSVC_DOWNMIX_ITU {.center = 0.70710678f, .surround = 0.70710678f, .lfe = 0.0f}
+
+// Reads interleaved audio described by `info` from `src_file` until
+// EOF, and writes it to `dst_file` as stereo in the same sample format.
+// 16-bit output is dithered, and noise-shaped if `noise_shaping` is
+// set.
+bool rsvc_downmix(FILE* src_file, FILE* dst_file, rsvc_audio_info_t info,
+                  const struct rsvc_downmix_levels* levels, bool noise_shaping,
+                  rsvc_done_t fail);
+
+#endif  // SRC_RSVC_DOWNMIX_H_
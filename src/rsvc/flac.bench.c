@@ -0,0 +1,285 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+// For RTLD_NEXT.
+#define _GNU_SOURCE
+#define _DARWIN_C_SOURCE
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <math.h>
+#include <rsvc/audio.h>
+#include <rsvc/format.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <time.h>
+
+#include "common.h"
+#include "unix.h"
+
+// A minute of CD-quality stereo audio.
+#define kRate      44100
+#define kFrames    (kRate * 60)
+#define kChannels  2
+#define kSamples   (kFrames * kChannels)
+
+// Decoding allocates a fixed amount up front, for the decoder and its
+// buffers, and should allocate nothing per block.  A minute of audio
+// is about 650 blocks, so a per-block allocation trips this.
+#define kMaxAllocationsPerMinute  100
+
+// Counts calls to malloc(), calloc(), and realloc() from rsvc and the
+// codec libraries linked into this binary, by wrapping the system's.
+static atomic_size_t allocations;
+static void* (*system_malloc)(size_t size);
+static void* (*system_calloc)(size_t count, size_t size);
+static void* (*system_realloc)(void* ptr, size_t size);
+static void  (*system_free)(void* ptr);
+
+// dlsym() may itself allocate before the wrappers are ready.
+static max_align_t  bootstrap[256];
+static size_t       bootstrap_used;
+
+static bool is_bootstrap(void* ptr) {
+    return ((uint8_t*)ptr >= (uint8_t*)bootstrap)
+        && ((uint8_t*)ptr < (uint8_t*)(bootstrap + 256));
+}
+
+static void* bootstrap_alloc(size_t size) {
+    size_t n = (size + sizeof(max_align_t) - 1) / sizeof(max_align_t);
+    if (bootstrap_used + n > 256) {
+        return NULL;
+    }
+    void* ptr = bootstrap + bootstrap_used;
+    bootstrap_used += n;
+    return ptr;
+}
+
+static void init_allocator() {
+    static bool initializing = false;
+    if (system_malloc || initializing) {
+        return;
+    }
+    initializing = true;
+    system_calloc = dlsym(RTLD_NEXT, "calloc");
+    system_realloc = dlsym(RTLD_NEXT, "realloc");
+    system_free = dlsym(RTLD_NEXT, "free");
+    system_malloc = dlsym(RTLD_NEXT, "malloc");
+}
+
+void* malloc(size_t size) {
+    init_allocator();
+    if (!system_malloc) {
+        return bootstrap_alloc(size);
+    }
+    atomic_fetch_add(&allocations, 1);
+    return system_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    init_allocator();
+    if (!system_calloc) {
+        return bootstrap_alloc(count * size);  // already zero
+    }
+    atomic_fetch_add(&allocations, 1);
+    return system_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    if (is_bootstrap(ptr)) {
+        void* copy = malloc(size);
+        memcpy(copy, ptr, MIN(size, (uint8_t*)(bootstrap + 256) - (uint8_t*)ptr));
+        return copy;
+    }
+    init_allocator();
+    atomic_fetch_add(&allocations, 1);
+    return system_realloc(ptr, size);
+}
+
+void free(void* ptr) {
+    if (ptr && !is_bootstrap(ptr)) {
+        system_free(ptr);
+    }
+}
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Errors in a benchmark aren't recoverable.
+static rsvc_done_t fail = ^(rsvc_error_t error){
+    errf("%s (%s:%d)\n", error->message, error->file, error->lineno);
+    exit(1);
+};
+
+// Encodes a minute of audio: a chord with a little noise, so that it
+// compresses about as well as music does.
+static bool encode(size_t bits, uint8_t** data, size_t* size) {
+    const bool wide = (bits > 16);
+    const size_t sample_size = wide ? sizeof(int32_t) : sizeof(int16_t);
+    void* pcm = malloc(kSamples * sample_size);
+    unsigned seed = 1;
+    for (size_t i = 0; i < kFrames; ++i) {
+        double t = (double)i / kRate;
+        for (int c = 0; c < kChannels; ++c) {
+            double x = 0.3 * sin(2 * M_PI * 220 * (c + 1) * t)
+                     + 0.2 * sin(2 * M_PI * 277.18 * t)
+                     + 0.1 * sin(2 * M_PI * 329.63 * t)
+                     + 0.01 * ((rand_r(&seed) / (double)RAND_MAX) - 0.5);
+            int32_t sample = lrint(x * ((1 << (bits - 1)) - 1));
+            if (wide) {
+                ((int32_t*)pcm)[(i * kChannels) + c] = sample;
+            } else {
+                ((int16_t*)pcm)[(i * kChannels) + c] = sample;
+            }
+        }
+    }
+
+    FILE* src_file;
+    FILE* dst_file = tmpfile();
+    if (!dst_file) {
+        rsvc_strerrorf(fail, __FILE__, __LINE__, "tmpfile");
+        return false;
+    } else if (!rsvc_memopen(pcm, kSamples * sample_size, &src_file, fail)) {
+        return false;
+    }
+    struct rsvc_encode_options options = {
+        .info = {
+            .sample_rate          = kRate,
+            .channels             = kChannels,
+            .samples_per_channel  = kFrames,
+            .bits_per_sample      = bits,
+            .block_align          = kChannels * sample_size,
+            .sample_format        = wide ? RSVC_SAMPLE_S32 : RSVC_SAMPLE_S16,
+        },
+        .level     = 5,
+        .verify    = RSVC_VERIFY_NONE,
+        .progress  = ^(double fraction){
+            (void)fraction;
+        },
+    };
+    if (!rsvc_flac.encode(src_file, dst_file, &options, fail)) {
+        return false;
+    }
+    fclose(src_file);
+    free(pcm);
+
+    *size = ftello(dst_file);
+    *data = malloc(*size);
+    rewind(dst_file);
+    if (!rsvc_read("flac", dst_file, *data, 1, *size, NULL, NULL, fail)) {
+        return false;
+    }
+    fclose(dst_file);
+    return true;
+}
+
+// Decodes `data`, printing throughput as a multiple of realtime and
+// allocations per minute of audio decoded.  If `mapped`, it is decoded
+// from a regular file, which the decoder can map; otherwise, from a
+// stream that it must read.
+static bool bench(const char* name, const uint8_t* data, size_t size, unsigned sample_formats,
+                  bool mapped) {
+    FILE* null_file;
+    FILE* tmp_file = NULL;
+    if (!rsvc_open("/dev/null", O_WRONLY, 0, &null_file, fail)) {
+        return false;
+    } else if (mapped) {
+        if (!(tmp_file = tmpfile())) {
+            rsvc_strerrorf(fail, __FILE__, __LINE__, "tmpfile");
+            return false;
+        } else if (!rsvc_write("flac", tmp_file, data, size, fail)) {
+            return false;
+        }
+    }
+
+    static const int kRuns = 5;
+    double best_time = 0;
+    size_t best_allocations = 0;
+    for (int i = 0; i < kRuns; ++i) {
+        FILE* src_file;
+        if (mapped) {
+            rewind(tmp_file);
+            src_file = tmp_file;
+        } else if (!rsvc_memopen(data, size, &src_file, fail)) {
+            return false;
+        }
+
+        struct rsvc_decode_options options = {.sample_formats = sample_formats};
+        size_t start_allocations = atomic_load(&allocations);
+        double start = now();
+        if (!rsvc_flac.decode(src_file, null_file, &options, ^(rsvc_audio_info_t info){
+            (void)info;
+        }, fail)) {
+            return false;
+        }
+        double time = now() - start;
+        size_t n = atomic_load(&allocations) - start_allocations;
+        if ((i == 0) || (time < best_time)) {
+            best_time = time;
+        }
+        best_allocations = (i == 0) ? n : MIN(n, best_allocations);
+
+        if (!mapped) {
+            fclose(src_file);
+        }
+    }
+
+    const double minutes = kFrames / (kRate * 60.0);
+    const double per_minute = best_allocations / minutes;
+    const bool ok = (per_minute <= kMaxAllocationsPerMinute);
+    outf("%-28s %9.0fx realtime %7.0f allocs/min%s\n", name,
+         (kFrames / (double)kRate) / best_time, per_minute, ok ? "" : "  TOO MANY");
+
+    if (tmp_file) {
+        fclose(tmp_file);
+    }
+    fclose(null_file);
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+
+    uint8_t* flac16;
+    uint8_t* flac24;
+    size_t flac16_size, flac24_size;
+    if (!(encode(16, &flac16, &flac16_size) && encode(24, &flac24, &flac24_size))) {
+        return 1;
+    }
+
+    const unsigned s32 = RSVC_SAMPLE_FORMAT_BIT(RSVC_SAMPLE_S32);
+    bool ok = true;
+    ok = bench("flac_decode_s16", flac16, flac16_size, 0, true) && ok;
+    ok = bench("flac_decode_s16 (stream)", flac16, flac16_size, 0, false) && ok;
+    ok = bench("flac_decode_s24_to_s16", flac24, flac24_size, 0, true) && ok;
+    ok = bench("flac_decode_s24_to_s32", flac24, flac24_size, s32, true) && ok;
+    ok = bench("flac_decode_s24 (stream)", flac24, flac24_size, s32, false) && ok;
+
+    free(flac16);
+    free(flac24);
+    return ok ? 0 : 1;
+}
@@ -39,8 +39,25 @@
 
 #include "audio.h"
 #include "common.h"
+#include "dither.h"
+#include "md5.h"
+#include "sample.h"
 #include "unix.h"
 
+// Parallel encoding sets the block size explicitly, since it depends
+// on it.  This is the block size of compression levels 3 through 8.
+#define kFlacBlockSize 4096
+
+// Parallel encoding splits the input into chunks of this many samples
+// per channel (about 6 seconds of CD audio), unless segment_samples
+// asks for another size.  Streams shorter than two chunks are encoded
+// serially.
+#define kFlacChunkSamples        (kFlacBlockSize * 64)
+
+// When the decoder's input can't be mapped, it is read this many bytes
+// at a time.
+#define kFlacReadAheadSize       (1 << 18)
+
 typedef FLAC__StreamEncoderWriteStatus write_encode_status_t;
 typedef FLAC__StreamEncoderSeekStatus seek_encode_status_t;
 typedef FLAC__StreamEncoderTellStatus tell_encode_status_t;
@@ -59,21 +76,52 @@ static seek_encode_status_t    flac_encode_seek(const FLAC__StreamEncoder* encod
 static tell_encode_status_t    flac_encode_tell(const FLAC__StreamEncoder* encoder,
                                                 FLAC__uint64* absolute_byte_offset,
                                                 void* userdata);
+static size_t                  flac_chunk_samples(rsvc_encode_options_t options);
+static bool                    flac_encode_parallel(FILE* src_file, FILE* dst_file,
+                                                    rsvc_encode_options_t options,
+                                                    rsvc_done_t fail);
 
 typedef FLAC__StreamDecoderReadStatus read_decode_status_t;
 typedef FLAC__StreamDecoderWriteStatus write_decode_status_t;
 typedef FLAC__StreamDecoderSeekStatus seek_decode_status_t;
 typedef FLAC__StreamDecoderTellStatus tell_decode_status_t;
 typedef FLAC__StreamDecoderLengthStatus length_decode_status_t;
+// The decoder's input: the whole file, if it can be mapped, or else a
+// window of it, refilled kFlacReadAheadSize bytes at a time.
+struct flac_input {
+    FILE*           file;
+    uint8_t*        map;
+    size_t          map_size;
+    uint8_t*        buffer;
+    const uint8_t*  data;    // map or buffer
+    size_t          size;    // bytes at data
+    size_t          pos;     // next byte at data
+    uint64_t        offset;  // file offset of data[0]
+    bool            eof;
+};
+
 typedef struct flac_decode_userdata* flac_decode_userdata_t;
 struct flac_decode_userdata {
-    FILE*               read_file;
-    FILE*               write_file;
-    rsvc_decode_info_f  info;
-    rsvc_done_t         fail;
-    bool                called_done;
+    struct flac_input        input;
+    FILE*                    write_file;
+    unsigned                 sample_formats;
+    enum rsvc_sample_format  sample_format;
+    bool                     noise_shaping;
+    struct rsvc_dither       dither;
+    rsvc_decode_info_f       info;
+    rsvc_done_t              fail;
+    bool                     called_done;
+
+    // Interleaved output for one block, sized from STREAMINFO's
+    // maximum block size, so that decoding doesn't allocate per block.
+    int32_t*                 s32;
+    int16_t*                 s16;
+    size_t                   capacity;  // in samples
 };
 
+static void                    flac_input_init(struct flac_input* input, FILE* file);
+static void                    flac_input_clear(struct flac_input* input);
+static void                    flac_decode_reserve(flac_decode_userdata_t u, size_t nsamples);
 static void                    flac_decode_metadata(const FLAC__StreamDecoder* decoder,
                                                     const FLAC__StreamMetadata* metadata,
                                                     void* userdata);
@@ -112,18 +160,60 @@ static void                    flac_decode_error(const FLAC__StreamDecoder* deco
 bool rsvc_flac_encode_options_validate(rsvc_encode_options_t opts, rsvc_done_t fail) {
     if (!rsvc_audio_info_validate(&opts->info, fail)) {
         return false;
-    } else if (opts->info.bits_per_sample != 16) {
-        rsvc_errorf(fail, __FILE__, __LINE__, "need 16-bit input");
+    } else if (opts->info.sample_format == RSVC_SAMPLE_F32) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "need integer input");
+        return false;
+    } else if (opts->info.bits_per_sample > 24) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "can't encode %zu-bit flac",
+                    opts->info.bits_per_sample);
+        return false;
+    } else if ((opts->level < 0) || (opts->level > 8)) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "invalid flac compression level: %d", opts->level);
         return false;
     }
     return true;
 }
 
+// Configures `encoder` as described by `options`, and initializes it.
+// If `blocksize` is 0, the compression level picks it.  Returns NULL on
+// success, or a description of the failure.
+static const char* flac_encoder_init(FLAC__StreamEncoder* encoder, rsvc_encode_options_t options,
+                                     unsigned blocksize,
+                                     FLAC__StreamEncoderWriteCallback write,
+                                     FLAC__StreamEncoderSeekCallback seek,
+                                     FLAC__StreamEncoderTellCallback tell, void* userdata) {
+    rsvc_audio_info_t info = &options->info;
+    if (!(FLAC__stream_encoder_set_verify(encoder, options->verify == RSVC_VERIFY_INLINE) &&
+          FLAC__stream_encoder_set_compression_level(encoder, options->level) &&
+          (!blocksize || FLAC__stream_encoder_set_blocksize(encoder, blocksize)) &&
+          FLAC__stream_encoder_set_channels(encoder, info->channels) &&
+          FLAC__stream_encoder_set_bits_per_sample(encoder, info->bits_per_sample) &&
+          FLAC__stream_encoder_set_sample_rate(encoder, info->sample_rate) &&
+          FLAC__stream_encoder_set_total_samples_estimate(encoder, info->samples_per_channel))) {
+        FLAC__StreamEncoderState state = FLAC__stream_encoder_get_state(encoder);
+        return FLAC__StreamEncoderStateString[state];
+    }
+
+    FLAC__StreamEncoderInitStatus init_status = FLAC__stream_encoder_init_stream(
+            encoder, write, seek, tell, NULL, userdata);
+    if (init_status == FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
+        return NULL;
+    } else if (init_status == FLAC__STREAM_ENCODER_INIT_STATUS_ENCODER_ERROR) {
+        FLAC__StreamEncoderState state = FLAC__stream_encoder_get_state(encoder);
+        return FLAC__StreamEncoderStateString[state];
+    } else {
+        return FLAC__StreamEncoderInitStatusString[init_status];
+    }
+}
+
 bool rsvc_flac_encode(FILE* src_file, FILE* dst_file, rsvc_encode_options_t options, rsvc_done_t fail) {
     struct rsvc_audio_info info         = options->info;
     rsvc_encode_progress_f progress     = options->progress;
     if (!rsvc_flac_encode_options_validate(options, fail)) {
         return false;
+    } else if ((options->threads > 1)
+               && (info.samples_per_channel >= (2 * flac_chunk_samples(options)))) {
+        return flac_encode_parallel(src_file, dst_file, options, fail);
     }
 
     FLAC__StreamEncoder *encoder = NULL;
@@ -140,16 +230,6 @@ bool rsvc_flac_encode(FILE* src_file, FILE* dst_file, rsvc_encode_options_t opti
         FLAC__stream_encoder_delete(encoder);
     };
 
-    if (!(FLAC__stream_encoder_set_verify(encoder, true) &&
-          FLAC__stream_encoder_set_compression_level(encoder, 8) &&
-          FLAC__stream_encoder_set_channels(encoder, info.channels) &&
-          FLAC__stream_encoder_set_bits_per_sample(encoder, info.bits_per_sample) &&
-          FLAC__stream_encoder_set_sample_rate(encoder, info.sample_rate) &&
-          FLAC__stream_encoder_set_total_samples_estimate(encoder, info.samples_per_channel))) {
-        FLAC__StreamEncoderState state = FLAC__stream_encoder_get_state(encoder);
-        const char* message = FLAC__StreamEncoderStateString[state];
-        rsvc_errorf(fail, __FILE__, __LINE__, "%s", message);
-    }
 
     // comment_metadata = FLAC__metadata_object_new(FLAC__METADATA_TYPE_VORBIS_COMMENT);
     // padding_metadata = FLAC__metadata_object_new(FLAC__METADATA_TYPE_PADDING);
@@ -171,35 +251,30 @@ bool rsvc_flac_encode(FILE* src_file, FILE* dst_file, rsvc_encode_options_t opti
     struct flac_encode_userdata userdata = {
         .file = dst_file,
     };
-    FLAC__StreamEncoderInitStatus init_status = FLAC__stream_encoder_init_stream(
-            encoder, flac_encode_write, flac_encode_seek, flac_encode_tell, NULL, &userdata);
-    if (init_status != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
-        const char* message;
-        if (init_status == FLAC__STREAM_ENCODER_INIT_STATUS_ENCODER_ERROR) {
-            FLAC__StreamEncoderState state = FLAC__stream_encoder_get_state(encoder);
-            message = FLAC__StreamEncoderStateString[state];
-        } else {
-            message = FLAC__StreamEncoderInitStatusString[init_status];
-        }
+    const char* message = flac_encoder_init(encoder, options, 0, flac_encode_write,
+                                            flac_encode_seek, flac_encode_tell, &userdata);
+    if (message) {
         cleanup();
         rsvc_errorf(fail, __FILE__, __LINE__, "%s", message);
         return false;
     }
 
+    // 32-bit input is already in the form FLAC wants; 16-bit input is
+    // widened into `samples`.
     static const int kSamples = 2048;
-    int16_t buffer[kSamples * 2];
+    const bool wide = (info.sample_format == RSVC_SAMPLE_S32);
+    int16_t buffer[kSamples * 8];
+    FLAC__int32 samples[kSamples * 8];
     bool eof = false;
     while (!eof) {
         size_t nsamples;
-        if (!rsvc_read(  "pipe", src_file, buffer, kSamples, 2 * sizeof(int16_t),
-                         &nsamples, &eof, fail)) {
+        if (!rsvc_read(  "pipe", src_file, wide ? (void*)samples : (void*)buffer, kSamples,
+                         info.block_align, &nsamples, &eof, fail)) {
             return false;
         } else if (nsamples) {
             samples_per_channel_read += nsamples;
-            FLAC__int32 samples[kSamples * 2];
-            FLAC__int32* sp = samples;
-            for (int16_t* p = buffer; p < buffer + (nsamples * 2); ++p) {
-                *(sp++) = *p;
+            if (!wide) {
+                rsvc_sample_s16_to_s32(buffer, samples, nsamples * info.channels);
             }
             if (!FLAC__stream_encoder_process_interleaved(encoder, samples, nsamples)) {
                 FLAC__StreamEncoderState state = FLAC__stream_encoder_get_state(encoder);
@@ -222,7 +297,7 @@ bool rsvc_flac_encode(FILE* src_file, FILE* dst_file, rsvc_encode_options_t opti
     return true;
 }
 
-bool rsvc_flac_decode(FILE* src_file, FILE* dst_file,
+bool rsvc_flac_decode(FILE* src_file, FILE* dst_file, rsvc_decode_options_t options,
                       rsvc_decode_info_f info, rsvc_done_t fail) {
     FLAC__StreamDecoder *decoder = NULL;
 
@@ -231,15 +306,20 @@ bool rsvc_flac_decode(FILE* src_file, FILE* dst_file,
         rsvc_errorf(fail, __FILE__, __LINE__, "couldn't allocate FLAC decoder");
         return false;
     }
+    struct flac_decode_userdata userdata = {
+        .write_file      = dst_file,
+        .sample_formats  = options->sample_formats,
+        .noise_shaping   = options->noise_shaping,
+        .info            = info,
+        .fail            = fail,
+    };
+    flac_decode_userdata_t u = &userdata;
+    flac_input_init(&u->input, src_file);
     void (^cleanup)() = ^{
         FLAC__stream_decoder_delete(decoder);
-    };
-
-    struct flac_decode_userdata userdata = {
-        .read_file   = src_file,
-        .write_file  = dst_file,
-        .info        = info,
-        .fail        = fail,
+        flac_input_clear(&u->input);
+        free(u->s32);
+        free(u->s16);
     };
     FLAC__StreamDecoderInitStatus init_status = FLAC__stream_decoder_init_stream(
             decoder, flac_decode_read, flac_decode_seek, flac_decode_tell,
@@ -266,6 +346,240 @@ bool rsvc_flac_decode(FILE* src_file, FILE* dst_file,
     return true;
 }
 
+struct flac_verify_userdata {
+    uint64_t                        total_samples;
+    uint64_t                        samples;
+    bool                            has_md5;
+    bool                            has_error;
+    FLAC__StreamDecoderErrorStatus  error;
+};
+
+static write_decode_status_t flac_verify_write(const FLAC__StreamDecoder* decoder,
+                                               const FLAC__Frame* frame,
+                                               const FLAC__int32* const* data,
+                                               void* userdata) {
+    (void)decoder;
+    (void)data;
+    struct flac_verify_userdata* u = userdata;
+    u->samples += frame->header.blocksize;
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+static void flac_verify_metadata(const FLAC__StreamDecoder* decoder,
+                                 const FLAC__StreamMetadata* metadata, void* userdata) {
+    (void)decoder;
+    struct flac_verify_userdata* u = userdata;
+    if (metadata->type == FLAC__METADATA_TYPE_STREAMINFO) {
+        u->total_samples = metadata->data.stream_info.total_samples;
+        for (int i = 0; i < 16; ++i) {
+            u->has_md5 = u->has_md5 || metadata->data.stream_info.md5sum[i];
+        }
+    }
+}
+
+static void flac_verify_error(const FLAC__StreamDecoder* decoder,
+                              FLAC__StreamDecoderErrorStatus status, void* userdata) {
+    (void)decoder;
+    struct flac_verify_userdata* u = userdata;
+    if (!u->has_error) {
+        u->has_error = true;
+        u->error = status;
+    }
+}
+
+// Decodes the whole file, which makes libFLAC check every frame's CRC
+// and the MD5 signature of the decoded audio.
+bool rsvc_flac_verify(const char* path, rsvc_done_t fail) {
+    FLAC__StreamDecoder* decoder = FLAC__stream_decoder_new();
+    if (decoder == NULL) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "couldn't allocate FLAC decoder");
+        return false;
+    }
+
+    struct flac_verify_userdata userdata = {
+        .has_md5 = false,
+    };
+    FLAC__stream_decoder_set_md5_checking(decoder, true);
+    FLAC__StreamDecoderInitStatus init_status = FLAC__stream_decoder_init_file(
+            decoder, path, flac_verify_write, flac_verify_metadata, flac_verify_error,
+            &userdata);
+    if (init_status != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+        const char* message = FLAC__StreamDecoderInitStatusString[init_status];
+        FLAC__stream_decoder_delete(decoder);
+        rsvc_errorf(fail, __FILE__, __LINE__, "%s", message);
+        return false;
+    }
+
+    bool decoded = FLAC__stream_decoder_process_until_end_of_stream(decoder);
+    FLAC__StreamDecoderState state = FLAC__stream_decoder_get_state(decoder);
+    bool md5_matches = FLAC__stream_decoder_finish(decoder);
+    FLAC__stream_decoder_delete(decoder);
+
+    // A truncated file ends the stream early; report it by length.
+    if (!decoded && (state != FLAC__STREAM_DECODER_END_OF_STREAM)) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "%s", FLAC__StreamDecoderStateString[state]);
+        return false;
+    } else if (userdata.has_error) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "%s",
+                    FLAC__StreamDecoderErrorStatusString[userdata.error]);
+        return false;
+    } else if (userdata.total_samples && (userdata.samples != userdata.total_samples)) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "expected %llu samples; decoded %llu",
+                    (unsigned long long)userdata.total_samples,
+                    (unsigned long long)userdata.samples);
+        return false;
+    } else if (!userdata.has_md5) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "no MD5 signature to verify against");
+        return false;
+    } else if (!md5_matches) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "MD5 signature mismatch");
+        return false;
+    }
+    return true;
+}
+
+bool rsvc_flac_md5(const char* path, uint8_t* md5, rsvc_done_t fail) {
+    FLAC__StreamMetadata streaminfo;
+    if (!FLAC__metadata_get_streaminfo(path, &streaminfo)) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "couldn't read FLAC STREAMINFO");
+        return false;
+    }
+    memcpy(md5, streaminfo.data.stream_info.md5sum, 16);
+    return true;
+}
+
+static FLAC__StreamDecoderWriteStatus flac_scan_write(
+        const FLAC__StreamDecoder* decoder, const FLAC__Frame* frame,
+        const FLAC__int32* const buffer[], void* userdata) {
+    (void)decoder;
+    (void)frame;
+    (void)buffer;
+    (void)userdata;
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+static void flac_scan_error(const FLAC__StreamDecoder* decoder,
+                            FLAC__StreamDecoderErrorStatus status, void* userdata) {
+    (void)decoder;
+    (void)status;
+    (void)userdata;
+}
+
+// Points each seek point of `seektable` at the frame of `path` that
+// holds its sample, as the encoder would have.  Frames are skipped
+// rather than decoded; only their positions are needed.  Points past
+// the end become placeholders, as do duplicates.
+static bool flac_seektable_fill(FLAC__StreamMetadata* seektable, const char* path,
+                                rsvc_done_t fail) {
+    FLAC__StreamDecoder* decoder = FLAC__stream_decoder_new();
+    if (decoder == NULL) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "couldn't allocate FLAC decoder");
+        return false;
+    }
+    FLAC__stream_decoder_set_metadata_ignore_all(decoder);
+    FLAC__StreamDecoderInitStatus init_status = FLAC__stream_decoder_init_file(
+            decoder, path, flac_scan_write, NULL, flac_scan_error, NULL);
+    if (init_status != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+        FLAC__stream_decoder_delete(decoder);
+        rsvc_errorf(fail, __FILE__, __LINE__, "%s",
+                    FLAC__StreamDecoderInitStatusString[init_status]);
+        return false;
+    }
+
+    FLAC__StreamMetadata_SeekTable* table = &seektable->data.seek_table;
+    FLAC__StreamMetadata_SeekPoint* point = table->points;
+    FLAC__StreamMetadata_SeekPoint* end = table->points + table->num_points;
+    uint64_t first_frame, offset, sample = 0;
+    bool ok = FLAC__stream_decoder_process_until_end_of_metadata(decoder)
+        && FLAC__stream_decoder_get_decode_position(decoder, &first_frame);
+    while (ok && (point != end)
+           && (point->sample_number != FLAC__STREAM_METADATA_SEEKPOINT_PLACEHOLDER)) {
+        ok = FLAC__stream_decoder_get_decode_position(decoder, &offset)
+            && FLAC__stream_decoder_skip_single_frame(decoder);
+        if (!ok || (FLAC__stream_decoder_get_state(decoder) == FLAC__STREAM_DECODER_END_OF_STREAM)) {
+            break;
+        }
+        unsigned blocksize = FLAC__stream_decoder_get_blocksize(decoder);
+        for ( ; (point != end) && (point->sample_number < sample + blocksize); ++point) {
+            point->sample_number = sample;
+            point->stream_offset = offset - first_frame;
+            point->frame_samples = blocksize;
+        }
+        sample += blocksize;
+    }
+    FLAC__StreamDecoderState state = FLAC__stream_decoder_get_state(decoder);
+    FLAC__stream_decoder_delete(decoder);
+    if (!ok) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "%s", FLAC__StreamDecoderStateString[state]);
+        return false;
+    }
+
+    for ( ; point != end; ++point) {
+        point->sample_number = FLAC__STREAM_METADATA_SEEKPOINT_PLACEHOLDER;
+        point->stream_offset = 0;
+        point->frame_samples = 0;
+    }
+    FLAC__metadata_object_seektable_template_sort(seektable, false);
+    return true;
+}
+
+static bool flac_chain_read(FLAC__Metadata_Chain* chain, const char* path, rsvc_done_t fail) {
+    if (!FLAC__metadata_chain_read(chain, path)) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "%s: %s", path,
+           FLAC__Metadata_ChainStatusString[FLAC__metadata_chain_status(chain)]);
+        return false;
+    }
+    return true;
+}
+
+// Replaces the metadata that the encoder wrote to `dst_path` with a
+// copy of every block of `src_path` but STREAMINFO.  Blocks are copied
+// as-is, except that seek points are moved to the new frames.
+bool rsvc_flac_copy_metadata(const char* src_path, const char* dst_path, rsvc_done_t fail) {
+    FLAC__Metadata_Chain* src = FLAC__metadata_chain_new();
+    FLAC__Metadata_Chain* dst = FLAC__metadata_chain_new();
+    FLAC__Metadata_Iterator* src_it = FLAC__metadata_iterator_new();
+    FLAC__Metadata_Iterator* dst_it = FLAC__metadata_iterator_new();
+    bool ok = flac_chain_read(src, src_path, fail) && flac_chain_read(dst, dst_path, fail);
+
+    if (ok) {
+        // The first block is always STREAMINFO; delete the rest.
+        FLAC__metadata_iterator_init(dst_it, dst);
+        while (FLAC__metadata_iterator_next(dst_it)) {
+            FLAC__metadata_iterator_delete_block(dst_it, false);
+        }
+        FLAC__metadata_iterator_init(src_it, src);
+    }
+    while (ok && FLAC__metadata_iterator_next(src_it)) {
+        FLAC__StreamMetadata* block =
+                FLAC__metadata_object_clone(FLAC__metadata_iterator_get_block(src_it));
+        if (!block) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "couldn't copy FLAC metadata");
+            ok = false;
+        } else if ((block->type == FLAC__METADATA_TYPE_SEEKTABLE)
+                   && !flac_seektable_fill(block, dst_path, fail)) {
+            FLAC__metadata_object_delete(block);
+            ok = false;
+        } else if (!FLAC__metadata_iterator_insert_block_after(dst_it, block)) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "error inserting %s block",
+                        FLAC__MetadataTypeString[block->type]);
+            FLAC__metadata_object_delete(block);
+            ok = false;
+        }
+    }
+    if (ok && !FLAC__metadata_chain_write(dst, false, false)) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "%s: %s", dst_path,
+           FLAC__Metadata_ChainStatusString[FLAC__metadata_chain_status(dst)]);
+        ok = false;
+    }
+
+    FLAC__metadata_iterator_delete(dst_it);
+    FLAC__metadata_iterator_delete(src_it);
+    FLAC__metadata_chain_delete(dst);
+    FLAC__metadata_chain_delete(src);
+    return ok;
+}
+
 struct rsvc_flac_tags {
     struct rsvc_tags super;
     FLAC__Metadata_Chain* chain;
@@ -588,6 +902,364 @@ static tell_encode_status_t flac_encode_tell(const FLAC__StreamEncoder* encoder,
     return FLAC__STREAM_ENCODER_TELL_STATUS_OK;
 }
 
+// Parallel encoding
+// -----------------
+//
+// FLAC frames are independent, so a long stream is split into chunks
+// which are encoded concurrently, each by its own encoder.  Chunks are a
+// whole number of blocks, so that every frame but the last one has the
+// stream's fixed block size.
+//
+// Each encoder numbers its frames from 0, so frames are renumbered
+// (which means recomputing their CRCs) as they are collected.  The
+// first chunk's encoder provides the metadata blocks; its STREAMINFO is
+// patched at the end with the whole stream's frame sizes, length, and
+// MD5 signature.
+
+struct flac_buffer {
+    uint8_t*  data;
+    size_t    size;
+    size_t    capacity;
+};
+
+static void flac_buffer_append(struct flac_buffer* buffer, const void* data, size_t size) {
+    if (buffer->size + size > buffer->capacity) {
+        buffer->capacity = MAX(buffer->capacity * 2, buffer->size + size);
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+typedef struct flac_chunk* flac_chunk_t;
+struct flac_chunk {
+    struct rsvc_encode_options
+                            options;
+    FLAC__int32*            samples;
+    size_t                  samples_per_channel;
+    uint64_t                first_frame;
+    size_t                  nframes;
+
+    struct flac_buffer      metadata;
+    struct flac_buffer      frames;
+    size_t                  min_frame_size;
+    size_t                  max_frame_size;
+    const char*             error;
+    dispatch_semaphore_t    encoded;
+};
+
+static uint8_t   flac_crc8_table[256];
+static uint16_t  flac_crc16_table[256];
+
+static void flac_crc_init() {
+    static dispatch_once_t once;
+    dispatch_once(&once, ^{
+        for (int i = 0; i < 256; ++i) {
+            uint8_t crc8 = i;
+            uint16_t crc16 = i << 8;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc8 = (crc8 << 1) ^ ((crc8 & 0x80) ? 0x07 : 0);
+                crc16 = (crc16 << 1) ^ ((crc16 & 0x8000) ? 0x8005 : 0);
+            }
+            flac_crc8_table[i] = crc8;
+            flac_crc16_table[i] = crc16;
+        }
+    });
+}
+
+static uint8_t flac_crc8(const uint8_t* data, size_t size) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < size; ++i) {
+        crc = flac_crc8_table[crc ^ data[i]];
+    }
+    return crc;
+}
+
+static uint16_t flac_crc16(uint16_t crc, const uint8_t* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        crc = (crc << 8) ^ flac_crc16_table[(crc >> 8) ^ data[i]];
+    }
+    return crc;
+}
+
+// Appends the frame in `data` to `out`, with its frame number changed to
+// `number`.  Returns false if the frame is not a fixed-blocksize frame.
+static bool flac_renumber_frame(const uint8_t* data, size_t size, uint64_t number,
+                                struct flac_buffer* out) {
+    // Sync code, block size and sample rate, channels and sample size,
+    // then the frame number as "UTF-8", then the optional block size and
+    // sample rate, then the header's CRC-8.
+    if ((size < 7) || (data[0] != 0xff) || (data[1] != 0xf8)) {
+        return false;
+    }
+    size_t number_size = 1;
+    while ((number_size < 7) && (data[4] & (0x80 >> (number_size - 1)))) {
+        ++number_size;
+    }
+    if (number_size == 2) {
+        return false;  // a continuation byte; not a valid start
+    } else if (number_size > 1) {
+        --number_size;
+    }
+    size_t extra_size = 0;
+    switch (data[2] >> 4) {
+      case 6: extra_size += 1; break;
+      case 7: extra_size += 2; break;
+    }
+    switch (data[2] & 0xf) {
+      case 12: extra_size += 1; break;
+      case 13: case 14: extra_size += 2; break;
+    }
+    size_t header_size = 4 + number_size + extra_size;
+    if (size < header_size + 3) {
+        return false;
+    }
+
+    uint8_t header[4 + 6 + 4 + 1];
+    memcpy(header, data, 4);
+    size_t n = 4;
+    if (number < 0x80) {
+        header[n++] = number;
+    } else {
+        size_t bytes = 2;
+        while ((bytes < 6) && (number >= (1ull << (5 * bytes + 1)))) {
+            ++bytes;
+        }
+        header[n++] = (0xff00 >> bytes) | (number >> (6 * (bytes - 1)));
+        for (size_t i = bytes - 1; i > 0; --i) {
+            header[n++] = 0x80 | ((number >> (6 * (i - 1))) & 0x3f);
+        }
+    }
+    memcpy(header + n, data + 4 + number_size, extra_size);
+    n += extra_size;
+    header[n] = flac_crc8(header, n);
+    ++n;
+
+    const uint8_t* body = data + header_size + 1;
+    size_t body_size = size - header_size - 1 - 2;
+    uint16_t crc = flac_crc16(flac_crc16(0, header, n), body, body_size);
+    uint8_t footer[2] = {crc >> 8, crc};
+    flac_buffer_append(out, header, n);
+    flac_buffer_append(out, body, body_size);
+    flac_buffer_append(out, footer, 2);
+    return true;
+}
+
+static write_encode_status_t flac_chunk_write(const FLAC__StreamEncoder* encoder,
+                                              const FLAC__byte bytes[], size_t nbytes,
+                                              unsigned samples, unsigned current_frame,
+                                              void* userdata) {
+    (void)encoder;
+    (void)current_frame;
+    flac_chunk_t chunk = userdata;
+    if (samples == 0) {
+        flac_buffer_append(&chunk->metadata, bytes, nbytes);
+        return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+    }
+
+    size_t start = chunk->frames.size;
+    if (!flac_renumber_frame(bytes, nbytes, chunk->first_frame + chunk->nframes,
+                             &chunk->frames)) {
+        chunk->error = "unexpected frame from FLAC encoder";
+        return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+    }
+    size_t frame_size = chunk->frames.size - start;
+    if ((chunk->nframes == 0) || (frame_size < chunk->min_frame_size)) {
+        chunk->min_frame_size = frame_size;
+    }
+    chunk->max_frame_size = MAX(chunk->max_frame_size, frame_size);
+    ++chunk->nframes;
+    return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+}
+
+static void flac_encode_chunk(flac_chunk_t chunk) {
+    FLAC__StreamEncoder* encoder = FLAC__stream_encoder_new();
+    if (encoder == NULL) {
+        chunk->error = "couldn't allocate FLAC encoder";
+        return;
+    }
+    const char* message = flac_encoder_init(encoder, &chunk->options, kFlacBlockSize,
+                                            flac_chunk_write, NULL, NULL, chunk);
+    if (!message
+        && !(FLAC__stream_encoder_process_interleaved(encoder, chunk->samples,
+                                                      chunk->samples_per_channel)
+             && FLAC__stream_encoder_finish(encoder))) {
+        FLAC__StreamEncoderState state = FLAC__stream_encoder_get_state(encoder);
+        message = FLAC__StreamEncoderStateString[state];
+    }
+    if (message && !chunk->error) {
+        chunk->error = message;
+    }
+    FLAC__stream_encoder_delete(encoder);
+}
+
+static void flac_chunk_destroy(flac_chunk_t chunk) {
+    dispatch_release(chunk->encoded);
+    free(chunk->samples);
+    free(chunk->metadata.data);
+    free(chunk->frames.data);
+    free(chunk);
+}
+
+// FLAC's MD5 signature covers the samples as little-endian integers of
+// the smallest whole number of bytes.
+static void flac_md5_update(struct rsvc_md5* md5, const FLAC__int32* samples, size_t count,
+                            size_t bits_per_sample) {
+    const size_t bytes = (bits_per_sample + 7) / 8;
+    uint8_t buffer[4096];
+    size_t n = 0;
+    for (size_t i = 0; i < count; ++i) {
+        for (size_t b = 0; b < bytes; ++b) {
+            buffer[n++] = samples[i] >> (8 * b);
+        }
+        if (n + 4 > sizeof(buffer)) {
+            rsvc_md5_update(md5, buffer, n);
+            n = 0;
+        }
+    }
+    rsvc_md5_update(md5, buffer, n);
+}
+
+static void flac_put_be(uint8_t* data, uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = value >> (8 * (size - i - 1));
+    }
+}
+
+// Whole blocks, so that only the last chunk has a short block.
+static size_t flac_chunk_samples(rsvc_encode_options_t options) {
+    if (!options->segment_samples) {
+        return kFlacChunkSamples;
+    }
+    return ((options->segment_samples + kFlacBlockSize - 1) / kFlacBlockSize) * kFlacBlockSize;
+}
+
+static bool flac_encode_parallel(FILE* src_file, FILE* dst_file, rsvc_encode_options_t options,
+                                 rsvc_done_t fail) {
+    struct rsvc_audio_info info      = options->info;
+    rsvc_encode_progress_f progress  = options->progress;
+    const bool wide                  = (info.sample_format == RSVC_SAMPLE_S32);
+    const size_t max_chunks          = options->threads * 2;
+    const size_t chunk_samples       = flac_chunk_samples(options);
+    flac_crc_init();
+
+    flac_chunk_t* chunks = calloc(max_chunks, sizeof(flac_chunk_t));
+    int16_t* buffer = wide ? NULL : malloc(chunk_samples * info.block_align);
+    __block size_t first = 0, count = 0;
+    __block bool ok = true;
+
+    struct rsvc_md5 md5;
+    rsvc_md5_init(&md5);
+    __block uint8_t streaminfo[34];
+    __block off_t streaminfo_offset = -1;
+    __block size_t min_frame_size = 0, max_frame_size = 0;
+    __block uint64_t samples_written = 0;
+    uint64_t samples_read = 0;
+    uint64_t frames_read = 0;
+
+    // Waits for the oldest chunk to be encoded, then writes it out.
+    bool (^finish_chunk)() = ^bool{
+        flac_chunk_t chunk = chunks[first];
+        first = (first + 1) % max_chunks;
+        --count;
+        dispatch_semaphore_wait(chunk->encoded, DISPATCH_TIME_FOREVER);
+        if (!ok) {
+            // An error has already been reported.
+        } else if (chunk->error) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "%s", chunk->error);
+            ok = false;
+        } else if (chunk->first_frame == 0) {
+            // The metadata starts with "fLaC", then STREAMINFO's header.
+            if ((chunk->metadata.size < 4 + 4 + sizeof(streaminfo))
+                || (memcmp(chunk->metadata.data, "fLaC", 4) != 0)
+                || ((chunk->metadata.data[4] & 0x7f) != 0)) {
+                rsvc_errorf(fail, __FILE__, __LINE__, "unexpected metadata from FLAC encoder");
+                ok = false;
+            } else {
+                memcpy(streaminfo, chunk->metadata.data + 8, sizeof(streaminfo));
+                streaminfo_offset = ftello(dst_file);
+                if (streaminfo_offset >= 0) {
+                    streaminfo_offset += 8;
+                }
+                ok = rsvc_write(NULL, dst_file, chunk->metadata.data, chunk->metadata.size,
+                                fail);
+            }
+        }
+        if (ok) {
+            if (chunk->first_frame == 0) {
+                min_frame_size = chunk->min_frame_size;
+            }
+            min_frame_size = MIN(min_frame_size, chunk->min_frame_size);
+            max_frame_size = MAX(max_frame_size, chunk->max_frame_size);
+            ok = rsvc_write(NULL, dst_file, chunk->frames.data, chunk->frames.size, fail);
+            samples_written += chunk->samples_per_channel;
+            progress(samples_written * 1.0 / info.samples_per_channel);
+        }
+        flac_chunk_destroy(chunk);
+        return ok;
+    };
+
+    bool eof = false;
+    while (ok && !eof) {
+        if (count == max_chunks) {
+            finish_chunk();
+            continue;
+        }
+
+        flac_chunk_t chunk = calloc(1, sizeof(struct flac_chunk));
+        chunk->options = *options;
+        chunk->samples = malloc(chunk_samples * info.channels * sizeof(FLAC__int32));
+        chunk->encoded = dispatch_semaphore_create(0);
+        size_t nsamples;
+        if (!rsvc_read("pipe", src_file, wide ? (void*)chunk->samples : (void*)buffer,
+                       chunk_samples, info.block_align, &nsamples, &eof, fail)) {
+            ok = false;
+        }
+        if (!ok || (nsamples == 0)) {
+            flac_chunk_destroy(chunk);
+            break;
+        }
+        if (!wide) {
+            rsvc_sample_s16_to_s32(buffer, chunk->samples, nsamples * info.channels);
+        }
+        flac_md5_update(&md5, chunk->samples, nsamples * info.channels, info.bits_per_sample);
+        chunk->samples_per_channel = nsamples;
+        chunk->first_frame = frames_read;
+        samples_read += nsamples;
+        frames_read += (nsamples + kFlacBlockSize - 1) / kFlacBlockSize;
+
+        chunks[(first + count) % max_chunks] = chunk;
+        ++count;
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            flac_encode_chunk(chunk);
+            dispatch_semaphore_signal(chunk->encoded);
+        });
+    }
+    while (count) {
+        finish_chunk();
+    }
+    free(buffer);
+    free(chunks);
+    if (!ok) {
+        return false;
+    }
+
+    // Patch STREAMINFO, if the output is seekable.  As with the serial
+    // encoder, a pipe keeps the first chunk's values.
+    flac_put_be(streaminfo + 4, min_frame_size, 3);
+    flac_put_be(streaminfo + 7, max_frame_size, 3);
+    streaminfo[13] = (streaminfo[13] & 0xf0) | ((samples_read >> 32) & 0x0f);
+    flac_put_be(streaminfo + 14, samples_read, 4);
+    rsvc_md5_final(&md5, streaminfo + 18);
+    if ((streaminfo_offset >= 0) && (fseeko(dst_file, streaminfo_offset, SEEK_SET) == 0)) {
+        if (!(rsvc_write(NULL, dst_file, streaminfo, sizeof(streaminfo), fail)
+              && (fseeko(dst_file, 0, SEEK_END) == 0))) {
+            return false;
+        }
+    }
+    return true;
+}
+
 static void flac_decode_metadata(const FLAC__StreamDecoder* decoder,
                                  const FLAC__StreamMetadata* metadata,
                                  void* userdata) {
@@ -600,71 +1272,159 @@ static void flac_decode_metadata(const FLAC__StreamDecoder* decoder,
         .channels = metadata->data.stream_info.channels,
         .sample_rate = metadata->data.stream_info.sample_rate,
         .samples_per_channel = metadata->data.stream_info.total_samples,
-        .bits_per_sample = 16,  // TODO(sfiera): metadata->data.stream_info.bits_per_sample
+        .bits_per_sample = 16,
         .block_align = 2 * metadata->data.stream_info.channels,
+        .sample_format = RSVC_SAMPLE_S16,
     };
+    if ((metadata->data.stream_info.bits_per_sample > 16)
+        && (u->sample_formats & RSVC_SAMPLE_FORMAT_BIT(RSVC_SAMPLE_S32))) {
+        info.bits_per_sample = metadata->data.stream_info.bits_per_sample;
+        info.block_align = 4 * metadata->data.stream_info.channels;
+        info.sample_format = RSVC_SAMPLE_S32;
+    } else {
+        rsvc_dither_init(&u->dither, metadata->data.stream_info.channels,
+                         metadata->data.stream_info.bits_per_sample, u->noise_shaping);
+    }
+    u->sample_format = info.sample_format;
+    flac_decode_reserve(u, metadata->data.stream_info.max_blocksize
+                           * metadata->data.stream_info.channels);
     u->info(&info);
 }
 
+static void flac_input_init(struct flac_input* input, FILE* file) {
+    *input = (struct flac_input){.file = file};
+    off_t start = ftello(file);
+    struct stat st;
+    if ((start >= 0) && (fstat(fileno(file), &st) == 0) && S_ISREG(st.st_mode)
+        && (st.st_size > 0)) {
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+        if (map != MAP_FAILED) {
+            posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+            input->map = map;
+            input->map_size = st.st_size;
+            input->data = map;
+            input->size = st.st_size;
+            input->pos = MIN(start, st.st_size);
+            return;
+        }
+    }
+    input->buffer = malloc(kFlacReadAheadSize);
+    input->data = input->buffer;
+    input->offset = (start >= 0) ? start : 0;
+}
+
+static void flac_input_clear(struct flac_input* input) {
+    if (input->map) {
+        munmap(input->map, input->map_size);
+    }
+    free(input->buffer);
+}
+
+static void flac_decode_reserve(flac_decode_userdata_t u, size_t nsamples) {
+    if (nsamples > u->capacity) {
+        u->capacity = nsamples;
+        u->s32 = realloc(u->s32, nsamples * sizeof(int32_t));
+        u->s16 = realloc(u->s16, nsamples * sizeof(int16_t));
+    }
+}
+
 static read_decode_status_t flac_decode_read(const FLAC__StreamDecoder* encoder,
                                              FLAC__byte bytes[], size_t* nbytes, void* userdata) {
     (void)encoder;
     flac_decode_userdata_t u = (flac_decode_userdata_t)userdata;
-    while (true) {
-        ssize_t bytes_read = fread(bytes, 1, *nbytes, u->read_file);
-        if (bytes_read > 0) {
-            *nbytes = bytes_read;
-            return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
-        } else if (bytes_read == 0) {
+    struct flac_input* in = &u->input;
+    while (in->pos == in->size) {
+        if (in->map || in->eof) {
             return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
-        } else if (errno != EINTR) {
+        }
+        in->offset += in->size;
+        in->pos = in->size = 0;
+        in->size = fread(in->buffer, 1, kFlacReadAheadSize, in->file);
+        if (in->size > 0) {
+            break;
+        } else if (feof(in->file)) {
+            in->eof = true;
+        } else if (errno == EINTR) {
+            clearerr(in->file);
+        } else {
             rsvc_strerrorf(u->fail, __FILE__, __LINE__, NULL);
             u->called_done = true;
             return FLAC__STREAM_DECODER_READ_STATUS_ABORT;
         }
     }
+    *nbytes = MIN(*nbytes, in->size - in->pos);
+    memcpy(bytes, in->data + in->pos, *nbytes);
+    in->pos += *nbytes;
+    return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
 }
 
-// TODO(sfiera): support 24-bit better.
-// This function simply clips samples larger than 16 bits.  It should
-// instead do dithering and ideally noise-shaping.  Or we should allow
-// 24-bit samples through the pipe.
+// If the consumer accepts 32-bit samples, hi-res audio is passed
+// through untouched.  Otherwise, samples larger than 16 bits are
+// requantized with dither, and smaller ones are widened to 16 bits.
 static write_decode_status_t flac_decode_write(const FLAC__StreamDecoder* decoder,
                                                const FLAC__Frame* frame,
                                                const FLAC__int32* const* data,
                                                void* userdata) {
     (void)decoder;
     flac_decode_userdata_t u = (flac_decode_userdata_t)userdata;
-    int shift = frame->header.bits_per_sample - 16;
-    size_t size = frame->header.channels * frame->header.blocksize * sizeof(int16_t);
-    int16_t* s16 = malloc(size);
-    int16_t* p = s16;
-    for (int i = 0; i < frame->header.blocksize; ++i) {
-        for (int c = 0; c < frame->header.channels; ++c) {
-            *(p++) = data[c][i] >> shift;
+    const size_t channels = frame->header.channels;
+    const size_t blocksize = frame->header.blocksize;
+    const size_t nsamples = channels * blocksize;
+    flac_decode_reserve(u, nsamples);
+    size_t size;
+    const void* out;
+    if (u->sample_format == RSVC_SAMPLE_S32) {
+        size = nsamples * sizeof(int32_t);
+        rsvc_sample_interleave_s32(data, u->s32, channels, blocksize);
+        out = u->s32;
+    } else if (frame->header.bits_per_sample > 16) {
+        size = nsamples * sizeof(int16_t);
+        rsvc_sample_interleave_s32(data, u->s32, channels, blocksize);
+        rsvc_dither_s32_to_s16(&u->dither, u->s32, u->s16, nsamples);
+        out = u->s16;
+    } else if (frame->header.bits_per_sample < 16) {
+        size = nsamples * sizeof(int16_t);
+        const int32_t scale = 1 << (16 - frame->header.bits_per_sample);
+        int16_t* s16 = u->s16;
+        for (size_t f = 0; f < blocksize; ++f) {
+            for (size_t c = 0; c < channels; ++c) {
+                *(s16++) = data[c][f] * scale;
+            }
         }
+        out = u->s16;
+    } else {
+        size = nsamples * sizeof(int16_t);
+        rsvc_sample_interleave_s32_to_s16(data, u->s16, channels, blocksize);
+        out = u->s16;
     }
-    if (fwrite(s16, 1, size, u->write_file) < size) {
+    if (fwrite(out, 1, size, u->write_file) < size) {
         if (errno == EPIPE) {
             u->fail(NULL);
         } else {
             rsvc_strerrorf(u->fail, __FILE__, __LINE__, NULL);
         }
         u->called_done = true;
-        free(s16);
         return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
     }
-    free(s16);
     return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
 
+// Seeks within the map, or within the read-ahead window if possible.
 static seek_decode_status_t flac_decode_seek(const FLAC__StreamDecoder* decoder,
                                              FLAC__uint64 absolute_byte_offset,
                                              void* userdata) {
     (void)decoder;
     flac_decode_userdata_t u = (flac_decode_userdata_t)userdata;
-    if (fseek(u->read_file, absolute_byte_offset, SEEK_SET) < 0) {
+    struct flac_input* in = &u->input;
+    if ((absolute_byte_offset >= in->offset)
+        && (absolute_byte_offset <= in->offset + in->size)) {
+        in->pos = absolute_byte_offset - in->offset;
+    } else if (in->map || (fseeko(in->file, absolute_byte_offset, SEEK_SET) < 0)) {
         return FLAC__STREAM_DECODER_SEEK_STATUS_ERROR;
+    } else {
+        in->offset = absolute_byte_offset;
+        in->pos = in->size = 0;
+        in->eof = false;
     }
     return FLAC__STREAM_DECODER_SEEK_STATUS_OK;
 }
@@ -674,11 +1434,7 @@ static tell_decode_status_t flac_decode_tell(const FLAC__StreamDecoder* decoder,
                                              void* userdata) {
     (void)decoder;
     flac_decode_userdata_t u = (flac_decode_userdata_t)userdata;
-    off_t offset = ftell(u->read_file);
-    if (offset < 0) {
-        return FLAC__STREAM_DECODER_TELL_STATUS_ERROR;
-    }
-    *absolute_byte_offset = offset;
+    *absolute_byte_offset = u->input.offset + u->input.pos;
     return FLAC__STREAM_DECODER_TELL_STATUS_OK;
 }
 
@@ -687,8 +1443,12 @@ static length_decode_status_t flac_decode_length(const FLAC__StreamDecoder* deco
                                                  void* userdata) {
     (void)decoder;
     flac_decode_userdata_t u = (flac_decode_userdata_t)userdata;
+    if (u->input.map) {
+        *absolute_byte_offset = u->input.map_size;
+        return FLAC__STREAM_DECODER_LENGTH_STATUS_OK;
+    }
     struct stat st;
-    if (fstat(fileno(u->read_file), &st) < 0) {
+    if (fstat(fileno(u->input.file), &st) < 0) {
         return FLAC__STREAM_DECODER_LENGTH_STATUS_ERROR;
     }
     *absolute_byte_offset = st.st_size;
@@ -697,8 +1457,8 @@ static length_decode_status_t flac_decode_length(const FLAC__StreamDecoder* deco
 
 static FLAC__bool flac_decode_eof(const FLAC__StreamDecoder* decoder, void* userdata) {
     (void)decoder;
-    (void)userdata;
-    return false;
+    flac_decode_userdata_t u = (flac_decode_userdata_t)userdata;
+    return (u->input.pos == u->input.size) && (u->input.map || u->input.eof);
 }
 
 static void flac_decode_error(const FLAC__StreamDecoder* decoder,
@@ -805,6 +1565,8 @@ const struct rsvc_format rsvc_flac = {
     .lossless = true,
     .open_tags = rsvc_flac_open_tags,
     .encode = rsvc_flac_encode,
+    .sample_formats = RSVC_SAMPLE_FORMAT_BIT(RSVC_SAMPLE_S32),
     .decode = rsvc_flac_decode,
+    .verify = rsvc_flac_verify,
     .audio_info = rsvc_flac_audio_info,
 };
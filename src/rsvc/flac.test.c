@@ -0,0 +1,266 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <FLAC/stream_decoder.h>
+#include <FLAC/stream_encoder.h>
+#include <math.h>
+#include <rsvc/audio.h>
+#include <rsvc/format.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "unix.h"
+
+// The block size that parallel encoding uses.
+#define kBlockSize 4096
+
+static rsvc_done_t fail = ^(rsvc_error_t error){
+    TEST_FAILF("%s (%s:%d)", error->message, error->file, error->lineno);
+};
+
+// M_PI isn't POSIX.
+static const double kPi = 3.14159265358979323846;
+
+// A tone with a little noise, interleaved.
+static void* make_pcm(struct rsvc_audio_info info) {
+    const bool wide = (info.sample_format == RSVC_SAMPLE_S32);
+    const size_t count = info.samples_per_channel * info.channels;
+    void* pcm = malloc(count * (wide ? sizeof(int32_t) : sizeof(int16_t)));
+    unsigned seed = 1;
+    for (size_t i = 0; i < count; ++i) {
+        double t = (double)(i / info.channels) / info.sample_rate;
+        double x = 0.5 * sin(2 * kPi * 440 * (1 + (i % info.channels)) * t)
+                 + 0.01 * ((rand_r(&seed) / (double)RAND_MAX) - 0.5);
+        int32_t sample = lrint(x * ((1 << (info.bits_per_sample - 1)) - 1));
+        if (wide) {
+            ((int32_t*)pcm)[i] = sample;
+        } else {
+            ((int16_t*)pcm)[i] = sample;
+        }
+    }
+    return pcm;
+}
+
+static bool encode(const char* path, const void* pcm, struct rsvc_audio_info info,
+                   size_t threads, size_t segment_samples) {
+    FILE* src_file;
+    FILE* dst_file = fopen(path, "w+");
+    if (!dst_file) {
+        rsvc_strerrorf(fail, __FILE__, __LINE__, "%s", path);
+        return false;
+    } else if (!rsvc_memopen(pcm, info.samples_per_channel * info.block_align, &src_file,
+                             fail)) {
+        fclose(dst_file);
+        return false;
+    }
+    struct rsvc_encode_options options = {
+        .info             = info,
+        .level            = 0,
+        .threads          = threads,
+        .segment_samples  = segment_samples,
+        .progress         = ^(double fraction){
+            (void)fraction;
+        },
+    };
+    bool ok = rsvc_flac.encode(src_file, dst_file, &options, fail);
+    fclose(src_file);
+    fclose(dst_file);
+    return ok;
+}
+
+// Decodes `path` with rsvc_flac.decode() and compares it to `pcm`.
+static void check_samples(const char* path, const void* pcm, struct rsvc_audio_info info) {
+    FILE* src_file = fopen(path, "r");
+    FILE* dst_file = tmpfile();
+    if (!src_file || !dst_file) {
+        rsvc_strerrorf(fail, __FILE__, __LINE__, "%s", path);
+        return;
+    }
+    struct rsvc_decode_options options = {
+        .sample_formats = RSVC_SAMPLE_FORMAT_BIT(info.sample_format),
+    };
+    __block struct rsvc_audio_info decoded = {};
+    if (rsvc_flac.decode(src_file, dst_file, &options, ^(rsvc_audio_info_t actual){
+        decoded = *actual;
+    }, fail)) {
+        EXPECT_EQ(info.samples_per_channel, decoded.samples_per_channel);
+        EXPECT_EQ(info.bits_per_sample, decoded.bits_per_sample);
+        EXPECT_EQ(info.sample_format, decoded.sample_format);
+
+        const size_t size = info.samples_per_channel * info.block_align;
+        uint8_t* data = malloc(size + 1);
+        rewind(dst_file);
+        EXPECT_EQ(size, fread(data, 1, size + 1, dst_file));
+        if (memcmp(data, pcm, size) != 0) {
+            TEST_FAILF("%s: decoded samples differ", path);
+        }
+        free(data);
+    }
+    fclose(src_file);
+    fclose(dst_file);
+}
+
+struct frame_numbers {
+    uint64_t  frames;
+    uint64_t  samples;
+    uint64_t  misnumbered;
+    uint64_t  errors;
+};
+
+// libFLAC converts each frame number to a sample number, assuming that
+// all blocks but the last have the size given by STREAMINFO.
+static FLAC__StreamDecoderWriteStatus frame_numbers_write(
+        const FLAC__StreamDecoder* decoder, const FLAC__Frame* frame,
+        const FLAC__int32* const buffer[], void* userdata) {
+    (void)decoder;
+    (void)buffer;
+    struct frame_numbers* n = userdata;
+    if ((frame->header.number_type != FLAC__FRAME_NUMBER_TYPE_SAMPLE_NUMBER)
+        || (frame->header.number.sample_number != n->samples)) {
+        ++n->misnumbered;
+    }
+    ++n->frames;
+    n->samples += frame->header.blocksize;
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+static void frame_numbers_error(const FLAC__StreamDecoder* decoder,
+                                FLAC__StreamDecoderErrorStatus status, void* userdata) {
+    (void)decoder;
+    (void)status;
+    ++((struct frame_numbers*)userdata)->errors;
+}
+
+static void check_frame_numbers(const char* path, struct rsvc_audio_info info) {
+    struct frame_numbers n = {};
+    FLAC__StreamDecoder* decoder = FLAC__stream_decoder_new();
+    if (FLAC__stream_decoder_init_file(decoder, path, frame_numbers_write, NULL,
+                                       frame_numbers_error, &n)
+        != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+        TEST_FAILF("%s: couldn't open", path);
+    } else {
+        FLAC__stream_decoder_process_until_end_of_stream(decoder);
+        FLAC__stream_decoder_finish(decoder);
+    }
+    FLAC__stream_decoder_delete(decoder);
+    EXPECT_EQ((info.samples_per_channel + kBlockSize - 1) / kBlockSize, n.frames);
+    EXPECT_EQ(info.samples_per_channel, n.samples);
+    EXPECT_EQ(0, n.misnumbered);
+    EXPECT_EQ(0, n.errors);
+}
+
+// Encodes the same audio serially and in parallel.  Both must decode
+// to the original samples, and parallel encoding must produce valid
+// frame numbers, CRCs, and the same MD5 signature.
+static void test_parallel(size_t bits, size_t channels, size_t frames, size_t segment_samples) {
+    const bool wide = (bits > 16);
+    struct rsvc_audio_info info = {
+        .sample_rate          = 44100,
+        .channels             = channels,
+        .samples_per_channel  = frames,
+        .bits_per_sample      = bits,
+        .block_align          = channels * (wide ? sizeof(int32_t) : sizeof(int16_t)),
+        .sample_format        = wide ? RSVC_SAMPLE_S32 : RSVC_SAMPLE_S16,
+    };
+    void* pcm = make_pcm(info);
+
+    char serial[] = "/tmp/flac.test.XXXXXX";
+    char parallel[] = "/tmp/flac.test.XXXXXX";
+    int serial_fd = mkstemp(serial);
+    int parallel_fd = mkstemp(parallel);
+    close(serial_fd);
+    close(parallel_fd);
+
+    uint8_t serial_md5[16], parallel_md5[16];
+    if (encode(serial, pcm, info, 1, 0)
+        && encode(parallel, pcm, info, 4, segment_samples)
+        && rsvc_flac.verify(parallel, fail)
+        && rsvc_flac_md5(serial, serial_md5, fail)
+        && rsvc_flac_md5(parallel, parallel_md5, fail)) {
+        if (memcmp(serial_md5, parallel_md5, 16) != 0) {
+            TEST_FAILF("%s: MD5 signature differs", parallel);
+        }
+        check_frame_numbers(parallel, info);
+        check_samples(parallel, pcm, info);
+    }
+
+    unlink(serial);
+    unlink(parallel);
+    free(pcm);
+}
+
+// rsvc only encodes 16 bits and up, so libFLAC writes the file.  It
+// must decode widened to 16 bits, not as quiet 16-bit audio.
+static void test_low_bits(size_t bits, size_t channels, size_t frames) {
+    char path[] = "/tmp/flac.test.XXXXXX";
+    close(mkstemp(path));
+
+    const size_t count = frames * channels;
+    FLAC__int32* samples = malloc(count * sizeof(FLAC__int32));
+    int16_t* expected = malloc(count * sizeof(int16_t));
+    unsigned seed = 1;
+    for (size_t i = 0; i < count; ++i) {
+        samples[i] = (int32_t)(rand_r(&seed) % (1 << bits)) - (1 << (bits - 1));
+        expected[i] = samples[i] * (1 << (16 - bits));
+    }
+
+    FLAC__StreamEncoder* encoder = FLAC__stream_encoder_new();
+    if (!(FLAC__stream_encoder_set_channels(encoder, channels)
+          && FLAC__stream_encoder_set_bits_per_sample(encoder, bits)
+          && FLAC__stream_encoder_set_sample_rate(encoder, 44100)
+          && (FLAC__stream_encoder_init_file(encoder, path, NULL, NULL)
+              == FLAC__STREAM_ENCODER_INIT_STATUS_OK)
+          && FLAC__stream_encoder_process_interleaved(encoder, samples, frames)
+          && FLAC__stream_encoder_finish(encoder))) {
+        TEST_FAILF("couldn't encode %zu-bit FLAC", bits);
+    } else {
+        struct rsvc_audio_info info = {
+            .sample_rate          = 44100,
+            .channels             = channels,
+            .samples_per_channel  = frames,
+            .bits_per_sample      = 16,
+            .block_align          = channels * sizeof(int16_t),
+            .sample_format        = RSVC_SAMPLE_S16,
+        };
+        check_samples(path, expected, info);
+    }
+    FLAC__stream_encoder_delete(encoder);
+
+    unlink(path);
+    free(samples);
+    free(expected);
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    // Frame numbers take 1 byte below 128, 2 below 2048, and 3 above.
+    test_parallel(16, 2, (2100 * kBlockSize) + 1000, 32 * kBlockSize);
+    test_parallel(24, 1, (300 * kBlockSize) + 1, 10 * kBlockSize);
+    test_parallel(16, 2, 100 * kBlockSize, 50 * kBlockSize);  // exactly two chunks
+    test_parallel(16, 1, 17 * kBlockSize, 1);  // a segment rounds up to a block
+    test_low_bits(8, 1, 10000);
+    test_low_bits(12, 2, 10000);
+    return test_result();
+}
@@ -20,11 +20,95 @@
 
 #include "audio.h"
 
+#include <dispatch/dispatch.h>
 #include <lame/lame.h>
 #include <rsvc/audio.h>
 #include <rsvc/format.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include "common.h"
+#include "mp3.h"
 #include "unix.h"
 
+// Parallel encoding splits the stream into segments of
+// kLameSegmentFrames frames (by default), encoded by separate
+// encoders.  Each encoder starts kLameLeadInFrames early, so that its
+// psychoacoustic model and MDCT have settled by the time its output is
+// used, and runs kLameWindowFrames + kLameLeadOutFrames past the end of
+// its segment, so that the join with the next one can be made at any
+// frame in a window.  Frames are 1152 samples (576 below 32 kHz).
+#define kLameSegmentFrames     1024
+#define kLameMinSegmentFrames  128
+#define kLameLeadInFrames      32
+#define kLameWindowFrames      32
+#define kLameLeadOutFrames     4
+
+// Room for encoding kLameSamples samples, per lame.h.
+static const size_t kLameSamples = 2048;
+#define kLameBufferSize (kLameSamples * 5 / 4 + 7200)
+
+struct lame_buffer {
+    uint8_t*  data;
+    size_t    size;
+    size_t    capacity;
+};
+
+// The Xing header of LAME's tag frame has every optional field: frame
+// count, byte count, 100-entry seek table, and quality.  The LAME
+// extension follows it; its last 2 bytes are a CRC of the frame up to
+// there.
+#define kXingFramesOffset   8
+#define kXingBytesOffset    12
+#define kXingTocOffset      16
+#define kXingTocSize        100
+#define kLameExtOffset      120
+#define kLameDelayOffset    (kLameExtOffset + 21)
+#define kLameLengthOffset   (kLameExtOffset + 28)
+#define kLameMusicCrcOffset (kLameExtOffset + 32)
+#define kLameTagCrcOffset   (kLameExtOffset + 34)
+
+struct lame_frame {
+    size_t                 offset;
+    struct rsvc_mp3_frame  mp3;
+};
+
+// The tag frame of a stream encoded in parallel.  The first segment's
+// encoder writes it, but only knows about its own frames, so the rest
+// of the tag is rewritten for the whole stream.
+struct lame_tag {
+    off_t      offset;         // in dst_file, or -1 if not seekable
+    uint8_t*   frame;
+    size_t     size;
+    uint64_t*  frame_offsets;  // from the start of the tag frame
+    size_t     nframes;
+    size_t     capacity;
+    uint64_t   bytes;          // including the tag frame
+    uint16_t   music_crc;      // of the frames after it
+};
+
+typedef struct lame_segment* lame_segment_t;
+struct lame_segment {
+    struct rsvc_encode_options  options;
+    bool                        disable_reservoir;
+    int16_t*                    samples;
+    size_t                      samples_per_channel;
+    uint64_t                    first_frame;  // the stream's frame number of out's first frame
+    struct lame_buffer          out;
+    struct lame_frame*          frames;
+    size_t                      nframes;
+    size_t                      keep_begin;   // frames of out that go into the stream
+    size_t                      keep_end;
+    bool                        write_tag;    // set for the first segment only
+    uint8_t*                    tag;
+    size_t                      tag_size;
+    const char*                 error;
+    dispatch_semaphore_t        encoded;
+};
+
+static bool lame_encode_parallel(FILE* src_file, FILE* dst_file, rsvc_encode_options_t options,
+                                 size_t frame_samples, rsvc_done_t fail);
+
 bool rsvc_lame_encode_options_validate(rsvc_encode_options_t opts, rsvc_done_t fail) {
     if (!rsvc_audio_info_validate(&opts->info, fail)) {
         return false;
@@ -46,8 +130,52 @@ bool rsvc_lame_encode_options_validate(rsvc_encode_options_t opts, rsvc_done_t f
     return true;
 }
 
+static bool lame_setup(lame_global_flags* lame, rsvc_encode_options_t options,
+                       bool disable_reservoir, bool write_tag) {
+    struct rsvc_audio_info info = options->info;
+    if (info.channels == 1) {
+        lame_set_mode(lame, MONO);
+    }
+    lame_set_num_channels(lame, info.channels);
+    if (options->vbr) {
+        lame_set_VBR(lame, vbr_default);
+        lame_set_VBR_q(lame, options->quality);
+    } else {
+        lame_set_brate(lame, options->bitrate >> 10);
+    }
+    lame_set_in_samplerate(lame, info.sample_rate);
+    lame_set_bWriteVbrTag(lame, write_tag);
+    lame_set_disable_reservoir(lame, disable_reservoir);
+    return lame_init_params(lame) >= 0;
+}
+
+// LAME starts its output with a placeholder for its tag frame, which
+// carries the stream's length, seek table, and encoder delay and
+// padding, and can only be filled in once the stream is done.  Writes
+// the finished frame over it, if the output is seekable; a pipe keeps
+// the placeholder.
+static bool lame_put_tag(FILE* dst_file, off_t offset, const uint8_t* tag, size_t size,
+                         rsvc_done_t fail) {
+    if ((offset >= 0) && (fseeko(dst_file, offset, SEEK_SET) == 0)) {
+        return rsvc_write(NULL, dst_file, tag, size, fail)
+            && rsvc_seek(dst_file, 0, SEEK_END, fail);
+    }
+    return true;
+}
+
+static int lame_encode_samples(lame_global_flags* lame, const int16_t* samples,
+                               size_t samples_per_channel, size_t channels,
+                               unsigned char* mp3buf, size_t mp3buf_size) {
+    if (channels == 2) {
+        return lame_encode_buffer_interleaved(
+                lame, (int16_t*)samples, samples_per_channel, mp3buf, mp3buf_size);
+    } else {
+        return lame_encode_buffer(
+                lame, samples, NULL, samples_per_channel, mp3buf, mp3buf_size);
+    }
+}
+
 bool rsvc_lame_encode(FILE* src_file, FILE* dst_file, rsvc_encode_options_t options, rsvc_done_t fail) {
-    int32_t                 bitrate   = options->bitrate;
     struct rsvc_audio_info  info      = options->info;
     rsvc_encode_progress_f  progress  = options->progress;
 
@@ -56,54 +184,448 @@ bool rsvc_lame_encode(FILE* src_file, FILE* dst_file, rsvc_encode_options_t opti
     }
 
     lame_global_flags* lame = lame_init();
-    if (info.channels == 1) {
-        lame_set_mode(lame, MONO);
-    }
-    lame_set_num_channels(lame, info.channels);
-    lame_set_brate(lame, bitrate >> 10);
-    lame_set_in_samplerate(lame, info.sample_rate);
-    lame_set_bWriteVbrTag(lame, 0);  // TODO(sfiera): write the tag.
-    if (lame_init_params(lame) < 0) {
+    if (!lame_setup(lame, options, false, true)) {
+        lame_close(lame);
         rsvc_errorf(fail, __FILE__, __LINE__, "init error");
         return false;
     }
 
+    // Segments can only be joined on frame boundaries if each frame
+    // covers a whole number of input samples: not if LAME resamples.
+    size_t frame_samples = lame_get_framesize(lame);
+    size_t segment_frames = options->segment_samples
+            ? MAX(options->segment_samples / frame_samples, kLameMinSegmentFrames)
+            : kLameSegmentFrames;
+    if ((options->threads > 1)
+        && (lame_get_out_samplerate(lame) == (int)info.sample_rate)
+        && (info.samples_per_channel >= (2 * segment_frames * frame_samples))) {
+        lame_close(lame);
+        return lame_encode_parallel(src_file, dst_file, options, frame_samples, fail);
+    }
+
+    const off_t tag_offset = ftello(dst_file);
     size_t samples_per_channel_read = 0;
-    static const int kSamples = 2048;
-    static const int kMp3BufSize = kSamples * 5 + 7200;
-    unsigned char* mp3buf = malloc(kMp3BufSize);
-    int16_t buffer[kSamples * 2];
+    unsigned char* mp3buf = malloc(kLameBufferSize);
+    int16_t buffer[kLameSamples * 2];
+    void (^cleanup)() = ^{
+        lame_close(lame);
+        free(mp3buf);
+    };
     bool eof = false;
     while (!eof) {
         size_t nsamples;
-        if (!rsvc_read(  "pipe", src_file, buffer, kSamples, 2 * sizeof(int16_t),
+        if (!rsvc_read(  "pipe", src_file, buffer, kLameSamples, info.block_align,
                          &nsamples, &eof, fail)) {
+            cleanup();
             return false;
         } else if (nsamples) {
             samples_per_channel_read += nsamples;
-            int mp3buf_written = -1;
-            if (info.channels == 2) {
-                mp3buf_written = lame_encode_buffer_interleaved(
-                        lame, buffer, nsamples, mp3buf, kMp3BufSize);
-            } else {
-                mp3buf_written = lame_encode_buffer(
-                        lame, buffer, NULL, nsamples * 2, mp3buf, kMp3BufSize);
-            }
+            int mp3buf_written = lame_encode_samples(
+                    lame, buffer, nsamples, info.channels, mp3buf, kLameBufferSize);
             if (mp3buf_written < 0) {
+                cleanup();
                 rsvc_errorf(fail, __FILE__, __LINE__, "encode error");
                 return false;
             }
             if (!rsvc_write("pipe", dst_file, mp3buf, mp3buf_written, fail)) {
+                cleanup();
                 return false;
             }
-            progress(samples_per_channel_read * 2.0 / info.channels / info.samples_per_channel);
+            progress(samples_per_channel_read * 1.0 / info.samples_per_channel);
         }
     }
-    if (lame_encode_flush(lame, mp3buf, kMp3BufSize) < 0) {
+    int mp3buf_written = lame_encode_flush(lame, mp3buf, kLameBufferSize);
+    if (mp3buf_written < 0) {
+        cleanup();
         rsvc_errorf(fail, __FILE__, __LINE__, "flush error");
         return false;
+    } else if (!rsvc_write("pipe", dst_file, mp3buf, mp3buf_written, fail)) {
+        cleanup();
+        return false;
+    }
+    size_t tag_size = lame_get_lametag_frame(lame, mp3buf, kLameBufferSize);
+    if (tag_size && !lame_put_tag(dst_file, tag_offset, mp3buf, tag_size, fail)) {
+        cleanup();
+        return false;
+    }
+    cleanup();
+    return true;
+}
+
+static void lame_buffer_append(struct lame_buffer* buffer, const void* data, size_t size) {
+    if (buffer->size + size > buffer->capacity) {
+        buffer->capacity = MAX(buffer->capacity * 2, buffer->size + size);
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+// Splits the segment's output into frames, after the placeholder for
+// the tag frame, if any.  Every byte should belong to a Layer III frame.
+static bool lame_segment_index(lame_segment_t segment) {
+    size_t capacity = 0;
+    for (size_t offset = segment->tag_size; offset < segment->out.size; ) {
+        struct rsvc_mp3_frame mp3;
+        if (!rsvc_mp3_frame_parse(segment->out.data + offset, segment->out.size - offset,
+                                  &mp3)
+            || (offset + mp3.size > segment->out.size)) {
+            return false;
+        }
+        if (segment->nframes == capacity) {
+            capacity = MAX(capacity * 2, 64);
+            segment->frames = realloc(segment->frames, capacity * sizeof(struct lame_frame));
+        }
+        segment->frames[segment->nframes].offset = offset;
+        segment->frames[segment->nframes].mp3 = mp3;
+        ++segment->nframes;
+        offset += mp3.size;
+    }
+    segment->keep_end = segment->nframes;
+    return true;
+}
+
+static void lame_encode_segment(lame_segment_t segment) {
+    segment->out.size = 0;
+    segment->nframes = 0;
+    lame_global_flags* lame = lame_init();
+    if (!lame_setup(lame, &segment->options, segment->disable_reservoir,
+                    segment->write_tag)) {
+        segment->error = "init error";
+        lame_close(lame);
+        return;
+    }
+
+    const size_t channels = segment->options.info.channels;
+    unsigned char mp3buf[kLameBufferSize];
+    int written = 0;
+    for (size_t i = 0; i < segment->samples_per_channel; i += kLameSamples) {
+        size_t n = MIN(kLameSamples, segment->samples_per_channel - i);
+        written = lame_encode_samples(lame, segment->samples + (i * channels), n, channels,
+                                      mp3buf, sizeof(mp3buf));
+        if (written < 0) {
+            segment->error = "encode error";
+            break;
+        }
+        lame_buffer_append(&segment->out, mp3buf, written);
+    }
+    if (!segment->error) {
+        written = lame_encode_flush(lame, mp3buf, sizeof(mp3buf));
+        if (written < 0) {
+            segment->error = "flush error";
+        } else {
+            lame_buffer_append(&segment->out, mp3buf, written);
+        }
+    }
+    if (!segment->error && segment->write_tag) {
+        // The tag is filled in for the whole stream once it's done.
+        segment->tag_size = lame_get_lametag_frame(lame, mp3buf, sizeof(mp3buf));
+        if ((segment->tag_size == 0) || (segment->tag_size > segment->out.size)) {
+            segment->error = "missing tag from LAME encoder";
+        } else {
+            segment->tag = malloc(segment->tag_size);
+            memcpy(segment->tag, mp3buf, segment->tag_size);
+        }
     }
     lame_close(lame);
-    free(mp3buf);
+
+    if (!segment->error && !lame_segment_index(segment)) {
+        segment->error = "unexpected frame from LAME encoder";
+    }
+}
+
+static void lame_segment_destroy(lame_segment_t segment) {
+    dispatch_release(segment->encoded);
+    free(segment->samples);
+    free(segment->out.data);
+    free(segment->frames);
+    free(segment->tag);
+    free(segment);
+}
+
+static void lame_put_be(uint8_t* data, uint64_t value, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = value >> (8 * (size - i - 1));
+    }
+}
+
+// CRC-16 with polynomial 0x8005, bit-reversed, as LAME computes it.
+static uint16_t lame_crc16(uint16_t crc, const uint8_t* data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xa001 : 0);
+        }
+    }
+    return crc;
+}
+
+static void lame_tag_add(struct lame_tag* tag, const uint8_t* data,
+                         const struct lame_frame* frames, size_t nframes) {
+    if (tag->nframes + nframes > tag->capacity) {
+        tag->capacity = MAX(tag->capacity * 2, tag->nframes + nframes);
+        tag->frame_offsets = realloc(tag->frame_offsets, tag->capacity * sizeof(uint64_t));
+    }
+    for (size_t i = 0; i < nframes; ++i) {
+        tag->frame_offsets[tag->nframes++] = tag->bytes;
+        tag->music_crc = lame_crc16(tag->music_crc, data + frames[i].offset, frames[i].mp3.size);
+        tag->bytes += frames[i].mp3.size;
+    }
+}
+
+// Rewrites the frame count, byte count, seek table, padding, and CRCs
+// of the tag for a stream of `samples` samples per channel.  The
+// encoder delay is the first segment's, which started the stream.
+static bool lame_tag_finish(struct lame_tag* tag, size_t frame_samples, uint64_t samples) {
+    struct rsvc_mp3_frame mp3;
+    struct rsvc_mp3_vbr_header header;
+    if (!(rsvc_mp3_frame_parse(tag->frame, tag->size, &mp3)
+          && (mp3.size == tag->size)
+          && (mp3.data_offset + kLameTagCrcOffset + 2 <= mp3.size)
+          && rsvc_mp3_vbr_header_parse(tag->frame, &mp3, &header)
+          && header.has_frames && header.has_lame)
+        || (tag->nframes == 0)) {
+        return false;
+    }
+
+    uint8_t* xing = tag->frame + mp3.data_offset;
+    lame_put_be(xing + kXingFramesOffset, tag->nframes, 4);
+    lame_put_be(xing + kXingBytesOffset, tag->bytes, 4);
+    for (size_t i = 1; i < kXingTocSize; ++i) {
+        uint64_t offset = tag->frame_offsets[i * tag->nframes / kXingTocSize];
+        xing[kXingTocOffset + i] = MIN(255, offset * 256 / tag->bytes);
+    }
+
+    uint64_t padded = tag->nframes * frame_samples;
+    uint64_t padding = 0;
+    if (padded > header.encoder_delay + samples) {
+        padding = MIN(0xfff, padded - header.encoder_delay - samples);
+    }
+    uint8_t* delay = xing + kLameDelayOffset;
+    delay[1] = (delay[1] & 0xf0) | (padding >> 8);
+    delay[2] = padding;
+
+    lame_put_be(xing + kLameLengthOffset, tag->bytes, 4);
+    lame_put_be(xing + kLameMusicCrcOffset, tag->music_crc, 2);
+    lame_put_be(xing + kLameTagCrcOffset,
+                lame_crc16(0, tag->frame, mp3.data_offset + kLameTagCrcOffset), 2);
     return true;
 }
+
+// Returns the main data byte `back` bytes (counting from 1) before the
+// main data of frame `index` would start if it had no reservoir, or
+// NULL if that falls before frame `first`.
+static uint8_t* lame_reservoir_byte(lame_segment_t segment, size_t index, size_t back,
+                                    size_t first) {
+    while (index-- > first) {
+        struct lame_frame* frame = &segment->frames[index];
+        size_t body = frame->mp3.size - frame->mp3.data_offset;
+        if (back <= body) {
+            return segment->out.data + frame->offset + frame->mp3.size - back;
+        }
+        back -= body;
+    }
+    return NULL;
+}
+
+// The space between the end of the main data of the frames before
+// `index` and the start of frame `index`'s own main data.  Once frame
+// `index` and those after it are dropped, nothing uses it.
+static size_t lame_free_space(lame_segment_t segment, size_t index) {
+    const struct rsvc_mp3_frame* prev = &segment->frames[index - 1].mp3;
+    size_t body = prev->size - prev->data_offset;
+    size_t end = prev->main_data_size;
+    size_t begin = body + prev->main_data_begin;
+    return (end < begin) ? (begin - end) : 0;
+}
+
+// Joins `next` onto `prev` at the first frame of the window where the
+// part of next's bit reservoir from before that frame fits into the
+// space that prev leaves free there.  The reservoir bytes are copied
+// into prev's frames, which makes the join a valid bitstream.  Both
+// encoders saw the same audio for some time around the join, so it
+// doesn't click.
+//
+// Returns false if no frame in the window works.
+static bool lame_splice(lame_segment_t prev, lame_segment_t next, uint64_t window) {
+    for (uint64_t frame = window; frame < window + kLameWindowFrames; ++frame) {
+        size_t p = frame - prev->first_frame;
+        size_t n = frame - next->first_frame;
+        if ((p >= prev->nframes) || (n >= next->nframes)) {
+            break;
+        } else if ((p <= prev->keep_begin) || (n == 0)) {
+            continue;
+        }
+
+        size_t reservoir = next->frames[n].mp3.main_data_begin;
+        if (reservoir > lame_free_space(prev, p)) {
+            continue;
+        }
+        bool fits = true;
+        for (size_t back = 1; fits && (back <= reservoir); ++back) {
+            fits = lame_reservoir_byte(prev, p, back, prev->keep_begin)
+                && lame_reservoir_byte(next, n, back, 0);
+        }
+        if (!fits) {
+            continue;
+        }
+        for (size_t back = 1; back <= reservoir; ++back) {
+            *lame_reservoir_byte(prev, p, back, prev->keep_begin) =
+                *lame_reservoir_byte(next, n, back, 0);
+        }
+        prev->keep_end = p;
+        next->keep_begin = n;
+        return true;
+    }
+    return false;
+}
+
+static bool lame_encode_parallel(FILE* src_file, FILE* dst_file, rsvc_encode_options_t options,
+                                 size_t frame_samples, rsvc_done_t fail) {
+    struct rsvc_audio_info info      = options->info;
+    rsvc_encode_progress_f progress  = options->progress;
+    const size_t max_segments        = options->threads * 2;
+    const size_t segment_frames      = options->segment_samples
+            ? MAX(options->segment_samples / frame_samples, kLameMinSegmentFrames)
+            : kLameSegmentFrames;
+
+    lame_segment_t* segments = calloc(max_segments, sizeof(lame_segment_t));
+    __block size_t first = 0, count = 0;
+    __block lame_segment_t prev = NULL;
+    __block uint64_t frames_written = 0;
+    __block bool ok = true;
+    __block struct lame_tag tag = {.offset = -1};
+    uint64_t samples_read = 0;
+
+    bool (^write_prev)() = ^bool{
+        if (prev->tag) {
+            // The first segment: write its tag as a placeholder.
+            tag.offset = ftello(dst_file);
+            tag.frame = prev->tag;
+            tag.size = tag.bytes = prev->tag_size;
+            prev->tag = NULL;
+            if (!rsvc_write(NULL, dst_file, tag.frame, tag.size, fail)) {
+                lame_segment_destroy(prev);
+                prev = NULL;
+                return ok = false;
+            }
+        }
+        const struct lame_frame* begin = &prev->frames[prev->keep_begin];
+        const struct lame_frame* end = &prev->frames[prev->keep_end - 1];
+        ok = rsvc_write(NULL, dst_file, prev->out.data + begin->offset,
+                        end->offset + end->mp3.size - begin->offset, fail);
+        lame_tag_add(&tag, prev->out.data, begin, prev->keep_end - prev->keep_begin);
+        frames_written += prev->keep_end - prev->keep_begin;
+        progress(MIN(1.0, frames_written * frame_samples * 1.0 / info.samples_per_channel));
+        lame_segment_destroy(prev);
+        prev = NULL;
+        return ok;
+    };
+
+    // Waits for the oldest segment to be encoded, then joins it to the
+    // one before, which can then be written out.
+    bool (^finish_segment)() = ^bool{
+        lame_segment_t segment = segments[first];
+        first = (first + 1) % max_segments;
+        --count;
+        dispatch_semaphore_wait(segment->encoded, DISPATCH_TIME_FOREVER);
+        if (!ok) {
+            lame_segment_destroy(segment);
+            return false;
+        } else if (segment->error) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "%s", segment->error);
+            lame_segment_destroy(segment);
+            return ok = false;
+        }
+
+        if (prev) {
+            uint64_t window = segment->first_frame + kLameLeadInFrames;
+            if (!lame_splice(prev, segment, window)) {
+                // Rare: a segment without a bit reservoir always fits.
+                segment->disable_reservoir = true;
+                lame_encode_segment(segment);
+                if (segment->error || !lame_splice(prev, segment, window)) {
+                    rsvc_errorf(fail, __FILE__, __LINE__, "%s",
+                                segment->error ? segment->error : "couldn't join segments");
+                    lame_segment_destroy(segment);
+                    return ok = false;
+                }
+            }
+            if (!write_prev()) {
+                lame_segment_destroy(segment);
+                return false;
+            }
+        }
+        prev = segment;
+        return true;
+    };
+
+    // Segment k covers frames [k*S, (k+1)*S) of the stream, but its
+    // encoder is given samples from the lead-in before it to the
+    // lead-out after its window.  Consecutive segments overlap, so the
+    // start of each one is copied from the one before.
+    const size_t overlap_frames = kLameLeadInFrames + kLameWindowFrames + kLameLeadOutFrames;
+    const size_t max_samples = (segment_frames + overlap_frames) * frame_samples;
+    lame_segment_t last = NULL;
+    bool eof = false;
+    for (uint64_t k = 0; ok && !eof; ++k) {
+        if (count == max_segments) {
+            finish_segment();
+            --k;
+            continue;
+        }
+
+        lame_segment_t segment = calloc(1, sizeof(struct lame_segment));
+        segment->options = *options;
+        segment->samples = malloc(max_samples * info.block_align);
+        segment->encoded = dispatch_semaphore_create(0);
+        segment->write_tag = (k == 0);
+        size_t nsamples = 0;
+        if (k > 0) {
+            segment->first_frame = (k * segment_frames) - kLameLeadInFrames;
+            size_t skip = (segment->first_frame - last->first_frame) * frame_samples;
+            nsamples = last->samples_per_channel - skip;
+            memcpy(segment->samples, last->samples + (skip * info.channels),
+                   nsamples * info.block_align);
+        }
+        size_t want = max_samples - (k ? 0 : kLameLeadInFrames * frame_samples) - nsamples;
+        size_t nread;
+        if (!rsvc_read("pipe", src_file, segment->samples + (nsamples * info.channels), want,
+                       info.block_align, &nread, &eof, fail)) {
+            lame_segment_destroy(segment);
+            ok = false;
+            break;
+        }
+        eof = eof || (nread < want);
+        samples_read += nread;
+        segment->samples_per_channel = nsamples + nread;
+        last = segment;
+
+        segments[(first + count) % max_segments] = segment;
+        ++count;
+        dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            lame_encode_segment(segment);
+            dispatch_semaphore_signal(segment->encoded);
+        });
+    }
+    while (count) {
+        finish_segment();
+    }
+    if (ok && prev) {
+        write_prev();
+    } else if (prev) {
+        lame_segment_destroy(prev);
+    }
+    if (ok && tag.frame) {
+        if (!lame_tag_finish(&tag, frame_samples, samples_read)) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "unexpected tag from LAME encoder");
+            ok = false;
+        } else {
+            ok = lame_put_tag(dst_file, tag.offset, tag.frame, tag.size, fail);
+        }
+    }
+    free(tag.frame);
+    free(tag.frame_offsets);
+    free(segments);
+    return ok;
+}
@@ -28,27 +28,47 @@
 #include <rsvc/common.h>
 #include <rsvc/format.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/param.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "mp3.h"
+#include "sample.h"
 #include "unix.h"
 
+// Bytes read at once when walking frame headers, and the least that
+// must be buffered to check a frame: enough for two of the largest
+// frames and the header after them.
+#define kMadScanBufferSize  65536
+#define kMadScanLookahead   4096
+
 struct mad_userdata {
     FILE* src_file;
     FILE* dst_file;
-    unsigned char data[4096];
+    unsigned char data[4096 + MAD_BUFFER_GUARD];
     unsigned char* end;
     size_t end_position;
+    bool guarded;
+    unsigned sample_formats;
     struct rsvc_audio_info info;
     rsvc_done_t fail;
+
+    // Decoded samples per channel to drop from the start (a Xing
+    // frame, and the encoder and decoder delay), and to write after
+    // that.  The output always has exactly info.samples_per_channel
+    // samples, so that a consumer that relies on it, like the WAV
+    // encoder, gets a consistent file.
+    size_t skip;
+    size_t remaining;
 };
 
 static enum mad_flow mad_input(void* v, struct mad_stream* stream) {
     struct mad_userdata* userdata = v;
 
     unsigned char* data = userdata->data;
-    size_t size = sizeof(userdata->data);
+    size_t size = sizeof(userdata->data) - MAD_BUFFER_GUARD;
     if (stream->next_frame) {
         size_t prefix = userdata->end - stream->next_frame;
         memmove(userdata->data, stream->next_frame, prefix);
@@ -60,51 +80,43 @@ static enum mad_flow mad_input(void* v, struct mad_stream* stream) {
     if (!rsvc_read("pipe", userdata->src_file, data, size, 1, &size, &eof, userdata->fail)) {
         return MAD_FLOW_BREAK;
     } else if (eof) {
-        return MAD_FLOW_STOP;
+        // libmad needs MAD_BUFFER_GUARD bytes past the end of the last
+        // frame before it will decode it.
+        if (userdata->guarded) {
+            return MAD_FLOW_STOP;
+        }
+        userdata->guarded = true;
+        memset(data, 0, MAD_BUFFER_GUARD);
+        userdata->end = data + MAD_BUFFER_GUARD;
     } else {
         userdata->end = data + size;
         userdata->end_position += size;
-        mad_stream_buffer(stream, userdata->data, userdata->end - userdata->data);
-        return MAD_FLOW_CONTINUE;
     }
+    mad_stream_buffer(stream, userdata->data, userdata->end - userdata->data);
+    return MAD_FLOW_CONTINUE;
 }
 
-static enum mad_flow mad_header(void* v, struct mad_header const* header) {
-    struct mad_userdata* userdata = v;
-    switch (header->mode) {
-        case MAD_MODE_SINGLE_CHANNEL:
-            userdata->info.channels = 1;
-            break;
-
-        case MAD_MODE_DUAL_CHANNEL:
-        case MAD_MODE_STEREO:
-        case MAD_MODE_JOINT_STEREO:
-        default:
-            userdata->info.channels = 2;
-            break;
+static void mad_set_format(struct mad_userdata* userdata, size_t channels, size_t sample_rate) {
+    userdata->info.channels = channels;
+    // mad's output has more than 16 bits of precision; pass it through
+    // as float if possible.
+    if (userdata->sample_formats & RSVC_SAMPLE_FORMAT_BIT(RSVC_SAMPLE_F32)) {
+        userdata->info.bits_per_sample = 32;
+        userdata->info.block_align = 4 * channels;
+        userdata->info.sample_format = RSVC_SAMPLE_F32;
+    } else {
+        userdata->info.bits_per_sample = 16;
+        userdata->info.block_align = 2 * channels;
+        userdata->info.sample_format = RSVC_SAMPLE_S16;
     }
-    userdata->info.bits_per_sample = 16;  // TODO(sfiera): mad outputs 24
-    userdata->info.block_align = 2 * userdata->info.channels;
-    userdata->info.sample_rate = header->samplerate;
-
-    return MAD_FLOW_CONTINUE;
+    userdata->info.sample_rate = sample_rate;
 }
 
-// Taken directly from minimad.c example code.  Comments there suggest
-// using a version with dithering and noise shaping instead.  Is this
-// really relevant with most MP3s? (i.e. ones from 16-bit CDs).
-// TODO(sfiera): investigate better 24-to-32 bit audio conversion.
-static int16_t mad_scale(mad_fixed_t sample) {
-    // round
-    sample += (1L << (MAD_F_FRACBITS - 16));
-    // clip
-    if (sample >= MAD_F_ONE) {
-        sample = MAD_F_ONE - 1;
-    } else if (sample < -MAD_F_ONE) {
-        sample = -MAD_F_ONE;
-    }
-    // quantize
-    return sample >> (MAD_F_FRACBITS + 1 - 16);
+static enum mad_flow mad_header(void* v, struct mad_header const* header) {
+    struct mad_userdata* userdata = v;
+    mad_set_format(userdata, (header->mode == MAD_MODE_SINGLE_CHANNEL) ? 1 : 2,
+                   header->samplerate);
+    return MAD_FLOW_CONTINUE;
 }
 
 static enum mad_flow mad_count(void* v, struct mad_header const* header, struct mad_pcm* pcm) {
@@ -117,15 +129,27 @@ static enum mad_flow mad_count(void* v, struct mad_header const* header, struct
 static enum mad_flow mad_output(void* v, struct mad_header const* header, struct mad_pcm* pcm) {
     (void)header;
     struct mad_userdata* userdata = v;
-    int16_t data[2 * 1152];
-    size_t size = 0;
-    mad_fixed_t* channels[2] = {pcm->samples[0], pcm->samples[1]};
-    for (int i = 0; i < pcm->length; ++i) {
-        for (int chan = 0; chan < pcm->channels; ++chan) {
-            data[size++] = mad_scale(*(channels[chan]++));
-        }
+    size_t start = MIN(userdata->skip, pcm->length);
+    size_t length = MIN(pcm->length - start, userdata->remaining);
+    userdata->skip -= start;
+    userdata->remaining -= length;
+
+    union {
+        int16_t  s16[2 * 1152];
+        float    f32[2 * 1152];
+    } data;
+    const int32_t* const channels[2] = {pcm->samples[0] + start, pcm->samples[1] + start};
+    size_t size;
+    if (userdata->info.sample_format == RSVC_SAMPLE_F32) {
+        rsvc_sample_interleave_fixed_to_f32(channels, data.f32, pcm->channels, length,
+                                            MAD_F_FRACBITS);
+        size = pcm->channels * length * sizeof(float);
+    } else {
+        rsvc_sample_interleave_fixed_to_s16(channels, data.s16, pcm->channels, length,
+                                            MAD_F_FRACBITS);
+        size = pcm->channels * length * sizeof(int16_t);
     }
-    if (!rsvc_write("pipe", userdata->dst_file, &data, size * sizeof(int16_t), userdata->fail)) {
+    if (!rsvc_write("pipe", userdata->dst_file, &data, size, userdata->fail)) {
         return MAD_FLOW_BREAK;
     }
     return MAD_FLOW_CONTINUE;
@@ -174,7 +198,172 @@ bool mad_decode(struct mad_userdata* userdata) {
     return result == 0;
 }
 
-bool rsvc_mad_decode(FILE* src_file, FILE* dst_file,
+struct mp3_scan {
+    FILE*     file;
+    uint8_t*  data;
+    size_t    begin;
+    size_t    end;
+    bool      eof;
+};
+
+// Tops up the buffer so that at least kMadScanLookahead bytes are
+// available, unless the file ends first.
+static bool scan_fill(struct mp3_scan* s, rsvc_done_t fail) {
+    if (s->eof || ((s->end - s->begin) >= kMadScanLookahead)) {
+        return true;
+    }
+    memmove(s->data, s->data + s->begin, s->end - s->begin);
+    s->end -= s->begin;
+    s->begin = 0;
+    size_t size;
+    if (!rsvc_read(NULL, s->file, s->data + s->end, kMadScanBufferSize - s->end, 1,
+                   &size, &s->eof, fail)) {
+        return false;
+    }
+    s->end += size;
+    return true;
+}
+
+static bool same_stream(const struct rsvc_mp3_frame* a, const struct rsvc_mp3_frame* b) {
+    return (a->version == b->version) && (a->sample_rate == b->sample_rate);
+}
+
+// Parses the frame at the start of the buffer.  Unless `synced`, it
+// must be followed by another frame like it, or by the end of the
+// file, so that junk that happens to look like a frame header isn't
+// taken for one.
+static bool scan_frame(struct mp3_scan* s, const struct rsvc_mp3_frame* like, bool synced,
+                       struct rsvc_mp3_frame* frame) {
+    const uint8_t* data = s->data + s->begin;
+    size_t size = s->end - s->begin;
+    if (!(rsvc_mp3_frame_parse(data, size, frame) && (frame->size <= size) &&
+          (!like || same_stream(frame, like)))) {
+        return false;
+    } else if (synced) {
+        return true;
+    } else if (frame->size == size) {
+        return s->eof;
+    }
+    struct rsvc_mp3_frame next;
+    return rsvc_mp3_frame_parse(data + frame->size, size - frame->size, &next)
+        && same_stream(frame, &next);
+}
+
+// Counts the frames from the start of the buffer to the end of the
+// file, reading only their headers.  Junk between frames is skipped,
+// as libmad would.
+static bool scan_count(struct mp3_scan* s, const struct rsvc_mp3_frame* first, size_t* nframes,
+                       rsvc_done_t fail) {
+    bool synced = true;
+    size_t n = 0;
+    while (true) {
+        if (!scan_fill(s, fail)) {
+            return false;
+        } else if (s->begin == s->end) {
+            break;
+        }
+        struct rsvc_mp3_frame frame;
+        if (scan_frame(s, first, synced, &frame)) {
+            ++n;
+            s->begin += frame.size;
+            synced = true;
+        } else {
+            ++s->begin;
+            synced = false;
+        }
+    }
+    *nframes = n;
+    return true;
+}
+
+// Finds the length of the stream without decoding it: from its Xing or
+// VBRI header, if it has one with a frame count, or else by walking its
+// frame headers.  A LAME header also gives the encoder delay and
+// padding, which are trimmed from the decoded output.
+//
+// Sets `found` to false if the start of the file doesn't look like a
+// Layer III stream (e.g. Layer II, or free format), in which case the
+// caller has to decode the stream to find out.
+static bool mad_scan_audio_info(struct mad_userdata* userdata, bool* found) {
+    struct mp3_scan s = {
+        .file = userdata->src_file,
+        .data = malloc(kMadScanBufferSize),
+    };
+    *found = false;
+    bool ok = scan_fill(&s, userdata->fail);
+
+    // Look for the first frame in the first buffer's worth of data.
+    struct rsvc_mp3_frame first;
+    while (ok && (s.begin < s.end) && !scan_frame(&s, NULL, false, &first)) {
+        ++s.begin;
+    }
+    if (ok && (s.begin < s.end)) {
+        *found = true;
+        struct rsvc_mp3_vbr_header vbr;
+        bool has_vbr = rsvc_mp3_vbr_header_parse(s.data + s.begin, &first, &vbr);
+        size_t nframes = 0;
+        if (has_vbr) {
+            s.begin += first.size;
+        }
+        if (has_vbr && vbr.has_frames) {
+            nframes = vbr.frames;
+        } else {
+            ok = scan_count(&s, &first, &nframes, userdata->fail);
+        }
+
+        // The VBR header's frame decodes to silence.
+        size_t samples = nframes * first.samples;
+        userdata->skip = has_vbr ? first.samples : 0;
+        if (has_vbr && vbr.has_lame
+            && ((vbr.encoder_delay + vbr.encoder_padding) <= samples)) {
+            userdata->skip += vbr.encoder_delay + RSVC_MP3_DECODER_DELAY;
+            samples -= vbr.encoder_delay + vbr.encoder_padding;
+        }
+        mad_set_format(userdata, first.channels, first.sample_rate);
+        userdata->info.samples_per_channel = samples;
+        userdata->remaining = samples;
+    }
+    free(s.data);
+    return ok;
+}
+
+// Finds the length of the stream, rewinding `src_file` to `offset`.
+static bool mad_audio_info(struct mad_userdata* userdata, off_t offset) {
+    bool found;
+    if (!mad_scan_audio_info(userdata, &found)) {
+        return false;
+    } else if (!found) {
+        if (!(rsvc_seek(userdata->src_file, offset, SEEK_SET, userdata->fail) &&
+              mad_get_audio_info(userdata))) {
+            return false;
+        }
+        userdata->remaining = userdata->info.samples_per_channel;
+    }
+    userdata->end_position = 0;
+    userdata->guarded = false;
+    return rsvc_seek(userdata->src_file, offset, SEEK_SET, userdata->fail);
+}
+
+// Writes silence in place of any samples the stream fell short by,
+// e.g. if it was truncated after its Xing header was written.
+static bool mad_pad(struct mad_userdata* userdata) {
+    if (userdata->remaining == 0) {
+        return true;
+    }
+    rsvc_logf(1, "mp3 stream is %zu samples short", userdata->remaining);
+    static const uint8_t zero[4096];
+    while (userdata->remaining > 0) {
+        size_t n = MIN(userdata->remaining, sizeof(zero) / userdata->info.block_align);
+        if (!rsvc_write("pipe", userdata->dst_file, zero, n * userdata->info.block_align,
+                        userdata->fail)) {
+            return false;
+        }
+        userdata->remaining -= n;
+    }
+    return true;
+}
+
+bool rsvc_mad_decode(FILE* src_file, FILE* dst_file, rsvc_decode_options_t options,
                      rsvc_decode_info_f info, rsvc_done_t fail) {
     if (!rsvc_id3_skip_tags(src_file, fail)) {
         return false;
@@ -186,18 +375,15 @@ bool rsvc_mad_decode(FILE* src_file, FILE* dst_file,
     struct mad_userdata userdata = {
         .src_file = src_file,
         .dst_file = dst_file,
+        .sample_formats = options->sample_formats,
         .fail = fail,
     };
-    if (!mad_get_audio_info(&userdata)) {
+    if (!mad_audio_info(&userdata, offset)) {
         return false;
     }
     info(&userdata.info);
-
-    if (!rsvc_seek(src_file, offset, SEEK_SET, fail)) {
-        return false;
-    }
-    userdata.end_position = 0;
-    return mad_decode(&userdata);
+    return mad_decode(&userdata)
+        && mad_pad(&userdata);
 }
 
 bool rsvc_mad_audio_info(FILE* file, rsvc_audio_info_t info, rsvc_done_t fail) {
@@ -205,8 +391,10 @@ bool rsvc_mad_audio_info(FILE* file, rsvc_audio_info_t info, rsvc_done_t fail) {
         .src_file = file,
         .fail = fail,
     };
+    off_t offset;
     if (!(rsvc_id3_skip_tags(file, fail) &&
-          mad_get_audio_info(&userdata))) {
+          rsvc_tell(file, &offset, fail) &&
+          mad_audio_info(&userdata, offset))) {
         return false;
     }
     *info = userdata.info;
@@ -0,0 +1,122 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "md5.h"
+
+#include <string.h>
+
+static const uint32_t kSines[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613,
+    0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193,
+    0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d,
+    0x02441453, 0xd8a1e681, 0xe7d3fbc8, 0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+    0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122,
+    0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+    0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665, 0xf4292244,
+    0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb,
+    0xeb86d391,
+};
+
+static const int kShifts[4][4] = {
+    {7, 12, 17, 22},
+    {5, 9, 14, 20},
+    {4, 11, 16, 23},
+    {6, 10, 15, 21},
+};
+
+static inline uint32_t rotl(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+static void md5_block(uint32_t state[4], const uint8_t block[64]) {
+    uint32_t m[16];
+    for (int i = 0; i < 16; ++i) {
+        m[i] = block[4 * i] | (block[4 * i + 1] << 8) | (block[4 * i + 2] << 16)
+             | ((uint32_t)block[4 * i + 3] << 24);
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t f;
+        int g;
+        switch (i / 16) {
+          case 0: f = (b & c) | (~b & d); g = i; break;
+          case 1: f = (d & b) | (~d & c); g = (5 * i + 1) % 16; break;
+          case 2: f = b ^ c ^ d;          g = (3 * i + 5) % 16; break;
+          default: f = c ^ (b | ~d);      g = (7 * i) % 16; break;
+        }
+        uint32_t t = d;
+        d = c;
+        c = b;
+        b = b + rotl(a + f + kSines[i] + m[g], kShifts[i / 16][i % 4]);
+        a = t;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+}
+
+void rsvc_md5_init(struct rsvc_md5* md5) {
+    md5->state[0] = 0x67452301;
+    md5->state[1] = 0xefcdab89;
+    md5->state[2] = 0x98badcfe;
+    md5->state[3] = 0x10325476;
+    md5->size = 0;
+}
+
+void rsvc_md5_update(struct rsvc_md5* md5, const void* data, size_t size) {
+    const uint8_t* bytes = data;
+    size_t used = md5->size % 64;
+    md5->size += size;
+    if (used) {
+        size_t n = 64 - used;
+        if (size < n) {
+            memcpy(md5->buffer + used, bytes, size);
+            return;
+        }
+        memcpy(md5->buffer + used, bytes, n);
+        md5_block(md5->state, md5->buffer);
+        bytes += n;
+        size -= n;
+    }
+    for ( ; size >= 64; bytes += 64, size -= 64) {
+        md5_block(md5->state, bytes);
+    }
+    memcpy(md5->buffer, bytes, size);
+}
+
+void rsvc_md5_final(struct rsvc_md5* md5, uint8_t digest[16]) {
+    uint64_t bits = md5->size * 8;
+    uint8_t padding[72] = {0x80};
+    size_t used = md5->size % 64;
+    size_t n = (used < 56) ? (56 - used) : (120 - used);
+    for (int i = 0; i < 8; ++i) {
+        padding[n + i] = bits >> (8 * i);
+    }
+    rsvc_md5_update(md5, padding, n + 8);
+    for (int i = 0; i < 16; ++i) {
+        digest[i] = md5->state[i / 4] >> (8 * (i % 4));
+    }
+}
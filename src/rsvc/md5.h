@@ -0,0 +1,40 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#ifndef SRC_RSVC_MD5_H_
+#define SRC_RSVC_MD5_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// MD5 (RFC 1321), for FLAC's STREAMINFO signature.  Not for anything
+// that needs a secure hash.
+struct rsvc_md5 {
+    uint32_t  state[4];
+    uint64_t  size;
+    uint8_t   buffer[64];
+};
+
+void rsvc_md5_init(struct rsvc_md5* md5);
+void rsvc_md5_update(struct rsvc_md5* md5, const void* data, size_t size);
+void rsvc_md5_final(struct rsvc_md5* md5, uint8_t digest[16]);
+
+#endif  // SRC_RSVC_MD5_H_
@@ -0,0 +1,169 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mp3.h"
+
+#include <string.h>
+
+static const int kBitrates[2][16] = {
+    {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, -1},  // MPEG-1
+    {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, -1},      // MPEG-2, 2.5
+};
+
+static const int kSampleRates[3][4] = {
+    {44100, 48000, 32000, -1},
+    {22050, 24000, 16000, -1},
+    {11025, 12000, 8000, -1},
+};
+
+struct bit_reader {
+    const uint8_t*  data;
+    size_t          bit;
+};
+
+static uint32_t read_bits(struct bit_reader* r, int count) {
+    uint32_t value = 0;
+    for (int i = 0; i < count; ++i, ++r->bit) {
+        value = (value << 1) | ((r->data[r->bit / 8] >> (7 - (r->bit % 8))) & 1);
+    }
+    return value;
+}
+
+bool rsvc_mp3_frame_parse(const uint8_t* data, size_t size, struct rsvc_mp3_frame* frame) {
+    if ((size < 4) || (data[0] != 0xff) || ((data[1] & 0xe0) != 0xe0)) {
+        return false;
+    }
+
+    struct rsvc_mp3_frame f = {};
+    switch ((data[1] >> 3) & 3) {
+      case 0: f.version = RSVC_MPEG_2_5; break;
+      case 2: f.version = RSVC_MPEG_2; break;
+      case 3: f.version = RSVC_MPEG_1; break;
+      default: return false;
+    }
+    if (((data[1] >> 1) & 3) != 1) {
+        return false;  // not Layer III
+    }
+    const bool mpeg1 = (f.version == RSVC_MPEG_1);
+    f.crc = !(data[1] & 1);
+    f.bitrate = kBitrates[mpeg1 ? 0 : 1][data[2] >> 4];
+    f.sample_rate = kSampleRates[f.version][(data[2] >> 2) & 3];
+    f.channels = ((data[3] >> 6) == 3) ? 1 : 2;
+    if ((f.bitrate <= 0) || (f.sample_rate < 0)) {
+        return false;
+    }
+
+    const bool padding = data[2] & 2;
+    f.samples = mpeg1 ? 1152 : 576;
+    f.size = (f.samples / 8) * f.bitrate * 1000 / f.sample_rate + padding;
+    size_t side_info_size;
+    if (mpeg1) {
+        side_info_size = (f.channels == 1) ? 17 : 32;
+    } else {
+        side_info_size = (f.channels == 1) ? 9 : 17;
+    }
+    f.data_offset = 4 + (f.crc ? 2 : 0) + side_info_size;
+    if ((size < f.data_offset) || (f.size < f.data_offset)) {
+        return false;
+    }
+
+    // Only main_data_begin and each granule's part2_3_length matter
+    // here; skip the rest of the side information.
+    struct bit_reader r = {data + 4 + (f.crc ? 2 : 0), 0};
+    size_t bits = 0;
+    if (mpeg1) {
+        f.main_data_begin = read_bits(&r, 9);
+        r.bit += (f.channels == 1) ? 5 : 3;  // private bits
+        r.bit += 4 * f.channels;             // scfsi
+        for (int gr = 0; gr < 2; ++gr) {
+            for (int ch = 0; ch < f.channels; ++ch) {
+                bits += read_bits(&r, 12);
+                r.bit += 59 - 12;
+            }
+        }
+    } else {
+        f.main_data_begin = read_bits(&r, 8);
+        r.bit += f.channels;  // private bits
+        for (int ch = 0; ch < f.channels; ++ch) {
+            bits += read_bits(&r, 12);
+            r.bit += 63 - 12;
+        }
+    }
+    f.main_data_size = (bits + 7) / 8;
+    *frame = f;
+    return true;
+}
+
+static uint32_t u32be(const uint8_t* data) {
+    return ((uint32_t)data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+}
+
+// Xing header flags, for the optional fields that follow them.
+enum {
+    kXingFrames   = 0x1,
+    kXingBytes    = 0x2,
+    kXingToc      = 0x4,
+    kXingQuality  = 0x8,
+};
+
+bool rsvc_mp3_vbr_header_parse(const uint8_t* data, const struct rsvc_mp3_frame* frame,
+                               struct rsvc_mp3_vbr_header* header) {
+    struct rsvc_mp3_vbr_header h = {};
+
+    // The Xing header takes the place of the main data; the VBRI header
+    // is always 32 bytes past the frame header.
+    const uint8_t* p = data + frame->data_offset;
+    const uint8_t* end = data + frame->size;
+    if ((p + 8 <= end) && ((memcmp(p, "Xing", 4) == 0) || (memcmp(p, "Info", 4) == 0))) {
+        uint32_t flags = u32be(p + 4);
+        p += 8;
+        if (flags & kXingFrames) {
+            if (p + 4 > end) {
+                return false;
+            }
+            h.has_frames = true;
+            h.frames = u32be(p);
+            p += 4;
+        }
+        p += (flags & kXingBytes) ? 4 : 0;
+        p += (flags & kXingToc) ? 100 : 0;
+        p += (flags & kXingQuality) ? 4 : 0;
+
+        // The LAME extension starts with a 9-byte encoder version; the
+        // delay and padding are two 12-bit fields at byte 21.  FFmpeg
+        // writes the same extension, under its own name.
+        if ((p + 24 <= end) &&
+            ((memcmp(p, "LAME", 4) == 0) || (memcmp(p, "Lavf", 4) == 0) ||
+             (memcmp(p, "Lavc", 4) == 0))) {
+            h.has_lame = true;
+            h.encoder_delay = (p[21] << 4) | (p[22] >> 4);
+            h.encoder_padding = ((p[22] & 0x0f) << 8) | p[23];
+        }
+    } else if ((data + 36 + 18 <= end) && (memcmp(data + 36, "VBRI", 4) == 0)) {
+        h.has_frames = true;
+        h.frames = u32be(data + 36 + 14);
+    } else {
+        return false;
+    }
+    *header = h;
+    return true;
+}
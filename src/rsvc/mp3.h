@@ -0,0 +1,85 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#ifndef SRC_RSVC_MP3_H_
+#define SRC_RSVC_MP3_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum rsvc_mpeg_version {
+    RSVC_MPEG_1,
+    RSVC_MPEG_2,
+    RSVC_MPEG_2_5,
+};
+
+// An MPEG audio Layer III frame, as described by its header and side
+// information.  Offsets are from the start of the frame.
+//
+// A frame's main data (scale factors and Huffman-coded samples) need
+// not be inside the frame: it starts `main_data_begin` bytes before
+// `data_offset`, counting only the bytes after the side information
+// of each earlier frame.  That space is the bit reservoir.
+struct rsvc_mp3_frame {
+    enum rsvc_mpeg_version  version;
+    bool                    crc;
+    int                     bitrate;          // kbit/s
+    int                     sample_rate;
+    int                     channels;
+    size_t                  size;
+    size_t                  samples;          // per channel
+    size_t                  data_offset;      // past header, CRC, and side information
+    size_t                  main_data_begin;
+    size_t                  main_data_size;   // rounded up to whole bytes
+};
+
+// Parses the Layer III frame at the start of `data`.  Returns false if
+// `data` doesn't start with one, or if it is a free-format frame, or if
+// `size` is too small for its header and side information.  The frame
+// itself may extend past `size`.
+bool rsvc_mp3_frame_parse(const uint8_t* data, size_t size, struct rsvc_mp3_frame* frame);
+
+// The header that some encoders write in place of the first frame's
+// audio: "Xing" (or "Info", for CBR streams) from LAME and others, or
+// "VBRI" from Fraunhofer's encoder.  It counts the frames after it, so
+// that the length of the stream is known without reading it all.
+//
+// LAME extends the Xing header with the number of samples of silence
+// that the encoder added at the start (not counting the decoder's
+// delay of 529 samples) and at the end; a gapless decoder trims them.
+struct rsvc_mp3_vbr_header {
+    bool    has_frames;
+    size_t  frames;
+    bool    has_lame;
+    size_t  encoder_delay;
+    size_t  encoder_padding;
+};
+
+// The decoder delay of the MP3 synthesis filterbank.
+#define RSVC_MP3_DECODER_DELAY 529
+
+// Parses the header in `frame`, the first frame of a stream, which
+// starts at `data` and must be entirely within it.  Returns false if
+// the frame is an ordinary audio frame.
+bool rsvc_mp3_vbr_header_parse(const uint8_t* data, const struct rsvc_mp3_frame* frame,
+                               struct rsvc_mp3_vbr_header* header);
+
+#endif  // SRC_RSVC_MP3_H_
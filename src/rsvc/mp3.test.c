@@ -0,0 +1,216 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "mp3.h"
+
+#include <string.h>
+#include "test.h"
+
+// Writes the low `count` bits of `value` at bit `bit` of `data`.
+static void put_bits(uint8_t* data, size_t bit, int count, uint32_t value) {
+    for (int i = count - 1; i >= 0; --i, ++bit) {
+        if (value & (1u << i)) {
+            data[bit / 8] |= 0x80 >> (bit % 8);
+        }
+    }
+}
+
+static void put_u32be(uint8_t* data, uint32_t value) {
+    data[0] = value >> 24;
+    data[1] = value >> 16;
+    data[2] = value >> 8;
+    data[3] = value;
+}
+
+static void test_frame_header() {
+    struct rsvc_mp3_frame f;
+    uint8_t frame[1024] = {};
+
+    // MPEG-1, 128 kbit/s, 44.1 kHz, stereo, no CRC.
+    memcpy(frame, "\xff\xfb\x90\x00", 4);
+    EXPECT_EQ(true, rsvc_mp3_frame_parse(frame, sizeof(frame), &f));
+    EXPECT_EQ(RSVC_MPEG_1, f.version);
+    EXPECT_EQ(false, f.crc);
+    EXPECT_EQ(128, f.bitrate);
+    EXPECT_EQ(44100, f.sample_rate);
+    EXPECT_EQ(2, f.channels);
+    EXPECT_EQ(417, f.size);
+    EXPECT_EQ(1152, f.samples);
+    EXPECT_EQ(4 + 32, f.data_offset);
+
+    // The same, padded, with a CRC.
+    memcpy(frame, "\xff\xfa\x92\x00", 4);
+    EXPECT_EQ(true, rsvc_mp3_frame_parse(frame, sizeof(frame), &f));
+    EXPECT_EQ(true, f.crc);
+    EXPECT_EQ(418, f.size);
+    EXPECT_EQ(4 + 2 + 32, f.data_offset);
+
+    // MPEG-1 mono has shorter side information.
+    memcpy(frame, "\xff\xfb\x90\xc0", 4);
+    EXPECT_EQ(true, rsvc_mp3_frame_parse(frame, sizeof(frame), &f));
+    EXPECT_EQ(1, f.channels);
+    EXPECT_EQ(4 + 17, f.data_offset);
+
+    // MPEG-2, 64 kbit/s, 22.05 kHz, stereo.
+    memcpy(frame, "\xff\xf3\x80\x00", 4);
+    EXPECT_EQ(true, rsvc_mp3_frame_parse(frame, sizeof(frame), &f));
+    EXPECT_EQ(RSVC_MPEG_2, f.version);
+    EXPECT_EQ(64, f.bitrate);
+    EXPECT_EQ(22050, f.sample_rate);
+    EXPECT_EQ(208, f.size);
+    EXPECT_EQ(576, f.samples);
+    EXPECT_EQ(4 + 17, f.data_offset);
+
+    // MPEG-2.5, 8 kbit/s, 8 kHz, mono.
+    memcpy(frame, "\xff\xe3\x18\xc0", 4);
+    EXPECT_EQ(true, rsvc_mp3_frame_parse(frame, sizeof(frame), &f));
+    EXPECT_EQ(RSVC_MPEG_2_5, f.version);
+    EXPECT_EQ(8, f.bitrate);
+    EXPECT_EQ(8000, f.sample_rate);
+    EXPECT_EQ(72, f.size);
+    EXPECT_EQ(4 + 9, f.data_offset);
+}
+
+static void test_frame_rejects() {
+    struct rsvc_mp3_frame f;
+    uint8_t frame[1024] = {};
+
+    memcpy(frame, "\xff\xfb\x90\x00", 4);
+    EXPECT_EQ(false, rsvc_mp3_frame_parse(frame, 3, &f));       // truncated header
+    EXPECT_EQ(false, rsvc_mp3_frame_parse(frame, 20, &f));      // truncated side info
+    memcpy(frame, "\xfe\xfb\x90\x00", 4);
+    EXPECT_EQ(false, rsvc_mp3_frame_parse(frame, sizeof(frame), &f));  // no sync
+    memcpy(frame, "\xff\xeb\x90\x00", 4);
+    EXPECT_EQ(false, rsvc_mp3_frame_parse(frame, sizeof(frame), &f));  // reserved version
+    memcpy(frame, "\xff\xfd\x90\x00", 4);
+    EXPECT_EQ(false, rsvc_mp3_frame_parse(frame, sizeof(frame), &f));  // Layer I
+    memcpy(frame, "\xff\xfb\x00\x00", 4);
+    EXPECT_EQ(false, rsvc_mp3_frame_parse(frame, sizeof(frame), &f));  // free format
+    memcpy(frame, "\xff\xfb\xf0\x00", 4);
+    EXPECT_EQ(false, rsvc_mp3_frame_parse(frame, sizeof(frame), &f));  // bad bitrate
+    memcpy(frame, "\xff\xfb\x9c\x00", 4);
+    EXPECT_EQ(false, rsvc_mp3_frame_parse(frame, sizeof(frame), &f));  // bad sample rate
+}
+
+static void test_side_info() {
+    struct rsvc_mp3_frame f;
+
+    // MPEG-1 stereo: main_data_begin, private bits and scfsi, then 59
+    // bits per granule and channel, starting with part2_3_length.
+    uint8_t frame[1024] = {0xff, 0xfb, 0x90, 0x00};
+    put_bits(frame + 4, 0, 9, 300);
+    put_bits(frame + 4, 20 + (0 * 59), 12, 100);
+    put_bits(frame + 4, 20 + (1 * 59), 12, 200);
+    put_bits(frame + 4, 20 + (2 * 59), 12, 300);
+    put_bits(frame + 4, 20 + (3 * 59), 12, 401);
+    EXPECT_EQ(true, rsvc_mp3_frame_parse(frame, sizeof(frame), &f));
+    EXPECT_EQ(300, f.main_data_begin);
+    EXPECT_EQ(126, f.main_data_size);  // 1001 bits, rounded up
+
+    // MPEG-2 mono: an 8-bit main_data_begin, one private bit, then one
+    // granule.  The CRC comes before the side information.
+    uint8_t frame2[1024] = {0xff, 0xf2, 0x80, 0xc0};
+    put_bits(frame2 + 6, 0, 8, 255);
+    put_bits(frame2 + 6, 9, 12, 17);
+    EXPECT_EQ(true, rsvc_mp3_frame_parse(frame2, sizeof(frame2), &f));
+    EXPECT_EQ(4 + 2 + 9, f.data_offset);
+    EXPECT_EQ(255, f.main_data_begin);
+    EXPECT_EQ(3, f.main_data_size);
+}
+
+static void test_xing() {
+    struct rsvc_mp3_frame f;
+    struct rsvc_mp3_vbr_header h;
+    uint8_t frame[1024] = {0xff, 0xfb, 0x90, 0x00};
+    rsvc_mp3_frame_parse(frame, sizeof(frame), &f);
+
+    // An ordinary frame.
+    EXPECT_EQ(false, rsvc_mp3_vbr_header_parse(frame, &f, &h));
+
+    // Frames, bytes, TOC, and quality, then LAME's extension with 576
+    // samples of delay and 1234 of padding.
+    uint8_t* p = frame + f.data_offset;
+    memcpy(p, "Xing", 4);
+    put_u32be(p + 4, 0xf);
+    put_u32be(p + 8, 12345);
+    uint8_t* lame = p + 8 + 4 + 4 + 100 + 4;
+    memcpy(lame, "LAME3.100", 9);
+    lame[21] = 576 >> 4;
+    lame[22] = ((576 & 0xf) << 4) | (1234 >> 8);
+    lame[23] = 1234 & 0xff;
+    EXPECT_EQ(true, rsvc_mp3_vbr_header_parse(frame, &f, &h));
+    EXPECT_EQ(true, h.has_frames);
+    EXPECT_EQ(12345, h.frames);
+    EXPECT_EQ(true, h.has_lame);
+    EXPECT_EQ(576, h.encoder_delay);
+    EXPECT_EQ(1234, h.encoder_padding);
+
+    // Without the TOC, the extension moves up.
+    memset(p, 0, f.size - f.data_offset);
+    memcpy(p, "Xing", 4);
+    put_u32be(p + 4, 0x1);
+    put_u32be(p + 8, 99);
+    memcpy(p + 12, "Lavc", 4);
+    p[12 + 21] = 0x12;
+    p[12 + 22] = 0x34;
+    p[12 + 23] = 0x56;
+    EXPECT_EQ(true, rsvc_mp3_vbr_header_parse(frame, &f, &h));
+    EXPECT_EQ(99, h.frames);
+    EXPECT_EQ(true, h.has_lame);
+    EXPECT_EQ(0x123, h.encoder_delay);
+    EXPECT_EQ(0x456, h.encoder_padding);
+
+    // "Info" marks a CBR stream; this one has no frame count or
+    // extension.
+    memset(p, 0, f.size - f.data_offset);
+    memcpy(p, "Info", 4);
+    EXPECT_EQ(true, rsvc_mp3_vbr_header_parse(frame, &f, &h));
+    EXPECT_EQ(false, h.has_frames);
+    EXPECT_EQ(false, h.has_lame);
+}
+
+static void test_vbri() {
+    struct rsvc_mp3_frame f;
+    struct rsvc_mp3_vbr_header h;
+    uint8_t frame[1024] = {0xff, 0xfb, 0x90, 0x00};
+    rsvc_mp3_frame_parse(frame, sizeof(frame), &f);
+
+    // VBRI is always 32 bytes past the header, whatever the side
+    // information's size; the frame count is 14 bytes into it.
+    memcpy(frame + 36, "VBRI", 4);
+    put_u32be(frame + 36 + 14, 4321);
+    EXPECT_EQ(true, rsvc_mp3_vbr_header_parse(frame, &f, &h));
+    EXPECT_EQ(true, h.has_frames);
+    EXPECT_EQ(4321, h.frames);
+    EXPECT_EQ(false, h.has_lame);
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    test_frame_header();
+    test_frame_rejects();
+    test_side_info();
+    test_xing();
+    test_vbri();
+    return test_result();
+}
@@ -59,8 +59,6 @@ static bool set_mb_tag(rsvc_tags_t tags, const char* tag_name,
 }
 
 static bool mb5_query_cached(const char* discid, Mb5Metadata* meta, rsvc_done_t fail) {
-    (void)fail;  // TODO(sfiera): handle failure conditions?
-
     // MusicBrainz requires that requests be throttled to 1 per second.
     // In order to do so, we serialize all of our requests through a
     // single dispatch queue.
@@ -73,6 +71,8 @@ static bool mb5_query_cached(const char* discid, Mb5Metadata* meta, rsvc_done_t
         throttle = dispatch_semaphore_create(1);
     });
 
+    // An entry with NULL `meta` records that MusicBrainz doesn't know
+    // the disc, so that each track doesn't ask again.
     struct cache_entry {
         char*               discid;
         Mb5Metadata         meta;
@@ -81,6 +81,9 @@ static bool mb5_query_cached(const char* discid, Mb5Metadata* meta, rsvc_done_t
     static struct cache_entry* cache = NULL;
 
     __block bool result = true;
+    __block bool not_found = false;
+    char error_storage[256] = "";
+    char* error = error_storage;  // blocks can't capture arrays
     dispatch_sync(cache_queue, ^{
         // Look for `discid` in the cache.
         //
@@ -90,7 +93,8 @@ static bool mb5_query_cached(const char* discid, Mb5Metadata* meta, rsvc_done_t
             if (strcmp(discid, curr->discid) == 0) {
                 rsvc_logf(1, "mb request in cache for %s", discid);
                 *meta = curr->meta;
-                result = true;
+                not_found = !curr->meta;
+                result = !not_found;
                 return;
             }
         }
@@ -116,6 +120,18 @@ static bool mb5_query_cached(const char* discid, Mb5Metadata* meta, rsvc_done_t
         Mb5Metadata response = mb5_query_query(q, "discid", discid, NULL,
                                              1, param_names, param_values);
         rsvc_logf(1, "received mb response for %s", discid);
+        if (!response) {
+            not_found = (mb5_query_get_lastresult(q) == eQuery_ResourceNotFound);
+            mb5_query_get_lasterrormessage(q, error, sizeof(error_storage));
+            result = false;
+        }
+        mb5_query_delete(q);
+        if (!response && !not_found) {
+            // Leave transient failures (network errors, timeouts, server
+            // errors) out of the cache, so that a later lookup tries
+            // again.
+            return;
+        }
         *meta = response;
         struct cache_entry new_cache = {
             .discid = strdup(discid),
@@ -123,9 +139,31 @@ static bool mb5_query_cached(const char* discid, Mb5Metadata* meta, rsvc_done_t
             .next   = cache,
         };
         cache = memdup(&new_cache, sizeof new_cache);
-        mb5_query_delete(q);
     });
-    return result;
+    if (result) {
+        return true;
+    } else if (not_found) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "discid not found: %s", discid);
+    } else {
+        rsvc_errorf(fail, __FILE__, __LINE__, "musicbrainz query failed: %s", error);
+    }
+    return false;
+}
+
+// Starts the query for `discid` in the background, so that it is
+// likely to be cached by the time rsvc_apply_musicbrainz_tags() needs
+// it.  Failures are ignored here.  A disc that MusicBrainz doesn't
+// know is cached as such; other failures aren't, so the later lookup
+// queries again, and reports the error if it recurs.
+void rsvc_prefetch_musicbrainz(const char* discid) {
+    char* discid_copy = strdup(discid);
+    dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+        Mb5Metadata meta;
+        (void)mb5_query_cached(discid_copy, &meta, ^(rsvc_error_t error){
+            (void)error;
+        });
+        free(discid_copy);
+    });
 }
 
 bool rsvc_apply_musicbrainz_tags(rsvc_tags_t tags, rsvc_done_t fail) {
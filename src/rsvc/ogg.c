@@ -27,6 +27,18 @@
 #include "common.h"
 #include "unix.h"
 
+const uint8_t rsvc_ogg_channel_order[9][8] = {
+    {0},
+    {0},
+    {0, 1},
+    {0, 2, 1},
+    {0, 1, 2, 3},
+    {0, 2, 1, 3, 4},
+    {0, 2, 1, 4, 5, 3},
+    {0, 2, 1, 5, 6, 4, 3},
+    {0, 2, 1, 6, 7, 4, 5, 3},
+};
+
 void rsvc_ogg_page_clear(ogg_page* og) {
     if (og->header) {
         free(og->header);
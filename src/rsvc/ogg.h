@@ -22,6 +22,7 @@
 #define SRC_RSVC_OGG_H_
 
 #include <ogg/ogg.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #include <rsvc/common.h>
@@ -38,4 +39,9 @@ bool rsvc_ogg_flush(FILE* file, ogg_stream_state *os, ogg_page* og, rsvc_done_t
 bool rsvc_ogg_align_packet(FILE* file, ogg_stream_state *os,
                            ogg_page* og, ogg_packet* op, rsvc_done_t fail);
 
+// Vorbis, and Opus with mapping family 1, order channels differently
+// from WAV and FLAC.  Row n gives, for each channel of an n-channel
+// Ogg stream, the WAV channel it corresponds to.
+extern const uint8_t rsvc_ogg_channel_order[9][8];
+
 #endif  // RSVC_OGG_H_
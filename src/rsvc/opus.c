@@ -23,17 +23,32 @@
 #include "audio.h"
 
 #include <opus.h>
+#include <opus_multistream.h>
 #include <opusfile.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/param.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 #include <rsvc/format.h>
 
 #include "common.h"
 #include "ogg.h"
+#include "dither.h"
+#include "resample.h"
+#include "sample.h"
 #include "unix.h"
 
+// Opus always codes 48 kHz audio; other rates are resampled on the way
+// in.  Pre-skip and granule positions count 48 kHz samples regardless
+// of the input rate.  Packets are 20 ms.
+#define kOpusRate          48000
+#define kOpusFrameSize     960
+#define kOpusSamples       2048
+#define kOpusMaxPacketSize 4000  // per stream, as recommended by opus.h
+#define kOpusMaxFrameSize  5760  // 120 ms
+
 typedef struct opus_tags* opus_tags_t;
 struct opus_tags {
     struct rsvc_tags  super;
@@ -165,6 +180,364 @@ static void rsvc_opus_tags_out(OpusTags* tags, ogg_packet* op) {
     op->granulepos = 0;
 }
 
+typedef struct opus_encoder* opus_encoder_t;
+struct opus_encoder {
+    struct rsvc_audio_info  info;
+    FILE*                   file;
+    OpusMSEncoder*          encoder;
+    rsvc_resampler_t        resampler;  // NULL if the input is 48 kHz
+    ogg_stream_state        os;
+    int                     streams;
+
+    float*                  frame;
+    size_t                  frame_fill;
+    unsigned char*          packet;
+    int64_t                 packetno;
+    int64_t                 granulepos;
+};
+
+static void opus_encoder_clear(opus_encoder_t self) {
+    opus_multistream_encoder_destroy(self->encoder);
+    if (self->resampler) {
+        rsvc_resampler_destroy(self->resampler);
+    }
+    ogg_stream_clear(&self->os);
+    free(self->frame);
+    free(self->packet);
+}
+
+static bool opus_write_pages(opus_encoder_t self, bool flush, rsvc_done_t fail) {
+    ogg_page og;
+    while (flush ? ogg_stream_flush(&self->os, &og) : ogg_stream_pageout(&self->os, &og)) {
+        if (!(rsvc_write(NULL, self->file, og.header, og.header_len, fail) &&
+              rsvc_write(NULL, self->file, og.body, og.body_len, fail))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Encodes the frame buffer, padded with silence, as a packet ending at
+// `end` samples into the stream.  The last packet's granule position
+// is the end of the audio, not of the packet, which tells the decoder
+// how much of the padding to trim.
+static bool opus_encode_frame(opus_encoder_t self, int64_t end, bool eos, rsvc_done_t fail) {
+    const size_t channels = self->info.channels;
+    memset(self->frame + (self->frame_fill * channels), 0,
+           (kOpusFrameSize - self->frame_fill) * channels * sizeof(float));
+    self->frame_fill = 0;
+    opus_int32 size = opus_multistream_encode_float(
+            self->encoder, self->frame, kOpusFrameSize,
+            self->packet, kOpusMaxPacketSize * self->streams);
+    if (size < 0) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "opus encode error: %s", opus_strerror(size));
+        return false;
+    }
+    self->granulepos += kOpusFrameSize;
+    ogg_packet op = {
+        .packet      = self->packet,
+        .bytes       = size,
+        .e_o_s       = eos,
+        .granulepos  = eos ? end : self->granulepos,
+        .packetno    = self->packetno++,
+    };
+    ogg_stream_packetin(&self->os, &op);
+    return opus_write_pages(self, eos, fail);
+}
+
+// Buffers `count` samples per channel of 48 kHz audio, encoding each
+// frame as it fills up.
+static bool opus_feed(opus_encoder_t self, const float* samples, size_t count,
+                      rsvc_done_t fail) {
+    const size_t channels = self->info.channels;
+    while (count > 0) {
+        size_t n = MIN(count, kOpusFrameSize - self->frame_fill);
+        memcpy(self->frame + (self->frame_fill * channels), samples,
+               n * channels * sizeof(float));
+        self->frame_fill  += n;
+        samples           += n * channels;
+        count             -= n;
+        if ((self->frame_fill == kOpusFrameSize) &&
+            !opus_encode_frame(self, 0, false, fail)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool rsvc_opus_encode(FILE* src_file, FILE* dst_file, rsvc_encode_options_t options,
+                      rsvc_done_t fail) {
+    struct rsvc_audio_info  info      = options->info;
+    rsvc_encode_progress_f  progress  = options->progress;
+    if (!rsvc_audio_info_validate(&info, fail)) {
+        return false;
+    }
+
+    OpusHead head = {
+        .version            = 1,
+        .channel_count      = info.channels,
+        .input_sample_rate  = info.sample_rate,
+        .mapping_family     = (info.channels > 2) ? 1 : 0,
+    };
+    int error;
+    OpusMSEncoder* encoder = opus_multistream_surround_encoder_create(
+            kOpusRate, info.channels, head.mapping_family,
+            &head.stream_count, &head.coupled_count, head.mapping,
+            OPUS_APPLICATION_AUDIO, &error);
+    if (!encoder) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "couldn't init opus encoder: %s",
+                    opus_strerror(error));
+        return false;
+    }
+    opus_int32 lookahead;
+    if ((opus_multistream_encoder_ctl(encoder, OPUS_SET_BITRATE(options->bitrate)) != OPUS_OK) ||
+        (opus_multistream_encoder_ctl(encoder, OPUS_GET_LOOKAHEAD(&lookahead)) != OPUS_OK)) {
+        opus_multistream_encoder_destroy(encoder);
+        rsvc_errorf(fail, __FILE__, __LINE__, "invalid opus bitrate: %d", options->bitrate);
+        return false;
+    }
+    // The encoder's lookahead comes out as silence before the first
+    // input sample; pre-skip tells the decoder to drop it.
+    head.pre_skip = lookahead;
+
+    struct opus_encoder self = {
+        .info       = info,
+        .file       = dst_file,
+        .encoder    = encoder,
+        .resampler  = (info.sample_rate == kOpusRate)
+                    ? NULL
+                    : rsvc_resampler_create(info.channels, info.sample_rate, kOpusRate),
+        .streams    = head.stream_count,
+        .frame      = malloc(kOpusFrameSize * info.channels * sizeof(float)),
+        .packet     = malloc(kOpusMaxPacketSize * head.stream_count),
+        .packetno   = 2,
+    };
+
+    // Pick a random-ish serial number, as for vorbis.
+    unsigned seed = time(NULL);
+    ogg_stream_init(&self.os, rand_r(&seed));
+
+    OpusTags tags;
+    opus_tags_init(&tags);
+    ogg_packet op_head;
+    rsvc_opus_head_out(&head, &op_head);
+    ogg_packet op_tags;
+    rsvc_opus_tags_out(&tags, &op_tags);
+    opus_tags_clear(&tags);
+    ogg_page og;
+    bool ok = rsvc_ogg_align_packet(dst_file, &self.os, &og, &op_head, fail)
+           && rsvc_ogg_align_packet(dst_file, &self.os, &og, &op_tags, fail);
+    rsvc_ogg_packet_clear(&op_head);
+    rsvc_ogg_packet_clear(&op_tags);
+    if (!ok) {
+        opus_encoder_clear(&self);
+        return false;
+    }
+
+    union {
+        int16_t  s16[kOpusSamples];
+        int32_t  s32[kOpusSamples];
+        float    f32[kOpusSamples];
+    } in;
+    float pcm[kOpusSamples];
+    float* resampled = NULL;
+    if (self.resampler) {
+        size_t max_out = rsvc_resample_max_out(self.resampler, kOpusSamples / info.channels);
+        resampled = malloc(max_out * info.channels * sizeof(float));
+    }
+    const uint8_t* order = rsvc_ogg_channel_order[info.channels];
+    const float scale = 1.0f / (1u << (info.bits_per_sample - 1));
+    size_t samples_per_channel_read = 0;
+    int64_t samples_per_channel_written = 0;
+    bool eof = false;
+    while (!eof) {
+        size_t nsamples;
+        if (!rsvc_read("pipe", src_file, &in, kOpusSamples / info.channels, info.block_align,
+                       &nsamples, &eof, fail)) {
+            ok = false;
+            break;
+        }
+        samples_per_channel_read += nsamples;
+
+        for (size_t i = 0; i < nsamples; ++i) {
+            for (size_t c = 0; c < info.channels; ++c) {
+                size_t j = (i * info.channels) + order[c];
+                float* out = &pcm[(i * info.channels) + c];
+                switch (info.sample_format) {
+                  case RSVC_SAMPLE_S16: *out = in.s16[j] * scale; break;
+                  case RSVC_SAMPLE_S32: *out = in.s32[j] * scale; break;
+                  case RSVC_SAMPLE_F32: *out = in.f32[j]; break;
+                }
+            }
+        }
+
+        const float* samples = pcm;
+        size_t count = nsamples;
+        if (self.resampler) {
+            samples = resampled;
+            count = rsvc_resample(self.resampler, pcm, nsamples, resampled);
+            if (eof) {
+                count += rsvc_resample_flush(self.resampler, resampled + (count * info.channels));
+            }
+        }
+        samples_per_channel_written += count;
+        if (!opus_feed(&self, samples, count, fail)) {
+            ok = false;
+            break;
+        }
+        progress(samples_per_channel_read * 1.0 / info.samples_per_channel);
+    }
+
+    // Keep encoding silence until the lookahead has caught up with the
+    // end of the audio.  There is always at least one more packet,
+    // since the lookahead is never zero.
+    const int64_t end = head.pre_skip + samples_per_channel_written;
+    while (ok) {
+        bool eos = (self.granulepos + kOpusFrameSize) >= end;
+        if (!opus_encode_frame(&self, end, eos, fail)) {
+            ok = false;
+        } else if (eos) {
+            break;
+        }
+    }
+
+    free(resampled);
+    opus_encoder_clear(&self);
+    return ok;
+}
+
+static int opus_file_read(void* file, unsigned char* data, int size) {
+    size_t n = fread(data, 1, size, file);
+    return ((n == 0) && ferror(file)) ? -1 : (int)n;
+}
+
+static int opus_file_seek(void* file, opus_int64 offset, int whence) {
+    return fseeko(file, offset, whence);
+}
+
+static opus_int64 opus_file_tell(void* file) {
+    return ftello(file);
+}
+
+// The caller owns the file, so there is no close function.
+static const OpusFileCallbacks opus_file_callbacks = {
+    .read   = opus_file_read,
+    .seek   = opus_file_seek,
+    .tell   = opus_file_tell,
+    .close  = NULL,
+};
+
+// Opens `file` with opusfile, which accounts for pre-skip and the final
+// granule position, so the length is exact.  Opus always decodes at 48
+// kHz.  Every link of a chained file must have the same channel count.
+static bool opus_file_open(FILE* file, OggOpusFile** of, rsvc_audio_info_t info,
+                           rsvc_done_t fail) {
+    int error;
+    *of = op_open_callbacks(file, &opus_file_callbacks, NULL, 0, &error);
+    if (!*of) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "ogg file is not an opus file");
+        return false;
+    }
+    int channels = op_channel_count(*of, 0);
+    for (int i = 1; i < op_link_count(*of); ++i) {
+        if (op_channel_count(*of, i) != channels) {
+            op_free(*of);
+            rsvc_errorf(fail, __FILE__, __LINE__, "chained opus streams must match");
+            return false;
+        }
+    }
+    if (channels > 8) {
+        op_free(*of);
+        rsvc_errorf(fail, __FILE__, __LINE__, "can't decode %d-channel opus", channels);
+        return false;
+    }
+    ogg_int64_t total = op_pcm_total(*of, -1);
+    struct rsvc_audio_info i = {
+        .sample_rate = kOpusRate,
+        .channels = channels,
+        .samples_per_channel = (total > 0) ? total : 0,
+        .bits_per_sample = 16,
+        .block_align = 2 * channels,
+        .sample_format = RSVC_SAMPLE_S16,
+    };
+    *info = i;
+    return true;
+}
+
+bool rsvc_opus_audio_info(FILE* file, rsvc_audio_info_t info, rsvc_done_t fail) {
+    OggOpusFile* of;
+    if (!opus_file_open(file, &of, info, fail)) {
+        return false;
+    }
+    op_free(of);
+    return true;
+}
+
+// Like vorbis, passes float samples through if the consumer accepts
+// them, and otherwise requantizes to 16 bits with dither.  opusfile
+// interleaves its output, so it is deinterleaved (and reordered to WAV
+// order) first.
+bool rsvc_opus_decode(FILE* src_file, FILE* dst_file, rsvc_decode_options_t options,
+                      rsvc_decode_info_f info, rsvc_done_t fail) {
+    OggOpusFile* of;
+    struct rsvc_audio_info i;
+    if (!opus_file_open(src_file, &of, &i, fail)) {
+        return false;
+    }
+    struct rsvc_dither dither;
+    if (options->sample_formats & RSVC_SAMPLE_FORMAT_BIT(RSVC_SAMPLE_F32)) {
+        i.bits_per_sample = 32;
+        i.block_align = 4 * i.channels;
+        i.sample_format = RSVC_SAMPLE_F32;
+    } else {
+        rsvc_dither_init(&dither, i.channels, 24, options->noise_shaping);
+    }
+    info(&i);
+
+    const size_t size = kOpusMaxFrameSize * i.channels;
+    float* pcm = malloc(size * sizeof(float));
+    float* planar = malloc(size * sizeof(float));
+    void* out = malloc(size * sizeof(int32_t));
+    int16_t* s16 = malloc(size * sizeof(int16_t));
+    float* planes[8];
+    const float* wav_planes[8];
+    for (size_t c = 0; c < i.channels; ++c) {
+        planes[c] = planar + (rsvc_ogg_channel_order[i.channels][c] * kOpusMaxFrameSize);
+        wav_planes[c] = planar + (c * kOpusMaxFrameSize);
+    }
+
+    bool ok = true;
+    while (ok) {
+        int n = op_read_float(of, pcm, size, NULL);
+        if (n == 0) {
+            break;
+        } else if (n == OP_HOLE) {
+            continue;  // skip over corrupt or missing data.
+        } else if (n < 0) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "opus decoding error");
+            ok = false;
+            break;
+        }
+
+        rsvc_sample_deinterleave_f32(pcm, planes, i.channels, n);
+        if (i.sample_format == RSVC_SAMPLE_F32) {
+            rsvc_sample_interleave_f32(wav_planes, out, i.channels, n);
+            ok = rsvc_write("pipe", dst_file, out, n * i.block_align, fail);
+        } else {
+            rsvc_sample_interleave_f32_to_s32(wav_planes, out, i.channels, n, 24);
+            rsvc_dither_s32_to_s16(&dither, out, s16, n * i.channels);
+            ok = rsvc_write("pipe", dst_file, s16, n * i.block_align, fail);
+        }
+    }
+
+    free(pcm);
+    free(planar);
+    free(out);
+    free(s16);
+    op_free(of);
+    return ok;
+}
+
 static bool rsvc_opus_tags_save(rsvc_tags_t tags, rsvc_done_t fail) {
     opus_tags_t self = DOWN_CAST(struct opus_tags, tags);
 
@@ -404,4 +777,9 @@ const struct rsvc_format rsvc_opus = {
     .extension = "opus",
     .lossless = false,
     .open_tags = rsvc_opus_open_tags,
+    .audio_info = rsvc_opus_audio_info,
+    .encode = rsvc_opus_encode,
+    .decode = rsvc_opus_decode,
+    .sample_formats = RSVC_SAMPLE_FORMAT_BIT(RSVC_SAMPLE_S32)
+                    | RSVC_SAMPLE_FORMAT_BIT(RSVC_SAMPLE_F32),
 };
@@ -0,0 +1,202 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "resample.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+// Taps on each side of the interpolated point, when upsampling.  When
+// downsampling, the filter is stretched to cut off at the output's
+// Nyquist frequency, and gets proportionally more taps.
+#define kResampleTaps        32
+// The passband, as a fraction of the lower rate's Nyquist frequency.
+#define kResampleCutoff      0.95
+#define kResampleKaiserBeta  8.6
+// Input samples per channel buffered at once, besides the filter's.
+#define kResampleBlock       4096
+
+static const double kPi = 3.14159265358979323846;
+
+struct rsvc_resampler {
+    size_t    channels;
+    uint64_t  up, down;   // out_rate and in_rate, divided by their gcd.
+    size_t    half;       // taps on each side
+    float*    coefs;      // `up` phases of 2 * half taps
+
+    // The input, preceded by half - 1 samples of silence.  `buffer`
+    // holds `count` samples per channel from index `base` on.
+    float*    buffer;
+    size_t    count;
+    size_t    capacity;
+    uint64_t  base;
+    uint64_t  in_frames;
+
+    uint64_t  next;       // index of the next output sample
+    bool      flushed;
+};
+
+static uint64_t gcd(uint64_t a, uint64_t b) {
+    while (b) {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// Zeroth-order modified Bessel function of the first kind.
+static double bessel_i0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; term > (sum * 1e-12); ++k) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+static void make_coefs(rsvc_resampler_t r) {
+    const double cutoff = kResampleCutoff * MIN(1.0, (double)r->up / r->down);
+    const double i0_beta = bessel_i0(kResampleKaiserBeta);
+    const size_t taps = 2 * r->half;
+    for (size_t p = 0; p < r->up; ++p) {
+        float* phase = r->coefs + (p * taps);
+        double sum = 0.0;
+        double h[taps];
+        for (size_t j = 0; j < taps; ++j) {
+            // Distance from the interpolated point to tap j's input sample.
+            double d = (double)j - (double)r->half + 1.0 - ((double)p / r->up);
+            double x = d / r->half;
+            double window = (fabs(x) >= 1.0)
+                    ? 0.0
+                    : bessel_i0(kResampleKaiserBeta * sqrt(1.0 - (x * x))) / i0_beta;
+            double sinc = (d == 0.0) ? 1.0 : sin(kPi * cutoff * d) / (kPi * cutoff * d);
+            h[j] = sinc * window;
+            sum += h[j];
+        }
+        // Normalize each phase for unity gain at DC.
+        for (size_t j = 0; j < taps; ++j) {
+            phase[j] = h[j] / sum;
+        }
+    }
+}
+
+rsvc_resampler_t rsvc_resampler_create(size_t channels, size_t in_rate, size_t out_rate) {
+    uint64_t g = gcd(in_rate, out_rate);
+    struct rsvc_resampler resampler = {
+        .channels  = channels,
+        .up        = out_rate / g,
+        .down      = in_rate / g,
+    };
+    resampler.half      = (resampler.down > resampler.up)
+                        ? (kResampleTaps * resampler.down + resampler.up - 1) / resampler.up
+                        : kResampleTaps;
+    resampler.coefs     = malloc(resampler.up * 2 * resampler.half * sizeof(float));
+    resampler.capacity  = (2 * resampler.half) + kResampleBlock;
+    resampler.buffer    = calloc(resampler.capacity * channels, sizeof(float));
+    resampler.count     = resampler.half - 1;
+
+    rsvc_resampler_t r = malloc(sizeof(resampler));
+    memcpy(r, &resampler, sizeof(resampler));
+    make_coefs(r);
+    return r;
+}
+
+void rsvc_resampler_destroy(rsvc_resampler_t r) {
+    free(r->coefs);
+    free(r->buffer);
+    free(r);
+}
+
+size_t rsvc_resample_max_out(rsvc_resampler_t r, size_t frames) {
+    return (((frames + 3 * r->half) * r->up + r->down - 1) / r->down) + 1;
+}
+
+// Writes output samples, up to index `end`, for as long as their taps
+// are all in the buffer.
+static size_t drain(rsvc_resampler_t r, float* out, uint64_t end) {
+    const size_t channels = r->channels;
+    const size_t taps = 2 * r->half;
+    size_t produced = 0;
+    for (; r->next < end; ++r->next) {
+        uint64_t position = r->next * r->down;
+        uint64_t i = position / r->up;
+        if ((i + taps) > (r->base + r->count)) {
+            break;
+        }
+        const float* phase = r->coefs + ((position - (i * r->up)) * taps);
+        const float* in = r->buffer + ((i - r->base) * channels);
+        for (size_t c = 0; c < channels; ++c) {
+            float sum = 0.0f;
+            for (size_t j = 0; j < taps; ++j) {
+                sum += phase[j] * in[(j * channels) + c];
+            }
+            *(out++) = sum;
+        }
+        ++produced;
+    }
+    return produced;
+}
+
+// Drops input samples that no further output sample needs.
+static void compact(rsvc_resampler_t r) {
+    uint64_t first = (r->next * r->down) / r->up;
+    if (first <= r->base) {
+        return;
+    }
+    size_t drop = MIN(first - r->base, r->count);
+    memmove(r->buffer, r->buffer + (drop * r->channels),
+            (r->count - drop) * r->channels * sizeof(float));
+    r->base += drop;
+    r->count -= drop;
+}
+
+size_t rsvc_resample(rsvc_resampler_t r, const float* in, size_t frames, float* out) {
+    size_t produced = 0;
+    while (frames > 0) {
+        compact(r);
+        size_t n = MIN(frames, r->capacity - r->count);
+        memcpy(r->buffer + (r->count * r->channels), in, n * r->channels * sizeof(float));
+        r->count      += n;
+        r->in_frames  += n;
+        in            += n * r->channels;
+        frames        -= n;
+        produced += drain(r, out + (produced * r->channels), UINT64_MAX);
+    }
+    return produced;
+}
+
+size_t rsvc_resample_flush(rsvc_resampler_t r, float* out) {
+    if (r->flushed) {
+        return 0;
+    }
+    r->flushed = true;
+    compact(r);
+    memset(r->buffer + (r->count * r->channels), 0, r->half * r->channels * sizeof(float));
+    r->count += r->half;
+    uint64_t end = ((r->in_frames * r->up) + r->down - 1) / r->down;
+    return drain(r, out, end);
+}
@@ -0,0 +1,55 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#ifndef SRC_RSVC_RESAMPLE_H_
+#define SRC_RSVC_RESAMPLE_H_
+
+#include <stddef.h>
+
+// A streaming sample rate converter for interleaved float samples.
+//
+// Each output sample is interpolated from the input with a
+// Kaiser-windowed sinc filter, one phase per distinct output position
+// between input samples, so any pair of integer rates works (44100 ->
+// 48000 has 160 phases).  The filter is centered: output sample n lies
+// at input time n * in_rate / out_rate, with silence before the first
+// input sample and after the last, so the output has no delay to
+// compensate for.  After rsvc_resample_flush(), the output holds
+// ceil(in * out_rate / in_rate) samples per channel for `in` input
+// samples per channel.
+typedef struct rsvc_resampler* rsvc_resampler_t;
+
+rsvc_resampler_t  rsvc_resampler_create(size_t channels, size_t in_rate, size_t out_rate);
+void              rsvc_resampler_destroy(rsvc_resampler_t r);
+
+// The most samples per channel that a call to rsvc_resample() with
+// `frames` input samples per channel, or to rsvc_resample_flush(), can
+// produce.
+size_t            rsvc_resample_max_out(rsvc_resampler_t r, size_t frames);
+
+// Consumes `frames` samples per channel from `in`, and writes as many
+// samples per channel as are ready to `out`, returning that number.
+size_t            rsvc_resample(rsvc_resampler_t r, const float* in, size_t frames, float* out);
+
+// Writes the remaining samples per channel to `out`, returning their
+// number.  The resampler takes no further input.
+size_t            rsvc_resample_flush(rsvc_resampler_t r, float* out);
+
+#endif  // SRC_RSVC_RESAMPLE_H_
@@ -0,0 +1,316 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "ring.h"
+
+#include <dispatch/dispatch.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "unix.h"
+
+// Large enough to hold several reads from a CD or several frames of
+// decoded audio, so that neither side waits on the other often.
+static const size_t kRingPipeSize = 1 << 18;
+
+struct ring_reader {
+    atomic_size_t           tail;  // total bytes read.
+    atomic_bool             closed;
+    atomic_bool             waiting;
+    dispatch_semaphore_t    readable;
+};
+
+struct rsvc_ring {
+    uint8_t*                data;
+    size_t                  size;  // power of two.
+
+    // Total bytes written.  Stored only by the writer.
+    atomic_size_t           head;
+    atomic_bool             write_closed;
+
+    // A side that finds the ring full (or empty) sets its flag, then
+    // sleeps on its semaphore.  The other side signals it only when the
+    // flag was set, so the common case involves no syscalls.
+    atomic_bool             writer_waiting;
+    dispatch_semaphore_t    writable;
+
+    atomic_size_t           refs;
+    size_t                  nreaders;
+    struct ring_reader      readers[];
+};
+
+rsvc_ring_t rsvc_ring_create(size_t size, size_t nreaders) {
+    size_t rounded = 1;
+    while (rounded < size) {
+        rounded <<= 1;
+    }
+
+    rsvc_ring_t ring = malloc(sizeof(struct rsvc_ring)
+                              + (nreaders * sizeof(struct ring_reader)));
+    ring->data = malloc(rounded);
+    ring->size = rounded;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->write_closed, false);
+    atomic_init(&ring->writer_waiting, false);
+    ring->writable = dispatch_semaphore_create(0);
+    atomic_init(&ring->refs, nreaders + 1);
+    ring->nreaders = nreaders;
+    for (size_t i = 0; i < nreaders; ++i) {
+        struct ring_reader* r = &ring->readers[i];
+        atomic_init(&r->tail, 0);
+        atomic_init(&r->closed, false);
+        atomic_init(&r->waiting, false);
+        r->readable = dispatch_semaphore_create(0);
+    }
+    return ring;
+}
+
+static void ring_release(rsvc_ring_t ring) {
+    if (atomic_fetch_sub(&ring->refs, 1) == 1) {
+        dispatch_release(ring->writable);
+        for (size_t i = 0; i < ring->nreaders; ++i) {
+            dispatch_release(ring->readers[i].readable);
+        }
+        free(ring->data);
+        free(ring);
+    }
+}
+
+// Returns the number of bytes that can be written, as limited by the
+// slowest open reader.  Sets `*open` to whether there is one at all.
+static size_t ring_space(rsvc_ring_t ring, bool* open) {
+    size_t head = atomic_load(&ring->head);
+    size_t used = 0;
+    *open = false;
+    for (size_t i = 0; i < ring->nreaders; ++i) {
+        struct ring_reader* r = &ring->readers[i];
+        if (atomic_load(&r->closed)) {
+            continue;
+        }
+        *open = true;
+        size_t reader_used = head - atomic_load(&r->tail);
+        if (reader_used > used) {
+            used = reader_used;
+        }
+    }
+    return ring->size - used;
+}
+
+static bool can_write(rsvc_ring_t ring, size_t reader) {
+    (void)reader;
+    bool open;
+    return (ring_space(ring, &open) > 0) || !open;
+}
+
+static bool can_read(rsvc_ring_t ring, size_t reader) {
+    return (atomic_load(&ring->head) != atomic_load(&ring->readers[reader].tail))
+        || atomic_load(&ring->write_closed);
+}
+
+static void ring_wait(rsvc_ring_t ring, size_t reader, bool (*ready)(rsvc_ring_t, size_t),
+                      atomic_bool* waiting, dispatch_semaphore_t sema) {
+    while (!ready(ring, reader)) {
+        atomic_store(waiting, true);
+        if (!ready(ring, reader)) {
+            dispatch_semaphore_wait(sema, DISPATCH_TIME_FOREVER);
+        } else if (!atomic_exchange(waiting, false)) {
+            // The other side already cleared the flag, so it has
+            // signalled or is about to.  Absorb the signal so that it
+            // doesn't wake a later wait spuriously.
+            dispatch_semaphore_wait(sema, DISPATCH_TIME_FOREVER);
+        }
+    }
+}
+
+static void ring_wake(atomic_bool* waiting, dispatch_semaphore_t sema) {
+    if (atomic_load(waiting) && atomic_exchange(waiting, false)) {
+        dispatch_semaphore_signal(sema);
+    }
+}
+
+static void wake_readers(rsvc_ring_t ring) {
+    for (size_t i = 0; i < ring->nreaders; ++i) {
+        ring_wake(&ring->readers[i].waiting, ring->readers[i].readable);
+    }
+}
+
+size_t rsvc_ring_write_span(rsvc_ring_t ring, uint8_t** data) {
+    ring_wait(ring, 0, can_write, &ring->writer_waiting, ring->writable);
+    bool open;
+    size_t size = ring_space(ring, &open);
+    if (!open) {
+        return 0;
+    }
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t offset = head & (ring->size - 1);
+    if (size > ring->size - offset) {
+        size = ring->size - offset;
+    }
+    *data = ring->data + offset;
+    return size;
+}
+
+void rsvc_ring_write_commit(rsvc_ring_t ring, size_t size) {
+    atomic_store(&ring->head, atomic_load_explicit(&ring->head, memory_order_relaxed) + size);
+    wake_readers(ring);
+}
+
+void rsvc_ring_close_write(rsvc_ring_t ring) {
+    atomic_store(&ring->write_closed, true);
+    wake_readers(ring);
+    ring_release(ring);
+}
+
+size_t rsvc_ring_read_span(rsvc_ring_t ring, size_t reader, const uint8_t** data) {
+    struct ring_reader* r = &ring->readers[reader];
+    ring_wait(ring, reader, can_read, &r->waiting, r->readable);
+    size_t head = atomic_load(&ring->head);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t offset = tail & (ring->size - 1);
+    size_t size = head - tail;
+    if (size > ring->size - offset) {
+        size = ring->size - offset;
+    }
+    *data = ring->data + offset;
+    return size;
+}
+
+void rsvc_ring_read_commit(rsvc_ring_t ring, size_t reader, size_t size) {
+    struct ring_reader* r = &ring->readers[reader];
+    atomic_store(&r->tail, atomic_load_explicit(&r->tail, memory_order_relaxed) + size);
+    ring_wake(&ring->writer_waiting, ring->writable);
+}
+
+void rsvc_ring_close_read(rsvc_ring_t ring, size_t reader) {
+    atomic_store(&ring->readers[reader].closed, true);
+    ring_wake(&ring->writer_waiting, ring->writable);
+    ring_release(ring);
+}
+
+// The cookie for a read end.
+struct ring_file {
+    rsvc_ring_t  ring;
+    size_t       reader;
+};
+
+static ssize_t ring_file_read(void* cookie, char* data, size_t size) {
+    struct ring_file* f = cookie;
+    const uint8_t* span;
+    size_t span_size = rsvc_ring_read_span(f->ring, f->reader, &span);
+    if (span_size > size) {
+        span_size = size;
+    }
+    memcpy(data, span, span_size);
+    rsvc_ring_read_commit(f->ring, f->reader, span_size);
+    return span_size;
+}
+
+static ssize_t ring_file_write(void* cookie, const char* data, size_t size) {
+    rsvc_ring_t ring = cookie;
+    size_t written = 0;
+    while (written < size) {
+        uint8_t* span;
+        size_t span_size = rsvc_ring_write_span(ring, &span);
+        if (span_size == 0) {
+            if (written == 0) {
+                errno = EPIPE;
+                return -1;
+            }
+            break;
+        } else if (span_size > size - written) {
+            span_size = size - written;
+        }
+        memcpy(span, data + written, span_size);
+        rsvc_ring_write_commit(ring, span_size);
+        written += span_size;
+    }
+    return written;
+}
+
+static int ring_file_close_read(void* cookie) {
+    struct ring_file* f = cookie;
+    rsvc_ring_close_read(f->ring, f->reader);
+    free(f);
+    return 0;
+}
+
+static int ring_file_close_write(void* cookie) {
+    rsvc_ring_close_write(cookie);
+    return 0;
+}
+
+bool rsvc_ring_open_write(rsvc_ring_t ring, FILE** file, rsvc_done_t fail) {
+    if (!rsvc_cookieopen(ring, "w", NULL, ring_file_write, ring_file_close_write,
+                         file, fail)) {
+        return false;
+    }
+    // stdio's own buffer would only add a copy; without one, writes go
+    // straight to the ring.  Reads keep the buffer: unbuffered, glibc
+    // would fetch them a byte at a time.
+    setvbuf(*file, NULL, _IONBF, 0);
+    return true;
+}
+
+bool rsvc_ring_open_read(rsvc_ring_t ring, size_t reader, FILE** file, rsvc_done_t fail) {
+    struct ring_file cookie = {
+        .ring    = ring,
+        .reader  = reader,
+    };
+    struct ring_file* f = memdup(&cookie, sizeof(cookie));
+    if (!rsvc_cookieopen(f, "r", ring_file_read, NULL, ring_file_close_read, file, fail)) {
+        free(f);
+        return false;
+    }
+    return true;
+}
+
+bool rsvc_ring_fanout(size_t nreaders, FILE** read_files, FILE** write_file,
+                      rsvc_done_t fail) {
+    rsvc_ring_t ring = rsvc_ring_create(kRingPipeSize, nreaders);
+    for (size_t i = 0; i < nreaders; ++i) {
+        if (!rsvc_ring_open_read(ring, i, &read_files[i], fail)) {
+            for (size_t j = 0; j < i; ++j) {
+                fclose(read_files[j]);
+            }
+            for (size_t j = i; j < nreaders; ++j) {
+                rsvc_ring_close_read(ring, j);
+            }
+            rsvc_ring_close_write(ring);
+            return false;
+        }
+    }
+    if (!rsvc_ring_open_write(ring, write_file, fail)) {
+        for (size_t i = 0; i < nreaders; ++i) {
+            fclose(read_files[i]);
+        }
+        rsvc_ring_close_write(ring);
+        return false;
+    }
+    return true;
+}
+
+bool rsvc_ring_pipe(FILE** read_file, FILE** write_file, rsvc_done_t fail) {
+    return rsvc_ring_fanout(1, read_file, write_file, fail);
+}
@@ -0,0 +1,73 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#ifndef SRC_RSVC_RING_H_
+#define SRC_RSVC_RING_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <rsvc/common.h>
+
+// A single-producer, multiple-consumer byte channel in memory.
+// Unlike rsvc_pipe(), it doesn't go through the kernel: the producer
+// writes directly into spans of the ring and each consumer reads
+// directly out of them.  Every reader sees every byte; the writer waits
+// for the slowest one, so one decode can feed several encoders without
+// copying.
+//
+// Each end is used by one thread at a time and closed exactly once;
+// the ring is freed when all ends are closed.  Closing the write end
+// gives each reader EOF once it has drained the ring; once every read
+// end is closed, further writes fail.
+typedef struct rsvc_ring* rsvc_ring_t;
+
+rsvc_ring_t rsvc_ring_create(size_t size, size_t nreaders);
+
+// Waits until there is room, then points `data` at the largest
+// contiguous span that can be written and returns its size.  Returns 0
+// if all read ends are closed.  Nothing is visible to the readers until
+// rsvc_ring_write_commit().
+size_t      rsvc_ring_write_span(rsvc_ring_t ring, uint8_t** data);
+void        rsvc_ring_write_commit(rsvc_ring_t ring, size_t size);
+void        rsvc_ring_close_write(rsvc_ring_t ring);
+
+// Waits until there is data for `reader`, then points `data` at the
+// largest contiguous span it can read and returns its size.  Returns 0
+// at EOF.  The span remains valid until rsvc_ring_read_commit().
+size_t      rsvc_ring_read_span(rsvc_ring_t ring, size_t reader, const uint8_t** data);
+void        rsvc_ring_read_commit(rsvc_ring_t ring, size_t reader, size_t size);
+void        rsvc_ring_close_read(rsvc_ring_t ring, size_t reader);
+
+// Adapters for code that expects a FILE*.  fclose() closes that end of
+// the ring.
+bool        rsvc_ring_open_write(rsvc_ring_t ring, FILE** file, rsvc_done_t fail);
+bool        rsvc_ring_open_read(rsvc_ring_t ring, size_t reader, FILE** file,
+                                rsvc_done_t fail);
+
+// Creates a ring and opens all of its ends: one write end and
+// `nreaders` read ends.  rsvc_ring_pipe() is a drop-in replacement for
+// rsvc_pipe().
+bool        rsvc_ring_fanout(size_t nreaders, FILE** read_files, FILE** write_file,
+                             rsvc_done_t fail);
+bool        rsvc_ring_pipe(FILE** read_file, FILE** write_file, rsvc_done_t fail);
+
+#endif  // SRC_RSVC_RING_H_
@@ -0,0 +1,179 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "ring.h"
+
+#include <dispatch/dispatch.h>
+#include <string.h>
+#include "test.h"
+
+// Not periodic in any power of two, so that data from the wrong lap of
+// the ring doesn't match.
+static uint8_t pattern(size_t i) {
+    return i % 251;
+}
+
+static size_t write_pattern(rsvc_ring_t ring, size_t* written, size_t size) {
+    uint8_t* span;
+    size_t span_size = rsvc_ring_write_span(ring, &span);
+    if (span_size > size) {
+        span_size = size;
+    }
+    for (size_t i = 0; i < span_size; ++i) {
+        span[i] = pattern(*written + i);
+    }
+    rsvc_ring_write_commit(ring, span_size);
+    *written += span_size;
+    return span_size;
+}
+
+static size_t read_pattern(rsvc_ring_t ring, size_t reader, size_t* read, size_t size) {
+    const uint8_t* span;
+    size_t span_size = rsvc_ring_read_span(ring, reader, &span);
+    if (span_size > size) {
+        span_size = size;
+    }
+    for (size_t i = 0; i < span_size; ++i) {
+        if (span[i] != pattern(*read + i)) {
+            TEST_FAILF("reader %zu: wrong byte at %zu", reader, *read + i);
+            break;
+        }
+    }
+    rsvc_ring_read_commit(ring, reader, span_size);
+    *read += span_size;
+    return span_size;
+}
+
+// Spans on one thread, where no call needs to wait.
+static void test_spans() {
+    rsvc_ring_t ring = rsvc_ring_create(5, 2);  // rounded up to 8.
+    size_t written = 0, read[2] = {0, 0};
+
+    EXPECT_EQ(6, write_pattern(ring, &written, 6));
+    EXPECT_EQ(6, read_pattern(ring, 0, &read[0], 100));
+    EXPECT_EQ(3, read_pattern(ring, 1, &read[1], 3));
+
+    // Reader 1 holds 3 bytes, leaving 5 free, but only 2 before the end.
+    EXPECT_EQ(2, write_pattern(ring, &written, 100));
+    EXPECT_EQ(3, write_pattern(ring, &written, 100));
+
+    // Reader 0 sees the wrap as two spans.
+    EXPECT_EQ(2, read_pattern(ring, 0, &read[0], 100));
+    EXPECT_EQ(3, read_pattern(ring, 0, &read[0], 100));
+    EXPECT_EQ(5, read_pattern(ring, 1, &read[1], 100));
+
+    // Reader 1 still holds 3, so the ring fills for it at 16 bytes.
+    EXPECT_EQ(5, write_pattern(ring, &written, 100));
+
+    // Once reader 1 closes, only reader 0 limits the writer.
+    rsvc_ring_close_read(ring, 1);
+    EXPECT_EQ(3, write_pattern(ring, &written, 100));
+    rsvc_ring_close_write(ring);
+
+    EXPECT_EQ(5, read_pattern(ring, 0, &read[0], 100));
+    EXPECT_EQ(3, read_pattern(ring, 0, &read[0], 100));
+    EXPECT_EQ(0, read_pattern(ring, 0, &read[0], 100));  // EOF
+    EXPECT_EQ(written, read[0]);
+    rsvc_ring_close_read(ring, 0);
+}
+
+static void test_closed_readers() {
+    rsvc_ring_t ring = rsvc_ring_create(8, 1);
+    size_t written = 0;
+    EXPECT_EQ(8, write_pattern(ring, &written, 100));
+    rsvc_ring_close_read(ring, 0);
+    EXPECT_EQ(0, write_pattern(ring, &written, 100));  // doesn't wait
+    rsvc_ring_close_write(ring);
+}
+
+// Several readers on other threads, through the FILE* adapters.  The
+// last reader stops early; the others must still see every byte.
+static void test_fanout(size_t nreaders, size_t size) {
+    rsvc_done_t fail = ^(rsvc_error_t error) {
+        TEST_FAILF("%s", error->message);
+    };
+    FILE* read_files[nreaders];
+    FILE* write_file;
+    if (!rsvc_ring_fanout(nreaders, read_files, &write_file, fail)) {
+        return;
+    }
+
+    size_t results[nreaders];
+    size_t* read = results;  // blocks can't capture arrays
+    dispatch_group_t group = dispatch_group_create();
+    for (size_t i = 0; i < nreaders; ++i) {
+        FILE* file = read_files[i];
+        size_t limit = (i == nreaders - 1) ? (size / 3) : size + 1;
+        read[i] = 0;
+        dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+        dispatch_group_async(group, queue, ^{
+            uint8_t buffer[1000];
+            size_t n;
+            bool ok = true;
+            while (ok && (read[i] < limit)
+                   && ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)) {
+                for (size_t j = 0; j < n; ++j) {
+                    ok = ok && (buffer[j] == pattern(read[i] + j));
+                }
+                read[i] += n;
+            }
+            if (!ok) {
+                read[i] = SIZE_MAX;
+            }
+            fclose(file);
+        });
+    }
+
+    uint8_t buffer[4093];
+    for (size_t written = 0; written < size; ) {
+        size_t n = sizeof(buffer);
+        if (n > size - written) {
+            n = size - written;
+        }
+        for (size_t j = 0; j < n; ++j) {
+            buffer[j] = pattern(written + j);
+        }
+        EXPECT_EQ(n, fwrite(buffer, 1, n, write_file));
+        written += n;
+    }
+    fclose(write_file);
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    dispatch_release(group);
+
+    for (size_t i = 0; i < nreaders - 1; ++i) {
+        EXPECT_EQ(size, read[i]);
+    }
+    size_t last = read[nreaders - 1];
+    if ((last < size / 3) || (last > size)) {
+        TEST_FAILF("reader %zu read %zu bytes", nreaders - 1, last);
+    }
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+    test_spans();
+    test_closed_readers();
+    test_fanout(2, 1 << 20);
+    test_fanout(4, (3 << 20) + 7);
+    return test_result();
+}
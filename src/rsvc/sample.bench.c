@@ -0,0 +1,191 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "sample.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "common.h"
+#include "dither.h"
+
+// A minute of CD-quality stereo audio.
+#define kRate      44100
+#define kFrames    (kRate * 60)
+#define kChannels  2
+#define kSamples   (kFrames * kChannels)
+#define kSurround  6
+
+static int16_t  s16[kSamples];
+static int32_t  s32[kSamples];
+static int32_t  fixed[kSamples];
+static float    f32[kSamples];
+
+static int32_t* s32_planar[kChannels];
+static int32_t* fixed_planar[kChannels];
+static float*   f32_planar[kChannels];
+static float*   surround[kSurround];
+
+typedef void (^kernel_f)(void* out);
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static float* const* planar_f32(void* out) {
+    static float* planes[kChannels];
+    for (int c = 0; c < kChannels; ++c) {
+        planes[c] = (float*)out + (c * kFrames);
+    }
+    return planes;
+}
+
+// Runs `kernel` with every instruction set the CPU supports, printing
+// throughput as multiples of realtime, and checks that each produces
+// the same output as the scalar version.
+static bool bench(const char* name, size_t out_size, kernel_f kernel) {
+    void* expected = malloc(out_size);
+    void* actual = malloc(out_size);
+    bool ok = true;
+
+    rsvc_sample_limit_isa(RSVC_ISA_AVX2);
+    enum rsvc_isa best = rsvc_sample_isa();
+    for (enum rsvc_isa isa = RSVC_ISA_SCALAR; isa <= best; ++isa) {
+        rsvc_sample_limit_isa(isa);
+        void* out = (isa == RSVC_ISA_SCALAR) ? expected : actual;
+        memset(out, 0, out_size);
+
+        static const int kRuns = 5;
+        double best_time = 0;
+        for (int i = 0; i < kRuns; ++i) {
+            double start = now();
+            kernel(out);
+            double time = now() - start;
+            if ((i == 0) || (time < best_time)) {
+                best_time = time;
+            }
+        }
+
+        bool match = (memcmp(out, expected, out_size) == 0);
+        ok = ok && match;
+        outf("%-28s %-7s %9.0fx realtime%s\n", name, rsvc_isa_name(isa),
+             (kFrames / (double)kRate) / best_time, match ? "" : "  MISMATCH");
+    }
+
+    rsvc_sample_limit_isa(RSVC_ISA_AVX2);
+    free(expected);
+    free(actual);
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    (void)argc;
+    (void)argv;
+
+    unsigned seed = 1;
+    for (size_t i = 0; i < kSamples; ++i) {
+        int32_t r = rand_r(&seed) ^ (rand_r(&seed) << 16);
+        s16[i] = r;
+        s32[i] = r >> 8;
+        fixed[i] = r >> 2;  // some samples are out of range, to test clipping
+        f32[i] = (r >> 8) / 8388608.0f;
+    }
+    for (int c = 0; c < kChannels; ++c) {
+        s32_planar[c] = s32 + (c * kFrames);
+        fixed_planar[c] = fixed + (c * kFrames);
+        f32_planar[c] = f32 + (c * kFrames);
+    }
+    const size_t planar_size = kSamples * sizeof(float);
+
+    // 5.1 to stereo, with the normalized ITU-R BS.775 coefficients that
+    // rsvc_downmix() uses by default.
+    for (int c = 0; c < kSurround; ++c) {
+        surround[c] = malloc(kFrames * sizeof(float));
+        memcpy(surround[c], f32_planar[c % kChannels], kFrames * sizeof(float));
+    }
+    static const float downmix[2 * kSurround] = {
+        0.4142f, 0, 0.2929f, 0, 0.2929f, 0,
+        0, 0.4142f, 0.2929f, 0, 0, 0.2929f,
+    };
+
+    bool ok = true;
+    ok = bench("s16_to_s32", kSamples * sizeof(int32_t), ^(void* out){
+        rsvc_sample_s16_to_s32(s16, out, kSamples);
+    }) && ok;
+    ok = bench("deinterleave_s16_to_f32", planar_size, ^(void* out){
+        rsvc_sample_deinterleave_s16_to_f32(s16, planar_f32(out), kChannels, kFrames,
+                                            1.0f / 32768);
+    }) && ok;
+    ok = bench("deinterleave_s32_to_f32", planar_size, ^(void* out){
+        rsvc_sample_deinterleave_s32_to_f32(s32, planar_f32(out), kChannels, kFrames,
+                                            1.0f / 8388608);
+    }) && ok;
+    ok = bench("deinterleave_f32", planar_size, ^(void* out){
+        rsvc_sample_deinterleave_f32(f32, planar_f32(out), kChannels, kFrames);
+    }) && ok;
+    ok = bench("interleave_s32", kSamples * sizeof(int32_t), ^(void* out){
+        rsvc_sample_interleave_s32((const int32_t* const*)s32_planar, out, kChannels, kFrames);
+    }) && ok;
+    ok = bench("interleave_s32_to_s16", kSamples * sizeof(int16_t), ^(void* out){
+        rsvc_sample_interleave_s32_to_s16((const int32_t* const*)s32_planar, out, kChannels,
+                                          kFrames);
+    }) && ok;
+    ok = bench("interleave_fixed_to_s16", kSamples * sizeof(int16_t), ^(void* out){
+        rsvc_sample_interleave_fixed_to_s16((const int32_t* const*)fixed_planar, out, kChannels,
+                                            kFrames, 28);
+    }) && ok;
+    ok = bench("interleave_fixed_to_f32", kSamples * sizeof(float), ^(void* out){
+        rsvc_sample_interleave_fixed_to_f32((const int32_t* const*)fixed_planar, out, kChannels,
+                                            kFrames, 28);
+    }) && ok;
+    ok = bench("interleave_f32", kSamples * sizeof(float), ^(void* out){
+        rsvc_sample_interleave_f32((const float* const*)f32_planar, out, kChannels, kFrames);
+    }) && ok;
+    ok = bench("interleave_f32_to_s32", kSamples * sizeof(int32_t), ^(void* out){
+        rsvc_sample_interleave_f32_to_s32((const float* const*)f32_planar, out, kChannels,
+                                          kFrames, 24);
+    }) && ok;
+    ok = bench("mix_f32 (5.1 to stereo)", planar_size, ^(void* out){
+        rsvc_sample_mix_f32((const float* const*)surround, planar_f32(out), kSurround, kChannels,
+                            kFrames, downmix);
+    }) && ok;
+    ok = bench("dither_s32_to_s16", kSamples * sizeof(int16_t), ^(void* out){
+        struct rsvc_dither dither;
+        rsvc_dither_init(&dither, kChannels, 24, false);
+        rsvc_dither_s32_to_s16(&dither, s32, out, kSamples);
+    }) && ok;
+    ok = bench("dither_s32_to_s16 (shaped)", kSamples * sizeof(int16_t), ^(void* out){
+        struct rsvc_dither dither;
+        rsvc_dither_init(&dither, kChannels, 24, true);
+        rsvc_dither_s32_to_s16(&dither, s32, out, kSamples);
+    }) && ok;
+
+    for (int c = 0; c < kSurround; ++c) {
+        free(surround[c]);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,549 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "sample.h"
+
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RSVC_SAMPLE_X86 1
+#include <immintrin.h>
+#endif
+
+static enum rsvc_isa isa_limit = RSVC_ISA_AVX2;
+
+enum rsvc_isa rsvc_sample_isa() {
+    enum rsvc_isa isa = RSVC_ISA_SCALAR;
+#ifdef RSVC_SAMPLE_X86
+    if (__builtin_cpu_supports("avx2")) {
+        isa = RSVC_ISA_AVX2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        isa = RSVC_ISA_SSE2;
+    }
+#endif
+    return (isa < isa_limit) ? isa : isa_limit;
+}
+
+void rsvc_sample_limit_isa(enum rsvc_isa isa) {
+    isa_limit = isa;
+}
+
+const char* rsvc_isa_name(enum rsvc_isa isa) {
+    switch (isa) {
+      case RSVC_ISA_SCALAR: return "scalar";
+      case RSVC_ISA_SSE2:   return "sse2";
+      case RSVC_ISA_AVX2:   return "avx2";
+    }
+    return "unknown";
+}
+
+static inline int16_t clip16(int32_t sample) {
+    if (sample > INT16_MAX) {
+        return INT16_MAX;
+    } else if (sample < INT16_MIN) {
+        return INT16_MIN;
+    }
+    return sample;
+}
+
+static inline float clipf(float sample) {
+    if (sample > 1.0f) {
+        return 1.0f;
+    } else if (sample < -1.0f) {
+        return -1.0f;
+    }
+    return sample;
+}
+
+#ifdef RSVC_SAMPLE_X86
+
+// Each vector kernel handles as many whole vectors as it can, and
+// returns the number of samples (or frames, for planar kernels) it
+// handled; the scalar loop finishes the rest.
+
+__attribute__((target("sse2")))
+static inline __m128i widen_lo_sse2(__m128i x) {
+    return _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+}
+
+__attribute__((target("sse2")))
+static inline __m128i widen_hi_sse2(__m128i x) {
+    return _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+}
+
+// Splits four interleaved stereo frames in `a` and `b` into channels.
+__attribute__((target("sse2")))
+static inline void store_deinterleaved_sse2(__m128 a, __m128 b, float* l, float* r) {
+    _mm_storeu_ps(l, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+    _mm_storeu_ps(r, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+}
+
+__attribute__((target("sse2")))
+static size_t s16_to_s32_sse2(const int16_t* in, int32_t* out, size_t count) {
+    size_t i = 0;
+    for ( ; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(in + i));
+        _mm_storeu_si128((__m128i*)(out + i), widen_lo_sse2(x));
+        _mm_storeu_si128((__m128i*)(out + i + 4), widen_hi_sse2(x));
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t s16_to_s32_avx2(const int16_t* in, int32_t* out, size_t count) {
+    size_t i = 0;
+    for ( ; i + 16 <= count; i += 16) {
+        __m128i x0 = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i x1 = _mm_loadu_si128((const __m128i*)(in + i + 8));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_cvtepi16_epi32(x0));
+        _mm256_storeu_si256((__m256i*)(out + i + 8), _mm256_cvtepi16_epi32(x1));
+    }
+    return i;
+}
+
+__attribute__((target("sse2")))
+static size_t deinterleave_s16_to_f32_sse2(const int16_t* in, float* const* out, size_t frames,
+                                           float scale) {
+    const __m128 s = _mm_set1_ps(scale);
+    size_t f = 0;
+    for ( ; f + 4 <= frames; f += 4) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(in + 2 * f));
+        __m128 a = _mm_mul_ps(_mm_cvtepi32_ps(widen_lo_sse2(x)), s);
+        __m128 b = _mm_mul_ps(_mm_cvtepi32_ps(widen_hi_sse2(x)), s);
+        store_deinterleaved_sse2(a, b, out[0] + f, out[1] + f);
+    }
+    return f;
+}
+
+__attribute__((target("avx2")))
+static size_t deinterleave_s16_to_f32_avx2(const int16_t* in, float* const* out, size_t frames,
+                                           float scale) {
+    const __m256 s = _mm256_set1_ps(scale);
+    size_t f = 0;
+    for ( ; f + 8 <= frames; f += 8) {
+        __m128i x0 = _mm_loadu_si128((const __m128i*)(in + 2 * f));
+        __m128i x1 = _mm_loadu_si128((const __m128i*)(in + 2 * f + 8));
+        __m256 a = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(x0)), s);
+        __m256 b = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(x1)), s);
+        // Shuffles work within 128-bit halves, leaving pairs of frames
+        // in the order 0, 2, 1, 3.
+        __m256d l = _mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        __m256d r = _mm256_castps_pd(_mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+        l = _mm256_permute4x64_pd(l, _MM_SHUFFLE(3, 1, 2, 0));
+        r = _mm256_permute4x64_pd(r, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_ps(out[0] + f, _mm256_castpd_ps(l));
+        _mm256_storeu_ps(out[1] + f, _mm256_castpd_ps(r));
+    }
+    return f;
+}
+
+__attribute__((target("sse2")))
+static size_t deinterleave_s32_to_f32_sse2(const int32_t* in, float* const* out, size_t frames,
+                                           float scale) {
+    const __m128 s = _mm_set1_ps(scale);
+    size_t f = 0;
+    for ( ; f + 4 <= frames; f += 4) {
+        __m128i x0 = _mm_loadu_si128((const __m128i*)(in + 2 * f));
+        __m128i x1 = _mm_loadu_si128((const __m128i*)(in + 2 * f + 4));
+        __m128 a = _mm_mul_ps(_mm_cvtepi32_ps(x0), s);
+        __m128 b = _mm_mul_ps(_mm_cvtepi32_ps(x1), s);
+        store_deinterleaved_sse2(a, b, out[0] + f, out[1] + f);
+    }
+    return f;
+}
+
+__attribute__((target("sse2")))
+static size_t deinterleave_f32_sse2(const float* in, float* const* out, size_t frames) {
+    size_t f = 0;
+    for ( ; f + 4 <= frames; f += 4) {
+        __m128 a = _mm_loadu_ps(in + 2 * f);
+        __m128 b = _mm_loadu_ps(in + 2 * f + 4);
+        store_deinterleaved_sse2(a, b, out[0] + f, out[1] + f);
+    }
+    return f;
+}
+
+__attribute__((target("sse2")))
+static size_t interleave_s32_sse2(const int32_t* const* in, int32_t* out, size_t frames) {
+    size_t f = 0;
+    for ( ; f + 4 <= frames; f += 4) {
+        __m128i l = _mm_loadu_si128((const __m128i*)(in[0] + f));
+        __m128i r = _mm_loadu_si128((const __m128i*)(in[1] + f));
+        _mm_storeu_si128((__m128i*)(out + 2 * f), _mm_unpacklo_epi32(l, r));
+        _mm_storeu_si128((__m128i*)(out + 2 * f + 4), _mm_unpackhi_epi32(l, r));
+    }
+    return f;
+}
+
+__attribute__((target("avx2")))
+static size_t interleave_s32_avx2(const int32_t* const* in, int32_t* out, size_t frames) {
+    size_t f = 0;
+    for ( ; f + 8 <= frames; f += 8) {
+        __m256i l = _mm256_loadu_si256((const __m256i*)(in[0] + f));
+        __m256i r = _mm256_loadu_si256((const __m256i*)(in[1] + f));
+        // Unpacking works within 128-bit halves; recombine the halves.
+        __m256i lo = _mm256_unpacklo_epi32(l, r);
+        __m256i hi = _mm256_unpackhi_epi32(l, r);
+        _mm256_storeu_si256((__m256i*)(out + 2 * f), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i*)(out + 2 * f + 8),
+                            _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    return f;
+}
+
+__attribute__((target("sse2")))
+static size_t interleave_s32_to_s16_sse2(const int32_t* const* in, int16_t* out,
+                                         size_t frames) {
+    size_t f = 0;
+    for ( ; f + 4 <= frames; f += 4) {
+        __m128i l = _mm_loadu_si128((const __m128i*)(in[0] + f));
+        __m128i r = _mm_loadu_si128((const __m128i*)(in[1] + f));
+        __m128i packed = _mm_packs_epi32(_mm_unpacklo_epi32(l, r), _mm_unpackhi_epi32(l, r));
+        _mm_storeu_si128((__m128i*)(out + 2 * f), packed);
+    }
+    return f;
+}
+
+// Rounds and shifts fixed-point samples to 16 bits; the caller's
+// saturating pack does the clipping.
+__attribute__((target("sse2")))
+static inline __m128i fixed_to_s16_sse2(const int32_t* in, __m128i bias, __m128i shift) {
+    __m128i x = _mm_loadu_si128((const __m128i*)in);
+    return _mm_sra_epi32(_mm_add_epi32(x, bias), shift);
+}
+
+__attribute__((target("sse2")))
+static size_t interleave_fixed_to_s16_sse2(const int32_t* const* in, int16_t* out,
+                                           size_t channels, size_t frames, int fracbits) {
+    const __m128i bias = _mm_set1_epi32(1u << (fracbits - 16));
+    const __m128i shift = _mm_cvtsi32_si128(fracbits + 1 - 16);
+    size_t f = 0;
+    if (channels == 1) {
+        for ( ; f + 8 <= frames; f += 8) {
+            __m128i a = fixed_to_s16_sse2(in[0] + f, bias, shift);
+            __m128i b = fixed_to_s16_sse2(in[0] + f + 4, bias, shift);
+            _mm_storeu_si128((__m128i*)(out + f), _mm_packs_epi32(a, b));
+        }
+    } else if (channels == 2) {
+        for ( ; f + 4 <= frames; f += 4) {
+            __m128i l = fixed_to_s16_sse2(in[0] + f, bias, shift);
+            __m128i r = fixed_to_s16_sse2(in[1] + f, bias, shift);
+            __m128i packed = _mm_packs_epi32(_mm_unpacklo_epi32(l, r),
+                                             _mm_unpackhi_epi32(l, r));
+            _mm_storeu_si128((__m128i*)(out + 2 * f), packed);
+        }
+    }
+    return f;
+}
+
+__attribute__((target("sse2")))
+static inline __m128 fixed_to_f32_sse2(const int32_t* in, __m128 scale) {
+    __m128 x = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)in)), scale);
+    return _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+}
+
+__attribute__((target("sse2")))
+static size_t interleave_fixed_to_f32_sse2(const int32_t* const* in, float* out,
+                                           size_t channels, size_t frames, int fracbits) {
+    const __m128 scale = _mm_set1_ps(1.0f / (1u << fracbits));
+    size_t f = 0;
+    if (channels == 1) {
+        for ( ; f + 4 <= frames; f += 4) {
+            _mm_storeu_ps(out + f, fixed_to_f32_sse2(in[0] + f, scale));
+        }
+    } else if (channels == 2) {
+        for ( ; f + 4 <= frames; f += 4) {
+            __m128 l = fixed_to_f32_sse2(in[0] + f, scale);
+            __m128 r = fixed_to_f32_sse2(in[1] + f, scale);
+            _mm_storeu_ps(out + 2 * f, _mm_unpacklo_ps(l, r));
+            _mm_storeu_ps(out + 2 * f + 4, _mm_unpackhi_ps(l, r));
+        }
+    }
+    return f;
+}
+
+__attribute__((target("sse2")))
+static inline __m128 clip_sse2(__m128 x, __m128 lo, __m128 hi) {
+    return _mm_min_ps(_mm_max_ps(x, lo), hi);
+}
+
+__attribute__((target("sse2")))
+static size_t interleave_f32_sse2(const float* const* in, float* out, size_t frames) {
+    const __m128 lo = _mm_set1_ps(-1.0f);
+    const __m128 hi = _mm_set1_ps(1.0f);
+    size_t f = 0;
+    for ( ; f + 4 <= frames; f += 4) {
+        __m128 l = clip_sse2(_mm_loadu_ps(in[0] + f), lo, hi);
+        __m128 r = clip_sse2(_mm_loadu_ps(in[1] + f), lo, hi);
+        _mm_storeu_ps(out + 2 * f, _mm_unpacklo_ps(l, r));
+        _mm_storeu_ps(out + 2 * f + 4, _mm_unpackhi_ps(l, r));
+    }
+    return f;
+}
+
+// Converts with the current rounding mode (round-to-nearest-even by
+// default), like lrintf().
+__attribute__((target("sse2")))
+static size_t interleave_f32_to_s32_sse2(const float* const* in, int32_t* out, size_t frames,
+                                         float max, float scale) {
+    const __m128 lo = _mm_set1_ps(-1.0f);
+    const __m128 hi = _mm_set1_ps(max);
+    const __m128 s = _mm_set1_ps(scale);
+    size_t f = 0;
+    for ( ; f + 4 <= frames; f += 4) {
+        __m128i l = _mm_cvtps_epi32(_mm_mul_ps(clip_sse2(_mm_loadu_ps(in[0] + f), lo, hi), s));
+        __m128i r = _mm_cvtps_epi32(_mm_mul_ps(clip_sse2(_mm_loadu_ps(in[1] + f), lo, hi), s));
+        _mm_storeu_si128((__m128i*)(out + 2 * f), _mm_unpacklo_epi32(l, r));
+        _mm_storeu_si128((__m128i*)(out + 2 * f + 4), _mm_unpackhi_epi32(l, r));
+    }
+    return f;
+}
+
+// Sums the products in channel order, like the scalar loop, so that
+// rounding is the same.
+__attribute__((target("sse2")))
+static size_t mix_f32_sse2(const float* const* in, float* const* out, size_t channels,
+                           size_t outputs, size_t frames, const float* matrix) {
+    size_t f = 0;
+    for ( ; f + 4 <= frames; f += 4) {
+        for (size_t o = 0; o < outputs; ++o) {
+            const float* m = matrix + (o * channels);
+            __m128 sum = _mm_mul_ps(_mm_set1_ps(m[0]), _mm_loadu_ps(in[0] + f));
+            for (size_t c = 1; c < channels; ++c) {
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(m[c]), _mm_loadu_ps(in[c] + f)));
+            }
+            _mm_storeu_ps(out[o] + f, sum);
+        }
+    }
+    return f;
+}
+
+__attribute__((target("avx2")))
+static size_t mix_f32_avx2(const float* const* in, float* const* out, size_t channels,
+                           size_t outputs, size_t frames, const float* matrix) {
+    size_t f = 0;
+    for ( ; f + 8 <= frames; f += 8) {
+        for (size_t o = 0; o < outputs; ++o) {
+            const float* m = matrix + (o * channels);
+            __m256 sum = _mm256_mul_ps(_mm256_set1_ps(m[0]), _mm256_loadu_ps(in[0] + f));
+            for (size_t c = 1; c < channels; ++c) {
+                sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(m[c]),
+                                                       _mm256_loadu_ps(in[c] + f)));
+            }
+            _mm256_storeu_ps(out[o] + f, sum);
+        }
+    }
+    return f;
+}
+
+#endif  // RSVC_SAMPLE_X86
+
+void rsvc_sample_s16_to_s32(const int16_t* in, int32_t* out, size_t count) {
+    size_t i = 0;
+#ifdef RSVC_SAMPLE_X86
+    switch (rsvc_sample_isa()) {
+      case RSVC_ISA_AVX2: i = s16_to_s32_avx2(in, out, count); break;
+      case RSVC_ISA_SSE2: i = s16_to_s32_sse2(in, out, count); break;
+      case RSVC_ISA_SCALAR: break;
+    }
+#endif
+    for ( ; i < count; ++i) {
+        out[i] = in[i];
+    }
+}
+
+void rsvc_sample_deinterleave_s16_to_f32(const int16_t* in, float* const* out, size_t channels,
+                                         size_t frames, float scale) {
+    size_t f = 0;
+#ifdef RSVC_SAMPLE_X86
+    if (channels == 2) {
+        switch (rsvc_sample_isa()) {
+          case RSVC_ISA_AVX2: f = deinterleave_s16_to_f32_avx2(in, out, frames, scale); break;
+          case RSVC_ISA_SSE2: f = deinterleave_s16_to_f32_sse2(in, out, frames, scale); break;
+          case RSVC_ISA_SCALAR: break;
+        }
+    }
+#endif
+    for (in += f * channels; f < frames; ++f) {
+        for (size_t c = 0; c < channels; ++c) {
+            out[c][f] = *(in++) * scale;
+        }
+    }
+}
+
+void rsvc_sample_deinterleave_s32_to_f32(const int32_t* in, float* const* out, size_t channels,
+                                         size_t frames, float scale) {
+    size_t f = 0;
+#ifdef RSVC_SAMPLE_X86
+    if ((channels == 2) && (rsvc_sample_isa() >= RSVC_ISA_SSE2)) {
+        f = deinterleave_s32_to_f32_sse2(in, out, frames, scale);
+    }
+#endif
+    for (in += f * channels; f < frames; ++f) {
+        for (size_t c = 0; c < channels; ++c) {
+            out[c][f] = *(in++) * scale;
+        }
+    }
+}
+
+void rsvc_sample_deinterleave_f32(const float* in, float* const* out, size_t channels,
+                                  size_t frames) {
+    size_t f = 0;
+#ifdef RSVC_SAMPLE_X86
+    if ((channels == 2) && (rsvc_sample_isa() >= RSVC_ISA_SSE2)) {
+        f = deinterleave_f32_sse2(in, out, frames);
+    }
+#endif
+    for (in += f * channels; f < frames; ++f) {
+        for (size_t c = 0; c < channels; ++c) {
+            out[c][f] = *(in++);
+        }
+    }
+}
+
+void rsvc_sample_interleave_s32(const int32_t* const* in, int32_t* out, size_t channels,
+                                size_t frames) {
+    size_t f = 0;
+#ifdef RSVC_SAMPLE_X86
+    if (channels == 2) {
+        switch (rsvc_sample_isa()) {
+          case RSVC_ISA_AVX2: f = interleave_s32_avx2(in, out, frames); break;
+          case RSVC_ISA_SSE2: f = interleave_s32_sse2(in, out, frames); break;
+          case RSVC_ISA_SCALAR: break;
+        }
+    }
+#endif
+    for (out += f * channels; f < frames; ++f) {
+        for (size_t c = 0; c < channels; ++c) {
+            *(out++) = in[c][f];
+        }
+    }
+}
+
+void rsvc_sample_interleave_s32_to_s16(const int32_t* const* in, int16_t* out,
+                                       size_t channels, size_t frames) {
+    size_t f = 0;
+#ifdef RSVC_SAMPLE_X86
+    if ((channels == 2) && (rsvc_sample_isa() >= RSVC_ISA_SSE2)) {
+        f = interleave_s32_to_s16_sse2(in, out, frames);
+    }
+#endif
+    for (out += f * channels; f < frames; ++f) {
+        for (size_t c = 0; c < channels; ++c) {
+            *(out++) = clip16(in[c][f]);
+        }
+    }
+}
+
+// Arithmetic is unsigned, so that it wraps the same way as the vector
+// version.
+void rsvc_sample_interleave_fixed_to_s16(const int32_t* const* in, int16_t* out,
+                                         size_t channels, size_t frames, int fracbits) {
+    const uint32_t bias = 1u << (fracbits - 16);
+    const int shift = fracbits + 1 - 16;
+    size_t f = 0;
+#ifdef RSVC_SAMPLE_X86
+    if (rsvc_sample_isa() >= RSVC_ISA_SSE2) {
+        f = interleave_fixed_to_s16_sse2(in, out, channels, frames, fracbits);
+    }
+#endif
+    for (out += f * channels; f < frames; ++f) {
+        for (size_t c = 0; c < channels; ++c) {
+            *(out++) = clip16((int32_t)((uint32_t)in[c][f] + bias) >> shift);
+        }
+    }
+}
+
+void rsvc_sample_interleave_fixed_to_f32(const int32_t* const* in, float* out,
+                                         size_t channels, size_t frames, int fracbits) {
+    const float scale = 1.0f / (1u << fracbits);
+    size_t f = 0;
+#ifdef RSVC_SAMPLE_X86
+    if (rsvc_sample_isa() >= RSVC_ISA_SSE2) {
+        f = interleave_fixed_to_f32_sse2(in, out, channels, frames, fracbits);
+    }
+#endif
+    for (out += f * channels; f < frames; ++f) {
+        for (size_t c = 0; c < channels; ++c) {
+            *(out++) = clipf(in[c][f] * scale);
+        }
+    }
+}
+
+void rsvc_sample_interleave_f32(const float* const* in, float* out, size_t channels,
+                                size_t frames) {
+    size_t f = 0;
+#ifdef RSVC_SAMPLE_X86
+    if ((channels == 2) && (rsvc_sample_isa() >= RSVC_ISA_SSE2)) {
+        f = interleave_f32_sse2(in, out, frames);
+    }
+#endif
+    for (out += f * channels; f < frames; ++f) {
+        for (size_t c = 0; c < channels; ++c) {
+            *(out++) = clipf(in[c][f]);
+        }
+    }
+}
+
+// Full scale is clipped to one step below 1.0, so that it stays in
+// range after scaling.
+void rsvc_sample_interleave_f32_to_s32(const float* const* in, int32_t* out, size_t channels,
+                                       size_t frames, int bits) {
+    const float scale = 1u << (bits - 1);
+    const float max = (scale - 1.0f) / scale;
+    size_t f = 0;
+#ifdef RSVC_SAMPLE_X86
+    if ((channels == 2) && (rsvc_sample_isa() >= RSVC_ISA_SSE2)) {
+        f = interleave_f32_to_s32_sse2(in, out, frames, max, scale);
+    }
+#endif
+    for (out += f * channels; f < frames; ++f) {
+        for (size_t c = 0; c < channels; ++c) {
+            float x = in[c][f];
+            x = (x < -1.0f) ? -1.0f : ((x > max) ? max : x);
+            *(out++) = lrintf(x * scale);
+        }
+    }
+}
+
+void rsvc_sample_mix_f32(const float* const* in, float* const* out, size_t channels,
+                         size_t outputs, size_t frames, const float* matrix) {
+    size_t f = 0;
+#ifdef RSVC_SAMPLE_X86
+    switch (rsvc_sample_isa()) {
+      case RSVC_ISA_AVX2: f = mix_f32_avx2(in, out, channels, outputs, frames, matrix); break;
+      case RSVC_ISA_SSE2: f = mix_f32_sse2(in, out, channels, outputs, frames, matrix); break;
+      case RSVC_ISA_SCALAR: break;
+    }
+#endif
+    for ( ; f < frames; ++f) {
+        for (size_t o = 0; o < outputs; ++o) {
+            const float* m = matrix + (o * channels);
+            float sum = m[0] * in[0][f];
+            for (size_t c = 1; c < channels; ++c) {
+                sum += m[c] * in[c][f];
+            }
+            out[o][f] = sum;
+        }
+    }
+}
@@ -0,0 +1,87 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+
+#ifndef SRC_RSVC_SAMPLE_H_
+#define SRC_RSVC_SAMPLE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Sample conversion kernels shared by the codec adapters.
+//
+// Interleaved buffers hold `frames * channels` samples; planar buffers
+// are arrays of `channels` pointers to `frames` samples each.  Each
+// kernel picks the best implementation for the CPU at runtime; all
+// implementations produce identical output.  Stereo (and for some
+// kernels, mono) is vectorized; other layouts use the scalar loop.
+
+enum rsvc_isa {
+    RSVC_ISA_SCALAR = 0,
+    RSVC_ISA_SSE2,
+    RSVC_ISA_AVX2,
+};
+
+// The best instruction set supported by this CPU, no higher than the
+// limit set by rsvc_sample_limit_isa().  The limit exists so that
+// benchmarks can compare implementations.
+enum rsvc_isa rsvc_sample_isa();
+void rsvc_sample_limit_isa(enum rsvc_isa isa);
+const char* rsvc_isa_name(enum rsvc_isa isa);
+
+// int16 -> int32, layout unchanged.
+void rsvc_sample_s16_to_s32(const int16_t* in, int32_t* out, size_t count);
+
+// Interleaved -> planar float, multiplying integers by `scale`.
+void rsvc_sample_deinterleave_s16_to_f32(const int16_t* in, float* const* out, size_t channels,
+                                         size_t frames, float scale);
+void rsvc_sample_deinterleave_s32_to_f32(const int32_t* in, float* const* out, size_t channels,
+                                         size_t frames, float scale);
+void rsvc_sample_deinterleave_f32(const float* in, float* const* out, size_t channels,
+                                  size_t frames);
+
+// Planar -> interleaved.  The int16 version saturates.
+void rsvc_sample_interleave_s32(const int32_t* const* in, int32_t* out, size_t channels,
+                                size_t frames);
+void rsvc_sample_interleave_s32_to_s16(const int32_t* const* in, int16_t* out,
+                                       size_t channels, size_t frames);
+
+// Planar fixed-point with `fracbits` fractional bits (libmad uses 28)
+// -> interleaved.  The int16 version rounds; both clip to full scale.
+void rsvc_sample_interleave_fixed_to_s16(const int32_t* const* in, int16_t* out,
+                                         size_t channels, size_t frames, int fracbits);
+void rsvc_sample_interleave_fixed_to_f32(const int32_t* const* in, float* out,
+                                         size_t channels, size_t frames, int fracbits);
+
+// Planar float -> interleaved, clipped to full scale.  The int32
+// version scales to `bits` significant bits (at most 24) and rounds.
+void rsvc_sample_interleave_f32(const float* const* in, float* out, size_t channels,
+                                size_t frames);
+void rsvc_sample_interleave_f32_to_s32(const float* const* in, int32_t* out, size_t channels,
+                                       size_t frames, int bits);
+
+// Planar float -> planar float, mixing `channels` inputs into
+// `outputs` outputs.  Output o is the sum over c of
+// `matrix[o * channels + c] * in[c]`; it is not clipped.  Vectorized
+// for any number of channels.
+void rsvc_sample_mix_f32(const float* const* in, float* const* out, size_t channels,
+                         size_t outputs, size_t frames, const float* matrix);
+
+#endif  // SRC_RSVC_SAMPLE_H_
@@ -0,0 +1,67 @@
+//
+// This file is part of Rip Service.
+//
+// Copyright (C) 2016 Chris Pickel <sfiera@sfzmail.com>
+//
+// Rip Service is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or (at
+// your option) any later version.
+//
+// Rip Service is distributed in the hope that it will be useful, but
+// WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+// General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Rip Service; if not, write to the Free Software
+// Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+//
+
+#ifndef SRC_RSVC_TEST_H_
+#define SRC_RSVC_TEST_H_
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include "common.h"
+
+// Shared by the *.test.c programs.  A failed check is reported with
+// its location and counted, and the test goes on; main() returns
+// test_result(), which summarizes the run.
+
+static int test_failures = 0;
+
+__attribute__((format(printf, 3, 4)))
+static inline void test_failf(const char* file, int line, const char* format, ...) {
+    char* message;
+    va_list ap;
+    va_start(ap, format);
+    rsvc_vasprintf(&message, format, ap);
+    va_end(ap);
+    errf("%s:%d: %s\n", file, line, message);
+    free(message);
+    ++test_failures;
+}
+
+static inline void test_expect_eq(const char* file, int line, const char* expr,
+                                  long long expected, long long actual) {
+    if (expected != actual) {
+        test_failf(file, line, "%s: expected %lld, got %lld", expr, expected, actual);
+    }
+}
+
+#define TEST_FAILF(...) test_failf(__FILE__, __LINE__, __VA_ARGS__)
+#define EXPECT_EQ(EXPECTED, ACTUAL) \
+    test_expect_eq(__FILE__, __LINE__, #ACTUAL, (EXPECTED), (ACTUAL))
+
+// Returns the exit status for main().
+static inline int test_result() {
+    if (test_failures) {
+        errf("%d failures\n", test_failures);
+        return 1;
+    }
+    outf("OK!\n");
+    return 0;
+}
+
+#endif  // SRC_RSVC_TEST_H_
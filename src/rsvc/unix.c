@@ -206,6 +206,15 @@ bool rsvc_tell(FILE* file, off_t* where, rsvc_done_t fail) {
     return true;
 }
 
+// The one-minute load average.
+bool rsvc_loadavg(double* load, rsvc_done_t fail) {
+    if (getloadavg(load, 1) < 1) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "couldn't read load average");
+        return false;
+    }
+    return true;
+}
+
 static int compare_names(const FTSENT** x, const FTSENT** y) {
     return strcmp((*x)->fts_name, (*y)->fts_name);
 }
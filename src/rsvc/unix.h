@@ -30,6 +30,11 @@
 bool rsvc_open(const char* path, int oflag, mode_t mode, FILE** file, rsvc_done_t fail);
 bool rsvc_opendev(const char* path, int oflag, mode_t mode, FILE** file, rsvc_done_t fail);
 bool rsvc_memopen(const void* data, size_t size, FILE** file, rsvc_done_t fail);
+bool rsvc_cookieopen(void* cookie, const char* mode,
+                     ssize_t (*read)(void* cookie, char* data, size_t size),
+                     ssize_t (*write)(void* cookie, const char* data, size_t size),
+                     int (*close)(void* cookie),
+                     FILE** file, rsvc_done_t fail);
 bool rsvc_temp(const char* base, char* path, FILE** file, rsvc_done_t fail);
 bool rsvc_rename(const char* src, const char* dst, rsvc_done_t fail);
 bool rsvc_refile(const char* src, const char* dst, rsvc_done_t fail);
@@ -37,8 +42,10 @@ bool rsvc_rm(const char* path, rsvc_done_t fail);
 bool rsvc_mkdir(const char* path, mode_t mode, rsvc_done_t fail);
 bool rsvc_rmdir(const char* path, rsvc_done_t fail);
 bool rsvc_mmap(const char* path, FILE* file, uint8_t** data, size_t* size, rsvc_done_t fail);
+bool rsvc_preallocate(FILE* file, off_t size, rsvc_done_t fail);
 bool rsvc_seek(FILE* file, off_t where, int whence, rsvc_done_t fail);
 bool rsvc_tell(FILE* file, off_t* where, rsvc_done_t fail);
+bool rsvc_loadavg(double* load, rsvc_done_t fail);
 
 bool rsvc_walk(char* path, int options, rsvc_done_t fail,
                bool (^callback)(unsigned short info, const char* dirname, const char* basename,
@@ -119,6 +119,84 @@ bool rsvc_memopen(const void* data, size_t size, FILE** file, rsvc_done_t fail)
     return true;
 }
 
+// funopen() takes int-sized callbacks; adapt them to the
+// fopencookie()-style ones that rsvc_cookieopen() takes.
+typedef struct cookieopen_data* cookieopen_data_t;
+struct cookieopen_data {
+    void*    cookie;
+    ssize_t  (*read)(void* cookie, char* data, size_t size);
+    ssize_t  (*write)(void* cookie, const char* data, size_t size);
+    int      (*close)(void* cookie);
+};
+
+static int cookie_read(void* cookie, char* data, int size) {
+    cookieopen_data_t u = cookie;
+    return u->read(u->cookie, data, size);
+}
+
+static int cookie_write(void* cookie, const char* data, int size) {
+    cookieopen_data_t u = cookie;
+    return u->write(u->cookie, data, size);
+}
+
+static int cookie_close(void* cookie) {
+    cookieopen_data_t u = cookie;
+    int result = u->close ? u->close(u->cookie) : 0;
+    free(u);
+    return result;
+}
+
+bool rsvc_cookieopen(void* cookie, const char* mode,
+                     ssize_t (*read)(void* cookie, char* data, size_t size),
+                     ssize_t (*write)(void* cookie, const char* data, size_t size),
+                     int (*close)(void* cookie),
+                     FILE** file, rsvc_done_t fail) {
+    (void)mode;  // implied by which of read and write are given.
+    struct cookieopen_data data = {
+        .cookie  = cookie,
+        .read    = read,
+        .write   = write,
+        .close   = close,
+    };
+    cookieopen_data_t u = memdup(&data, sizeof(data));
+    *file = funopen(u, read ? cookie_read : NULL, write ? cookie_write : NULL, NULL,
+                    cookie_close);
+    if (!*file) {
+        free(u);
+        rsvc_strerrorf(fail, __FILE__, __LINE__, NULL);
+        return false;
+    }
+    return true;
+}
+
+// Reserves disk space for `file` to grow to `size` bytes, without
+// changing its length: contiguously if possible.  Only running out of
+// space is an error; pipes and file systems that can't preallocate are
+// left alone.
+bool rsvc_preallocate(FILE* file, off_t size, rsvc_done_t fail) {
+    int fd = fileno(file);
+    if (fd < 0) {
+        return true;
+    }
+    fstore_t store = {
+        .fst_flags       = F_ALLOCATECONTIG,
+        .fst_posmode     = F_PEOFPOSMODE,
+        .fst_offset      = 0,
+        .fst_length      = size,
+    };
+    if (fcntl(fd, F_PREALLOCATE, &store) == 0) {
+        return true;
+    }
+    store.fst_flags = F_ALLOCATEALL;
+    if (fcntl(fd, F_PREALLOCATE, &store) == 0) {
+        return true;
+    } else if ((errno == ENOSPC) || (errno == EFBIG)) {
+        rsvc_strerrorf(fail, __FILE__, __LINE__, "preallocate");
+        return false;
+    }
+    return true;
+}
+
 bool rsvc_cp(const char* src, const char* dst, rsvc_done_t fail) {
     rsvc_logf(3, "cp %s %s", src, dst);
     FILE* src_file;
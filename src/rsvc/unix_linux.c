@@ -20,6 +20,7 @@
 
 #define _BSD_SOURCE
 #define _DEFAULT_SOURCE
+#define _GNU_SOURCE
 
 #include "unix.h"
 
@@ -54,6 +55,24 @@ bool rsvc_memopen(const void* data, size_t size, FILE** file, rsvc_done_t fail)
     return true;
 }
 
+bool rsvc_cookieopen(void* cookie, const char* mode,
+                     ssize_t (*read)(void* cookie, char* data, size_t size),
+                     ssize_t (*write)(void* cookie, const char* data, size_t size),
+                     int (*close)(void* cookie),
+                     FILE** file, rsvc_done_t fail) {
+    cookie_io_functions_t functions = {
+        .read   = read,
+        .write  = write,
+        .seek   = NULL,
+        .close  = close,
+    };
+    if (!(*file = fopencookie(cookie, mode, functions))) {
+        rsvc_strerrorf(fail, __FILE__, __LINE__, NULL);
+        return false;
+    }
+    return true;
+}
+
 static bool rsvc_futimes(int fd, int64_t atime_sec, int64_t mtime_sec) {
     struct timeval tv[2] = {};
     tv[0].tv_sec = atime_sec;
@@ -61,6 +80,20 @@ static bool rsvc_futimes(int fd, int64_t atime_sec, int64_t mtime_sec) {
     return futimes(fd, tv) >= 0;
 }
 
+// Reserves disk space for `file` to grow to `size` bytes, without
+// changing its length.  Only running out of space is an error; pipes
+// and file systems that can't preallocate are left alone.
+bool rsvc_preallocate(FILE* file, off_t size, rsvc_done_t fail) {
+    int fd = fileno(file);
+    if ((fd < 0) || (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, size) == 0)) {
+        return true;
+    } else if ((errno == ENOSPC) || (errno == EFBIG)) {
+        rsvc_strerrorf(fail, __FILE__, __LINE__, "preallocate");
+        return false;
+    }
+    return true;
+}
+
 bool rsvc_cp(const char* src, const char* dst, rsvc_done_t fail) {
     rsvc_logf(3, "cp %s %s", src, dst);
     FILE* src_file = NULL;
@@ -21,6 +21,7 @@
 #define _BSD_SOURCE
 #define _DEFAULT_SOURCE
 #define _POSIX_C_SOURCE 200809L
+#define OV_EXCLUDE_STATIC_CALLBACKS
 
 #include "audio.h"
 
@@ -34,12 +35,15 @@
 #include <time.h>
 #include <unistd.h>
 #include <vorbis/vorbisenc.h>
+#include <vorbis/vorbisfile.h>
 #include <sys/errno.h>
 #include <sys/param.h>
 
 #include "common.h"
+#include "dither.h"
 #include "list.h"
 #include "ogg.h"
+#include "sample.h"
 #include "unix.h"
 
 bool rsvc_vorbis_encode_options_validate(rsvc_encode_options_t opts, rsvc_done_t fail) {
@@ -54,7 +58,6 @@ bool rsvc_vorbis_encode(  FILE* src_file, FILE* dst_file, rsvc_encode_options_t
     int32_t                 bitrate   = options->bitrate;
     struct rsvc_audio_info  info      = options->info;
     rsvc_encode_progress_f  progress  = options->progress;
-    float                   div       = 1 << (info.bits_per_sample - 1);
     if (!rsvc_vorbis_encode_options_validate(options, fail)) {
         return false;
     }
@@ -97,20 +100,35 @@ bool rsvc_vorbis_encode(  FILE* src_file, FILE* dst_file, rsvc_encode_options_t
     }
 
     bool eos = false;
-    int16_t in[2048];
+    union {
+        int16_t  s16[2048];
+        int32_t  s32[2048];
+        float    f32[2048];
+    } in;
+    float scale = 1.0f / (1u << (info.bits_per_sample - 1));
     while (!eos) {
         bool eof = false;
         size_t nsamples;
-        if (!rsvc_read(  "pipe", src_file, in, 2048 / info.channels, info.channels * sizeof(int16_t),
+        if (!rsvc_read(  "pipe", src_file, &in, 2048 / info.channels, info.block_align,
                          &nsamples, &eof, fail)) {
             return false;
         } else if (nsamples) {
             samples_per_channel_read += nsamples;
-            float** out = vorbis_analysis_buffer(&vd, sizeof(in));
-            for (int16_t* p = in; p < in + (nsamples * info.channels); ) {
-                for (int i = 0; i < info.channels; ++i) {
-                    *(out[i]++) = *(p++) / div;
-                }
+            float** buffer = vorbis_analysis_buffer(&vd, 2048);
+            float* out[8];
+            for (size_t i = 0; i < info.channels; ++i) {
+                out[rsvc_ogg_channel_order[info.channels][i]] = buffer[i];
+            }
+            switch (info.sample_format) {
+              case RSVC_SAMPLE_S16:
+                rsvc_sample_deinterleave_s16_to_f32(in.s16, out, info.channels, nsamples, scale);
+                break;
+              case RSVC_SAMPLE_S32:
+                rsvc_sample_deinterleave_s32_to_f32(in.s32, out, info.channels, nsamples, scale);
+                break;
+              case RSVC_SAMPLE_F32:
+                rsvc_sample_deinterleave_f32(in.f32, out, info.channels, nsamples);
+                break;
             }
             vorbis_analysis_wrote(&vd, nsamples);
         } else if (eof) {
@@ -465,104 +483,125 @@ bool rsvc_vorbis_open_tags(const char* path, int flags, rsvc_tags_t* tags, rsvc_
     return ok;
 }
 
-#define MAX_READ_BACK          65536
-#define READ_BACK_CHUNK_SIZE   4096
-#define READ_BACK_CHUNK_COUNT  (MAX_READ_BACK / READ_BACK_CHUNK_SIZE)
-
-bool read_last_page(  FILE* file, ogg_sync_state* oy, ogg_page* og,
-                      rsvc_done_t fail) {
-    off_t end;
-    if (!rsvc_tell(file, &end, fail)) {
-        return false;
-    }
-
-    bool ok = false;
-    off_t chunk_end = end;
-    uint8_t* chunk_data[READ_BACK_CHUNK_COUNT] = {};
-    size_t chunk_sizes[READ_BACK_CHUNK_COUNT] = {};
-    for (int i = 0; ; ++i) {
-        // If we've read 64kiB (or the whole file), then give up.
-        if ((chunk_end == 0) || (i == READ_BACK_CHUNK_COUNT)) {
-            rsvc_errorf(fail, __FILE__, __LINE__, "couldn't find last ogg page");
-            break;
-        }
-
-        // Seek back and read another new chunk.
-        off_t chunk_start = (end > READ_BACK_CHUNK_SIZE) ? end - READ_BACK_CHUNK_SIZE : 0;
-        if (!rsvc_seek(file, chunk_start, SEEK_SET, fail)) {
-            break;
-        }
-
-        chunk_sizes[i] = chunk_end - chunk_start;
-        chunk_data[i] = malloc(chunk_sizes[i]);
-        if (!rsvc_read(NULL, file, chunk_data[i], chunk_sizes[i], 1, NULL, NULL, fail)) {
-            break;
-        }
+static size_t vorbis_file_read(void* data, size_t size, size_t count, void* file) {
+    return fread(data, size, count, file);
+}
 
-        // Read back the chunks in `chunk_data` in reverse order.
-        ogg_sync_reset(oy);
-        for (int j = 0; j < i; ++j) {
-            char* buf = ogg_sync_buffer(oy, READ_BACK_CHUNK_SIZE);
-            memcpy(buf, chunk_data[i-j-1], chunk_sizes[i-j-1]);
-            ogg_sync_wrote(oy, chunk_sizes[i-j-1]);
-        }
+static int vorbis_file_seek(void* file, ogg_int64_t offset, int whence) {
+    return fseeko(file, offset, whence);
+}
 
-        while (true) {
-            int result = ogg_sync_pageseek(oy, og);
-            if (result == 0) {
-                break;
-            } else if (result < 0) {
-                continue;
-            }
+static long vorbis_file_tell(void* file) {
+    return ftello(file);
+}
 
-            ok = true;  // have one, but keep looping.
-        }
+// The caller owns the file, so there is no close function.
+static const ov_callbacks vorbis_file_callbacks = {
+    .read_func   = vorbis_file_read,
+    .seek_func   = vorbis_file_seek,
+    .close_func  = NULL,
+    .tell_func   = vorbis_file_tell,
+};
 
-        if (ok) {
-            break;
+// Opens `file` with vorbisfile, which finds the length from the last
+// page's granule position.  Every link of a chained file must have the
+// same layout.
+static bool vorbis_file_open(FILE* file, OggVorbis_File* vf, rsvc_audio_info_t info,
+                             rsvc_done_t fail) {
+    if (ov_open_callbacks(file, vf, NULL, 0, vorbis_file_callbacks) < 0) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "ogg file is not a vorbis file");
+        return false;
+    }
+    vorbis_info* vi = ov_info(vf, 0);
+    for (int i = 1; i < ov_streams(vf); ++i) {
+        vorbis_info* link = ov_info(vf, i);
+        if ((link->channels != vi->channels) || (link->rate != vi->rate)) {
+            ov_clear(vf);
+            rsvc_errorf(fail, __FILE__, __LINE__, "chained vorbis streams must match");
+            return false;
         }
-
-        chunk_end = chunk_start;
     }
-
-    for (int i = 0; i < READ_BACK_CHUNK_COUNT; ++i) {
-        free(chunk_data[i]);
+    if (vi->channels > 8) {
+        ov_clear(vf);
+        rsvc_errorf(fail, __FILE__, __LINE__, "can't decode %d-channel vorbis", vi->channels);
+        return false;
     }
-
-    return ok;
+    ogg_int64_t total = ov_pcm_total(vf, -1);
+    struct rsvc_audio_info i = {
+        .sample_rate = vi->rate,
+        .channels = vi->channels,
+        .samples_per_channel = (total > 0) ? total : 0,
+        .bits_per_sample = 16,
+        .block_align = 2 * vi->channels,
+        .sample_format = RSVC_SAMPLE_S16,
+    };
+    *info = i;
+    return true;
 }
 
 bool rsvc_vorbis_audio_info(FILE* file, rsvc_audio_info_t info, rsvc_done_t fail) {
-    struct rsvc_vorbis_tags ogv = {};
-    bool ok = false;
-
-    ogg_sync_state    oy = {};
-    ogg_stream_state  os = {};
-    vorbis_info       vi = {};
-    ogg_page          og = {};
-    ogg_packet        op = {};
+    OggVorbis_File vf;
+    if (!vorbis_file_open(file, &vf, info, fail)) {
+        return false;
+    }
+    ov_clear(&vf);
+    return true;
+}
 
-    ogg_sync_init(&oy);
-    vorbis_info_init(&vi);
-    vorbis_comment_init(&ogv.vc);
-
-    if (read_header(file, &ogv, &vi, &oy, &os, &og, &op, fail) &&
-        read_last_page(file, &oy, &og, fail)) {
-        struct rsvc_audio_info i = {
-            .sample_rate = vi.rate,
-            .channels = vi.channels,
-            .samples_per_channel = ogg_page_granulepos(&og),
-            .bits_per_sample = 16,
-            .block_align = 2 * vi.channels,
-        };
-        *info = i;
-        ok = true;
+// Vorbis decodes to float.  If the consumer accepts float samples,
+// they are passed through; otherwise, they are requantized to 16 bits
+// with dither.
+bool rsvc_vorbis_decode(FILE* src_file, FILE* dst_file, rsvc_decode_options_t options,
+                        rsvc_decode_info_f info, rsvc_done_t fail) {
+    OggVorbis_File vf;
+    struct rsvc_audio_info i;
+    if (!vorbis_file_open(src_file, &vf, &i, fail)) {
+        return false;
     }
+    struct rsvc_dither dither;
+    if (options->sample_formats & RSVC_SAMPLE_FORMAT_BIT(RSVC_SAMPLE_F32)) {
+        i.bits_per_sample = 32;
+        i.block_align = 4 * i.channels;
+        i.sample_format = RSVC_SAMPLE_F32;
+    } else {
+        rsvc_dither_init(&dither, i.channels, 24, options->noise_shaping);
+    }
+    info(&i);
+
+    union {
+        int32_t  s32[4096];
+        float    f32[4096];
+    } out;
+    int16_t s16[4096];
+    bool ok = true;
+    while (ok) {
+        float** pcm;
+        int link;
+        long n = ov_read_float(&vf, &pcm, 4096 / i.channels, &link);
+        if (n == 0) {
+            break;
+        } else if (n == OV_HOLE) {
+            continue;  // skip over corrupt or missing data.
+        } else if (n < 0) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "vorbis decoding error");
+            ok = false;
+            break;
+        }
 
-    ogg_sync_clear(&oy);
-    ogg_stream_clear(&os);
-    vorbis_info_clear(&vi);
-    rsvc_vorbis_tags_clear(&ogv.super);
+        const float* planes[8];
+        for (size_t c = 0; c < i.channels; ++c) {
+            planes[rsvc_ogg_channel_order[i.channels][c]] = pcm[c];
+        }
+        if (i.sample_format == RSVC_SAMPLE_F32) {
+            rsvc_sample_interleave_f32(planes, out.f32, i.channels, n);
+            ok = rsvc_write("pipe", dst_file, out.f32, n * i.block_align, fail);
+        } else {
+            rsvc_sample_interleave_f32_to_s32(planes, out.s32, i.channels, n, 24);
+            rsvc_dither_s32_to_s16(&dither, out.s32, s16, n * i.channels);
+            ok = rsvc_write("pipe", dst_file, s16, n * i.block_align, fail);
+        }
+    }
+    ov_clear(&vf);
     return ok;
 }
 
@@ -577,4 +616,7 @@ const struct rsvc_format rsvc_vorbis = {
     .open_tags = rsvc_vorbis_open_tags,
     .audio_info = rsvc_vorbis_audio_info,
     .encode = rsvc_vorbis_encode,
+    .decode = rsvc_vorbis_decode,
+    .sample_formats = RSVC_SAMPLE_FORMAT_BIT(RSVC_SAMPLE_S32)
+                    | RSVC_SAMPLE_FORMAT_BIT(RSVC_SAMPLE_F32),
 };
@@ -24,19 +24,50 @@
 
 #include "audio.h"
 
+#include <math.h>
 #include <rsvc/format.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/param.h>
 
 #include "common.h"
+#include "dither.h"
 #include "unix.h"
 
 #define WAV_RIFF  0x46464952
+#define WAV_RF64  0x34364652
+#define WAV_BW64  0x34365742
 #define WAV_WAVE  0x45564157
+#define WAV_DS64  0x34367364
 #define WAV_FMT   0x20746d66
+#define WAV_FACT  0x74636166
 #define WAV_DATA  0x61746164
 
 #define RIFF_HEADER_SIZE  8
 #define WAV_WAVE_SIZE     4
+#define WAV_DS64_SIZE     28
 #define WAV_FMT_SIZE      16
+#define WAV_FMT_EXT_SIZE  40
+#define WAV_FACT_SIZE     4
+
+#define WAV_FORMAT_PCM         0x0001
+#define WAV_FORMAT_IEEE_FLOAT  0x0003
+#define WAV_FORMAT_EXTENSIBLE  0xfffe
+
+// A chunk with an odd size is followed by a pad byte, which isn't
+// counted in the chunk's own size, but is in the container's.
+#define RIFF_PAD(SIZE)  ((SIZE) & 1)
+
+// RF64 (EBU Tech 3306) and BW64 (ITU-R BS.2088) files are WAV files
+// that can exceed 4 GiB.  The sizes of the RIFF and data chunks are
+// set to WAV_SIZE_IN_DS64, and the real sizes are in a ds64 chunk
+// that comes first.
+#define WAV_SIZE_IN_DS64  0xffffffff
+
+// PCM is copied this much at a time.  When encoding, writes after the
+// first start on multiples of it in the file.
+#define kWavBufferSize    (1 << 20)
 
 typedef struct riff_chunk* riff_chunk_t;
 struct riff_chunk {
@@ -62,6 +93,10 @@ static uint16_t u16le(uint8_t data[2]) {
     return (data[0] << 0) | (data[1] << 8);
 }
 
+static uint64_t u64le(uint8_t data[8]) {
+    return ((uint64_t)u32le(data + 4) << 32) | u32le(data);
+}
+
 static void u32le_out(uint8_t* data, uint32_t v) {
     data[0] = v >> 0;
     data[1] = v >> 8;
@@ -74,6 +109,11 @@ static void u16le_out(uint8_t* data, uint16_t v) {
     data[1] = v >> 8;
 }
 
+static void u64le_out(uint8_t* data, uint64_t v) {
+    u32le_out(data + 0, v);
+    u32le_out(data + 4, v >> 32);
+}
+
 static bool read_riff_chunk_header(FILE* file, riff_chunk_t rc, rsvc_done_t fail) {
     uint8_t header[RIFF_HEADER_SIZE];
     if (!rsvc_read(NULL, file, header, RIFF_HEADER_SIZE, 1, NULL, NULL, fail)) {
@@ -85,7 +125,8 @@ static bool read_riff_chunk_header(FILE* file, riff_chunk_t rc, rsvc_done_t fail
 }
 
 static bool check_is_wav(FILE* file, riff_chunk_t header, rsvc_done_t fail) {
-    if (header->code != WAV_RIFF) {
+    if ((header->code != WAV_RIFF) && (header->code != WAV_RF64)
+        && (header->code != WAV_BW64)) {
         rsvc_errorf(fail, __FILE__, __LINE__, "not a wav file");
         return false;
     }
@@ -99,30 +140,69 @@ static bool check_is_wav(FILE* file, riff_chunk_t header, rsvc_done_t fail) {
     return true;
 }
 
+// Describes the audio that decoding a file with format `wf` produces,
+// given the mask of sample formats its consumer accepts.  8-bit
+// samples are widened to S16 and 24-bit ones to S32.  Otherwise, if the
+// file's own format isn't accepted, float is converted to 24-bit S32,
+// and anything wider than 16 bits may be dithered to S16.
+static void wav_fmt_info(wav_fmt_t wf, unsigned sample_formats, rsvc_audio_info_t info) {
+    info->sample_rate      = wf->sample_rate;
+    info->channels         = wf->channels;
+    info->bits_per_sample  = 16;
+    info->block_align      = wf->channels * sizeof(int16_t);
+    info->sample_format    = RSVC_SAMPLE_S16;
+    if (wf->bits_per_sample <= 16) {
+        return;
+    } else if ((wf->audio_format == WAV_FORMAT_IEEE_FLOAT)
+               && (sample_formats & RSVC_SAMPLE_FORMAT_BIT(RSVC_SAMPLE_F32))) {
+        info->bits_per_sample  = 32;
+        info->block_align      = wf->channels * sizeof(float);
+        info->sample_format    = RSVC_SAMPLE_F32;
+    } else if (sample_formats & RSVC_SAMPLE_FORMAT_BIT(RSVC_SAMPLE_S32)) {
+        info->bits_per_sample  = (wf->audio_format == WAV_FORMAT_IEEE_FLOAT)
+                                 ? 24 : wf->bits_per_sample;
+        info->block_align      = wf->channels * sizeof(int32_t);
+        info->sample_format    = RSVC_SAMPLE_S32;
+    }
+}
+
 static bool wav_fmt_validate(wav_fmt_t wf, rsvc_done_t fail) {
-    if (wf->audio_format != 1) {
+    if ((wf->audio_format != WAV_FORMAT_PCM) && (wf->audio_format != WAV_FORMAT_IEEE_FLOAT)) {
         rsvc_errorf(fail, __FILE__, __LINE__, "unsupported audio format: %hu", wf->audio_format);
         return false;
+    } else if ((wf->audio_format == WAV_FORMAT_IEEE_FLOAT)
+               ? (wf->bits_per_sample != 32)
+               : ((wf->bits_per_sample != 8) && (wf->bits_per_sample != 16)
+                  && (wf->bits_per_sample != 24) && (wf->bits_per_sample != 32))) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "unsupported bit depth: %hu", wf->bits_per_sample);
+        return false;
+    } else if (wf->block_align != (wf->channels * wf->bits_per_sample / 8)) {
+        rsvc_errorf(fail, __FILE__, __LINE__, "invalid %hu-bit block align: %hu",
+                    wf->bits_per_sample, wf->block_align);
+        return false;
     } else if (wf->byte_rate != (wf->block_align * wf->sample_rate)) {
         rsvc_errorf(fail, __FILE__, __LINE__, "unsupported byte rate: %u", wf->byte_rate);
         return false;
     } else {
-        struct rsvc_audio_info info = {
-            .sample_rate      = wf->sample_rate,
-            .channels         = wf->channels,
-            .bits_per_sample  = wf->bits_per_sample,
-            .block_align      = wf->block_align,
-        };
+        struct rsvc_audio_info info;
+        wav_fmt_info(wf, ~0u, &info);
         return rsvc_audio_info_validate(&info, fail);
     }
 }
 
+// WAVE_FORMAT_EXTENSIBLE puts the real format code at the start of a
+// GUID, which otherwise matches this.
+static const uint8_t kWavSubformatGuid[14] = {
+    0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xaa, 0x00, 0x38, 0x9b, 0x71,
+};
+
 static bool read_wav_fmt(FILE* file, riff_chunk_t rc, wav_fmt_t wf, rsvc_done_t fail) {
     if (rc->size < WAV_FMT_SIZE) {
         rsvc_errorf(fail, __FILE__, __LINE__, "malformed wav fmt chunk");
         return false;
     }
-    uint8_t data[WAV_FMT_SIZE];
+    uint8_t data[WAV_FMT_EXT_SIZE];
+    size_t size = WAV_FMT_SIZE;
     if (!rsvc_read(NULL, file, data, WAV_FMT_SIZE, 1, NULL, NULL, fail)) {
         return false;
     }
@@ -134,16 +214,35 @@ static bool read_wav_fmt(FILE* file, riff_chunk_t rc, wav_fmt_t wf, rsvc_done_t
     wf->block_align      = u16le(data + 12);
     wf->bits_per_sample  = u16le(data + 14);
 
+    if (wf->audio_format == WAV_FORMAT_EXTENSIBLE) {
+        // Valid bits and the channel mask are ignored: samples with
+        // fewer valid bits are padded, and channels are always taken
+        // to be in WAV order.
+        size = WAV_FMT_EXT_SIZE;
+        if (rc->size < WAV_FMT_EXT_SIZE) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "malformed wav fmt chunk");
+            return false;
+        } else if (!rsvc_read(NULL, file, data + WAV_FMT_SIZE, WAV_FMT_EXT_SIZE - WAV_FMT_SIZE,
+                              1, NULL, NULL, fail)) {
+            return false;
+        } else if (memcmp(data + 26, kWavSubformatGuid, sizeof(kWavSubformatGuid)) != 0) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "unsupported audio format: extensible");
+            return false;
+        }
+        wf->audio_format = u16le(data + 24);
+    }
+
     if (!wav_fmt_validate(wf, fail)) {
         return false;
-    } else if (!rsvc_seek(file, rc->size - WAV_FMT_SIZE, SEEK_CUR, fail)) {
+    } else if (!rsvc_seek(file, rc->size - size + RIFF_PAD(rc->size), SEEK_CUR, fail)) {
         return false;
     }
     return true;
 }
 
 // Leaves `file` positioned at the start of the data chunk.
-bool wav_audio_info(FILE* file, rsvc_audio_info_t info, rsvc_done_t fail) {
+static bool wav_read_header(FILE* file, unsigned sample_formats, wav_fmt_t wf,
+                            rsvc_audio_info_t info, rsvc_done_t fail) {
     struct riff_chunk header;
     if (!(read_riff_chunk_header(file, &header, fail) &&
           check_is_wav(file, &header, fail))) {
@@ -152,13 +251,40 @@ bool wav_audio_info(FILE* file, rsvc_audio_info_t info, rsvc_done_t fail) {
     off_t end = RIFF_HEADER_SIZE + header.size;
     off_t at = RIFF_HEADER_SIZE + WAV_WAVE_SIZE;
 
-    struct wav_fmt wf;
+    uint64_t ds64_data_size = 0;
+    if (header.code != WAV_RIFF) {
+        struct riff_chunk rc;
+        uint8_t ds64[24];
+        if (!read_riff_chunk_header(file, &rc, fail)) {
+            return false;
+        } else if ((rc.code != WAV_DS64) || (rc.size < sizeof(ds64))) {
+            rsvc_errorf(fail, __FILE__, __LINE__, "missing ds64 chunk");
+            return false;
+        } else if (!(rsvc_read(NULL, file, ds64, sizeof(ds64), 1, NULL, NULL, fail)
+                     && rsvc_seek(file, rc.size - sizeof(ds64) + RIFF_PAD(rc.size), SEEK_CUR,
+                                  fail))) {
+            return false;
+        }
+        if (header.size == WAV_SIZE_IN_DS64) {
+            end = RIFF_HEADER_SIZE + u64le(ds64 + 0);
+        }
+        ds64_data_size = u64le(ds64 + 8);
+        at += RIFF_HEADER_SIZE + rc.size + RIFF_PAD(rc.size);
+    }
+
     bool have_fmt = false;
     while (true) {
         struct riff_chunk rc;
         if (!read_riff_chunk_header(file, &rc, fail)) {
             return false;
         }
+        if ((header.code != WAV_RIFF) && (rc.code == WAV_DATA)
+            && (rc.size == WAV_SIZE_IN_DS64)) {
+            rc.size = ds64_data_size;
+        }
+        // Pad bytes are counted once a chunk is skipped.  The data
+        // chunk's is never read, so a file that leaves it out is still
+        // accepted.
         at += RIFF_HEADER_SIZE + rc.size;
         if (at > end) {
             rsvc_errorf(fail, __FILE__, __LINE__, "riff chunk points past end of container");
@@ -171,107 +297,321 @@ bool wav_audio_info(FILE* file, rsvc_audio_info_t info, rsvc_done_t fail) {
             } else {
                 have_fmt = true;
             }
-            if (!read_wav_fmt(file, &rc, &wf, fail)) {
+            if (!read_wav_fmt(file, &rc, wf, fail)) {
                 return false;
             }
-            info->sample_rate      = wf.sample_rate;
-            info->channels         = wf.channels;
-            info->bits_per_sample  = wf.bits_per_sample;
-            info->block_align      = wf.block_align;
+            wav_fmt_info(wf, sample_formats, info);
         } else if (rc.code == WAV_DATA) {
             if (!have_fmt) {
                 rsvc_errorf(fail, __FILE__, __LINE__, "missing wav fmt chunk");
                 return false;
-            } else if (rc.size % wf.block_align) {
+            } else if (rc.size % wf->block_align) {
                 rsvc_errorf(fail, __FILE__, __LINE__, "trailing bytes in wav data");
                 return false;
             }
-            info->samples_per_channel = rc.size / wf.block_align;
+            info->samples_per_channel = rc.size / wf->block_align;
             return true;
         } else {
-            if (!rsvc_seek(file, rc.size, SEEK_CUR, fail)) {
+            if (!rsvc_seek(file, rc.size + RIFF_PAD(rc.size), SEEK_CUR, fail)) {
                 return false;
             }
         }
+        at += RIFF_PAD(rc.size);
     }
 }
 
-bool wav_audio_decode(FILE* src_file, FILE* dst_file, rsvc_decode_info_f info, rsvc_done_t fail) {
-    struct rsvc_audio_info i;
-    if (!wav_audio_info(src_file, &i, fail)) {
-        fclose(src_file);
-        return false;
+bool wav_audio_info(FILE* file, rsvc_audio_info_t info, rsvc_done_t fail) {
+    struct wav_fmt wf;
+    return wav_read_header(file, ~0u, &wf, info, fail);
+}
+
+// Copies `size` bytes through a buffer.  The first write is shortened
+// by `head`, the number of bytes already written before it.
+static bool wav_copy(FILE* src_file, FILE* dst_file, uint64_t size, size_t head,
+                     rsvc_encode_progress_f progress, rsvc_done_t fail) {
+    uint8_t* data = malloc(kWavBufferSize);
+    bool ok = true;
+    size_t chunk = kWavBufferSize - (head % kWavBufferSize);
+    for (uint64_t remainder = size; ok && remainder; ) {
+        size_t n = MIN(chunk, remainder);
+        // TODO(sfiera): endianness.
+        ok = rsvc_read(NULL, src_file, data, n, 1, NULL, NULL, fail)
+            && rsvc_write(NULL, dst_file, data, n, fail);
+        remainder -= n;
+        chunk = kWavBufferSize;
+        if (ok && progress) {
+            progress((size - remainder) / (double)size);
+        }
+    }
+    free(data);
+    return ok;
+}
+
+// Like wav_copy(), but packs int32_t samples with 24 significant bits
+// into 3 bytes each.  `size` is the size of the packed samples.
+static bool wav_pack_copy(FILE* src_file, FILE* dst_file, uint64_t size, size_t head,
+                          rsvc_encode_progress_f progress, rsvc_done_t fail) {
+    uint8_t* in = malloc(kWavBufferSize);
+    uint8_t* data = malloc(kWavBufferSize + 2);
+    bool ok = true;
+    size_t chunk = kWavBufferSize - (head % kWavBufferSize);
+    size_t fill = 0;
+    for (uint64_t remainder = size / 3; ok && remainder; ) {
+        size_t n = MIN(kWavBufferSize / sizeof(int32_t), remainder);
+        ok = rsvc_read(NULL, src_file, in, n, sizeof(int32_t), NULL, NULL, fail);
+        const int32_t* s32 = (const int32_t*)in;
+        for (size_t i = 0; ok && (i < n); ++i) {
+            data[fill++] = s32[i] >> 0;
+            data[fill++] = s32[i] >> 8;
+            data[fill++] = s32[i] >> 16;
+            if (fill >= chunk) {
+                // The last sample may straddle the end of the chunk;
+                // the rest of it starts the next one.
+                ok = rsvc_write(NULL, dst_file, data, chunk, fail);
+                fill -= chunk;
+                memmove(data, data + chunk, fill);
+                chunk = kWavBufferSize;
+            }
+        }
+        remainder -= n;
+        if (ok && progress) {
+            progress(((size / 3) - remainder) / (double)(size / 3));
+        }
+    }
+    if (ok && fill) {
+        ok = rsvc_write(NULL, dst_file, data, fill, fail);
+    }
+    free(data);
+    free(in);
+    return ok;
+}
+
+// Converts samples from a wav file to the format they are decoded to.
+typedef struct wav_decoder* wav_decoder_t;
+struct wav_decoder {
+    struct wav_fmt          fmt;
+    struct rsvc_audio_info  info;
+    struct rsvc_dither      dither;
+    int32_t*                s32;
+    void*                   out;
+};
+
+// Converts `n` samples at `in`, and returns them in decoded form.
+static const void* wav_decode_samples(wav_decoder_t d, const uint8_t* in, size_t n) {
+    const size_t bits = d->fmt.bits_per_sample;
+    const bool is_float = (d->fmt.audio_format == WAV_FORMAT_IEEE_FLOAT);
+    if ((bits == 16)
+        || ((bits == 32) && (d->info.sample_format == RSVC_SAMPLE_F32))
+        || ((bits == 32) && !is_float && (d->info.sample_format == RSVC_SAMPLE_S32))) {
+        return in;
+    } else if (bits == 8) {
+        int16_t* s16 = d->out;
+        for (size_t i = 0; i < n; ++i) {
+            s16[i] = (in[i] - 128) << 8;
+        }
+        return s16;
     }
-    info(&i);
-    size_t remainder = i.block_align * i.samples_per_channel;
-    while (remainder) {
-        uint8_t data[4096];
-        size_t size = (remainder > 4096) ? 4096 : remainder;
+
+    // Otherwise, go through int32_t with 24 significant bits, unless
+    // 32-bit samples are going straight out as S32.
+    int32_t* s32 = (d->info.sample_format == RSVC_SAMPLE_S32) ? d->out : d->s32;
+    if (is_float) {
+        for (size_t i = 0; i < n; ++i) {
+            float f;
+            memcpy(&f, in + (4 * i), sizeof(f));
+            f *= 8388608.0f;
+            s32[i] = lrintf((f > 8388607.0f) ? 8388607.0f : (f < -8388608.0f) ? -8388608.0f : f);
+        }
+    } else if (bits == 24) {
+        for (size_t i = 0; i < n; ++i, in += 3) {
+            s32[i] = (int32_t)(((uint32_t)in[0] << 8) | ((uint32_t)in[1] << 16)
+                               | ((uint32_t)in[2] << 24)) >> 8;
+        }
+    } else {
+        for (size_t i = 0; i < n; ++i, in += 4) {
+            s32[i] = (int32_t)u32le((uint8_t*)in) >> 8;
+        }
+    }
+    if (d->info.sample_format == RSVC_SAMPLE_S32) {
+        return s32;
+    }
+    rsvc_dither_s32_to_s16(&d->dither, s32, d->out, n);
+    return d->out;
+}
+
+// Writes `size` bytes of samples from a wav file as decoded samples.
+static bool wav_write_samples(wav_decoder_t d, FILE* dst_file, const uint8_t* data, size_t size,
+                              rsvc_done_t fail) {
+    const size_t in_size = d->fmt.block_align / d->fmt.channels;
+    const size_t out_size = d->info.block_align / d->info.channels;
+    const size_t step = kWavBufferSize / out_size;
+    for (size_t at = 0; at < size; at += step * in_size) {
+        size_t n = MIN(step, (size - at) / in_size);
         // TODO(sfiera): endianness.
-        if (!(rsvc_read(NULL, src_file, data, size, 1, NULL, NULL, fail) &&
-              rsvc_write(NULL, dst_file, data, size, fail))) {
-            fclose(src_file);
+        if (!rsvc_write(NULL, dst_file, wav_decode_samples(d, data + at, n), n * out_size,
+                        fail)) {
             return false;
         }
-        remainder -= size;
     }
-    fclose(src_file);
     return true;
 }
 
-bool wav_audio_encode(FILE* src_file, FILE* dst_file, rsvc_encode_options_t opts, rsvc_done_t fail) {
-    if (!rsvc_audio_info_validate(&opts->info, fail)) {
+// Decodes the `size` bytes of PCM at `offset` in `src_file` straight
+// from a mapping of it, if it is a regular file, or else reads them in
+// turn.  Mapping only saves the read into a buffer: samples that need
+// no conversion are written from the mapping itself, but the decoder's
+// output is a FILE*, so they are still copied once into the consumer's
+// pipe or ring.
+static bool wav_decode_data(wav_decoder_t d, FILE* src_file, off_t offset, uint64_t size,
+                            FILE* dst_file, rsvc_done_t fail) {
+    struct stat st;
+    if ((fstat(fileno(src_file), &st) == 0) && S_ISREG(st.st_mode)
+        && (size > 0) && (offset + size <= (uint64_t)st.st_size)) {
+        size_t map_size = offset + size;
+        uint8_t* map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fileno(src_file), 0);
+        if (map != MAP_FAILED) {
+            posix_madvise(map, map_size, POSIX_MADV_SEQUENTIAL);
+            bool ok = wav_write_samples(d, dst_file, map + offset, size, fail);
+            munmap(map, map_size);
+            return ok;
+        }
+    }
+
+    uint8_t* data = malloc(kWavBufferSize);
+    const size_t chunk = kWavBufferSize - (kWavBufferSize % d->fmt.block_align);
+    bool ok = true;
+    for (uint64_t remainder = size; ok && remainder; ) {
+        size_t n = MIN(chunk, remainder);
+        ok = rsvc_read(NULL, src_file, data, n, 1, NULL, NULL, fail)
+            && wav_write_samples(d, dst_file, data, n, fail);
+        remainder -= n;
+    }
+    free(data);
+    return ok;
+}
+
+bool wav_audio_decode(FILE* src_file, FILE* dst_file, rsvc_decode_options_t options,
+                      rsvc_decode_info_f info, rsvc_done_t fail) {
+    struct wav_decoder d;
+    if (!wav_read_header(src_file, options->sample_formats, &d.fmt, &d.info, fail)) {
+        fclose(src_file);
         return false;
     }
-    static const int header_size = 44;
-    uint8_t header[header_size];
-    size_t block = opts->info.block_align;
-    static const int fmt_size = 16;
-    size_t data_size = opts->info.samples_per_channel * block;
-    size_t riff_size = header_size - 4 + data_size;
-
-    u32le_out(header + 0,   WAV_RIFF);
-    u32le_out(header + 4,   riff_size);
-    u32le_out(header + 8,   WAV_WAVE);
-    u32le_out(header + 12,  WAV_FMT);
-    u32le_out(header + 16,  fmt_size);
-    u16le_out(header + 20,  1);
-    u16le_out(header + 22,  opts->info.channels);
-    u32le_out(header + 24,  opts->info.sample_rate);
-    u32le_out(header + 28,  block * opts->info.sample_rate);
-    u16le_out(header + 32,  block);
-    u16le_out(header + 34,  opts->info.bits_per_sample);
-    u32le_out(header + 36,  WAV_DATA);
-    u32le_out(header + 40,  data_size);
-
-    if (!rsvc_write(NULL, dst_file, header, header_size, fail)) {
+    info(&d.info);
+    rsvc_dither_init(&d.dither, d.info.channels, 24, options->noise_shaping);
+    d.s32 = malloc(kWavBufferSize / sizeof(int16_t) * sizeof(int32_t));
+    d.out = malloc(kWavBufferSize);
+
+    off_t offset;
+    bool ok = rsvc_tell(src_file, &offset, fail)
+        && wav_decode_data(&d, src_file, offset,
+                           (uint64_t)d.fmt.block_align * d.info.samples_per_channel,
+                           dst_file, fail);
+    free(d.out);
+    free(d.s32);
+    fclose(src_file);
+    return ok;
+}
+
+// The format of a wav file that holds `info`.  S32 audio is packed to
+// 24 bits if it has no more than that.
+static void wav_fmt_for(rsvc_audio_info_t info, wav_fmt_t wf) {
+    wf->audio_format     = (info->sample_format == RSVC_SAMPLE_F32) ? WAV_FORMAT_IEEE_FLOAT
+                                                                    : WAV_FORMAT_PCM;
+    wf->channels         = info->channels;
+    wf->sample_rate      = info->sample_rate;
+    wf->bits_per_sample  = (info->sample_format == RSVC_SAMPLE_S16) ? 16
+                         : (info->sample_format == RSVC_SAMPLE_F32) ? 32
+                         : (info->bits_per_sample <= 24)            ? 24
+                                                                    : 32;
+    wf->block_align      = wf->channels * wf->bits_per_sample / 8;
+    wf->byte_rate        = wf->block_align * wf->sample_rate;
+}
+
+// Writes a RIFF header, or an RF64 header if the file would be larger
+// than RIFF allows, and returns its size.  Float files get the cbSize
+// field and fact chunk that non-PCM formats need.
+static size_t wav_header_out(uint8_t* header, rsvc_audio_info_t info, wav_fmt_t wf,
+                             uint64_t data_size) {
+    const bool pcm = (wf->audio_format == WAV_FORMAT_PCM);
+    const size_t fmt_size = WAV_FMT_SIZE + (pcm ? 0 : 2);
+    const size_t fact_size = pcm ? 0 : (RIFF_HEADER_SIZE + WAV_FACT_SIZE);
+    const size_t size = RIFF_HEADER_SIZE + WAV_WAVE_SIZE + RIFF_HEADER_SIZE + fmt_size
+                        + fact_size + RIFF_HEADER_SIZE;
+    const uint64_t padded_size = data_size + RIFF_PAD(data_size);
+    const bool rf64 = (padded_size + size - RIFF_HEADER_SIZE >= WAV_SIZE_IN_DS64);
+    const size_t ds64_size = rf64 ? (RIFF_HEADER_SIZE + WAV_DS64_SIZE) : 0;
+    const size_t header_size = size + ds64_size;
+    const uint64_t riff_size = header_size - RIFF_HEADER_SIZE + padded_size;
+
+    uint8_t* p = header;
+    u32le_out(p + 0,   rf64 ? WAV_RF64 : WAV_RIFF);
+    u32le_out(p + 4,   rf64 ? WAV_SIZE_IN_DS64 : riff_size);
+    u32le_out(p + 8,   WAV_WAVE);
+    p += 12;
+    if (rf64) {
+        u32le_out(p + 0,   WAV_DS64);
+        u32le_out(p + 4,   WAV_DS64_SIZE);
+        u64le_out(p + 8,   riff_size);
+        u64le_out(p + 16,  data_size);
+        u64le_out(p + 24,  info->samples_per_channel);
+        u32le_out(p + 32,  0);  // no table of other chunk sizes
+        p += ds64_size;
+    }
+    u32le_out(p + 0,   WAV_FMT);
+    u32le_out(p + 4,   fmt_size);
+    u16le_out(p + 8,   wf->audio_format);
+    u16le_out(p + 10,  wf->channels);
+    u32le_out(p + 12,  wf->sample_rate);
+    u32le_out(p + 16,  wf->byte_rate);
+    u16le_out(p + 20,  wf->block_align);
+    u16le_out(p + 22,  wf->bits_per_sample);
+    p += RIFF_HEADER_SIZE + WAV_FMT_SIZE;
+    if (!pcm) {
+        u16le_out(p + 0,   0);  // cbSize
+        u32le_out(p + 2,   WAV_FACT);
+        u32le_out(p + 6,   WAV_FACT_SIZE);
+        u32le_out(p + 10,  rf64 ? WAV_SIZE_IN_DS64 : info->samples_per_channel);
+        p += 2 + fact_size;
+    }
+    u32le_out(p + 0,   WAV_DATA);
+    u32le_out(p + 4,   rf64 ? WAV_SIZE_IN_DS64 : data_size);
+    return header_size;
+}
+
+bool wav_audio_encode(FILE* src_file, FILE* dst_file, rsvc_encode_options_t opts, rsvc_done_t fail) {
+    if (!rsvc_audio_info_validate(&opts->info, fail)) {
         return false;
     }
+    struct wav_fmt wf;
+    wav_fmt_for(&opts->info, &wf);
+    uint8_t header[64 + RIFF_HEADER_SIZE + WAV_DS64_SIZE];
+    uint64_t data_size = (uint64_t)opts->info.samples_per_channel * wf.block_align;
+    size_t header_size = wav_header_out(header, &opts->info, &wf, data_size);
 
-    size_t remainder = data_size;
-    while (remainder) {
-        uint8_t data[4096];
-        size_t size = (remainder > 4096) ? 4096 : remainder;
-        // TODO(sfiera): endianness.
-        if (!(rsvc_read(NULL, src_file, data, size, 1, NULL, NULL, fail) &&
-              rsvc_write(NULL, dst_file, data, size, fail))) {
-            return false;
-        }
-        remainder -= size;
-        opts->progress((data_size - remainder) / (double)data_size);
+    // The final size is known, so reserve it all at once.
+    const uint8_t pad = 0;
+    if (!(rsvc_preallocate(dst_file, header_size + data_size + RIFF_PAD(data_size), fail)
+          && rsvc_write(NULL, dst_file, header, header_size, fail))) {
+        return false;
     }
-    return true;
+    bool ok = (wf.block_align != opts->info.block_align)
+        ? wav_pack_copy(src_file, dst_file, data_size, header_size, opts->progress, fail)
+        : wav_copy(src_file, dst_file, data_size, header_size, opts->progress, fail);
+    return ok && (!RIFF_PAD(data_size) || rsvc_write(NULL, dst_file, &pad, 1, fail));
 }
 
 const struct rsvc_format rsvc_wav = {
     .format_group = RSVC_AUDIO,
     .name = "wav",
     .mime = "audio/x-wav",
-    .magic = {"RIFF????WAVE"},
+    .magic = {"RIFF????WAVE", "RF64????WAVE", "BW64????WAVE"},
     .magic_size = 12,
     .extension = "wav",
     .lossless = true,
     .audio_info = wav_audio_info,
     .decode = wav_audio_decode,
     .encode = wav_audio_encode,
+    .sample_formats = RSVC_SAMPLE_FORMAT_BIT(RSVC_SAMPLE_S32)
+                    | RSVC_SAMPLE_FORMAT_BIT(RSVC_SAMPLE_F32),
 };